@@ -0,0 +1,754 @@
+//benchmarks of the dll's hot paths. every result is printed as one json object per line so runs can be diffed and
+//tracked between releases; human readable progress goes to stderr. only depends on the standard library, paths
+//that need a radio run against the simulated backend
+
+#include "../BleWinrt DLL/backend-sim.h"
+#include "../BleWinrt DLL/bulk-transfer.h"
+#include "../BleWinrt DLL/callback-dispatcher.h"
+#include "../BleWinrt DLL/device-table.h"
+#include "../BleWinrt DLL/gatt-cache.h"
+#include "../BleWinrt DLL/gatt-tree.h"
+#include "../BleWinrt DLL/operation-stats.h"
+#include "../BleWinrt DLL/result-arena.h"
+#include "../BleWinrt DLL/subscription-registry.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+const int64_t RUN_MICROSECONDS = 500000;
+
+
+//stand-in for a cached winrt object, copying it touches a shared reference count just like AddRef/Release
+using CachedObject = shared_ptr<int>;
+
+//extra holds further json members, each starting with a comma
+void Report(const char* benchmark, const char* variant, int threads, uint64_t operations, int64_t elapsedUs, const string& extra = "")
+{
+	double seconds = elapsedUs / 1e6;
+	double perSecond = operations / seconds;
+	double nsPerOperation = operations > 0 ? elapsedUs * 1000.0 * threads / operations : 0;
+
+	printf("{\"benchmark\":\"%s\",\"variant\":\"%s\",\"threads\":%d,\"operations\":%llu,\"seconds\":%.3f,\"ops_per_sec\":%.0f,\"ns_per_op\":%.1f%s}\n",
+		benchmark, variant, threads, (unsigned long long)operations, seconds, perSecond, nsPerOperation, extra.c_str());
+	fflush(stdout);
+}
+
+string JsonMember(const char* name, double value)
+{
+	char member[96];
+	snprintf(member, sizeof(member), ",\"%s\":%.0f", name, value);
+	return member;
+}
+
+//runs body on the given number of threads for RUN_MICROSECONDS, body returns the number of operations it did per call.
+//returns the operations of all threads, elapsedUs is the time they ran
+template <typename Body>
+uint64_t Drive(int threads, Body body, int64_t& elapsedUs)
+{
+	atomic<bool> start { false };
+	atomic<bool> stop { false };
+	atomic<uint64_t> operations { 0 };
+	vector<thread> workers;
+
+	for (int t = 0; t < threads; t++)
+	{
+		workers.emplace_back([&, t]()
+		{
+			mt19937_64 random(t + 1);
+			uint64_t done = 0;
+
+			while (!start)
+				this_thread::yield();
+
+			while (!stop)
+				done += body(random);
+
+			operations += done;
+		});
+	}
+
+	int64_t begin = NowMicroseconds();
+	start = true;
+	this_thread::sleep_for(chrono::microseconds(RUN_MICROSECONDS));
+	stop = true;
+
+	for (auto& worker : workers)
+		worker.join();
+
+	elapsedUs = NowMicroseconds() - begin;
+	return operations;
+}
+
+template <typename Body>
+void RunThreads(const char* benchmark, const char* variant, int threads, Body body)
+{
+	int64_t elapsedUs;
+	uint64_t operations = Drive(threads, body, elapsedUs);
+
+	Report(benchmark, variant, threads, operations, elapsedUs);
+}
+
+
+//cache lookups as done by RetrieveCharacteristic on every read, write and subscribe
+
+const int CACHE_DEVICES = 32;
+const int CACHE_SERVICES = 4;
+const int CACHE_CHARACTERISTICS = 8;
+const int CACHE_BATCH = 64;
+
+guid MakeUuid(uint32_t value)
+{
+	guid uuid {};
+	uuid.Data1 = value;
+	uuid.Data2 = 0x0000;
+	uuid.Data3 = 0x1000;
+	return uuid;
+}
+
+GattKey CacheKey(mt19937_64& random)
+{
+	uint64_t device = 0xC0FFEE000000ULL + random() % CACHE_DEVICES;
+	return { device, MakeUuid((uint32_t)(random() % CACHE_SERVICES)), MakeUuid(0x100 + (uint32_t)(random() % CACHE_CHARACTERISTICS)) };
+}
+
+bool operator<(const GattKey& left, const GattKey& right)
+{
+	if (left.device != right.device)
+		return left.device < right.device;
+
+	int service = memcmp(&left.service, &right.service, sizeof(guid));
+	if (service != 0)
+		return service < 0;
+
+	return memcmp(&left.characteristic, &right.characteristic, sizeof(guid)) < 0;
+}
+
+//the previous layout: nested ordered maps, here behind one global lock so it is at least correct under threads
+struct NestedCache
+{
+	mutex lock;
+	map<uint64_t, map<GattKey, CachedObject>> devices;
+
+	bool Find(const GattKey& key, CachedObject& value)
+	{
+		lock_guard guard(lock);
+
+		auto device = devices.find(key.device);
+		if (device == devices.end())
+			return false;
+
+		auto entry = device->second.find(key);
+		if (entry == device->second.end())
+			return false;
+
+		value = entry->second;
+		return true;
+	}
+};
+
+void BenchCache()
+{
+	GattCache<CachedObject> sharded;
+	NestedCache nested;
+
+	for (uint32_t d = 0; d < CACHE_DEVICES; d++)
+	{
+		for (uint32_t s = 0; s < CACHE_SERVICES; s++)
+		{
+			for (uint32_t c = 0; c < CACHE_CHARACTERISTICS; c++)
+			{
+				GattKey key { 0xC0FFEE000000ULL + d, MakeUuid(s), MakeUuid(0x100 + c) };
+				auto object = make_shared<int>((int)c);
+
+				sharded.Insert(key, object);
+				nested.devices[key.device][key] = object;
+			}
+		}
+	}
+
+	int maxThreads = max(1, (int)thread::hardware_concurrency());
+	for (int threads = 1; threads <= maxThreads * 2; threads *= 2)
+	{
+		fprintf(stderr, "cache hit, %d threads\n", threads);
+
+		RunThreads("cache_hit", "sharded", threads, [&](mt19937_64& random)
+		{
+			CachedObject object;
+			for (int i = 0; i < CACHE_BATCH; i++)
+				sharded.Find(CacheKey(random), object);
+
+			return (uint64_t)CACHE_BATCH;
+		});
+
+		RunThreads("cache_hit", "nested_map_mutex", threads, [&](mt19937_64& random)
+		{
+			CachedObject object;
+			for (int i = 0; i < CACHE_BATCH; i++)
+				nested.Find(CacheKey(random), object);
+
+			return (uint64_t)CACHE_BATCH;
+		});
+	}
+}
+
+
+//bulk transfers end to end against the simulator, operations are bytes so ops_per_sec is the achieved throughput
+
+const uint64_t TRANSFER_DEVICE = 0xB0B000000001ULL;
+const size_t TRANSFER_BYTES = 256 * 1024;
+
+//roughly one connection event per write with response
+const uint32_t TRANSFER_LATENCY_US = 1000;
+const uint32_t TRANSFER_JITTER_US = 200;
+
+void RunTransfer(TransferEngine& engine, const char* variant, const wchar_t* path, const vector<uint8_t>& buffer)
+{
+	GattKey key { TRANSFER_DEVICE, MakeUuid(1), MakeUuid(2) };
+	promise<BleTransferProgress> finished;
+
+	auto handler = [&finished](const BleTransferProgress& progress)
+	{
+		if (progress.state >= TRANSFER_COMPLETED)
+			finished.set_value(progress);
+	};
+
+	int64_t begin = NowMicroseconds();
+	uint32_t transfer = path != nullptr ? engine.StartFile(key, path, 0, handler) : engine.StartBuffer(key, buffer.data(), buffer.size(), 0, handler);
+	if (transfer == 0)
+	{
+		fprintf(stderr, "transfer %s could not start\n", variant);
+		return;
+	}
+
+	BleTransferProgress progress = finished.get_future().get();
+	if (progress.state != TRANSFER_COMPLETED)
+		fprintf(stderr, "transfer %s ended in state %d\n", variant, progress.state);
+
+	Report("transfer", variant, 1, progress.acknowledgedBytes, NowMicroseconds() - begin);
+}
+
+void BenchTransfer()
+{
+	SimulatedBackend& sim = GetSimulatedBackend();
+	sim.Reset();
+	sim.SetLatency(TRANSFER_LATENCY_US, TRANSFER_JITTER_US);
+	sim.AddPeripheral(TRANSFER_DEVICE, L"bench", -40, 0, 0);
+	sim.AddService(TRANSFER_DEVICE, MakeUuid(1), false);
+	sim.AddCharacteristic(TRANSFER_DEVICE, MakeUuid(1), MakeUuid(2), L"");
+
+	WriteScheduler writes([&sim](const GattKey& key, const uint8_t* data, size_t size, bool withResponse, CompletionHandler done)
+	{
+		sim.Write(key.device, key.service, key.characteristic, data, size, withResponse, done);
+	});
+
+	TransferEngine engine([&sim](uint64_t deviceAddress, MtuHandler done)
+	{
+		sim.QueryMtu(deviceAddress, done);
+	}, writes);
+
+	vector<uint8_t> buffer(TRANSFER_BYTES);
+	for (size_t i = 0; i < buffer.size(); i++)
+		buffer[i] = (uint8_t)(i * 31);
+
+	for (uint32_t window : { 1u, 4u, 8u, 16u })
+	{
+		fprintf(stderr, "transfer, window %u\n", window);
+
+		TransferOptions options;
+		options.window = window;
+		writes.Configure(window, 256);
+		engine.Configure(options);
+
+		string variant = "buffer_window_" + to_string(window);
+		RunTransfer(engine, variant.c_str(), nullptr, buffer);
+	}
+
+	//same stream from a mapped file
+	filesystem::path path = filesystem::temp_directory_path() / "blewinrt-bench-transfer.bin";
+	FILE* file = fopen(path.string().c_str(), "wb");
+	if (file != nullptr)
+	{
+		fwrite(buffer.data(), 1, buffer.size(), file);
+		fclose(file);
+
+		fprintf(stderr, "transfer, mapped file\n");
+		RunTransfer(engine, "file_window_16", path.wstring().c_str(), buffer);
+		filesystem::remove(path);
+	}
+
+	sim.Reset();
+}
+
+
+//adverts through the scan path: the simulator hands them to the handler on the emitting threads, like the watcher's
+//Received event does on the thread pool
+
+const uint64_t ADVERT_DEVICE = 0xAD0000000000ULL;
+const int ADVERT_DEVICES = 64;
+const uint32_t ADVERT_BATCH = 64;
+
+void BenchAdverts()
+{
+	SimulatedBackend& sim = GetSimulatedBackend();
+	sim.Reset();
+
+	for (int d = 0; d < ADVERT_DEVICES; d++)
+	{
+		sim.AddPeripheral(ADVERT_DEVICE + d, L"bench advertiser", -60, -4, 0);
+		sim.AddService(ADVERT_DEVICE + d, MakeUuid(0x180D), true);
+		sim.AddService(ADVERT_DEVICE + d, MakeUuid(0x180F), true);
+	}
+
+	atomic<uint64_t> received { 0 };
+	DeviceTable table;
+	table.Configure(ADVERT_DEVICES * 2, 0.2f);
+
+	struct Variant
+	{
+		const char* name;
+		AdvertHandler handler;
+	};
+
+	const Variant variants[] =
+	{
+		//what the export layer does per advert before calling receivedCallback
+		{ "callback", [&received](const AdvertEvent& advert)
+		{
+			//wcsncpy_s in the dll, a plain loop here so it builds without the secure crt
+			wchar_t name[64];
+			size_t length = 0;
+			for (; length + 1 < 64 && advert.name[length] != 0; length++)
+				name[length] = advert.name[length];
+
+			name[length] = 0;
+
+			if (advert.numServiceUuids > 0 && name[0] != 0)
+				received++;
+		} },
+		{ "device_table", [&table](const AdvertEvent& advert)
+		{
+			table.Merge(advert);
+		} },
+	};
+
+	int maxThreads = max(1, (int)thread::hardware_concurrency());
+
+	for (auto& variant : variants)
+	{
+		sim.InitializeScan(L"", guid {}, variant.handler, []() {});
+		sim.StartScan();
+
+		for (int threads = 1; threads <= maxThreads; threads *= 2)
+		{
+			fprintf(stderr, "adverts %s, %d threads\n", variant.name, threads);
+
+			RunThreads("adverts", variant.name, threads, [&sim](mt19937_64& random)
+			{
+				sim.EmitAdverts(ADVERT_DEVICE + random() % ADVERT_DEVICES, ADVERT_BATCH);
+				return (uint64_t)ADVERT_BATCH;
+			});
+		}
+
+		sim.StopScan();
+	}
+
+	sim.Reset();
+}
+
+
+//notifications through the subscription registry to every consumer, on the notifying threads or handed to the
+//dispatcher. operations are notifications delivered to a consumer, dropped ones don't count
+
+const uint64_t NOTIFY_DEVICE = 0xA11CE0000000ULL;
+const int NOTIFY_BATCH = 64;
+
+//waits for a registry or backend completion
+bool Await(function<void(CompletionHandler)> start)
+{
+	auto done = make_shared<promise<bool>>();
+	future<bool> result = done->get_future();
+
+	start([done](bool success) { done->set_value(success); });
+	return result.get();
+}
+
+void BenchNotifications()
+{
+	SimulatedBackend& sim = GetSimulatedBackend();
+	sim.Reset();
+
+	int producers = min(4, max(1, (int)thread::hardware_concurrency()));
+	for (int d = 0; d < producers; d++)
+	{
+		sim.AddPeripheral(NOTIFY_DEVICE + d, L"bench", -40, 0, 0);
+		sim.AddService(NOTIFY_DEVICE + d, MakeUuid(1), false);
+		sim.AddCharacteristic(NOTIFY_DEVICE + d, MakeUuid(1), MakeUuid(2), L"");
+	}
+
+	SubscriptionRegistry registry([&sim](const GattKey& key, NotificationHandler handler, CompletionHandler done)
+	{
+		sim.Subscribe(key.device, key.service, key.characteristic, handler, done);
+	}, [&sim](const GattKey& key, CompletionHandler done)
+	{
+		sim.Unsubscribe(key.device, key.service, key.characteristic, done);
+	});
+
+	CallbackDispatcher dispatcher;
+	atomic<uint64_t> delivered { 0 };
+	atomic<uint64_t> bytes { 0 };
+
+	for (uint32_t dispatcherThreads : { 0u, 2u })
+	{
+		for (int consumers : { 1, 4 })
+		{
+			for (size_t payloadSize : { (size_t)20, (size_t)244 })
+			{
+				DispatcherOptions options;
+				options.threads = dispatcherThreads;
+				dispatcher.Configure(options);
+
+				for (int d = 0; d < producers; d++)
+				{
+					uint64_t device = NOTIFY_DEVICE + d;
+
+					for (int c = 0; c < consumers; c++)
+					{
+						Await([&](CompletionHandler done)
+						{
+							//same as DeliverBytes in the export layer
+							registry.Add({ device, MakeUuid(1), MakeUuid(2) }, [&dispatcher, &delivered, &bytes, device](uint32_t, const uint8_t* data, size_t size)
+							{
+								if (!dispatcher.Running())
+								{
+									delivered++;
+									bytes += size;
+									return;
+								}
+
+								dispatcher.Post(device, true, [&delivered, &bytes, copy = vector<uint8_t>(data, data + size)]()
+								{
+									delivered++;
+									bytes += copy.size();
+								});
+							}, done);
+						});
+					}
+				}
+
+				string variant = (dispatcherThreads > 0 ? "dispatcher_" + to_string(dispatcherThreads) : string("inline")) +
+					"_consumers_" + to_string(consumers) + "_payload_" + to_string(payloadSize);
+				fprintf(stderr, "notifications %s\n", variant.c_str());
+
+				delivered = 0;
+				bytes = 0;
+
+				BleDispatcherStats before;
+				dispatcher.Stats(before);
+				uint64_t droppedBefore = before.dropped;
+
+				vector<uint8_t> payload(payloadSize, 0x5A);
+				atomic<int> nextProducer { 0 };
+
+				int64_t elapsedUs;
+				Drive(producers, [&](mt19937_64&)
+				{
+					//each producer thread sticks to its own peripheral
+					thread_local int producer = -1;
+					if (producer < 0)
+						producer = nextProducer++ % producers;
+
+					for (int i = 0; i < NOTIFY_BATCH; i++)
+						sim.Notify(NOTIFY_DEVICE + producer, MakeUuid(1), MakeUuid(2), payload.data(), payload.size());
+
+					return (uint64_t)NOTIFY_BATCH;
+				}, elapsedUs);
+
+				//what is still queued counts, and so does the time to deliver it
+				int64_t drainBegin = NowMicroseconds();
+				dispatcher.Configure(DispatcherOptions());
+				elapsedUs += NowMicroseconds() - drainBegin;
+
+				BleDispatcherStats stats;
+				dispatcher.Stats(stats);
+
+				double seconds = elapsedUs / 1e6;
+				Report("notifications", variant.c_str(), producers, delivered, elapsedUs,
+					JsonMember("bytes_per_sec", bytes / seconds) + JsonMember("dropped", (double)(stats.dropped - droppedBefore)));
+
+				for (int d = 0; d < producers; d++)
+					registry.RemoveAll({ NOTIFY_DEVICE + d, MakeUuid(1), MakeUuid(2) });
+			}
+		}
+	}
+
+	registry.Clear();
+	sim.Reset();
+}
+
+
+//full discovery (services, then the characteristics of all services at once, then the result tree) against
+//peripherals of growing size. ns_per_op is the time per discovery
+
+const uint64_t DISCOVERY_DEVICE = 0xD15C00000001ULL;
+
+bool DiscoverOnce(SimulatedBackend& sim, ResultArena& arena)
+{
+	struct State
+	{
+		mutex lock;
+		vector<ServiceInfo> services;
+		vector<vector<CharacteristicInfo>> characteristics;
+		size_t pending = 0;
+		bool success = true;
+		promise<bool> done;
+	};
+
+	auto state = make_shared<State>();
+	future<bool> result = state->done.get_future();
+
+	auto finish = [&arena](State& state)
+	{
+		BleGattTree* tree = BuildGattTree(arena, DISCOVERY_DEVICE, state.success, state.services, state.characteristics);
+		arena.Release(tree);
+		state.done.set_value(state.success);
+	};
+
+	sim.ScanServices(DISCOVERY_DEVICE, [&sim, state, finish](bool success, const vector<ServiceInfo>& services)
+	{
+		state->success = success;
+		state->services = services;
+		state->characteristics.resize(services.size());
+		state->pending = services.size();
+
+		if (!success || services.empty())
+		{
+			finish(*state);
+			return;
+		}
+
+		for (size_t i = 0; i < services.size(); i++)
+		{
+			sim.ScanCharacteristics(DISCOVERY_DEVICE, services[i].uuid, [state, finish, i](bool success, const vector<CharacteristicInfo>& characteristics)
+			{
+				bool last;
+
+				{
+					lock_guard guard(state->lock);
+					state->characteristics[i] = characteristics;
+					state->success &= success;
+					last = --state->pending == 0;
+				}
+
+				if (last)
+					finish(*state);
+			});
+		}
+	});
+
+	return result.get();
+}
+
+void BenchDiscovery()
+{
+	SimulatedBackend& sim = GetSimulatedBackend();
+	ResultArena arena;
+
+	const pair<int, int> sizes[] = { { 1, 4 }, { 4, 8 }, { 8, 16 }, { 16, 32 } };
+
+	for (uint32_t latencyUs : { 0u, 500u })
+	{
+		for (auto [services, characteristics] : sizes)
+		{
+			sim.Reset();
+			sim.SetLatency(latencyUs, 0);
+			sim.AddPeripheral(DISCOVERY_DEVICE, L"bench", -40, 0, 0);
+
+			for (int s = 0; s < services; s++)
+			{
+				sim.AddService(DISCOVERY_DEVICE, MakeUuid(s + 1), false);
+
+				for (int c = 0; c < characteristics; c++)
+					sim.AddCharacteristic(DISCOVERY_DEVICE, MakeUuid(s + 1), MakeUuid(0x1000 + c), L"bench characteristic");
+			}
+
+			string variant = "services_" + to_string(services) + "_characteristics_" + to_string(characteristics) + "_latency_" + to_string(latencyUs) + "us";
+			fprintf(stderr, "discovery %s\n", variant.c_str());
+
+			uint64_t discoveries = 0;
+			int64_t begin = NowMicroseconds();
+
+			while (NowMicroseconds() - begin < RUN_MICROSECONDS)
+			{
+				if (!DiscoverOnce(sim, arena))
+					fprintf(stderr, "discovery %s failed\n", variant.c_str());
+
+				discoveries++;
+			}
+
+			Report("discovery", variant.c_str(), 1, discoveries, NowMicroseconds() - begin, JsonMember("attributes", services * (1.0 + characteristics)));
+		}
+	}
+
+	sim.Reset();
+}
+
+
+//time from a notification leaving the peripheral to its consumer running, inline, on dispatcher threads and deferred
+//to a 1 ms frame loop. notifications are paced so queueing reflects delivery, not a backlog the producer built up
+
+const uint64_t LATENCY_DEVICE = 0x1A7E00000001ULL;
+const int64_t LATENCY_INTERVAL_NS = 20000;
+
+int64_t NowNanoseconds()
+{
+	using namespace chrono;
+	return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void BenchCallbackLatency()
+{
+	SimulatedBackend& sim = GetSimulatedBackend();
+	sim.Reset();
+	sim.AddPeripheral(LATENCY_DEVICE, L"bench", -40, 0, 0);
+	sim.AddService(LATENCY_DEVICE, MakeUuid(1), false);
+	sim.AddCharacteristic(LATENCY_DEVICE, MakeUuid(1), MakeUuid(2), L"");
+
+	CallbackDispatcher dispatcher;
+	LatencyHistogram histogram;
+
+	auto consume = [&histogram](const uint8_t* data, size_t)
+	{
+		int64_t sent;
+		memcpy(&sent, data, sizeof(sent));
+		histogram.Record((uint64_t)max<int64_t>(NowNanoseconds() - sent, 0), true);
+	};
+
+	GattKey key { LATENCY_DEVICE, MakeUuid(1), MakeUuid(2) };
+	Await([&](CompletionHandler done)
+	{
+		sim.Subscribe(key.device, key.service, key.characteristic, [&dispatcher, consume](const uint8_t* data, size_t size)
+		{
+			if (!dispatcher.Running())
+			{
+				consume(data, size);
+				return;
+			}
+
+			dispatcher.Post(LATENCY_DEVICE, false, [consume, copy = vector<uint8_t>(data, data + size)]()
+			{
+				consume(copy.data(), copy.size());
+			});
+		}, done);
+	});
+
+	struct Variant
+	{
+		const char* name;
+		uint32_t threads;
+		bool deferred;
+	};
+
+	const Variant variants[] = { { "inline", 0, false }, { "dispatcher_1", 1, false }, { "dispatcher_4", 4, false }, { "deferred_pump_1ms", 0, true } };
+
+	for (auto& variant : variants)
+	{
+		fprintf(stderr, "callback latency %s\n", variant.name);
+
+		DispatcherOptions options;
+		options.threads = variant.threads;
+		dispatcher.Configure(options);
+		dispatcher.Defer(variant.deferred, 1 << 16);
+		histogram.Reset();
+
+		atomic<bool> stop { false };
+		thread frames;
+
+		if (variant.deferred)
+		{
+			frames = thread([&dispatcher, &stop]()
+			{
+				while (!stop)
+				{
+					dispatcher.Pump(1000);
+					this_thread::sleep_for(chrono::milliseconds(1));
+				}
+			});
+		}
+
+		uint8_t payload[20] = {};
+		uint64_t sent = 0;
+		int64_t begin = NowMicroseconds();
+		int64_t next = NowNanoseconds();
+
+		while (NowMicroseconds() - begin < RUN_MICROSECONDS)
+		{
+			while (NowNanoseconds() < next)
+			{
+			}
+
+			int64_t now = NowNanoseconds();
+			memcpy(payload, &now, sizeof(now));
+			sim.Notify(key.device, key.service, key.characteristic, payload, sizeof(payload));
+
+			next += LATENCY_INTERVAL_NS;
+			sent++;
+		}
+
+		stop = true;
+		if (frames.joinable())
+			frames.join();
+
+		dispatcher.Defer(false, 0);
+		dispatcher.Configure(DispatcherOptions());
+
+		BleOperationStats stats;
+		histogram.Snapshot(stats);
+
+		string extra = JsonMember("p50_ns", (double)stats.p50) + JsonMember("p99_ns", (double)stats.p99) +
+			JsonMember("p999_ns", (double)stats.p999) + JsonMember("max_ns", (double)stats.max);
+		Report("callback_latency", variant.name, 1, stats.count, NowMicroseconds() - begin, extra);
+	}
+
+	sim.Reset();
+}
+
+
+int main(int argc, char** argv)
+{
+	//optional filter, only benchmarks whose name starts with it are run
+	const char* filter = argc > 1 ? argv[1] : "";
+
+	struct Benchmark
+	{
+		const char* name;
+		void (*run)();
+	};
+
+	const Benchmark benchmarks[] =
+	{
+		{ "adverts", BenchAdverts },
+		{ "notifications", BenchNotifications },
+		{ "cache", BenchCache },
+		{ "discovery", BenchDiscovery },
+		{ "callback_latency", BenchCallbackLatency },
+		{ "transfer", BenchTransfer },
+	};
+
+	for (auto& benchmark : benchmarks)
+		if (strncmp(benchmark.name, filter, strlen(filter)) == 0)
+			benchmark.run();
+
+	return 0;
+}
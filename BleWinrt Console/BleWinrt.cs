@@ -15,16 +15,53 @@ public class BleWinrt
 	[DllImport("BleWinrt.dll", EntryPoint = "RegisterErrorCallback")]
 	public static extern void RegisterErrorCallback(ErrorCallback logCb);
 
+	public enum LogLevel { Trace = 0, Debug = 1, Info = 2, Warning = 3, Error = 4, None = 5 };
+
+	[StructLayout(LayoutKind.Sequential)]
+	public struct BleLogStats
+	{
+		public ulong logged;
+		public ulong dropped;
+		public ulong suppressed;
+		public ulong delivered;
+		public uint pending;
+		public uint capacity;
+	}
+
+	/// <summary>
+	/// the callbacks are called from a logging thread, lines below the level are discarded
+	/// </summary>
+	[DllImport("BleWinrt.dll", EntryPoint = "SetLogLevel")]
+	public static extern void SetLogLevel(LogLevel level);
+
+	/// <summary>
+	/// lines per second from one call site before the rest are summed up, 0 disables the limit
+	/// </summary>
+	[DllImport("BleWinrt.dll", EntryPoint = "SetLogRateLimit")]
+	public static extern void SetLogRateLimit(uint linesPerSecond);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "EnableBinaryLog", CharSet = CharSet.Unicode)]
+	[return: MarshalAs(UnmanagedType.I1)]
+	public static extern bool EnableBinaryLog(string path);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "FlushLog")]
+	public static extern void FlushLog();
+
+	[DllImport("BleWinrt.dll", EntryPoint = "GetLogStats")]
+	public static extern void GetLogStats(out BleLogStats stats);
+
 
 	public delegate void AdvertCallback(BleAdvert ad);
+	public delegate void BeaconCallback(ref BleBeacon beacon);
 	public delegate void StoppedCallback();
 	public delegate void DisconnectedCallback();
 
 	public delegate void ServicesFoundCallback(BleServiceArray services);
 	public delegate void CharacteristicsFoundCallback(BleCharacteristicArray characteristics);
 
-	public delegate void SubscribeCallback(ulong deviceAddress, Guid serviceUuid, Guid characteristicUuid, byte[] data, ulong size);
-	public delegate void ReadBytesCallback(byte[] data, ulong size);
+	//data points into native memory that is only valid during the callback, copy it out with Marshal.Copy
+	public delegate void SubscribeCallback(ulong deviceAddress, Guid serviceUuid, Guid characteristicUuid, IntPtr data, ulong size);
+	public delegate void ReadBytesCallback(IntPtr data, ulong size);
 	public delegate void WriteBytesCallback(bool success);
 
 
@@ -45,6 +82,10 @@ public class BleWinrt
 		public IntPtr serviceUuids;
 		public int numServiceUuids;
 
+		//flags, manufacturer and service data, read them with ParseSections
+		public IntPtr sections;
+		public int sectionBytes;
+
 		public override readonly string ToString()
 		{
 			string str = MacHex(mac);
@@ -64,6 +105,122 @@ public class BleWinrt
 		}
 	}
 
+	[StructLayout(LayoutKind.Sequential, CharSet = CharSet.Unicode)]
+	public struct BleAdvertRecord
+	{
+		public ulong mac;
+		public long timestamp;
+
+		public int signalStrength;
+		public int powerLevel;
+
+		//total count in the advert, only the first 4 are stored inline
+		public int numServiceUuids;
+
+		[MarshalAs(UnmanagedType.ByValArray, SizeConst = 4)]
+		public Guid[] serviceUuids;
+
+		[MarshalAs(UnmanagedType.ByValTStr, SizeConst = 32)]
+		public string name;
+
+		public int sectionBytes;
+
+		[MarshalAs(UnmanagedType.ByValArray, SizeConst = 64)]
+		public byte[] sections;
+	}
+
+	public const byte AdvertFlags = 0x01;
+	public const byte AdvertServiceData = 0x21;
+	public const byte AdvertManufacturerData = 0xFF;
+
+	/// <summary>
+	/// splits advert sections into their type and payload. manufacturer data starts with the little endian company id,
+	/// service data with the 16 byte uuid as new Guid(bytes) reads it
+	/// </summary>
+	public static List<(byte type, byte[] payload)> ParseSections(byte[] sections, int sectionBytes)
+	{
+		var result = new List<(byte type, byte[] payload)>();
+
+		int offset = 0;
+		while (offset + 3 <= sectionBytes)
+		{
+			int length = sections[offset] | sections[offset + 1] << 8;
+			if (length < 1 || offset + 2 + length > sectionBytes)
+				break;
+
+			byte[] payload = new byte[length - 1];
+			Array.Copy(sections, offset + 3, payload, 0, length - 1);
+
+			result.Add((sections[offset + 2], payload));
+			offset += 2 + length;
+		}
+
+		return result;
+	}
+
+	public static List<(byte type, byte[] payload)> ParseSections(IntPtr sections, int sectionBytes)
+	{
+		byte[] copy = new byte[sectionBytes];
+		if (sectionBytes > 0)
+			Marshal.Copy(sections, copy, 0, sectionBytes);
+
+		return ParseSections(copy, sectionBytes);
+	}
+
+	public enum BeaconType { None = 0, IBeacon = 1, AltBeacon = 2, EddystoneUid = 3, EddystoneUrl = 4, EddystoneTlm = 5 };
+
+	[StructLayout(LayoutKind.Sequential, CharSet = CharSet.Unicode)]
+	public struct BleBeacon
+	{
+		public ulong mac;
+		public long timestamp;
+		public int signalStrength;
+		public BeaconType type;
+		public int txPower;
+		public uint idSize;
+		[MarshalAs(UnmanagedType.ByValArray, SizeConst = 20)]
+		public byte[] id;
+		public ushort major;
+		public ushort minor;
+		public uint batteryMillivolts;
+		public float temperature;
+		public uint advertCount;
+		public uint uptimeDeciseconds;
+		[MarshalAs(UnmanagedType.ByValTStr, SizeConst = 64)]
+		public string url;
+	}
+
+	[StructLayout(LayoutKind.Sequential)]
+	public struct BleQueueStats
+	{
+		public ulong enqueued;
+		public ulong dropped;
+		public uint capacity;
+		public uint pending;
+	}
+
+	[StructLayout(LayoutKind.Sequential, CharSet = CharSet.Unicode)]
+	public struct BleDeviceState
+	{
+		public ulong mac;
+
+		public long firstSeen;
+		public long lastSeen;
+		public uint advertCount;
+
+		public int signalStrength;
+		public float smoothedSignalStrength;
+		public int powerLevel;
+
+		public int numServiceUuids;
+
+		[MarshalAs(UnmanagedType.ByValArray, SizeConst = 8)]
+		public Guid[] serviceUuids;
+
+		[MarshalAs(UnmanagedType.ByValTStr, SizeConst = 32)]
+		public string name;
+	}
+
 	public struct BleService
 	{
 		public Guid serviceUuid;
@@ -92,6 +249,59 @@ public class BleWinrt
 		public int count;        // Number of elements in the array
 	}
 
+	/// <summary>
+	/// header of the block passed to DiscoverAllCallback, offsets are in bytes from the start of the block
+	/// </summary>
+	[StructLayout(LayoutKind.Sequential)]
+	public struct BleGattTree
+	{
+		public ulong deviceAddress;
+		public int success;
+
+		public int serviceCount;
+		public int characteristicCount;
+		public uint stringBytes;
+
+		public uint servicesOffset;
+		public uint characteristicsOffset;
+		public uint stringsOffset;
+		public uint totalBytes;
+	}
+
+	[StructLayout(LayoutKind.Sequential)]
+	public struct BleGattTreeService
+	{
+		public Guid serviceUuid;
+		public uint firstCharacteristic;
+		public uint characteristicCount;
+		public ushort attributeHandle;
+		public ushort reserved;
+	}
+
+	[StructLayout(LayoutKind.Sequential)]
+	public struct BleGattTreeCharacteristic
+	{
+		public Guid characteristicUuid;
+		public uint serviceIndex;
+		public uint properties;
+		public ushort attributeHandle;
+		public ushort reserved;
+
+		//utf-8 bytes in the string pool
+		public uint descriptionOffset;
+		public uint descriptionBytes;
+	}
+
+	public class GattLayout
+	{
+		public bool success;
+		public List<BleGattTreeService> services = new();
+		public List<BleGattTreeCharacteristic> characteristics = new();
+		public List<string> descriptions = new();
+	}
+
+	public delegate void DiscoverAllCallback(IntPtr tree);
+
 	[StructLayout(LayoutKind.Sequential, CharSet = CharSet.Unicode)]
 	public struct BleData
 	{
@@ -186,6 +396,66 @@ public class BleWinrt
 		return tcs.Task;
 	}
 
+	public Task<GattLayout> DiscoverAll(ulong addr)
+	{
+		var tcs = new TaskCompletionSource<GattLayout>();
+		DiscoverAll(addr, (treePtr) => tcs.SetResult(TakeGattTree(treePtr)));
+		return tcs.Task;
+	}
+
+	/// <summary>
+	/// services without characteristics
+	/// </summary>
+	public Task<GattLayout> ScanServicesTree(ulong addr)
+	{
+		var tcs = new TaskCompletionSource<GattLayout>();
+		ScanServicesTree(addr, (treePtr) => tcs.SetResult(TakeGattTree(treePtr)));
+		return tcs.Task;
+	}
+
+	public Task<GattLayout> ScanCharacteristicsTree(ulong addr, Guid serviceUuid)
+	{
+		var tcs = new TaskCompletionSource<GattLayout>();
+		ScanCharacteristicsTree(addr, serviceUuid, (treePtr) => tcs.SetResult(TakeGattTree(treePtr)));
+		return tcs.Task;
+	}
+
+	/// <summary>
+	/// copy a BleGattTree into managed objects and release it
+	/// </summary>
+	static GattLayout TakeGattTree(IntPtr treePtr)
+	{
+		GattLayout layout = new();
+
+		if (treePtr != IntPtr.Zero)
+		{
+			BleGattTree tree = Marshal.PtrToStructure<BleGattTree>(treePtr);
+			layout.success = tree.success != 0;
+
+			for (int i = 0; i < tree.serviceCount; i++)
+			{
+				IntPtr servicePtr = IntPtr.Add(treePtr, (int)tree.servicesOffset + i * Marshal.SizeOf(typeof(BleGattTreeService)));
+				layout.services.Add(Marshal.PtrToStructure<BleGattTreeService>(servicePtr));
+			}
+
+			for (int i = 0; i < tree.characteristicCount; i++)
+			{
+				IntPtr characteristicPtr = IntPtr.Add(treePtr, (int)tree.characteristicsOffset + i * Marshal.SizeOf(typeof(BleGattTreeCharacteristic)));
+				BleGattTreeCharacteristic characteristic = Marshal.PtrToStructure<BleGattTreeCharacteristic>(characteristicPtr);
+
+				byte[] description = new byte[characteristic.descriptionBytes];
+				Marshal.Copy(IntPtr.Add(treePtr, (int)(tree.stringsOffset + characteristic.descriptionOffset)), description, 0, description.Length);
+
+				layout.characteristics.Add(characteristic);
+				layout.descriptions.Add(System.Text.Encoding.UTF8.GetString(description));
+			}
+
+			ReleaseResult(treePtr);
+		}
+
+		return layout;
+	}
+
 	public void Disconnect(ulong addr, DisconnectedCallback disconnectedCb)
 	{
 		DisconnectDevice(addr, disconnectedCb);
@@ -201,9 +471,143 @@ public class BleWinrt
 	[DllImport("BleWinrt.dll", EntryPoint = "StopScan")]
 	static extern void StopScan();
 
+	public enum ScanMode { Idle = 0, Passive = 1, Active = 2 };
+
+	[StructLayout(LayoutKind.Sequential)]
+	public struct BleScanSchedule
+	{
+		public uint activeMilliseconds;
+		public uint passiveMilliseconds;
+		public uint idleMilliseconds;
+		public uint autoPassive;
+	}
+
+	[StructLayout(LayoutKind.Sequential)]
+	public struct BleScanStats
+	{
+		public ulong activeAdverts;
+		public ulong passiveAdverts;
+		public ulong activeCallbacks;
+		public ulong passiveCallbacks;
+		public ulong activeWindows;
+		public ulong passiveWindows;
+		public ulong idleWindows;
+		public ulong activeMilliseconds;
+		public ulong passiveMilliseconds;
+		public ulong idleMilliseconds;
+		public ulong namesFilled;
+		public ScanMode mode;
+		public uint cachedNames;
+	}
+
+	/// <summary>
+	/// alternate active, passive and idle scan windows, autoPassive scans passively once the names around are cached
+	/// </summary>
+	[DllImport("BleWinrt.dll", EntryPoint = "SetScanSchedule")]
+	public static extern void SetScanSchedule(ref BleScanSchedule schedule);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "GetScanStats")]
+	public static extern void GetScanStats(out BleScanStats stats);
+
+	/// <summary>
+	/// queue adverts natively instead of calling back per packet, 0 switches back to callbacks
+	/// </summary>
+	[DllImport("BleWinrt.dll", EntryPoint = "EnableAdvertQueue")]
+	public static extern void EnableAdvertQueue(int capacity);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "PollAdverts")]
+	public static extern int PollAdverts([Out] BleAdvertRecord[] buffer, int maxCount);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "GetAdvertQueueStats")]
+	public static extern void GetAdvertQueueStats(out BleQueueStats stats);
+
+	/// <summary>
+	/// decode ibeacon, altbeacon and eddystone frames natively, null stops decoding. keep the delegate alive meanwhile
+	/// </summary>
+	[DllImport("BleWinrt.dll", EntryPoint = "RegisterBeaconCallback")]
+	public static extern void RegisterBeaconCallback(BeaconCallback beaconCb);
+
+	/// <summary>
+	/// coalesce adverts per device natively, 0 switches back to callbacks
+	/// </summary>
+	[DllImport("BleWinrt.dll", EntryPoint = "EnableDeviceTable")]
+	public static extern void EnableDeviceTable(int maxDevices, float smoothing);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "GetDeviceChanges")]
+	public static extern int GetDeviceChanges([Out] BleDeviceState[] buffer, int maxCount);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "GetDeviceSnapshot")]
+	public static extern int GetDeviceSnapshot([Out] BleDeviceState[] buffer, int maxCount);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "ClearDeviceTable")]
+	public static extern void ClearDeviceTable();
+
 	[DllImport("BleWinrt.dll", EntryPoint = "DisconnectDevice", CharSet = CharSet.Unicode)]
 	static extern void DisconnectDevice(ulong addr, DisconnectedCallback disconnectedCb);
 
+	public enum LinkState { Disconnected = 0, Connecting = 1, Connected = 2, Reconnecting = 3, Failed = 4 };
+
+	[StructLayout(LayoutKind.Sequential)]
+	public struct BleCharacteristicKey
+	{
+		public Guid service;
+		public Guid characteristic;
+	}
+
+	[StructLayout(LayoutKind.Sequential)]
+	public struct BleReconnectPolicy
+	{
+		public uint initialDelayMilliseconds;
+		public uint maxDelayMilliseconds;
+		public float multiplier;
+		public float jitter;
+		public uint maxAttempts;
+	}
+
+	[StructLayout(LayoutKind.Sequential)]
+	public struct BleLinkStats
+	{
+		public ulong device;
+		public LinkState state;
+		public uint attempts;
+		public ulong drops;
+		public ulong reconnects;
+		public ulong failedAttempts;
+		public ulong rearmed;
+		public ulong lastReconnect;
+		public ulong meanReconnect;
+		public ulong maxReconnect;
+	}
+
+	public delegate void LinkStateCallback(ulong deviceAddress, LinkState state);
+
+	/// <summary>
+	/// keep the link up and reconnect with backoff whenever it drops, resolving the warm characteristics and re-arming
+	/// subscriptions after every connect
+	/// </summary>
+	[DllImport("BleWinrt.dll", EntryPoint = "ManageConnection")]
+	public static extern void ManageConnection(ulong addr, BleCharacteristicKey[] warm, int warmCount);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "ReleaseConnection")]
+	[return: MarshalAs(UnmanagedType.I1)]
+	public static extern bool ReleaseConnection(ulong addr);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "ConfigureReconnect")]
+	public static extern void ConfigureReconnect(ref BleReconnectPolicy policy);
+
+	/// <summary>
+	/// keep the delegate alive while registered
+	/// </summary>
+	[DllImport("BleWinrt.dll", EntryPoint = "RegisterLinkStateCallback")]
+	public static extern void RegisterLinkStateCallback(LinkStateCallback linkStateCb);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "GetLinkStats")]
+	[return: MarshalAs(UnmanagedType.I1)]
+	public static extern bool GetLinkStats(ulong addr, out BleLinkStats stats);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "GetLinkSnapshot")]
+	public static extern int GetLinkSnapshot([Out] BleLinkStats[] buffer, int maxCount);
+
 
 	[DllImport("BleWinrt.dll", EntryPoint = "ScanServices", CharSet = CharSet.Unicode)]
 	static extern void ScanServices(ulong addr, ServicesFoundCallback serviceFoundCb);
@@ -211,6 +615,53 @@ public class BleWinrt
 	[DllImport("BleWinrt.dll", EntryPoint = "ScanCharacteristics", CharSet = CharSet.Unicode)]
 	static extern void ScanCharacteristics(ulong addr, Guid serviceUuid, CharacteristicsFoundCallback characteristicFoundCb);
 
+	[DllImport("BleWinrt.dll", EntryPoint = "DiscoverAll")]
+	static extern void DiscoverAll(ulong addr, DiscoverAllCallback discoveredCb);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "ScanServicesTree")]
+	static extern void ScanServicesTree(ulong addr, DiscoverAllCallback servicesCb);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "ScanCharacteristicsTree")]
+	static extern void ScanCharacteristicsTree(ulong addr, Guid serviceUuid, DiscoverAllCallback characteristicsCb);
+
+	/// <summary>
+	/// hand a result block back to the dll, it must not be touched afterwards
+	/// </summary>
+	[DllImport("BleWinrt.dll", EntryPoint = "ReleaseResult")]
+	public static extern void ReleaseResult(IntPtr result);
+
+	/// <summary>
+	/// read characteristic user descriptions with up to maxConcurrentReads requests in flight, or skip them
+	/// </summary>
+	[DllImport("BleWinrt.dll", EntryPoint = "SetDiscoveryOptions")]
+	public static extern void SetDiscoveryOptions(int maxConcurrentReads, [MarshalAs(UnmanagedType.I1)] bool readUserDescriptions);
+
+	[StructLayout(LayoutKind.Sequential)]
+	public struct BleGattDatabaseStats
+	{
+		public ulong hits;
+		public ulong misses;
+		public ulong revalidations;
+		public ulong changes;
+		public uint devices;
+		public uint fileBytes;
+	}
+
+	/// <summary>
+	/// persist discovered gatt layouts in a file, known devices are answered from it and revalidated in the background. null closes it
+	/// </summary>
+	[DllImport("BleWinrt.dll", EntryPoint = "EnableGattDatabase", CharSet = CharSet.Unicode)]
+	public static extern void EnableGattDatabase(string path);
+
+	/// <summary>
+	/// forget the stored layout of one device, 0 forgets all
+	/// </summary>
+	[DllImport("BleWinrt.dll", EntryPoint = "InvalidateGattDatabase")]
+	public static extern void InvalidateGattDatabase(ulong addr);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "GetGattDatabaseStats")]
+	public static extern void GetGattDatabaseStats(out BleGattDatabaseStats stats);
+
 
 	[DllImport("BleWinrt.dll", EntryPoint = "SubscribeCharacteristic", CharSet = CharSet.Unicode)]
 	static extern void SubscribeCharacteristic(ulong addr, Guid serviceUuid, Guid characteristicUuid, SubscribeCallback subscribeCallback);
@@ -218,6 +669,52 @@ public class BleWinrt
 	[DllImport("BleWinrt.dll", EntryPoint = "UnsubscribeCharacteristic", CharSet = CharSet.Unicode)]
 	static extern void UnsubscribeCharacteristic(ulong addr, Guid serviceUuid, Guid characteristicUuid);
 
+	[StructLayout(LayoutKind.Sequential)]
+	public struct BleSubscriptionStats
+	{
+		public uint characteristics;
+		public uint consumers;
+		public ulong cccdWrites;
+		public ulong notifications;
+	}
+
+	/// <summary>
+	/// subscribe alongside other consumers of the same characteristic, only the first one enables notifications on the device.
+	/// the callback has to be kept alive until RemoveSubscription
+	/// </summary>
+	[DllImport("BleWinrt.dll", EntryPoint = "AddSubscription")]
+	public static extern uint AddSubscription(ulong addr, Guid serviceUuid, Guid characteristicUuid, SubscribeCallback subscribeCallback);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "RemoveSubscription")]
+	[return: MarshalAs(UnmanagedType.I1)]
+	public static extern bool RemoveSubscription(uint handle);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "GetSubscriptionStats")]
+	public static extern void GetSubscriptionStats(out BleSubscriptionStats stats);
+
+
+	/// <summary>
+	/// header of a record written by DrainNotifications, the payload follows and the next record starts at the next multiple of 8
+	/// </summary>
+	[StructLayout(LayoutKind.Sequential)]
+	public struct BleNotificationRecord
+	{
+		public uint subscription;
+		public uint size;
+		public long timestamp;
+	}
+
+	[DllImport("BleWinrt.dll", EntryPoint = "EnableNotificationQueue")]
+	public static extern void EnableNotificationQueue(uint capacityBytes);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "SubscribeCharacteristicQueued")]
+	public static extern uint SubscribeCharacteristicQueued(ulong addr, Guid serviceUuid, Guid characteristicUuid);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "DrainNotifications")]
+	public static extern uint DrainNotifications(byte[] buffer, uint bufferBytes);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "GetNotificationQueueStats")]
+	public static extern void GetNotificationQueueStats(out BleQueueStats stats);
 
 	[DllImport("BleWinrt.dll", EntryPoint = "ReadData", CharSet = CharSet.Unicode)]
 	static extern void ReadBytes(ulong addr, Guid serviceUuid, Guid characteristicUuid, ReadBytesCallback readBufferCb);
@@ -225,6 +722,329 @@ public class BleWinrt
 	[DllImport("BleWinrt.dll", EntryPoint = "WriteData", CharSet = CharSet.Unicode)]
 	static extern void WriteBytes(ulong addr, Guid serviceUuid, Guid characteristicUuid, byte[] buf, int size, WriteBytesCallback writeBytesCb);
 
+	public enum WriteOption { WithResponse = 0, WithoutResponse = 1 };
+
+	[StructLayout(LayoutKind.Sequential)]
+	public struct BleWriteQueueStats
+	{
+		public ulong enqueued;
+		public ulong completed;
+		public ulong failed;
+		public ulong rejected;
+		public ulong bytesCompleted;
+		public double bytesPerSecond;
+		public uint depth;
+		public uint maxDepth;
+		public uint inFlight;
+		public uint reserved;
+	}
+
+	/// <summary>
+	/// queue a write behind the characteristic's earlier ones, false if the queue is full. keep the callback alive until it ran
+	/// </summary>
+	[DllImport("BleWinrt.dll", EntryPoint = "WriteBytesQueued")]
+	[return: MarshalAs(UnmanagedType.I1)]
+	public static extern bool WriteBytesQueued(ulong addr, Guid serviceUuid, Guid characteristicUuid, byte[] buf, UIntPtr size, WriteOption option, WriteBytesCallback writeBytesCb);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "ConfigureWriteQueue")]
+	public static extern void ConfigureWriteQueue(uint maxOutstanding, uint maxQueued);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "GetWriteQueueStats")]
+	[return: MarshalAs(UnmanagedType.I1)]
+	public static extern bool GetWriteQueueStats(ulong addr, Guid serviceUuid, Guid characteristicUuid, out BleWriteQueueStats stats);
+
+	public enum TransferState { Starting = 0, Running = 1, Completed = 2, Failed = 3, Cancelled = 4 };
+
+	[StructLayout(LayoutKind.Sequential)]
+	public struct BleTransferProgress
+	{
+		public uint transfer;
+		public TransferState state;
+		public ulong totalBytes;
+		public ulong sentBytes;
+		public ulong acknowledgedBytes;
+		public double bytesPerSecond;
+		public uint chunkSize;
+		public uint reserved;
+	}
+
+	public delegate void BulkTransferCallback(ref BleTransferProgress progress);
+
+	/// <summary>
+	/// stream a file from offset in mtu sized writes, 0 on error. keep the callback alive until it reported an end state
+	/// </summary>
+	[DllImport("BleWinrt.dll", EntryPoint = "StartBulkTransferFile", CharSet = CharSet.Unicode)]
+	public static extern uint StartBulkTransferFile(ulong addr, Guid serviceUuid, Guid characteristicUuid, string path, ulong offset, BulkTransferCallback progressCb);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "StartBulkTransfer")]
+	public static extern uint StartBulkTransfer(ulong addr, Guid serviceUuid, Guid characteristicUuid, byte[] data, UIntPtr size, ulong offset, BulkTransferCallback progressCb);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "CancelBulkTransfer")]
+	public static extern void CancelBulkTransfer(uint transfer);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "GetBulkTransferProgress")]
+	[return: MarshalAs(UnmanagedType.I1)]
+	public static extern bool GetBulkTransferProgress(uint transfer, out BleTransferProgress progress);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "ConfigureBulkTransfer")]
+	public static extern void ConfigureBulkTransfer(uint window, uint ackInterval);
+
+	[StructLayout(LayoutKind.Sequential)]
+	public struct BleFramingStats
+	{
+		public ulong messagesSent;
+		public ulong fragmentsSent;
+		public ulong messagesReceived;
+		public ulong fragmentsReceived;
+		public ulong errors;
+		public uint maxFragment;
+		public uint reserved;
+	}
+
+	/// <summary>
+	/// data is only valid during the call
+	/// </summary>
+	public delegate void FramedMessageCallback(uint channel, IntPtr data, UIntPtr size);
+
+	/// <summary>
+	/// messages larger than the mtu over a write and a notify characteristic, maxMessage 0 for 64 KB. keep the callback alive until the channel is closed
+	/// </summary>
+	[DllImport("BleWinrt.dll", EntryPoint = "OpenFramedChannel")]
+	public static extern uint OpenFramedChannel(ulong addr, Guid serviceUuid, Guid writeCharacteristicUuid, Guid notifyCharacteristicUuid, uint maxMessage, FramedMessageCallback messageCb);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "SendFramedMessage")]
+	[return: MarshalAs(UnmanagedType.I1)]
+	public static extern bool SendFramedMessage(uint channel, byte[] data, UIntPtr size, WriteOption option, WriteBytesCallback sentCb);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "CloseFramedChannel")]
+	public static extern void CloseFramedChannel(uint channel);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "GetFramingStats")]
+	[return: MarshalAs(UnmanagedType.I1)]
+	public static extern bool GetFramingStats(uint channel, out BleFramingStats stats);
+
+	[StructLayout(LayoutKind.Sequential)]
+	public struct BleDispatcherStats
+	{
+		public ulong posted;
+		public ulong delivered;
+		public ulong dropped;
+		public ulong stalled;
+		public ulong inlined;
+		public ulong totalDelayMicroseconds;
+		public ulong maxDelayMicroseconds;
+		public uint threads;
+		public uint pending;
+	}
+
+	/// <summary>
+	/// run callbacks on dedicated threads, each device's callbacks in order. priority is a THREAD_PRIORITY_* value and
+	/// worker i is pinned to the i-th cpu of affinityMask (0 for no pinning). 0 threads delivers on the event threads again
+	/// </summary>
+	[DllImport("BleWinrt.dll", EntryPoint = "ConfigureDispatcher")]
+	[return: MarshalAs(UnmanagedType.I1)]
+	public static extern bool ConfigureDispatcher(uint threads, int priority, ulong affinityMask, uint queueCapacity);
+
+	/// <summary>
+	/// hold adverts, notifications and completions until Pump runs them, e.g. once per frame from the main thread.
+	/// maxDeferred (0 for 4096) bounds the adverts and notifications, completions are never dropped
+	/// </summary>
+	[DllImport("BleWinrt.dll", EntryPoint = "EnableDeferredDelivery")]
+	public static extern void EnableDeferredDelivery([MarshalAs(UnmanagedType.I1)] bool enabled, uint maxDeferred);
+
+	/// <summary>
+	/// run deferred callbacks on the calling thread for up to maxMicroseconds, returns how many are still waiting
+	/// </summary>
+	[DllImport("BleWinrt.dll", EntryPoint = "Pump")]
+	public static extern uint Pump(uint maxMicroseconds);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "GetDispatcherStats")]
+	public static extern void GetDispatcherStats(out BleDispatcherStats stats);
+
+	public enum StatsOperation { Connect = 0, Services = 1, Characteristics = 2, Read = 3, Write = 4, Subscribe = 5, Notification = 6, Reconnect = 7, Resolve = 8 };
+
+	/// <summary>
+	/// latencies in microseconds, device 0 holds the totals over all devices
+	/// </summary>
+	[StructLayout(LayoutKind.Sequential)]
+	public struct BleOperationStats
+	{
+		public ulong device;
+		public StatsOperation operation;
+		public uint reserved;
+		public ulong count;
+		public ulong errors;
+		public ulong timeouts;
+		public ulong mean;
+		public ulong p50;
+		public ulong p99;
+		public ulong p999;
+		public ulong max;
+	}
+
+	/// <summary>
+	/// returns the number of lines written, or the number available when called with null
+	/// </summary>
+	[DllImport("BleWinrt.dll", EntryPoint = "GetStats")]
+	public static extern int GetStats([Out] BleOperationStats[] buffer, int maxCount);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "ResetStats")]
+	public static extern void ResetStats();
+
+	[StructLayout(LayoutKind.Sequential)]
+	public struct BleCaptureStats
+	{
+		public ulong adverts;
+		public ulong notifications;
+		public ulong dropped;
+		public ulong bytesWritten;
+		public uint recording;
+		public uint pendingBytes;
+	}
+
+	[StructLayout(LayoutKind.Sequential)]
+	public struct BleReplayStats
+	{
+		public ulong adverts;
+		public ulong notifications;
+		public ulong unmatched;
+		public ulong maxLagMicroseconds;
+		public uint running;
+		public uint passes;
+	}
+
+	public delegate void ReplayFinishedCallback();
+
+	/// <summary>
+	/// record every advert and notification to a binary file until StopCapture
+	/// </summary>
+	[DllImport("BleWinrt.dll", EntryPoint = "StartCapture", CharSet = CharSet.Unicode)]
+	[return: MarshalAs(UnmanagedType.I1)]
+	public static extern bool StartCapture(string path);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "StopCapture")]
+	public static extern void StopCapture();
+
+	[DllImport("BleWinrt.dll", EntryPoint = "GetCaptureStats")]
+	public static extern void GetCaptureStats(out BleCaptureStats stats);
+
+	/// <summary>
+	/// play a capture back through the callbacks, speed 1 for the recorded timing and 0 for as fast as possible
+	/// </summary>
+	[DllImport("BleWinrt.dll", EntryPoint = "StartReplay", CharSet = CharSet.Unicode)]
+	[return: MarshalAs(UnmanagedType.I1)]
+	public static extern bool StartReplay(string path, double speed, [MarshalAs(UnmanagedType.I1)] bool loop, ReplayFinishedCallback finishedCb);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "StopReplay")]
+	public static extern void StopReplay();
+
+	[DllImport("BleWinrt.dll", EntryPoint = "GetReplayStats")]
+	public static extern void GetReplayStats(out BleReplayStats stats);
+
+	public enum FilterAction { Accept = 0, Reject = 1 };
+
+	[Flags]
+	public enum FilterCondition : uint { Mac = 1, Signal = 2, NamePrefix = 4, Service = 8, Manufacturer = 16 };
+
+	[StructLayout(LayoutKind.Sequential, CharSet = CharSet.Unicode)]
+	public struct BleFilterRule
+	{
+		public FilterAction action;
+		public FilterCondition conditions;
+		public uint firstMac;
+		public uint numMacs;
+		public int minSignalStrength;
+		public int maxSignalStrength;
+		[MarshalAs(UnmanagedType.ByValTStr, SizeConst = 32)]
+		public string namePrefix;
+		[MarshalAs(UnmanagedType.ByValArray, SizeConst = 4)]
+		public Guid[] serviceUuids;
+		public int numServiceUuids;
+		public ushort companyId;
+		public ushort dataSize;
+		[MarshalAs(UnmanagedType.ByValArray, SizeConst = 24)]
+		public byte[] data;
+		[MarshalAs(UnmanagedType.ByValArray, SizeConst = 24)]
+		public byte[] mask;
+	}
+
+	[StructLayout(LayoutKind.Sequential)]
+	public struct BleFilterStats
+	{
+		public ulong evaluated;
+		public ulong accepted;
+		public ulong rejected;
+		public ulong unmatched;
+		public uint rules;
+		public FilterAction defaultAction;
+	}
+
+	/// <summary>
+	/// check adverts against the rules natively, the first matching rule decides. rules refer to ranges of macs
+	/// </summary>
+	[DllImport("BleWinrt.dll", EntryPoint = "SetAdvertFilter")]
+	[return: MarshalAs(UnmanagedType.I1)]
+	public static extern bool SetAdvertFilter(BleFilterRule[] rules, int count, ulong[] macs, int macCount, FilterAction defaultAction);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "GetAdvertFilterStats")]
+	public static extern void GetAdvertFilterStats(out BleFilterStats stats);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "GetAdvertFilterHits")]
+	public static extern int GetAdvertFilterHits([Out] ulong[] hits, int maxCount);
+
+	public enum BackendType { Winrt = 0, Simulated = 1 };
+
+	/// <summary>
+	/// route all following calls through the radio or the in-process simulator, call before Initialize
+	/// </summary>
+	[DllImport("BleWinrt.dll", EntryPoint = "SelectBackend")]
+	public static extern void SelectBackend(BackendType type);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "SimReset")]
+	public static extern void SimReset();
+
+	[DllImport("BleWinrt.dll", EntryPoint = "SimSetLatency")]
+	public static extern void SimSetLatency(uint latencyUs, uint jitterUs);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "SimSetFailureRate")]
+	public static extern void SimSetFailureRate(double probability);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "SimAddPeripheral", CharSet = CharSet.Unicode)]
+	public static extern void SimAddPeripheral(ulong addr, string name, int signalStrength, int powerLevel, uint advertIntervalUs);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "SimRemovePeripheral")]
+	public static extern void SimRemovePeripheral(ulong addr);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "SimAddService")]
+	public static extern void SimAddService(ulong addr, Guid serviceUuid, [MarshalAs(UnmanagedType.I1)] bool advertised);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "SimAddCharacteristic", CharSet = CharSet.Unicode)]
+	public static extern void SimAddCharacteristic(ulong addr, Guid serviceUuid, Guid characteristicUuid, string userDescription);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "SimSetMtu")]
+	public static extern void SimSetMtu(ulong addr, uint mtu);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "SimSetManufacturerData")]
+	public static extern void SimSetManufacturerData(ulong addr, ushort companyId, byte[] data, UIntPtr size);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "SimSetAdvertData")]
+	public static extern void SimSetAdvertData(ulong addr, byte[] data, UIntPtr size);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "SimSetValue")]
+	public static extern void SimSetValue(ulong addr, Guid serviceUuid, Guid characteristicUuid, byte[] data, UIntPtr size);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "SimSetNotificationInterval")]
+	public static extern void SimSetNotificationInterval(ulong addr, Guid serviceUuid, Guid characteristicUuid, uint intervalUs, uint payloadSize);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "SimEmitAdverts")]
+	public static extern void SimEmitAdverts(ulong addr, uint count);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "SimNotify")]
+	public static extern void SimNotify(ulong addr, Guid serviceUuid, Guid characteristicUuid, byte[] data, UIntPtr size);
+
+	[DllImport("BleWinrt.dll", EntryPoint = "SimDropLink")]
+	public static extern void SimDropLink(ulong addr, uint downMilliseconds);
+
 	/// <summary>
 	/// close everything and clean up
 	/// </summary>
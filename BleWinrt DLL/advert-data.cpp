@@ -0,0 +1,157 @@
+#include "advert-data.h"
+
+using namespace std;
+
+
+guid ShortServiceUuid(uint32_t uuid)
+{
+	//0000xxxx-0000-1000-8000-00805F9B34FB
+	const uint8_t tail[8] = { 0x80, 0x00, 0x00, 0x80, 0x5F, 0x9B, 0x34, 0xFB };
+
+	guid result {};
+	result.Data1 = uuid;
+	result.Data2 = 0x0000;
+	result.Data3 = 0x1000;
+	memcpy(result.Data4, tail, sizeof(tail));
+	return result;
+}
+
+//128 bit uuids are sent as one little endian number
+static guid LongServiceUuid(const uint8_t* bytes)
+{
+	guid result {};
+	result.Data1 = (uint32_t)bytes[15] << 24 | (uint32_t)bytes[14] << 16 | (uint32_t)bytes[13] << 8 | bytes[12];
+	result.Data2 = (uint16_t)(bytes[11] << 8 | bytes[10]);
+	result.Data3 = (uint16_t)(bytes[9] << 8 | bytes[8]);
+
+	for (int i = 0; i < 8; i++)
+		result.Data4[i] = bytes[7 - i];
+
+	return result;
+}
+
+void AdvertSections::Add(uint8_t type, const uint8_t* data, size_t size)
+{
+	switch (type)
+	{
+	case ADVERT_FLAGS:
+		if (size >= 1)
+			flags = data[0];
+		break;
+
+	case ADVERT_MANUFACTURER_DATA:
+		if (size >= 2)
+			AddManufacturerData((uint16_t)(data[0] | data[1] << 8), data + 2, size - 2);
+		break;
+
+	case ADVERT_SERVICE_DATA_16:
+		if (size >= 2)
+			AddServiceData(ShortServiceUuid(data[0] | data[1] << 8), data + 2, size - 2);
+		break;
+
+	case ADVERT_SERVICE_DATA_32:
+		if (size >= 4)
+			AddServiceData(ShortServiceUuid((uint32_t)data[3] << 24 | (uint32_t)data[2] << 16 | (uint32_t)data[1] << 8 | data[0]), data + 4, size - 4);
+		break;
+
+	case ADVERT_SERVICE_DATA_128:
+		if (size >= 16)
+			AddServiceData(LongServiceUuid(data), data + 16, size - 16);
+		break;
+	}
+}
+
+void AdvertSections::Parse(const uint8_t* data, size_t size)
+{
+	size_t offset = 0;
+
+	//a zero length ends the significant part, a structure running past the end is dropped
+	while (offset < size && data[offset] != 0)
+	{
+		size_t length = data[offset];
+		if (length > size - offset - 1)
+			break;
+
+		Add(data[offset + 1], data + offset + 2, length - 1);
+		offset += 1 + length;
+	}
+}
+
+void AdvertSections::AddManufacturerData(uint16_t companyId, const uint8_t* data, size_t size)
+{
+	if (numManufacturerData < MAX_ADVERT_SECTIONS)
+		manufacturerData[numManufacturerData++] = { companyId, data, (uint32_t)size };
+}
+
+void AdvertSections::AddServiceData(const guid& uuid, const uint8_t* data, size_t size)
+{
+	if (numServiceData < MAX_ADVERT_SECTIONS)
+		serviceData[numServiceData++] = { uuid, data, (uint32_t)size };
+}
+
+void AdvertSections::Apply(AdvertEvent& advert) const
+{
+	advert.flags = flags;
+	advert.manufacturerData = manufacturerData;
+	advert.numManufacturerData = numManufacturerData;
+	advert.serviceData = serviceData;
+	advert.numServiceData = numServiceData;
+}
+
+
+size_t AdvertSectionBytes(const AdvertEvent& advert)
+{
+	//length and type
+	const size_t header = 3;
+
+	size_t total = advert.flags != 0 ? header + 1 : 0;
+
+	for (int32_t i = 0; i < advert.numManufacturerData; i++)
+		total += header + 2 + advert.manufacturerData[i].size;
+
+	for (int32_t i = 0; i < advert.numServiceData; i++)
+		total += header + sizeof(guid) + advert.serviceData[i].size;
+
+	return total;
+}
+
+size_t WriteAdvertSections(const AdvertEvent& advert, uint8_t* buffer, size_t capacity)
+{
+	size_t written = 0;
+
+	auto write = [&](uint8_t type, const void* prefix, size_t prefixSize, const uint8_t* data, size_t size)
+	{
+		size_t length = 1 + prefixSize + size;
+		if (length > UINT16_MAX || capacity - written < 2 + length)
+			return;
+
+		uint8_t* out = buffer + written;
+		out[0] = (uint8_t)length;
+		out[1] = (uint8_t)(length >> 8);
+		out[2] = type;
+		memcpy(out + 3, prefix, prefixSize);
+
+		if (size > 0)
+			memcpy(out + 3 + prefixSize, data, size);
+
+		written += 2 + length;
+	};
+
+	if (advert.flags != 0)
+		write(ADVERT_FLAGS, &advert.flags, 1, nullptr, 0);
+
+	for (int32_t i = 0; i < advert.numManufacturerData; i++)
+	{
+		const ManufacturerData& section = advert.manufacturerData[i];
+		uint8_t companyId[2] = { (uint8_t)section.companyId, (uint8_t)(section.companyId >> 8) };
+		write(ADVERT_MANUFACTURER_DATA, companyId, sizeof(companyId), section.data, section.size);
+	}
+
+	for (int32_t i = 0; i < advert.numServiceData; i++)
+	{
+		const ServiceData& section = advert.serviceData[i];
+		write(ADVERT_SERVICE_DATA_128, &section.uuid, sizeof(guid), section.data, section.size);
+	}
+
+	return written;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "backend.h"
+
+//advertising data types assigned by the bluetooth sig. the sections handed to the host use the same codes, service
+//data always as ADVERT_SERVICE_DATA_128
+enum AdvertDataType : uint8_t
+{
+	ADVERT_FLAGS = 0x01,
+	ADVERT_SERVICE_DATA_16 = 0x16,
+	ADVERT_SERVICE_DATA_32 = 0x20,
+	ADVERT_SERVICE_DATA_128 = 0x21,
+	ADVERT_MANUFACTURER_DATA = 0xFF,
+};
+
+//per kind, an extended advert could carry more but nothing seen in practice does
+const int MAX_ADVERT_SECTIONS = 8;
+
+//the bluetooth base uuid with a 16 or 32 bit uuid in its first field
+guid ShortServiceUuid(uint32_t uuid);
+
+//the sections of one advert as ranges borrowed from whoever reports it, meant to live on the stack of the handler.
+//nothing is copied, sections past MAX_ADVERT_SECTIONS are left out
+struct AdvertSections
+{
+	uint8_t flags = 0;
+
+	ManufacturerData manufacturerData[MAX_ADVERT_SECTIONS];
+	int32_t numManufacturerData = 0;
+
+	ServiceData serviceData[MAX_ADVERT_SECTIONS];
+	int32_t numServiceData = 0;
+
+	//the payload of one advertising data structure following its type, types not listed above are ignored
+	void Add(uint8_t type, const uint8_t* data, size_t size);
+	//raw advertising data as sent on air, structures of a length byte, the type and the payload
+	void Parse(const uint8_t* data, size_t size);
+
+	void AddManufacturerData(uint16_t companyId, const uint8_t* data, size_t size);
+	void AddServiceData(const guid& uuid, const uint8_t* data, size_t size);
+
+	//points the advert at the sections, which have to outlive it
+	void Apply(AdvertEvent& advert) const;
+};
+
+//the advert's flags, manufacturer and service data laid out for the host: per section a little endian uint16 counting
+//the type byte and the payload, the type and the payload. manufacturer data starts with the company id in little
+//endian, service data with its 16 byte uuid as laid out in memory
+size_t AdvertSectionBytes(const AdvertEvent& advert);
+//sections that don't fit are left out whole, returns the bytes written
+size_t WriteAdvertSections(const AdvertEvent& advert, uint8_t* buffer, size_t capacity);
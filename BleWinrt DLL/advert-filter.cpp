@@ -0,0 +1,250 @@
+#include "advert-filter.h"
+#include "gatt-cache.h"
+
+#include <mutex>
+
+using namespace std;
+
+
+//mac addresses are 48 bits, so no real address ever takes the empty slot
+const uint64_t FILTER_EMPTY_SLOT = UINT64_MAX;
+
+bool AdvertFilter::Configure(const BleFilterRule* rules, size_t count, const uint64_t* macs, size_t macCount, FilterAction defaultAction)
+{
+	if (count == 0)
+	{
+		Clear();
+		return true;
+	}
+
+	if (rules == nullptr || (macCount > 0 && macs == nullptr) || (defaultAction != FILTER_ACCEPT && defaultAction != FILTER_REJECT))
+		return false;
+
+	auto compiled = make_unique<RuleSet>();
+	compiled->defaultAccept = defaultAction == FILTER_ACCEPT;
+	compiled->rules.resize(count);
+	compiled->hits = make_unique<atomic<uint64_t>[]>(count);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const BleFilterRule& rule = rules[i];
+		CompiledRule& target = compiled->rules[i];
+
+		if (rule.action != FILTER_ACCEPT && rule.action != FILTER_REJECT)
+			return false;
+
+		target.accept = rule.action == FILTER_ACCEPT;
+		target.conditions = rule.conditions;
+
+		if (rule.conditions & FILTER_MAC)
+		{
+			if (rule.firstMac > macCount || rule.numMacs > macCount - rule.firstMac)
+				return false;
+
+			//at most half full, a miss ends on an empty slot after a probe or two
+			size_t size = 4;
+			while (size < 2 * (size_t)rule.numMacs)
+				size *= 2;
+
+			target.macTable.assign(size, FILTER_EMPTY_SLOT);
+			target.macMask = size - 1;
+
+			for (uint32_t j = 0; j < rule.numMacs; j++)
+			{
+				uint64_t mac = macs[rule.firstMac + j];
+				if (mac == FILTER_EMPTY_SLOT)
+					continue;
+
+				size_t slot = MixBits(mac) & target.macMask;
+				while (target.macTable[slot] != FILTER_EMPTY_SLOT && target.macTable[slot] != mac)
+					slot = (slot + 1) & target.macMask;
+
+				target.macTable[slot] = mac;
+			}
+		}
+
+		if (rule.conditions & FILTER_SIGNAL)
+		{
+			target.minSignalStrength = rule.minSignalStrength;
+			target.maxSignalStrength = rule.maxSignalStrength;
+		}
+
+		if (rule.conditions & FILTER_NAME_PREFIX)
+		{
+			size_t length = 0;
+			while (length < FILTER_NAME_SIZE && rule.namePrefix[length] != 0)
+				length++;
+
+			if (length == FILTER_NAME_SIZE)
+				return false;
+
+			target.namePrefix.assign(rule.namePrefix, length);
+		}
+
+		if (rule.conditions & FILTER_SERVICE)
+		{
+			if (rule.numServiceUuids < 0 || rule.numServiceUuids > FILTER_SERVICE_UUIDS)
+				return false;
+
+			target.serviceUuids.assign(rule.serviceUuids, rule.serviceUuids + rule.numServiceUuids);
+		}
+
+		if (rule.conditions & FILTER_MANUFACTURER)
+		{
+			if (rule.dataSize > FILTER_DATA_SIZE)
+				return false;
+
+			target.companyId = rule.companyId;
+			target.dataSize = rule.dataSize;
+
+			//pre-masked, so matching is one and and one compare per byte
+			for (uint16_t j = 0; j < rule.dataSize; j++)
+			{
+				target.mask[j] = rule.mask[j];
+				target.data[j] = rule.data[j] & rule.mask[j];
+			}
+		}
+	}
+
+	unique_lock guard(lock);
+	ruleSet = move(compiled);
+	active = true;
+	return true;
+}
+
+void AdvertFilter::Clear()
+{
+	unique_lock guard(lock);
+	ruleSet.reset();
+	active = false;
+}
+
+bool AdvertFilter::Matches(const CompiledRule& rule, const AdvertEvent& advert)
+{
+	//cheapest conditions first
+	if ((rule.conditions & FILTER_SIGNAL) && (advert.signalStrength < rule.minSignalStrength || advert.signalStrength > rule.maxSignalStrength))
+		return false;
+
+	if (rule.conditions & FILTER_MAC)
+	{
+		size_t slot = MixBits(advert.mac) & rule.macMask;
+		while (rule.macTable[slot] != advert.mac)
+		{
+			if (rule.macTable[slot] == FILTER_EMPTY_SLOT)
+				return false;
+
+			slot = (slot + 1) & rule.macMask;
+		}
+	}
+
+	if (rule.conditions & FILTER_MANUFACTURER)
+	{
+		bool found = false;
+
+		for (int32_t i = 0; i < advert.numManufacturerData && !found; i++)
+		{
+			const ManufacturerData& section = advert.manufacturerData[i];
+			if (section.companyId != rule.companyId || section.size < rule.dataSize)
+				continue;
+
+			found = true;
+			for (uint16_t j = 0; j < rule.dataSize && found; j++)
+				found = (section.data[j] & rule.mask[j]) == rule.data[j];
+		}
+
+		if (!found)
+			return false;
+	}
+
+	if (rule.conditions & FILTER_SERVICE)
+	{
+		bool found = false;
+
+		for (int32_t i = 0; i < advert.numServiceUuids && !found; i++)
+			for (auto& uuid : rule.serviceUuids)
+				if (advert.serviceUuids[i] == uuid)
+				{
+					found = true;
+					break;
+				}
+
+		if (!found)
+			return false;
+	}
+
+	if (rule.conditions & FILTER_NAME_PREFIX)
+	{
+		const wchar_t* name = advert.name != nullptr ? advert.name : L"";
+
+		for (wchar_t c : rule.namePrefix)
+			if (*name++ != c)
+				return false;
+	}
+
+	return true;
+}
+
+bool AdvertFilter::Accept(const AdvertEvent& advert)
+{
+	if (!active.load(memory_order_acquire))
+		return true;
+
+	shared_lock guard(lock);
+
+	RuleSet* rules = ruleSet.get();
+	if (rules == nullptr)
+		return true;
+
+	rules->evaluated.fetch_add(1, memory_order_relaxed);
+
+	bool accept = rules->defaultAccept;
+	bool matched = false;
+
+	for (size_t i = 0; i < rules->rules.size(); i++)
+	{
+		const CompiledRule& rule = rules->rules[i];
+		if (!Matches(rule, advert))
+			continue;
+
+		rules->hits[i].fetch_add(1, memory_order_relaxed);
+		accept = rule.accept;
+		matched = true;
+		break;
+	}
+
+	if (!matched)
+		rules->unmatched.fetch_add(1, memory_order_relaxed);
+
+	(accept ? rules->accepted : rules->rejected).fetch_add(1, memory_order_relaxed);
+	return accept;
+}
+
+void AdvertFilter::Stats(BleFilterStats& stats)
+{
+	stats = BleFilterStats();
+
+	shared_lock guard(lock);
+	if (!ruleSet)
+		return;
+
+	stats.evaluated = ruleSet->evaluated.load(memory_order_relaxed);
+	stats.accepted = ruleSet->accepted.load(memory_order_relaxed);
+	stats.rejected = ruleSet->rejected.load(memory_order_relaxed);
+	stats.unmatched = ruleSet->unmatched.load(memory_order_relaxed);
+	stats.rules = (uint32_t)ruleSet->rules.size();
+	stats.defaultAction = ruleSet->defaultAccept ? FILTER_ACCEPT : FILTER_REJECT;
+}
+
+size_t AdvertFilter::RuleHits(uint64_t* hits, size_t maxCount)
+{
+	shared_lock guard(lock);
+	if (!ruleSet)
+		return 0;
+
+	size_t count = ruleSet->rules.size();
+	if (hits != nullptr)
+		for (size_t i = 0; i < count && i < maxCount; i++)
+			hits[i] = ruleSet->hits[i].load(memory_order_relaxed);
+
+	return count;
+}
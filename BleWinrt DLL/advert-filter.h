@@ -0,0 +1,127 @@
+#pragma once
+
+#include "backend.h"
+
+#include <atomic>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+enum FilterAction : int32_t
+{
+	FILTER_ACCEPT = 0,
+	FILTER_REJECT = 1,
+};
+
+//conditions of a rule, every one set in its conditions has to hold for the rule to match
+enum FilterCondition : uint32_t
+{
+	//the address is one of the rule's macs
+	FILTER_MAC = 1,
+	//minSignalStrength <= rssi <= maxSignalStrength
+	FILTER_SIGNAL = 2,
+	FILTER_NAME_PREFIX = 4,
+	//any of the rule's service uuids is advertised
+	FILTER_SERVICE = 8,
+	//a manufacturer section of companyId whose first dataSize bytes equal data wherever mask is set
+	FILTER_MANUFACTURER = 16,
+};
+
+const int FILTER_NAME_SIZE = 32;
+const int FILTER_SERVICE_UUIDS = 4;
+const int FILTER_DATA_SIZE = 24;
+
+struct BleFilterRule
+{
+	int32_t action = FILTER_ACCEPT;
+	uint32_t conditions = 0;
+
+	//range of the mac array passed along with the rules
+	uint32_t firstMac = 0;
+	uint32_t numMacs = 0;
+
+	int32_t minSignalStrength = INT16_MIN;
+	int32_t maxSignalStrength = INT16_MAX;
+
+	wchar_t namePrefix[FILTER_NAME_SIZE];
+
+	guid serviceUuids[FILTER_SERVICE_UUIDS];
+	int32_t numServiceUuids = 0;
+
+	uint16_t companyId = 0;
+	uint16_t dataSize = 0;
+	uint8_t data[FILTER_DATA_SIZE];
+	uint8_t mask[FILTER_DATA_SIZE];
+};
+
+struct BleFilterStats
+{
+	uint64_t evaluated = 0;
+	uint64_t accepted = 0;
+	uint64_t rejected = 0;
+	//adverts no rule matched, they got the default action
+	uint64_t unmatched = 0;
+
+	uint32_t rules = 0;
+	int32_t defaultAction = FILTER_ACCEPT;
+};
+
+//rules are checked in order and the first one that matches decides. a rule set is compiled once when it is set: mac
+//lists become open addressing tables and everything else flat values, so a rejected advert costs a shared lock and a
+//few comparisons per rule, nothing is allocated
+class AdvertFilter
+{
+public:
+	//replaces the rule set and its counters. false if a rule is malformed, the previous rule set stays then
+	bool Configure(const BleFilterRule* rules, size_t count, const uint64_t* macs, size_t macCount, FilterAction defaultAction);
+	//without rules everything is accepted and nothing is counted
+	void Clear();
+
+	bool Accept(const AdvertEvent& advert);
+
+	void Stats(BleFilterStats& stats);
+	//hits of each rule in order, returns the number of rules
+	size_t RuleHits(uint64_t* hits, size_t maxCount);
+
+private:
+	struct CompiledRule
+	{
+		bool accept = true;
+		uint32_t conditions = 0;
+
+		//power of two sized, FILTER_EMPTY_SLOT marks a free slot
+		std::vector<uint64_t> macTable;
+		uint64_t macMask = 0;
+
+		int32_t minSignalStrength = 0;
+		int32_t maxSignalStrength = 0;
+
+		std::wstring namePrefix;
+		std::vector<guid> serviceUuids;
+
+		uint16_t companyId = 0;
+		uint16_t dataSize = 0;
+		uint8_t data[FILTER_DATA_SIZE] = {};
+		uint8_t mask[FILTER_DATA_SIZE] = {};
+	};
+
+	struct RuleSet
+	{
+		std::vector<CompiledRule> rules;
+		bool defaultAccept = true;
+
+		std::unique_ptr<std::atomic<uint64_t>[]> hits;
+		std::atomic<uint64_t> evaluated { 0 };
+		std::atomic<uint64_t> accepted { 0 };
+		std::atomic<uint64_t> rejected { 0 };
+		std::atomic<uint64_t> unmatched { 0 };
+	};
+
+	static bool Matches(const CompiledRule& rule, const AdvertEvent& advert);
+
+	std::shared_mutex lock;
+	std::unique_ptr<RuleSet> ruleSet;
+	//lets Accept skip the lock while no rules are set
+	std::atomic<bool> active { false };
+};
@@ -0,0 +1,894 @@
+#include "backend-sim.h"
+
+#include <algorithm>
+
+using namespace std;
+
+//DateTime ticks (100ns since 1601) of the unix epoch, adverts are stamped in the same unit the WinRT backend reports
+const int64_t UNIX_EPOCH_TICKS = 116444736000000000LL;
+
+
+static int64_t AdvertTimestamp()
+{
+	using namespace chrono;
+	return UNIX_EPOCH_TICKS + duration_cast<microseconds>(system_clock::now().time_since_epoch()).count() * 10;
+}
+
+//the link is gone, and with it every subscription
+static void ReleaseLink(SimPeripheral& peripheral)
+{
+	peripheral.connected = false;
+
+	for (auto& service : peripheral.services)
+	{
+		for (auto& characteristic : service.characteristics)
+		{
+			characteristic.subscriber = nullptr;
+			characteristic.notifyGeneration++;
+		}
+	}
+}
+
+SimulatedBackend& GetSimulatedBackend()
+{
+	//never destroyed, the timeline thread must not be joined while the loader lock is held on unload
+	static SimulatedBackend* simulatedBackend = new SimulatedBackend();
+	return *simulatedBackend;
+}
+
+
+SimulatedBackend::SimulatedBackend()
+{
+	thread(&SimulatedBackend::RunTimeline, this).detach();
+}
+
+void SimulatedBackend::RunTimeline()
+{
+	unique_lock guard(lock);
+
+	while (true)
+	{
+		if (timeline.empty())
+		{
+			wake.wait(guard);
+			continue;
+		}
+
+		int64_t wait = timeline.top().due - NowMicroseconds();
+		if (wait > 0)
+		{
+			wake.wait_for(guard, chrono::microseconds(wait));
+			continue;
+		}
+
+		auto action = move(const_cast<ScheduledEvent&>(timeline.top()).action);
+		timeline.pop();
+
+		//actions take the lock themselves and never call out while holding it
+		guard.unlock();
+		action();
+		guard.lock();
+	}
+}
+
+void SimulatedBackend::Schedule(int64_t delayUs, function<void()> action, function<void()> abort)
+{
+	timeline.push({ NowMicroseconds() + delayUs, sequence++, move(action), move(abort) });
+	wake.notify_one();
+}
+
+vector<function<void()>> SimulatedBackend::DropTimeline()
+{
+	vector<function<void()>> aborts;
+
+	for (; !timeline.empty(); timeline.pop())
+	{
+		auto& abort = const_cast<ScheduledEvent&>(timeline.top()).abort;
+		if (abort)
+			aborts.push_back(move(abort));
+	}
+
+	return aborts;
+}
+
+int64_t SimulatedBackend::OperationDelay()
+{
+	if (jitterUs == 0)
+		return latencyUs;
+
+	return latencyUs + (int64_t)(random() % (jitterUs + 1));
+}
+
+bool SimulatedBackend::ShouldFail()
+{
+	if (failureRate <= 0.0)
+		return false;
+
+	return uniform_real_distribution<double>(0.0, 1.0)(random) < failureRate;
+}
+
+SimPeripheral* SimulatedBackend::FindPeripheral(uint64_t deviceAddress)
+{
+	for (auto& peripheral : peripherals)
+		if (peripheral.mac == deviceAddress)
+			return &peripheral;
+
+	return nullptr;
+}
+
+SimService* SimulatedBackend::FindService(uint64_t deviceAddress, guid serviceUuid)
+{
+	SimPeripheral* peripheral = FindPeripheral(deviceAddress);
+	if (peripheral == nullptr)
+		return nullptr;
+
+	for (auto& service : peripheral->services)
+		if (service.uuid == serviceUuid)
+			return &service;
+
+	return nullptr;
+}
+
+SimCharacteristic* SimulatedBackend::FindCharacteristic(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid)
+{
+	SimService* service = FindService(deviceAddress, serviceUuid);
+	if (service == nullptr)
+		return nullptr;
+
+	for (auto& characteristic : service->characteristics)
+		if (characteristic.uuid == characteristicUuid)
+			return &characteristic;
+
+	return nullptr;
+}
+
+SimPeripheral* SimulatedBackend::FindReachable(uint64_t deviceAddress)
+{
+	SimPeripheral* peripheral = FindPeripheral(deviceAddress);
+	if (peripheral == nullptr || NowMicroseconds() < peripheral->unreachableUntil)
+		return nullptr;
+
+	return peripheral;
+}
+
+bool SimulatedBackend::PassesScanFilter(const SimPeripheral& peripheral) const
+{
+	//same semantics as BluetoothLEAdvertisementFilter: exact local name and one advertised service
+	if (!nameFilter.empty() && peripheral.name != nameFilter)
+		return false;
+
+	if (serviceFilter == guid{})
+		return true;
+
+	for (auto& service : peripheral.services)
+		if (service.advertised && service.uuid == serviceFilter)
+			return true;
+
+	return false;
+}
+
+AdvertEvent SimulatedBackend::BuildAdvert(const SimPeripheral& peripheral, SimAdvertBuffers& buffers)
+{
+	buffers.uuids.clear();
+	for (auto& service : peripheral.services)
+		if (service.advertised)
+			buffers.uuids.push_back(service.uuid);
+
+	buffers.name = scanMode == SCAN_ACTIVE ? peripheral.name : wstring();
+	buffers.manufacturerBytes = peripheral.manufacturerData;
+	buffers.advertData = peripheral.advertData;
+
+	AdvertEvent advert;
+	advert.mac = peripheral.mac;
+	advert.timestamp = AdvertTimestamp();
+	advert.signalStrength = peripheral.signalStrength;
+	advert.powerLevel = peripheral.powerLevel;
+	advert.name = buffers.name.c_str();
+	advert.serviceUuids = buffers.uuids.data();
+	advert.numServiceUuids = (int32_t)buffers.uuids.size();
+
+	buffers.sections = AdvertSections();
+	buffers.sections.Parse(buffers.advertData.data(), buffers.advertData.size());
+
+	if (!buffers.manufacturerBytes.empty())
+		buffers.sections.AddManufacturerData(peripheral.companyId, buffers.manufacturerBytes.data(), buffers.manufacturerBytes.size());
+
+	buffers.sections.Apply(advert);
+
+	return advert;
+}
+
+void SimulatedBackend::ScheduleAdvert(const SimPeripheral& peripheral, uint32_t delayUs)
+{
+	uint64_t deviceAddress = peripheral.mac;
+	uint64_t generation = peripheral.advertGeneration;
+	uint64_t scan = scanGeneration;
+
+	Schedule(delayUs, [this, deviceAddress, generation, scan]()
+	{
+		AdvertEvent advert;
+		AdvertHandler handler;
+
+		{
+			lock_guard guard(lock);
+
+			SimPeripheral* peripheral = FindPeripheral(deviceAddress);
+			if (!scanning || scan != scanGeneration || peripheral == nullptr || peripheral->advertGeneration != generation)
+				return;
+
+			ScheduleAdvert(*peripheral, peripheral->advertIntervalUs);
+
+			if (scanMode == SCAN_IDLE || !PassesScanFilter(*peripheral))
+				return;
+
+			advert = BuildAdvert(*peripheral, advertBuffers);
+			handler = advertHandler;
+		}
+
+		if (handler)
+			handler(advert);
+	});
+}
+
+void SimulatedBackend::ScheduleNotification(uint64_t deviceAddress, guid serviceUuid, const SimCharacteristic& characteristic, uint32_t delayUs)
+{
+	guid characteristicUuid = characteristic.uuid;
+	uint64_t generation = characteristic.notifyGeneration;
+
+	Schedule(delayUs, [this, deviceAddress, serviceUuid, characteristicUuid, generation]()
+	{
+		shared_ptr<NotificationHandler> subscriber;
+
+		{
+			lock_guard guard(lock);
+
+			SimCharacteristic* characteristic = FindCharacteristic(deviceAddress, serviceUuid, characteristicUuid);
+			if (characteristic == nullptr || characteristic->notifyGeneration != generation || characteristic->subscriber == nullptr)
+				return;
+
+			ScheduleNotification(deviceAddress, serviceUuid, *characteristic, characteristic->notifyIntervalUs);
+
+			//payload starts with a running sequence number so consumers can detect gaps
+			uint32_t sequenceNumber = characteristic->notifySequence++;
+			notificationPayload.assign(characteristic->notifyPayloadSize, 0);
+			memcpy(notificationPayload.data(), &sequenceNumber, min(sizeof(sequenceNumber), notificationPayload.size()));
+
+			subscriber = characteristic->subscriber;
+		}
+
+		(*subscriber)(notificationPayload.data(), notificationPayload.size());
+	});
+}
+
+
+void SimulatedBackend::InitializeScan(const wchar_t* nameFilter, guid serviceFilter, AdvertHandler onAdvert, ScanStoppedHandler onStopped)
+{
+	lock_guard guard(lock);
+
+	this->nameFilter = nameFilter != nullptr ? nameFilter : L"";
+	this->serviceFilter = serviceFilter;
+	advertHandler = onAdvert;
+	stoppedHandler = onStopped;
+	scanning = false;
+	scanGeneration++;
+}
+
+void SimulatedBackend::StartScan()
+{
+	lock_guard guard(lock);
+
+	if (scanning)
+		return;
+
+	scanning = true;
+	scanGeneration++;
+
+	//spread the first adverts over one interval instead of firing everything at once
+	for (auto& peripheral : peripherals)
+		if (peripheral.advertIntervalUs > 0)
+			ScheduleAdvert(peripheral, (uint32_t)(random() % peripheral.advertIntervalUs));
+}
+
+void SimulatedBackend::StopScan()
+{
+	lock_guard guard(lock);
+
+	if (!scanning)
+		return;
+
+	scanning = false;
+	scanGeneration++;
+
+	Schedule(0, [this]()
+	{
+		ScanStoppedHandler handler;
+
+		{
+			lock_guard guard(lock);
+			handler = stoppedHandler;
+		}
+
+		if (handler)
+			handler();
+	});
+}
+
+void SimulatedBackend::SetScanMode(ScanMode mode)
+{
+	lock_guard guard(lock);
+	scanMode = mode;
+}
+
+void SimulatedBackend::Connect(uint64_t deviceAddress, CompletionHandler done)
+{
+	lock_guard guard(lock);
+
+	bool fail = ShouldFail();
+	Schedule(OperationDelay(), [this, deviceAddress, fail, done]()
+	{
+		bool success = false;
+
+		{
+			lock_guard guard(lock);
+
+			SimPeripheral* peripheral = FindReachable(deviceAddress);
+			if (peripheral != nullptr && !fail)
+				success = peripheral->connected = true;
+		}
+
+		done(success);
+	}, [done]()
+	{
+		done(false);
+	});
+}
+
+void SimulatedBackend::Disconnect(uint64_t deviceAddress)
+{
+	lock_guard guard(lock);
+
+	SimPeripheral* peripheral = FindPeripheral(deviceAddress);
+	if (peripheral != nullptr)
+		ReleaseLink(*peripheral);
+}
+
+void SimulatedBackend::SetLinkLostHandler(LinkLostHandler handler)
+{
+	lock_guard guard(lock);
+
+	linkLostHandler = handler;
+}
+
+void SimulatedBackend::Resolve(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, CompletionHandler done)
+{
+	lock_guard guard(lock);
+
+	bool fail = ShouldFail();
+	Schedule(OperationDelay(), [this, deviceAddress, serviceUuid, characteristicUuid, fail, done]()
+	{
+		bool success = false;
+
+		{
+			lock_guard guard(lock);
+
+			if (FindReachable(deviceAddress) != nullptr && !fail)
+			{
+				if (characteristicUuid == guid{})
+					success = FindService(deviceAddress, serviceUuid) != nullptr;
+				else
+					success = FindCharacteristic(deviceAddress, serviceUuid, characteristicUuid) != nullptr;
+			}
+		}
+
+		done(success);
+	}, [done]()
+	{
+		done(false);
+	});
+}
+
+void SimulatedBackend::ScanServices(uint64_t deviceAddress, ServicesHandler done)
+{
+	lock_guard guard(lock);
+
+	bool fail = ShouldFail();
+	Schedule(OperationDelay(), [this, deviceAddress, fail, done]()
+	{
+		vector<ServiceInfo> services;
+		bool success = false;
+
+		{
+			lock_guard guard(lock);
+
+			//discovery needs the device in range but doesn't connect it, only Connect does
+			SimPeripheral* peripheral = FindReachable(deviceAddress);
+			if (peripheral != nullptr && !fail)
+			{
+				success = true;
+
+				for (auto& service : peripheral->services)
+					services.push_back({ service.uuid, service.attributeHandle });
+			}
+		}
+
+		done(success, services);
+	}, [done]()
+	{
+		done(false, {});
+	});
+}
+
+void SimulatedBackend::ScanCharacteristics(uint64_t deviceAddress, guid serviceUuid, CharacteristicsHandler done)
+{
+	lock_guard guard(lock);
+
+	bool fail = ShouldFail();
+	bool readDescriptions = discoveryOptions.readUserDescriptions;
+	int64_t delay = OperationDelay();
+
+	//every described characteristic costs a descriptor discovery and a read, maxConcurrentReads of them overlap
+	SimService* service = FindService(deviceAddress, serviceUuid);
+	if (service != nullptr && readDescriptions)
+	{
+		int64_t described = count_if(service->characteristics.begin(), service->characteristics.end(), [](const SimCharacteristic& characteristic)
+		{
+			return !characteristic.userDescription.empty();
+		});
+
+		int64_t window = max(discoveryOptions.maxConcurrentReads, 1);
+		for (int64_t round = 0; round < (described + window - 1) / window; round++)
+			delay += 2 * OperationDelay();
+	}
+
+	Schedule(delay, [this, deviceAddress, serviceUuid, readDescriptions, fail, done]()
+	{
+		vector<CharacteristicInfo> characteristics;
+		bool success = false;
+
+		{
+			lock_guard guard(lock);
+
+			SimService* service = FindService(deviceAddress, serviceUuid);
+			if (service != nullptr && FindReachable(deviceAddress) != nullptr && !fail)
+			{
+				success = true;
+
+				for (auto& characteristic : service->characteristics)
+				{
+					characteristics.push_back({ characteristic.uuid, characteristic.userDescription, characteristic.properties, characteristic.attributeHandle });
+
+					if (!readDescriptions)
+						characteristics.back().userDescription.clear();
+				}
+			}
+		}
+
+		done(success, characteristics);
+	}, [done]()
+	{
+		done(false, {});
+	});
+}
+
+void SimulatedBackend::SetDiscoveryOptions(const DiscoveryOptions& options)
+{
+	lock_guard guard(lock);
+
+	discoveryOptions = options;
+}
+
+void SimulatedBackend::Subscribe(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, NotificationHandler notificationHandler, CompletionHandler done)
+{
+	lock_guard guard(lock);
+
+	bool fail = ShouldFail();
+	Schedule(OperationDelay(), [this, deviceAddress, serviceUuid, characteristicUuid, notificationHandler, fail, done]()
+	{
+		bool success = false;
+
+		{
+			lock_guard guard(lock);
+
+			SimCharacteristic* characteristic = FindCharacteristic(deviceAddress, serviceUuid, characteristicUuid);
+			if (characteristic != nullptr && FindReachable(deviceAddress) != nullptr && !fail)
+			{
+				success = true;
+
+				characteristic->subscriber = make_shared<NotificationHandler>(notificationHandler);
+				characteristic->notifyGeneration++;
+
+				if (characteristic->notifyIntervalUs > 0)
+					ScheduleNotification(deviceAddress, serviceUuid, *characteristic, characteristic->notifyIntervalUs);
+			}
+		}
+
+		done(success);
+	}, [done]()
+	{
+		done(false);
+	});
+}
+
+void SimulatedBackend::Unsubscribe(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, CompletionHandler done)
+{
+	lock_guard guard(lock);
+
+	bool fail = ShouldFail();
+	Schedule(OperationDelay(), [this, deviceAddress, serviceUuid, characteristicUuid, fail, done]()
+	{
+		bool success = false;
+
+		{
+			lock_guard guard(lock);
+
+			SimCharacteristic* characteristic = FindCharacteristic(deviceAddress, serviceUuid, characteristicUuid);
+			if (characteristic != nullptr && characteristic->subscriber != nullptr && !fail)
+			{
+				success = true;
+
+				characteristic->subscriber = nullptr;
+				characteristic->notifyGeneration++;
+			}
+		}
+
+		done(success);
+	}, [done]()
+	{
+		done(false);
+	});
+}
+
+void SimulatedBackend::Read(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, ReadHandler done)
+{
+	lock_guard guard(lock);
+
+	bool fail = ShouldFail();
+	Schedule(OperationDelay(), [this, deviceAddress, serviceUuid, characteristicUuid, fail, done]()
+	{
+		vector<uint8_t> value;
+		bool success = false;
+
+		{
+			lock_guard guard(lock);
+
+			SimCharacteristic* characteristic = FindCharacteristic(deviceAddress, serviceUuid, characteristicUuid);
+			if (characteristic != nullptr && FindReachable(deviceAddress) != nullptr && !fail)
+			{
+				success = true;
+				value = characteristic->value;
+			}
+		}
+
+		done(success, value.data(), value.size());
+	}, [done]()
+	{
+		done(false, nullptr, 0);
+	});
+}
+
+void SimulatedBackend::Write(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, const uint8_t* data, size_t size, bool withResponse, CompletionHandler done)
+{
+	lock_guard guard(lock);
+
+	bool fail = ShouldFail();
+	vector<uint8_t> value(data, data + size);
+
+	//without response there is no round trip to the peripheral, only the hand-off to the controller
+	int64_t delay = withResponse ? OperationDelay() : OperationDelay() / 4;
+
+	Schedule(delay, [this, deviceAddress, serviceUuid, characteristicUuid, value, withResponse, fail, done]()
+	{
+		bool success = false;
+
+		{
+			lock_guard guard(lock);
+
+			SimPeripheral* peripheral = FindReachable(deviceAddress);
+			SimCharacteristic* characteristic = FindCharacteristic(deviceAddress, serviceUuid, characteristicUuid);
+
+			size_t maxSize = withResponse ? ATT_MAX_VALUE_SIZE : peripheral != nullptr ? peripheral->mtu - ATT_WRITE_OVERHEAD : 0;
+			if (peripheral != nullptr && characteristic != nullptr && !fail && value.size() <= maxSize)
+			{
+				success = true;
+				characteristic->value = value;
+			}
+		}
+
+		done(success);
+	}, [done]()
+	{
+		done(false);
+	});
+}
+
+void SimulatedBackend::QueryMtu(uint64_t deviceAddress, MtuHandler done)
+{
+	lock_guard guard(lock);
+
+	bool fail = ShouldFail();
+	Schedule(OperationDelay(), [this, deviceAddress, fail, done]()
+	{
+		uint32_t mtu = 0;
+
+		{
+			lock_guard guard(lock);
+
+			SimPeripheral* peripheral = FindReachable(deviceAddress);
+			if (peripheral != nullptr && !fail)
+				mtu = peripheral->mtu;
+		}
+
+		done(mtu != 0, mtu);
+	}, [done]()
+	{
+		done(false, 0);
+	});
+}
+
+void SimulatedBackend::Quit()
+{
+	vector<function<void()>> aborts;
+
+	{
+		lock_guard guard(lock);
+
+		scanning = false;
+		scanGeneration++;
+		aborts = DropTimeline();
+
+		for (auto& peripheral : peripherals)
+			ReleaseLink(peripheral);
+	}
+
+	//operations in flight fail instead of never completing, their callers may be waiting on them
+	for (auto& abort : aborts)
+		abort();
+}
+
+
+void SimulatedBackend::Reset()
+{
+	vector<function<void()>> aborts;
+
+	{
+		lock_guard guard(lock);
+
+		aborts = DropTimeline();
+		peripherals.clear();
+		scanGeneration++;
+
+		latencyUs = 0;
+		jitterUs = 0;
+		failureRate = 0.0;
+		random.seed();
+	}
+
+	for (auto& abort : aborts)
+		abort();
+}
+
+void SimulatedBackend::SetLatency(uint32_t latencyUs, uint32_t jitterUs)
+{
+	lock_guard guard(lock);
+
+	this->latencyUs = latencyUs;
+	this->jitterUs = jitterUs;
+}
+
+void SimulatedBackend::SetFailureRate(double probability)
+{
+	lock_guard guard(lock);
+
+	failureRate = probability;
+}
+
+void SimulatedBackend::AddPeripheral(uint64_t deviceAddress, const wchar_t* name, int32_t signalStrength, int32_t powerLevel, uint32_t advertIntervalUs)
+{
+	lock_guard guard(lock);
+
+	SimPeripheral* peripheral = FindPeripheral(deviceAddress);
+	if (peripheral == nullptr)
+	{
+		peripherals.push_back({});
+		peripheral = &peripherals.back();
+		peripheral->mac = deviceAddress;
+	}
+
+	peripheral->name = name;
+	peripheral->signalStrength = signalStrength;
+	peripheral->powerLevel = powerLevel;
+	peripheral->advertIntervalUs = advertIntervalUs;
+	peripheral->advertGeneration++;
+
+	if (scanning && advertIntervalUs > 0)
+		ScheduleAdvert(*peripheral, (uint32_t)(random() % advertIntervalUs));
+}
+
+void SimulatedBackend::RemovePeripheral(uint64_t deviceAddress)
+{
+	lock_guard guard(lock);
+
+	peripherals.erase(remove_if(peripherals.begin(), peripherals.end(), [deviceAddress](const SimPeripheral& peripheral)
+	{
+		return peripheral.mac == deviceAddress;
+	}), peripherals.end());
+}
+
+bool SimulatedBackend::HasPeripheral(uint64_t deviceAddress)
+{
+	lock_guard guard(lock);
+	return FindPeripheral(deviceAddress) != nullptr;
+}
+
+void SimulatedBackend::AddService(uint64_t deviceAddress, guid serviceUuid, bool advertised)
+{
+	lock_guard guard(lock);
+
+	SimPeripheral* peripheral = FindPeripheral(deviceAddress);
+	if (peripheral == nullptr)
+		return;
+
+	SimService* service = FindService(deviceAddress, serviceUuid);
+	if (service == nullptr)
+	{
+		peripheral->services.emplace_back();
+		service = &peripheral->services.back();
+		service->uuid = serviceUuid;
+		service->attributeHandle = peripheral->nextHandle++;
+	}
+
+	service->advertised = advertised;
+}
+
+void SimulatedBackend::AddCharacteristic(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, const wchar_t* userDescription)
+{
+	lock_guard guard(lock);
+
+	SimPeripheral* peripheral = FindPeripheral(deviceAddress);
+	SimService* service = FindService(deviceAddress, serviceUuid);
+	if (service == nullptr)
+		return;
+
+	SimCharacteristic* characteristic = FindCharacteristic(deviceAddress, serviceUuid, characteristicUuid);
+	if (characteristic == nullptr)
+	{
+		service->characteristics.emplace_back();
+		characteristic = &service->characteristics.back();
+		characteristic->uuid = characteristicUuid;
+
+		//declaration and value attribute, the handle is the one of the value
+		peripheral->nextHandle += 2;
+		characteristic->attributeHandle = peripheral->nextHandle - 1;
+	}
+
+	characteristic->userDescription = userDescription;
+}
+
+void SimulatedBackend::SetMtu(uint64_t deviceAddress, uint32_t mtu)
+{
+	lock_guard guard(lock);
+
+	SimPeripheral* peripheral = FindPeripheral(deviceAddress);
+	if (peripheral != nullptr)
+		peripheral->mtu = mtu > ATT_DEFAULT_MTU ? mtu : ATT_DEFAULT_MTU;
+}
+
+void SimulatedBackend::SetManufacturerData(uint64_t deviceAddress, uint16_t companyId, const uint8_t* data, size_t size)
+{
+	lock_guard guard(lock);
+
+	SimPeripheral* peripheral = FindPeripheral(deviceAddress);
+	if (peripheral == nullptr)
+		return;
+
+	peripheral->companyId = companyId;
+	peripheral->manufacturerData.assign(data, data + size);
+}
+
+void SimulatedBackend::SetAdvertData(uint64_t deviceAddress, const uint8_t* data, size_t size)
+{
+	lock_guard guard(lock);
+
+	SimPeripheral* peripheral = FindPeripheral(deviceAddress);
+	if (peripheral != nullptr)
+		peripheral->advertData.assign(data, data + size);
+}
+
+void SimulatedBackend::SetValue(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, const uint8_t* data, size_t size)
+{
+	lock_guard guard(lock);
+
+	SimCharacteristic* characteristic = FindCharacteristic(deviceAddress, serviceUuid, characteristicUuid);
+	if (characteristic != nullptr)
+		characteristic->value.assign(data, data + size);
+}
+
+void SimulatedBackend::SetNotificationInterval(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, uint32_t intervalUs, uint32_t payloadSize)
+{
+	lock_guard guard(lock);
+
+	SimCharacteristic* characteristic = FindCharacteristic(deviceAddress, serviceUuid, characteristicUuid);
+	if (characteristic == nullptr)
+		return;
+
+	characteristic->notifyIntervalUs = intervalUs;
+	characteristic->notifyPayloadSize = payloadSize;
+	characteristic->notifyGeneration++;
+
+	if (characteristic->subscriber != nullptr && intervalUs > 0)
+		ScheduleNotification(deviceAddress, serviceUuid, *characteristic, intervalUs);
+}
+
+void SimulatedBackend::DropLink(uint64_t deviceAddress, uint32_t downUs)
+{
+	lock_guard guard(lock);
+
+	SimPeripheral* peripheral = FindPeripheral(deviceAddress);
+	if (peripheral == nullptr)
+		return;
+
+	bool wasConnected = peripheral->connected;
+	ReleaseLink(*peripheral);
+	peripheral->unreachableUntil = NowMicroseconds() + downUs;
+
+	//only a link that was up can be lost
+	if (!wasConnected)
+		return;
+
+	Schedule(0, [this, deviceAddress]()
+	{
+		LinkLostHandler handler;
+
+		{
+			lock_guard guard(lock);
+			handler = linkLostHandler;
+		}
+
+		if (handler)
+			handler(deviceAddress);
+	});
+}
+
+void SimulatedBackend::EmitAdverts(uint64_t deviceAddress, uint32_t count)
+{
+	SimAdvertBuffers buffers;
+	AdvertEvent advert;
+	AdvertHandler handler;
+
+	{
+		lock_guard guard(lock);
+
+		SimPeripheral* peripheral = FindPeripheral(deviceAddress);
+		if (!scanning || scanMode == SCAN_IDLE || peripheral == nullptr || !PassesScanFilter(*peripheral))
+			return;
+
+		advert = BuildAdvert(*peripheral, buffers);
+		handler = advertHandler;
+	}
+
+	if (!handler)
+		return;
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		advert.timestamp = AdvertTimestamp();
+		handler(advert);
+	}
+}
+
+void SimulatedBackend::Notify(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, const uint8_t* data, size_t size)
+{
+	shared_ptr<NotificationHandler> subscriber;
+
+	{
+		lock_guard guard(lock);
+
+		SimCharacteristic* characteristic = FindCharacteristic(deviceAddress, serviceUuid, characteristicUuid);
+		if (characteristic == nullptr || characteristic->subscriber == nullptr)
+			return;
+
+		subscriber = characteristic->subscriber;
+	}
+
+	(*subscriber)(data, size);
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+#include "advert-data.h"
+#include "backend.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <thread>
+#include <vector>
+
+//in-process backend serving scriptable virtual peripherals. adverts, operation completions and periodic notifications
+//are played back from a single timeline thread; latencies, jitter and failures are configurable so the layers above
+//can be profiled and load-tested at rates no real radio produces. only depends on the standard library
+
+//read, write without response, write and notify
+const uint32_t SIM_DEFAULT_PROPERTIES = 0x02 | 0x04 | 0x08 | 0x10;
+
+//what a data length extension capable peripheral typically negotiates
+const uint32_t SIM_DEFAULT_MTU = 247;
+
+struct SimCharacteristic
+{
+	guid uuid {};
+	std::wstring userDescription;
+	uint32_t properties = SIM_DEFAULT_PROPERTIES;
+	uint16_t attributeHandle = 0;
+	std::vector<uint8_t> value;
+
+	//periodic notifications while subscribed, an interval of 0 disables them
+	uint32_t notifyIntervalUs = 0;
+	uint32_t notifyPayloadSize = 0;
+	uint32_t notifySequence = 0;
+
+	//bumped on every (un)subscribe or interval change so stale periodic notifications retire themselves
+	uint64_t notifyGeneration = 0;
+	std::shared_ptr<NotificationHandler> subscriber;
+};
+
+struct SimService
+{
+	guid uuid {};
+	bool advertised = false;
+	uint16_t attributeHandle = 0;
+	std::vector<SimCharacteristic> characteristics;
+};
+
+struct SimPeripheral
+{
+	uint64_t mac = 0;
+	std::wstring name;
+	int32_t signalStrength = 0;
+	int32_t powerLevel = 0;
+	uint32_t advertIntervalUs = 0;
+
+	//one manufacturer specific section, left out of the advert while empty
+	uint16_t companyId = 0;
+	std::vector<uint8_t> manufacturerData;
+	//raw advertising data structures sent along, flags, service data or beacon frames
+	std::vector<uint8_t> advertData;
+
+	//bumped whenever the advert schedule is replaced, same purpose as notifyGeneration
+	uint64_t advertGeneration = 0;
+
+	bool connected = false;
+	//NowMicroseconds() until which connecting and gatt operations fail, as if out of range
+	int64_t unreachableUntil = 0;
+	std::vector<SimService> services;
+
+	//attribute handles are handed out in the order services and characteristics are added
+	uint16_t nextHandle = 1;
+
+	//writes without response larger than mtu - ATT_WRITE_OVERHEAD fail, like on a real link
+	uint32_t mtu = SIM_DEFAULT_MTU;
+};
+
+//what an advert built under the lock references, so it survives releasing the lock
+struct SimAdvertBuffers
+{
+	std::vector<guid> uuids;
+	std::wstring name;
+	std::vector<uint8_t> manufacturerBytes;
+	std::vector<uint8_t> advertData;
+	AdvertSections sections;
+};
+
+class SimulatedBackend : public BleBackend
+{
+public:
+	SimulatedBackend();
+
+	void InitializeScan(const wchar_t* nameFilter, guid serviceFilter, AdvertHandler advertHandler, ScanStoppedHandler stoppedHandler) override;
+	void StartScan() override;
+	void StopScan() override;
+	void SetScanMode(ScanMode mode) override;
+
+	void Connect(uint64_t deviceAddress, CompletionHandler done) override;
+	void Disconnect(uint64_t deviceAddress) override;
+	void SetLinkLostHandler(LinkLostHandler handler) override;
+	void Resolve(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, CompletionHandler done) override;
+
+	void ScanServices(uint64_t deviceAddress, ServicesHandler done) override;
+	void ScanCharacteristics(uint64_t deviceAddress, guid serviceUuid, CharacteristicsHandler done) override;
+	void SetDiscoveryOptions(const DiscoveryOptions& options) override;
+
+	void Subscribe(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, NotificationHandler notificationHandler, CompletionHandler done) override;
+	void Unsubscribe(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, CompletionHandler done) override;
+
+	void Read(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, ReadHandler done) override;
+	void Write(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, const uint8_t* data, size_t size, bool withResponse, CompletionHandler done) override;
+
+	void QueryMtu(uint64_t deviceAddress, MtuHandler done) override;
+
+	void Quit() override;
+
+	//scripting, safe to call from any thread and while scanning
+
+	//drop every peripheral and pending event, restore default latency and failure settings
+	void Reset();
+	void SetLatency(uint32_t latencyUs, uint32_t jitterUs);
+	void SetFailureRate(double probability);
+
+	void AddPeripheral(uint64_t deviceAddress, const wchar_t* name, int32_t signalStrength, int32_t powerLevel, uint32_t advertIntervalUs);
+	void RemovePeripheral(uint64_t deviceAddress);
+	bool HasPeripheral(uint64_t deviceAddress);
+	void AddService(uint64_t deviceAddress, guid serviceUuid, bool advertised);
+	void AddCharacteristic(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, const wchar_t* userDescription);
+	void SetMtu(uint64_t deviceAddress, uint32_t mtu);
+	//size 0 removes the section
+	void SetManufacturerData(uint64_t deviceAddress, uint16_t companyId, const uint8_t* data, size_t size);
+	//as sent on air: structures of a length byte, the type and the payload
+	void SetAdvertData(uint64_t deviceAddress, const uint8_t* data, size_t size);
+
+	void SetValue(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, const uint8_t* data, size_t size);
+	void SetNotificationInterval(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, uint32_t intervalUs, uint32_t payloadSize);
+
+	//the link drops as if the peripheral went out of range, it can't be reached for downUs. reported to the link lost
+	//handler from the timeline
+	void DropLink(uint64_t deviceAddress, uint32_t downUs);
+
+	//deliver straight from the calling thread, bypassing the timeline
+	void EmitAdverts(uint64_t deviceAddress, uint32_t count);
+	void Notify(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, const uint8_t* data, size_t size);
+
+private:
+	struct ScheduledEvent
+	{
+		int64_t due;
+		uint64_t sequence;
+		std::function<void()> action;
+		//completes the operation with a failure if the event is dropped before it is due, empty for adverts and
+		//notifications
+		std::function<void()> abort;
+
+		bool operator>(const ScheduledEvent& other) const
+		{
+			return due != other.due ? due > other.due : sequence > other.sequence;
+		}
+	};
+
+	//callers hold lock for everything below
+	void Schedule(int64_t delayUs, std::function<void()> action, std::function<void()> abort = nullptr);
+	//empties the timeline and hands out the aborts of what was in it, to be run once the lock is released
+	std::vector<std::function<void()>> DropTimeline();
+	int64_t OperationDelay();
+	bool ShouldFail();
+	SimPeripheral* FindPeripheral(uint64_t deviceAddress);
+	SimService* FindService(uint64_t deviceAddress, guid serviceUuid);
+	SimCharacteristic* FindCharacteristic(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid);
+	//the peripheral exists and isn't out of range
+	SimPeripheral* FindReachable(uint64_t deviceAddress);
+	bool PassesScanFilter(const SimPeripheral& peripheral) const;
+	void ScheduleAdvert(const SimPeripheral& peripheral, uint32_t delayUs);
+	void ScheduleNotification(uint64_t deviceAddress, guid serviceUuid, const SimCharacteristic& characteristic, uint32_t delayUs);
+
+	AdvertEvent BuildAdvert(const SimPeripheral& peripheral, SimAdvertBuffers& buffers);
+
+	void RunTimeline();
+
+	std::mutex lock;
+	std::condition_variable wake;
+	std::priority_queue<ScheduledEvent, std::vector<ScheduledEvent>, std::greater<ScheduledEvent>> timeline;
+	uint64_t sequence = 0;
+
+	std::vector<SimPeripheral> peripherals;
+
+	std::wstring nameFilter;
+	guid serviceFilter {};
+	AdvertHandler advertHandler;
+	ScanStoppedHandler stoppedHandler;
+	LinkLostHandler linkLostHandler;
+	bool scanning = false;
+	uint64_t scanGeneration = 0;
+	//passive scans get no scan response, so their adverts carry no name. idle ones get nothing
+	ScanMode scanMode = SCAN_ACTIVE;
+
+	DiscoveryOptions discoveryOptions;
+
+	uint32_t latencyUs = 0;
+	uint32_t jitterUs = 0;
+	double failureRate = 0.0;
+	std::mt19937_64 random;
+
+	//only touched by the timeline thread
+	SimAdvertBuffers advertBuffers;
+	std::vector<uint8_t> notificationPayload;
+};
+
+SimulatedBackend& GetSimulatedBackend();
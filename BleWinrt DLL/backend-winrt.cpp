@@ -0,0 +1,825 @@
+#include "stdafx.h"
+#include "advert-data.h"
+#include "carriers.h"
+#include "backend-winrt.h"
+#include "serialization.h"
+#include "logging.h"
+#include "cache.h"
+#include "gatt-cache.h"
+
+#include <winrt/Windows.Devices.Bluetooth.Advertisement.h>
+
+#define __WFILE__ L"backend-winrt.cpp"
+
+using namespace winrt;
+using namespace Windows::Devices::Bluetooth;
+using namespace Windows::Devices::Bluetooth::Advertisement;
+using namespace Windows::Foundation;
+using namespace Windows::Foundation::Collections;
+
+//upper bound of service uuids forwarded per advert, a legacy advert can't even carry this many
+const int MAX_ADVERT_SERVICE_UUIDS = 32;
+
+
+AdvertHandler advertHandler;
+ScanStoppedHandler stoppedHandler;
+
+//one watcher per scan mode, a window switch stops one and starts the other
+BluetoothLEAdvertisementWatcher activeWatcher{ nullptr };
+BluetoothLEAdvertisementWatcher passiveWatcher{ nullptr };
+
+//guards the watchers, the scheduler switches modes from its own thread
+mutex scanLock;
+bool scanRequested = false;
+ScanMode scanMode = SCAN_ACTIVE;
+
+// global flag to release calling thread
+mutex quitLock;
+bool quitFlag = false;
+
+//one entry per subscribed characteristic, the registry in front of the backend never subscribes one twice
+mutex subscriptionsLock;
+unordered_map<GattKey, unique_ptr<Subscription>, GattKeyHash> subscriptions;
+
+DiscoveryOptions discoveryOptions;
+
+//a device connected through Connect, watched for its link dropping
+struct DeviceLink
+{
+	//keeps the os from dropping the link while idle
+	GattSession session{ nullptr };
+	BluetoothLEDevice::ConnectionStatusChanged_revoker revoker;
+
+	//set once the link dropped, until a connect brings it back
+	bool lost = false;
+	//what was cached when it dropped, resolved again by the next connect
+	vector<GattKey> stale;
+};
+
+mutex linksLock;
+unordered_map<uint64_t, DeviceLink> links;
+LinkLostHandler linkLostHandler;
+
+//stops watching and lets the os drop the link, under linksLock
+static void CloseLink(DeviceLink& link)
+{
+	link.revoker.revoke();
+
+	if (link.session)
+		link.session.Close();
+
+	link.session = nullptr;
+}
+
+
+fire_and_forget ScanServicesAsync(uint64_t deviceAddress, ServicesHandler done);
+fire_and_forget ScanCharacteristicsAsync(uint64_t deviceAddress, guid serviceUuid, CharacteristicsHandler done);
+fire_and_forget SubscribeCharacteristicAsync(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, NotificationHandler notificationHandler, CompletionHandler done);
+fire_and_forget UnsubscribeCharacteristicAsync(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, CompletionHandler done);
+
+fire_and_forget ConnectDeviceAsync(uint64_t deviceAddress, CompletionHandler done);
+fire_and_forget ResolveAsync(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, CompletionHandler done);
+
+fire_and_forget ReadBytesAsync(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, ReadHandler done);
+fire_and_forget WriteBytesAsync(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, vector<uint8_t> data, bool withResponse, CompletionHandler done);
+fire_and_forget QueryMtuAsync(uint64_t deviceAddress, MtuHandler done);
+
+
+struct WinrtBackend : BleBackend
+{
+	void InitializeScan(const wchar_t* nameFilter, guid serviceFilter, AdvertHandler onAdvert, ScanStoppedHandler onStopped) override
+	{
+		{
+			std::lock_guard lock(quitLock);
+			quitFlag = false;
+		}
+
+		advertHandler = onAdvert;
+		stoppedHandler = onStopped;
+
+		lock_guard guard(scanLock);
+		scanRequested = false;
+
+		for (const auto& watcher : { activeWatcher, passiveWatcher })
+			if (watcher)
+				watcher.Stop();
+
+		// Create a BluetoothLEAdvertisementWatcher per scanning mode
+		auto createWatcher = [nameFilter, serviceFilter](BluetoothLEScanningMode mode)
+		{
+			BluetoothLEAdvertisementWatcher watcher;
+			watcher.ScanningMode(mode);
+
+			BluetoothLEAdvertisementFilter filter;
+
+			if (nameFilter != nullptr && wcslen(nameFilter) > 0)
+				filter.Advertisement().LocalName(nameFilter);
+
+			if (serviceFilter != guid{})
+				filter.Advertisement().ServiceUuids().Append(serviceFilter);
+
+			watcher.AdvertisementFilter(filter);
+			return watcher;
+		};
+
+		activeWatcher = createWatcher(BluetoothLEScanningMode::Active);
+		passiveWatcher = createWatcher(BluetoothLEScanningMode::Passive);
+
+		// Handle received advertisements
+		auto received = [](BluetoothLEAdvertisementWatcher const&, BluetoothLEAdvertisementReceivedEventArgs const& args)
+		{
+			AdvertEvent advert;
+
+			//convoluted way of getting the timestamp of the packet
+			//TODO
+			advert.timestamp = args.Timestamp().time_since_epoch().count();
+
+			advert.mac = args.BluetoothAddress();
+			advert.signalStrength = args.RawSignalStrengthInDBm();
+
+			// Check if TransmitPowerLevelInDBm has a value and assign it if available
+			if (args.TransmitPowerLevelInDBm())
+				advert.powerLevel = args.TransmitPowerLevelInDBm().Value();
+
+			// Retrieve the device name from the advertisement
+			auto advertisement = args.Advertisement();
+
+			//copy the service uuids onto the stack, the event only borrows them for the duration of the handler
+			guid serviceUuids[MAX_ADVERT_SERVICE_UUIDS];
+			advert.numServiceUuids = (int32_t)advertisement.ServiceUuids().GetMany(0, serviceUuids);
+			advert.serviceUuids = serviceUuids;
+
+			hstring localName = advertisement.LocalName();
+			advert.name = localName.c_str();
+
+			//the collection keeps the section buffers alive, their bytes are read in place
+			auto dataSections = advertisement.DataSections();
+			AdvertSections sections;
+
+			for (auto&& section : dataSections)
+			{
+				auto data = section.Data();
+				sections.Add(section.DataType(), data.data(), data.Length());
+			}
+
+			if (auto flags = advertisement.Flags())
+				sections.flags = (uint8_t)flags.Value();
+
+			sections.Apply(advert);
+
+			if (advertHandler)
+				advertHandler(advert);
+		};
+
+		// Handle watcher stopped
+		auto stopped = [](BluetoothLEAdvertisementWatcher const&, BluetoothLEAdvertisementWatcherStoppedEventArgs const& args)
+		{
+			//window switches stop a watcher while the scan goes on, only StopScan or a failure end it
+			{
+				lock_guard guard(scanLock);
+				if (scanRequested && args.Error() == BluetoothError::Success)
+					return;
+			}
+
+			if (stoppedHandler)
+				stoppedHandler();
+		};
+
+		for (const auto& watcher : { activeWatcher, passiveWatcher })
+		{
+			watcher.Received(received);
+			watcher.Stopped(stopped);
+		}
+	}
+
+	void StartScan() override
+	{
+		lock_guard guard(scanLock);
+		scanRequested = true;
+		ApplyScanMode();
+	}
+
+	void StopScan() override
+	{
+		lock_guard guard(scanLock);
+		scanRequested = false;
+		ApplyScanMode();
+	}
+
+	void SetScanMode(ScanMode mode) override
+	{
+		lock_guard guard(scanLock);
+		scanMode = mode;
+		ApplyScanMode();
+	}
+
+	//runs the watcher of the current mode while a scan is requested and stops the other, under scanLock
+	void ApplyScanMode()
+	{
+		BluetoothLEAdvertisementWatcher wanted{ nullptr };
+		if (scanRequested)
+			wanted = scanMode == SCAN_ACTIVE ? activeWatcher : scanMode == SCAN_PASSIVE ? passiveWatcher : nullptr;
+
+		for (const auto& watcher : { activeWatcher, passiveWatcher })
+			if (watcher && watcher != wanted && watcher.Status() == BluetoothLEAdvertisementWatcherStatus::Started)
+				watcher.Stop();
+
+		if (!wanted || wanted.Status() == BluetoothLEAdvertisementWatcherStatus::Started)
+			return;
+
+		try
+		{
+			wanted.Start();
+		}
+		catch (hresult_error& ex)
+		{
+			LogError(L"%s:%d Starting the advertisement watcher failed: %s\n", __WFILE__, __LINE__, ex.message().c_str());
+		}
+	}
+
+	void Connect(uint64_t deviceAddress, CompletionHandler done) override
+	{
+		ConnectDeviceAsync(deviceAddress, done);
+	}
+
+	void Disconnect(uint64_t deviceAddress) override
+	{
+		{
+			lock_guard guard(linksLock);
+
+			//before the device is closed, which would report the link lost
+			auto found = links.find(deviceAddress);
+			if (found != links.end())
+			{
+				CloseLink(found->second);
+				links.erase(found);
+			}
+		}
+
+		RemoveFromCache(deviceAddress);
+	}
+
+	void SetLinkLostHandler(LinkLostHandler handler) override
+	{
+		lock_guard guard(linksLock);
+		linkLostHandler = handler;
+	}
+
+	void Resolve(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, CompletionHandler done) override
+	{
+		ResolveAsync(deviceAddress, serviceUuid, characteristicUuid, done);
+	}
+
+	void ScanServices(uint64_t deviceAddress, ServicesHandler done) override
+	{
+		ScanServicesAsync(deviceAddress, done);
+	}
+
+	void ScanCharacteristics(uint64_t deviceAddress, guid serviceUuid, CharacteristicsHandler done) override
+	{
+		ScanCharacteristicsAsync(deviceAddress, serviceUuid, done);
+	}
+
+	void SetDiscoveryOptions(const DiscoveryOptions& options) override
+	{
+		discoveryOptions = options;
+	}
+
+	void Subscribe(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, NotificationHandler notificationHandler, CompletionHandler done) override
+	{
+		SubscribeCharacteristicAsync(deviceAddress, serviceUuid, characteristicUuid, notificationHandler, done);
+	}
+
+	void Unsubscribe(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, CompletionHandler done) override
+	{
+		UnsubscribeCharacteristicAsync(deviceAddress, serviceUuid, characteristicUuid, done);
+	}
+
+	void Read(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, ReadHandler done) override
+	{
+		ReadBytesAsync(deviceAddress, serviceUuid, characteristicUuid, done);
+	}
+
+	void Write(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, const uint8_t* data, size_t size, bool withResponse, CompletionHandler done) override
+	{
+		//the caller's buffer is only borrowed, keep a copy alive across the suspension points
+		WriteBytesAsync(deviceAddress, serviceUuid, characteristicUuid, vector<uint8_t>(data, data + size), withResponse, done);
+	}
+
+	void QueryMtu(uint64_t deviceAddress, MtuHandler done) override
+	{
+		QueryMtuAsync(deviceAddress, done);
+	}
+
+	void Quit() override
+	{
+		{
+			lock_guard lock(quitLock);
+			quitFlag = true;
+		}
+
+		StopScan();
+
+		{
+			lock_guard guard(linksLock);
+
+			for (auto& [deviceAddress, link] : links)
+				CloseLink(link);
+
+			links.clear();
+		}
+
+		{
+			lock_guard guard(subscriptionsLock);
+
+			for (auto& [key, subscription] : subscriptions)
+				subscription->revoker.revoke();
+
+			subscriptions.clear();
+		}
+
+		ClearCache();
+	}
+};
+
+BleBackend& GetWinrtBackend()
+{
+	static WinrtBackend winrtBackend;
+	return winrtBackend;
+}
+
+
+fire_and_forget ScanServicesAsync(uint64_t deviceAddress, ServicesHandler done)
+{
+	vector<ServiceInfo> service_list;
+	bool success = false;
+
+	try
+	{
+		// Connect to device if not already connected
+		BluetoothLEDevice device = co_await RetrieveDevice(deviceAddress);
+		if (device == nullptr)
+		{
+			//wprintf(L"Failed to retrieve device at address: %llu\n", deviceAddress);
+			done(false, service_list);
+			co_return;
+		}
+
+		// Try using BluetoothCacheMode::Cached to see if it improves results
+		GattDeviceServicesResult result = co_await device.GetGattServicesAsync(BluetoothCacheMode::Uncached);
+
+		{
+			//check for quit signal after an async operation
+			std::lock_guard lock(quitLock);
+			if (quitFlag)
+				co_return;
+		}
+
+		if (result.Status() == GattCommunicationStatus::Unreachable)
+			result = co_await device.GetGattServicesAsync(BluetoothCacheMode::Cached);
+
+		if (result.Status() == GattCommunicationStatus::Success)
+		{
+			success = true;
+
+			auto services = result.Services();
+			if (services.Size() == 0)
+				wprintf(L"No services found for device at address: %llu\n", deviceAddress);
+
+			for (auto&& service : services)
+				service_list.push_back({ service.Uuid(), service.AttributeHandle() });
+		}
+	}
+	catch (hresult_error& ex)
+	{
+		wprintf(L"%s:%d ScanServicesAsync catch: %s\n", __WFILE__, __LINE__, ex.message().c_str());
+	}
+
+	// Call the handler with the service list, even if it's empty
+	done(success, service_list);
+}
+
+
+IAsyncOperation<hstring> ReadUserDescriptionAsync(GattCharacteristic c)
+{
+	try
+	{
+		// retrieve user description
+		GattDescriptorsResult descriptorScan = co_await c.GetDescriptorsForUuidAsync(make_guid(L"00002901-0000-1000-8000-00805F9B34FB"), BluetoothCacheMode::Uncached);
+
+		if (descriptorScan.Status() != GattCommunicationStatus::Success || descriptorScan.Descriptors().Size() == 0)
+			co_return hstring();
+
+		//get first descriptor
+		GattDescriptor descriptor = descriptorScan.Descriptors().GetAt(0);
+
+		//read name descriptor
+		GattReadResult nameResult = co_await descriptor.ReadValueAsync();
+		if (nameResult.Status() != GattCommunicationStatus::Success)
+		{
+			LogError(L"%s:%d couldn't read user description for charasteristic %s, status %d", __WFILE__, __LINE__, to_hstring(c.Uuid()).c_str(), nameResult.Status());
+			co_return hstring();
+		}
+
+		auto dataReader = DataReader::FromBuffer(nameResult.Value());
+		co_return dataReader.ReadString(dataReader.UnconsumedBufferLength());
+	}
+	catch (hresult_error& ex)
+	{
+		LogError(L"%s:%d ReadUserDescriptionAsync catch: %s", __WFILE__, __LINE__, ex.message().c_str());
+	}
+
+	co_return hstring();
+}
+
+fire_and_forget ScanCharacteristicsAsync(uint64_t deviceAddress, guid serviceUuid, CharacteristicsHandler done)
+{
+	vector<CharacteristicInfo> char_list;
+	bool success = false;
+
+	try
+	{
+		auto service = co_await RetrieveService(deviceAddress, serviceUuid);
+		if (service == nullptr)
+		{
+			done(false, char_list);
+			co_return;
+		}
+
+		GattCharacteristicsResult charScan = co_await service.GetCharacteristicsAsync(BluetoothCacheMode::Uncached);
+
+		if (charScan.Status() != GattCommunicationStatus::Success)
+		{
+			LogError(L"%s:%d Error scanning characteristics from service %s width status %d\n", __WFILE__, __LINE__, serviceUuid, (int)charScan.Status());
+
+			done(false, char_list);
+			co_return;
+		}
+
+		success = true;
+
+		auto characteristics = charScan.Characteristics();
+
+		for (auto c : characteristics)
+		{
+			CharacteristicInfo char_info { c.Uuid() };
+			char_info.properties = (uint32_t)c.CharacteristicProperties();
+			char_info.attributeHandle = c.AttributeHandle();
+
+			char_list.push_back(char_info);
+		}
+
+		DiscoveryOptions options = discoveryOptions;
+
+		if (options.readUserDescriptions)
+		{
+			//descriptions are fetched concurrently, at most maxConcurrentReads at a time. the operations start eagerly,
+			//before starting the next one beyond the window the oldest is awaited, so results land in their own slot
+			size_t window = (size_t)max(options.maxConcurrentReads, 1);
+			vector<IAsyncOperation<hstring>> reads(char_list.size(), nullptr);
+
+			for (size_t i = 0; i < char_list.size(); i++)
+			{
+				if (i >= window)
+					char_list[i - window].userDescription = co_await reads[i - window];
+
+				reads[i] = ReadUserDescriptionAsync(characteristics.GetAt((uint32_t)i));
+			}
+
+			for (size_t i = char_list.size() > window ? char_list.size() - window : 0; i < char_list.size(); i++)
+				char_list[i].userDescription = co_await reads[i];
+		}
+
+		{
+			lock_guard lock(quitLock);
+			if (quitFlag)
+				co_return;
+		}
+	}
+	catch (hresult_error& ex)
+	{
+		LogError(L"%s:%d ScanCharacteristicsAsync catch: %s\n", __WFILE__, __LINE__, ex.message().c_str());
+	}
+
+	done(success, char_list);
+}
+
+fire_and_forget SubscribeCharacteristicAsync(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, NotificationHandler notificationHandler, CompletionHandler done)
+{
+	try
+	{
+		GattCharacteristic characteristic = co_await RetrieveCharacteristic(deviceAddress, serviceUuid, characteristicUuid);
+		if (characteristic != nullptr)
+		{
+			auto status = co_await characteristic.WriteClientCharacteristicConfigurationDescriptorAsync(GattClientCharacteristicConfigurationDescriptorValue::Notify);
+			if (status != GattCommunicationStatus::Success)
+			{
+				LogError(L"%s:%d Error subscribing to characteristic with uuid %s and status %d", __WFILE__, __LINE__, characteristicUuid, status);
+				done(false);
+				co_return;
+			}
+
+			auto subscription = make_unique<Subscription>();
+			subscription->characteristic = characteristic;
+
+			// Inline handler for ValueChanged event
+			subscription->revoker = characteristic.ValueChanged(auto_revoke,
+				[notificationHandler]
+				(GattCharacteristic const& characteristic, GattValueChangedEventArgs args)
+			{
+				//hand out the buffer's own bytes, no copy, no allocation and no size limit per notification
+				IBuffer value = args.CharacteristicValue();
+				notificationHandler(value.data(), value.Length());
+			});
+
+			{
+				lock_guard guard(subscriptionsLock);
+
+				//a stale subscription of the same characteristic stops delivering when its revoker goes
+				auto& entry = subscriptions[GattKey{ deviceAddress, serviceUuid, characteristicUuid }];
+				if (entry)
+					entry->revoker.revoke();
+
+				entry = move(subscription);
+			}
+
+			done(true);
+			co_return;
+		}
+	}
+	catch (hresult_error& ex)
+	{
+		LogError(L"%s:%d SubscribeCharacteristicAsync catch: %s", __WFILE__, __LINE__, ex.message().c_str());
+	}
+
+	done(false);
+}
+
+fire_and_forget UnsubscribeCharacteristicAsync(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, CompletionHandler done)
+{
+	//taken out first, exactly one of concurrent unsubscribes finds it and no notification arrives after this
+	unique_ptr<Subscription> subscription;
+
+	{
+		lock_guard guard(subscriptionsLock);
+
+		auto found = subscriptions.find(GattKey{ deviceAddress, serviceUuid, characteristicUuid });
+		if (found == subscriptions.end())
+		{
+			done(false);
+			co_return;
+		}
+
+		subscription = move(found->second);
+		subscriptions.erase(found);
+	}
+
+	subscription->revoker.revoke();
+
+	try
+	{
+		// Disable notifications
+		auto status = co_await subscription->characteristic.WriteClientCharacteristicConfigurationDescriptorAsync(GattClientCharacteristicConfigurationDescriptorValue::None);
+		if (status != GattCommunicationStatus::Success)
+		{
+			LogError(L"%s:%d Error unsubscribing from characteristic with uuid %s and status %d", __WFILE__, __LINE__, characteristicUuid, status);
+			done(false);
+			co_return;
+		}
+
+		done(true);
+		co_return;
+	}
+	catch (hresult_error& ex)
+	{
+		LogError(L"%s:%d UnsubscribeCharacteristicAsync catch: %s", __WFILE__, __LINE__, ex.message().c_str());
+	}
+
+	done(false);
+}
+
+//the cached objects of a dropped link fail every operation and its subscriptions never deliver again, everything of
+//the device goes. what was cached is remembered for the next connect
+static void OnLinkLost(uint64_t deviceAddress)
+{
+	LinkLostHandler handler;
+
+	{
+		lock_guard guard(linksLock);
+
+		auto found = links.find(deviceAddress);
+		if (found == links.end() || found->second.lost)
+			return;
+
+		DeviceLink& link = found->second;
+		link.lost = true;
+		link.stale = CachedKeys(deviceAddress);
+		CloseLink(link);
+
+		handler = linkLostHandler;
+	}
+
+	RemoveFromCache(deviceAddress);
+
+	{
+		lock_guard guard(subscriptionsLock);
+
+		for (auto it = subscriptions.begin(); it != subscriptions.end();)
+		{
+			if (it->first.device != deviceAddress)
+			{
+				it++;
+				continue;
+			}
+
+			it->second->revoker.revoke();
+			it = subscriptions.erase(it);
+		}
+	}
+
+	if (handler)
+		handler(deviceAddress);
+}
+
+static void WatchLink(uint64_t deviceAddress, BluetoothLEDevice device, GattSession session)
+{
+	lock_guard guard(linksLock);
+
+	DeviceLink& link = links[deviceAddress];
+	link.lost = false;
+	link.stale.clear();
+	link.session = session;
+
+	link.revoker = device.ConnectionStatusChanged(auto_revoke, [deviceAddress](BluetoothLEDevice const& sender, IInspectable const&)
+	{
+		if (sender.ConnectionStatus() == BluetoothConnectionStatus::Disconnected)
+			OnLinkLost(deviceAddress);
+	});
+}
+
+fire_and_forget ConnectDeviceAsync(uint64_t deviceAddress, CompletionHandler done)
+{
+	bool reconnect = false;
+	vector<GattKey> stale;
+
+	{
+		lock_guard guard(linksLock);
+
+		auto found = links.find(deviceAddress);
+		if (found != links.end() && found->second.lost)
+		{
+			reconnect = true;
+			stale = found->second.stale;
+		}
+	}
+
+	bool success = false;
+
+	try
+	{
+		BluetoothLEDevice device = co_await RetrieveDevice(deviceAddress);
+
+		if (device != nullptr && reconnect)
+		{
+			//the os answers from its own cache while the peripheral is gone, only an uncached discovery proves the
+			//link is back
+			GattDeviceServicesResult result = co_await device.GetGattServicesAsync(BluetoothCacheMode::Uncached);
+			if (result.Status() != GattCommunicationStatus::Success)
+				device = nullptr;
+		}
+
+		if (device != nullptr)
+		{
+			GattSession session = co_await GattSession::FromDeviceIdAsync(device.BluetoothDeviceId());
+			session.MaintainConnection(true);
+
+			//watched before resolving, a drop meanwhile is reported like any other
+			WatchLink(deviceAddress, device, session);
+
+			//an attribute that is gone since doesn't fail the connect, the operation using it will
+			for (auto& key : stale)
+			{
+				bool resolved;
+				if (key.characteristic == guid{})
+					resolved = (co_await RetrieveService(key.device, key.service)) != nullptr;
+				else
+					resolved = (co_await RetrieveCharacteristic(key.device, key.service, key.characteristic)) != nullptr;
+
+				if (!resolved)
+					LogError(L"%s:%d Couldn't resolve %s again after reconnecting", __WFILE__, __LINE__, to_hstring(key.characteristic == guid{} ? key.service : key.characteristic).c_str());
+			}
+
+			success = true;
+		}
+	}
+	catch (hresult_error& ex)
+	{
+		LogError(L"%s:%d ConnectDeviceAsync catch: %s", __WFILE__, __LINE__, ex.message().c_str());
+	}
+
+	//the next attempt starts from a fresh device
+	if (!success && reconnect)
+		RemoveFromCache(deviceAddress);
+
+	done(success);
+}
+
+fire_and_forget ResolveAsync(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, CompletionHandler done)
+{
+	bool success = false;
+
+	try
+	{
+		if (characteristicUuid == guid{})
+			success = (co_await RetrieveService(deviceAddress, serviceUuid)) != nullptr;
+		else
+			success = (co_await RetrieveCharacteristic(deviceAddress, serviceUuid, characteristicUuid)) != nullptr;
+	}
+	catch (hresult_error& ex)
+	{
+		LogError(L"%s:%d ResolveAsync catch: %s", __WFILE__, __LINE__, ex.message().c_str());
+	}
+
+	done(success);
+}
+
+fire_and_forget ReadBytesAsync(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, ReadHandler done)
+{
+	try
+	{
+		GattCharacteristic ch = co_await RetrieveCharacteristic(deviceAddress, serviceUuid, characteristicUuid);
+		if (!ch)
+		{
+			done(false, nullptr, 0);
+			co_return;
+		}
+
+		GattReadResult dataFromRead = co_await ch.ReadValueAsync();
+		if (dataFromRead.Status() != GattCommunicationStatus::Success)
+		{
+			done(false, nullptr, 0);
+			co_return;
+		}
+
+		// Pass the IBuffer's bytes straight through, they stay valid while the handler runs
+		IBuffer buffer = dataFromRead.Value();
+		done(true, buffer.data(), buffer.Length());
+	}
+	catch (hresult_error& ex)
+	{
+		LogError(L"%s:%d ReadBytesAsync catch: %s", __WFILE__, __LINE__, ex.message().c_str());
+		done(false, nullptr, 0);
+	}
+}
+
+fire_and_forget WriteBytesAsync(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, vector<uint8_t> data, bool withResponse, CompletionHandler done)
+{
+	try
+	{
+		// Retrieve the characteristic asynchronously
+		GattCharacteristic ch = co_await RetrieveCharacteristic(deviceAddress, serviceUuid, characteristicUuid);
+		if (!ch)
+		{
+			done(false); // Indicate that the characteristic is unavailable
+			co_return;
+		}
+
+		// Copy straight into an IBuffer, a DataWriter would copy twice
+		Windows::Storage::Streams::Buffer buffer((uint32_t)data.size());
+		memcpy(buffer.data(), data.data(), data.size());
+		buffer.Length((uint32_t)data.size());
+
+		GattWriteOption option = withResponse ? GattWriteOption::WriteWithResponse : GattWriteOption::WriteWithoutResponse;
+		GattWriteResult result = co_await ch.WriteValueWithResultAsync(buffer, option);
+
+		// Report the real status, a rejected write used to look like a success
+		done(result.Status() == GattCommunicationStatus::Success);
+	}
+	catch (hresult_error& ex)
+	{
+		LogError(L"%s:%d WriteBytesAsync catch: %s", __WFILE__, __LINE__, ex.message().c_str());
+		done(false);
+	}
+}
+
+fire_and_forget QueryMtuAsync(uint64_t deviceAddress, MtuHandler done)
+{
+	try
+	{
+		BluetoothLEDevice device = co_await RetrieveDevice(deviceAddress);
+		if (!device)
+		{
+			done(false, 0);
+			co_return;
+		}
+
+		// The session is shared with every other user of the device, MaxPduSize is the negotiated att mtu
+		GattSession session = co_await GattSession::FromDeviceIdAsync(device.BluetoothDeviceId());
+		done(true, session.MaxPduSize());
+	}
+	catch (hresult_error& ex)
+	{
+		LogError(L"%s:%d QueryMtuAsync catch: %s", __WFILE__, __LINE__, ex.message().c_str());
+		done(false, 0);
+	}
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include "backend.h"
+
+//backend talking to the radio through BluetoothLEAdvertisementWatcher and the GATT client api
+BleBackend& GetWinrtBackend();
@@ -0,0 +1,177 @@
+#pragma once
+
+#include "platform.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+//the exported api in ble-winrt.cpp is implemented on top of a backend. the WinRT backend talks to the radio, the
+//simulated backend replays scripted virtual peripherals so every path can be exercised without hardware.
+//handlers are invoked on whatever thread the backend completes on; pointers passed to them are only valid for the
+//duration of the call
+
+//one manufacturer specific data section, the company id and the bytes following it
+struct ManufacturerData
+{
+	uint16_t companyId = 0;
+	const uint8_t* data = nullptr;
+	uint32_t size = 0;
+};
+
+//one service data section, short uuids are expanded with the bluetooth base uuid
+struct ServiceData
+{
+	guid uuid {};
+	const uint8_t* data = nullptr;
+	uint32_t size = 0;
+};
+
+//raw advertisement as reported by the backend
+struct AdvertEvent
+{
+	uint64_t mac = 0;
+	int64_t timestamp = 0;
+
+	int32_t signalStrength = 0;
+	int32_t powerLevel = 0;
+
+	const wchar_t* name = L"";
+
+	const guid* serviceUuids = nullptr;
+	int32_t numServiceUuids = 0;
+
+	//borrowed like the uuids
+	const ManufacturerData* manufacturerData = nullptr;
+	int32_t numManufacturerData = 0;
+	const ServiceData* serviceData = nullptr;
+	int32_t numServiceData = 0;
+
+	//0 if the advert carries no flags
+	uint8_t flags = 0;
+};
+
+struct ServiceInfo
+{
+	guid uuid;
+	uint16_t attributeHandle = 0;
+};
+
+struct CharacteristicInfo
+{
+	guid uuid;
+	std::wstring userDescription;
+
+	//GattCharacteristicProperties bits
+	uint32_t properties = 0;
+	uint16_t attributeHandle = 0;
+};
+
+inline bool operator==(const ServiceInfo& left, const ServiceInfo& right)
+{
+	return left.uuid == right.uuid && left.attributeHandle == right.attributeHandle;
+}
+
+inline bool operator==(const CharacteristicInfo& left, const CharacteristicInfo& right)
+{
+	return left.uuid == right.uuid && left.properties == right.properties && left.attributeHandle == right.attributeHandle &&
+		left.userDescription == right.userDescription;
+}
+
+//how ScanCharacteristics fetches the 0x2901 user descriptions
+struct DiscoveryOptions
+{
+	//descriptor discoveries and reads in flight at once per scan
+	int32_t maxConcurrentReads = 4;
+	bool readUserDescriptions = true;
+};
+
+enum ScanMode : int32_t
+{
+	//scanning, but the radio listens to nothing until the next window
+	SCAN_IDLE = 0,
+	//adverts only, nothing is sent
+	SCAN_PASSIVE = 1,
+	//every advertiser is also sent a scan request, its response carries the name and more
+	SCAN_ACTIVE = 2,
+};
+
+using AdvertHandler = std::function<void(const AdvertEvent& advert)>;
+using ScanStoppedHandler = std::function<void()>;
+using NotificationHandler = std::function<void(const uint8_t* data, size_t size)>;
+
+using LinkLostHandler = std::function<void(uint64_t deviceAddress)>;
+
+using CompletionHandler = std::function<void(bool success)>;
+using ServicesHandler = std::function<void(bool success, const std::vector<ServiceInfo>& services)>;
+using CharacteristicsHandler = std::function<void(bool success, const std::vector<CharacteristicInfo>& characteristics)>;
+using ReadHandler = std::function<void(bool success, const uint8_t* data, size_t size)>;
+using MtuHandler = std::function<void(bool success, uint32_t mtu)>;
+
+//a handler to pass to count operations, done runs once after the last of them with whether all of them succeeded
+inline CompletionHandler JoinCompletions(size_t count, CompletionHandler done)
+{
+	struct Joined
+	{
+		std::atomic<size_t> left { 0 };
+		std::atomic<bool> success { true };
+		CompletionHandler done;
+	};
+
+	auto joined = std::make_shared<Joined>();
+	joined->left = count;
+	joined->done = std::move(done);
+
+	return [joined](bool success)
+	{
+		if (!success)
+			joined->success = false;
+
+		if (--joined->left == 0 && joined->done)
+			joined->done(joined->success);
+	};
+}
+
+//att mtu before any exchange, and what an att write request takes of it besides the value
+const uint32_t ATT_DEFAULT_MTU = 23;
+const uint32_t ATT_WRITE_OVERHEAD = 3;
+const uint32_t ATT_MAX_VALUE_SIZE = 512;
+
+struct BleBackend
+{
+	virtual ~BleBackend() = default;
+
+	virtual void InitializeScan(const wchar_t* nameFilter, guid serviceFilter, AdvertHandler advertHandler, ScanStoppedHandler stoppedHandler) = 0;
+	virtual void StartScan() = 0;
+	virtual void StopScan() = 0;
+	//switches a running scan between windows without reporting a stop, applies to the next StartScan otherwise.
+	//SCAN_ACTIVE until set
+	virtual void SetScanMode(ScanMode mode) = 0;
+
+	//after the link was lost, connecting again resolves whatever the backend had cached for the device
+	virtual void Connect(uint64_t deviceAddress, CompletionHandler done) = 0;
+	virtual void Disconnect(uint64_t deviceAddress) = 0;
+	//called when the link of a connected device drops, after the backend dropped its cached objects and subscriptions
+	virtual void SetLinkLostHandler(LinkLostHandler handler) = 0;
+	//looks up the characteristic, or the service if characteristicUuid is zero, and caches it without touching it
+	virtual void Resolve(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, CompletionHandler done) = 0;
+
+	virtual void ScanServices(uint64_t deviceAddress, ServicesHandler done) = 0;
+	virtual void ScanCharacteristics(uint64_t deviceAddress, guid serviceUuid, CharacteristicsHandler done) = 0;
+	virtual void SetDiscoveryOptions(const DiscoveryOptions& options) = 0;
+
+	virtual void Subscribe(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, NotificationHandler notificationHandler, CompletionHandler done) = 0;
+	virtual void Unsubscribe(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, CompletionHandler done) = 0;
+
+	virtual void Read(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, ReadHandler done) = 0;
+	//without response done only reports that the write left the host, with response it carries the peripheral's status
+	virtual void Write(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, const uint8_t* data, size_t size, bool withResponse, CompletionHandler done) = 0;
+
+	//negotiated att mtu of the connection, a write without response carries at most mtu - ATT_WRITE_OVERHEAD bytes
+	virtual void QueryMtu(uint64_t deviceAddress, MtuHandler done) = 0;
+
+	//stop scanning, drop subscriptions and release every cached object
+	virtual void Quit() = 0;
+};
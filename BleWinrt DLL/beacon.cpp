@@ -0,0 +1,160 @@
+#include "beacon.h"
+#include "advert-data.h"
+
+#include <iterator>
+
+using namespace std;
+
+
+const uint16_t APPLE_COMPANY_ID = 0x004C;
+const uint16_t EDDYSTONE_SERVICE = 0xFEAA;
+
+const uint8_t EDDYSTONE_UID = 0x00;
+const uint8_t EDDYSTONE_URL = 0x10;
+const uint8_t EDDYSTONE_TLM = 0x20;
+
+static uint16_t ReadBigEndian16(const uint8_t* data)
+{
+	return (uint16_t)(data[0] << 8 | data[1]);
+}
+
+static uint32_t ReadBigEndian32(const uint8_t* data)
+{
+	return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 | data[3];
+}
+
+static void StartBeacon(BleBeacon& beacon, const AdvertEvent& advert, BeaconType type)
+{
+	beacon = BleBeacon();
+	beacon.mac = advert.mac;
+	beacon.timestamp = advert.timestamp;
+	beacon.signalStrength = advert.signalStrength;
+	beacon.type = type;
+	beacon.url[0] = 0;
+}
+
+static void SetId(BleBeacon& beacon, const uint8_t* id, uint32_t size)
+{
+	memcpy(beacon.id, id, size);
+	memset(beacon.id + size, 0, BEACON_ID_SIZE - size);
+	beacon.idSize = size;
+}
+
+//4C 00 | 02 15, proximity uuid, major, minor, measured power
+static bool DecodeIBeacon(const AdvertEvent& advert, const ManufacturerData& section, BleBeacon& beacon)
+{
+	if (section.companyId != APPLE_COMPANY_ID || section.size < 23 || section.data[0] != 0x02 || section.data[1] != 0x15)
+		return false;
+
+	StartBeacon(beacon, advert, BEACON_IBEACON);
+	SetId(beacon, section.data + 2, 20);
+	beacon.major = ReadBigEndian16(section.data + 18);
+	beacon.minor = ReadBigEndian16(section.data + 20);
+	beacon.txPower = (int8_t)section.data[22];
+	return true;
+}
+
+//any company | BE AC, 20 byte id, reference rssi, reserved
+static bool DecodeAltBeacon(const AdvertEvent& advert, const ManufacturerData& section, BleBeacon& beacon)
+{
+	if (section.size < 24 || section.data[0] != 0xBE || section.data[1] != 0xAC)
+		return false;
+
+	StartBeacon(beacon, advert, BEACON_ALTBEACON);
+	SetId(beacon, section.data + 2, 20);
+	beacon.major = ReadBigEndian16(section.data + 18);
+	beacon.minor = ReadBigEndian16(section.data + 20);
+	beacon.txPower = (int8_t)section.data[22];
+	return true;
+}
+
+static void ExpandUrl(const uint8_t* data, size_t count, wchar_t* url)
+{
+	static const char* const schemes[] = { "http://www.", "https://www.", "http://", "https://" };
+	static const char* const expansions[] = { ".com/", ".org/", ".edu/", ".net/", ".info/", ".biz/", ".gov/", ".com", ".org", ".edu", ".net", ".info", ".biz", ".gov" };
+
+	size_t length = 0;
+	auto append = [&](const char* text)
+	{
+		while (*text != 0 && length < BEACON_URL_SIZE - 1)
+			url[length++] = (wchar_t)*text++;
+	};
+
+	if (count > 0 && data[0] < std::size(schemes))
+		append(schemes[data[0]]);
+
+	for (size_t i = 1; i < count; i++)
+	{
+		if (data[i] < std::size(expansions))
+		{
+			append(expansions[data[i]]);
+		}
+		else if (data[i] > 0x20 && data[i] < 0x7F)
+		{
+			char c[2] = { (char)data[i], 0 };
+			append(c);
+		}
+	}
+
+	url[length] = 0;
+}
+
+static bool DecodeEddystone(const AdvertEvent& advert, const ServiceData& section, BleBeacon& beacon)
+{
+	static const guid eddystone = ShortServiceUuid(EDDYSTONE_SERVICE);
+
+	if (section.uuid != eddystone || section.size < 2)
+		return false;
+
+	const uint8_t* data = section.data;
+
+	switch (data[0])
+	{
+	case EDDYSTONE_UID:
+		//frame type, tx power, 10 byte namespace, 6 byte instance, optionally 2 reserved
+		if (section.size < 18)
+			return false;
+
+		StartBeacon(beacon, advert, BEACON_EDDYSTONE_UID);
+		beacon.txPower = (int8_t)data[1];
+		SetId(beacon, data + 2, 16);
+		return true;
+
+	case EDDYSTONE_URL:
+		//frame type, tx power, scheme and the encoded url
+		if (section.size < 3)
+			return false;
+
+		StartBeacon(beacon, advert, BEACON_EDDYSTONE_URL);
+		beacon.txPower = (int8_t)data[1];
+		ExpandUrl(data + 2, section.size - 2, beacon.url);
+		return true;
+
+	case EDDYSTONE_TLM:
+		//frame type, version 0, battery, 8.8 fixed point temperature, advert count, uptime
+		if (section.size < 14 || data[1] != 0)
+			return false;
+
+		StartBeacon(beacon, advert, BEACON_EDDYSTONE_TLM);
+		beacon.batteryMillivolts = ReadBigEndian16(data + 2);
+		beacon.temperature = (float)(int16_t)ReadBigEndian16(data + 4) / 256.0f;
+		beacon.advertCount = ReadBigEndian32(data + 6);
+		beacon.uptimeDeciseconds = ReadBigEndian32(data + 10);
+		return true;
+	}
+
+	return false;
+}
+
+bool DecodeBeacon(const AdvertEvent& advert, BleBeacon& beacon)
+{
+	for (int32_t i = 0; i < advert.numManufacturerData; i++)
+		if (DecodeIBeacon(advert, advert.manufacturerData[i], beacon) || DecodeAltBeacon(advert, advert.manufacturerData[i], beacon))
+			return true;
+
+	for (int32_t i = 0; i < advert.numServiceData; i++)
+		if (DecodeEddystone(advert, advert.serviceData[i], beacon))
+			return true;
+
+	return false;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "backend.h"
+
+enum BeaconType : int32_t
+{
+	BEACON_NONE = 0,
+	BEACON_IBEACON = 1,
+	BEACON_ALTBEACON = 2,
+	BEACON_EDDYSTONE_UID = 3,
+	BEACON_EDDYSTONE_URL = 4,
+	BEACON_EDDYSTONE_TLM = 5,
+};
+
+const int BEACON_ID_SIZE = 20;
+const int BEACON_URL_SIZE = 64;
+
+//a beacon frame decoded from an advert, fields a format doesn't carry are left 0
+struct BleBeacon
+{
+	uint64_t mac = 0;
+	int64_t timestamp = 0;
+	int32_t signalStrength = 0;
+	int32_t type = BEACON_NONE;
+
+	//calibrated signal strength at 1 m, at 0 m for eddystone
+	int32_t txPower = 0;
+
+	//the identifier as sent: proximity uuid, major and minor for ibeacon, the 20 byte id for altbeacon, namespace and
+	//instance for eddystone uid
+	uint32_t idSize = 0;
+	uint8_t id[BEACON_ID_SIZE];
+	uint16_t major = 0;
+	uint16_t minor = 0;
+
+	//eddystone tlm
+	uint32_t batteryMillivolts = 0;
+	float temperature = 0;
+	uint32_t advertCount = 0;
+	uint32_t uptimeDeciseconds = 0;
+
+	//eddystone url, expanded
+	wchar_t url[BEACON_URL_SIZE];
+};
+
+//the first beacon frame in the advert's manufacturer or service data, false if there is none
+bool DecodeBeacon(const AdvertEvent& advert, BleBeacon& beacon);
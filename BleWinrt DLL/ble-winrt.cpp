@@ -1,134 +1,502 @@
 #include "stdafx.h"
+#include "advert-data.h"
+#include "advert-filter.h"
 #include "carriers.h"
+#include "callback-dispatcher.h"
+#include "capture.h"
+#include "connection-manager.h"
+#include "device-table.h"
+#include "gatt-database.h"
+#include "gatt-tree.h"
+#include "result-arena.h"
+#include "subscription-registry.h"
+#include "write-queue.h"
+#include "notification-queue.h"
+#include "operation-stats.h"
 #include "ble-winrt.h"
-#include "serialization.h"
+#include "backend-winrt.h"
+#include "backend-sim.h"
+#include "bulk-transfer.h"
+#include "framing.h"
 #include "logging.h"
-#include "cache.h"
-
-#include <winrt/Windows.Devices.Bluetooth.Advertisement.h>
+#include "ring-buffer.h"
+#include "scan-scheduler.h"
 
 #define __WFILE__ L"ble-winrt.cpp"
 
-using namespace winrt;
-using namespace Windows::Devices::Bluetooth;
-using namespace Windows::Devices::Bluetooth::Advertisement;
-using namespace Windows::Foundation;
-using namespace Windows::Foundation::Collections;
-
 
 ReceivedCallback* receivedCallback = nullptr;
 StoppedCallback* stoppedCallback = nullptr;
+//adverts are only decoded while set
+atomic<BeaconCallback*> beaconCallback{ nullptr };
+atomic<LinkStateCallback*> linkStateCallback{ nullptr };
 
-//TODO: move to this instead
-BluetoothLEAdvertisementWatcher advertisementWatcher{ nullptr };
+//sections of the advert being delivered on this thread, grows to the largest advert seen and is reused after that
+thread_local vector<uint8_t> sectionBuffer;
 
-// global flag to release calling thread
-mutex quitLock;
-bool quitFlag = false;
+//backend all exported calls are routed through, the radio unless SelectBackend says otherwise
+BleBackend* backend = nullptr;
 
-list<Subscription*> subscriptions;
+//set while adverts are queued for PollAdverts instead of being passed to receivedCallback. a replaced queue is kept
+//in retiredAdvertQueues rather than freed, event threads may still be pushing to it. there is at most one retired
+//queue per capacity and none of the current one's, a queue of a capacity asked for again is emptied and reused
+atomic<RingBuffer<BleAdvertRecord>*> advertQueue{ nullptr };
+vector<unique_ptr<RingBuffer<BleAdvertRecord>>> retiredAdvertQueues;
+mutex advertQueueLock;
+atomic<uint64_t> advertsQueued{ 0 };
+atomic<uint64_t> advertsDropped{ 0 };
 
+//set while adverts are coalesced per device, takes precedence over queue and callback
+DeviceTable deviceTable;
+atomic<bool> deviceTableEnabled{ false };
 
-void InitializeScan(const wchar_t* nameFilter, guid serviceFilter, ReceivedCallback addedCb, StoppedCallback stoppedCb)
+//target of queued subscriptions, empty until EnableNotificationQueue
+NotificationQueue notificationQueue;
+
+//applied to whichever backend is selected
+DiscoveryOptions discoveryOptions;
+
+//known gatt layouts, closed until EnableGattDatabase
+GattDatabase gattDatabase;
+
+//backs results that stay valid until ReleaseResult
+ResultArena resultArena;
+
+//latency of every backend operation, per device and in total
+OperationStats operationStats;
+
+//runs user callbacks on its own threads once ConfigureDispatcher started some, or holds them for Pump. never
+//destroyed, its threads must not be joined while the loader lock is held on unload, Quit stops them
+CallbackDispatcher& callbackDispatcher = *new CallbackDispatcher();
+const uint32_t DEFAULT_MAX_DEFERRED = 4096;
+
+//records adverts and notifications as the backend reports them, until StopCapture. never destroyed, its thread must
+//not be joined while the loader lock is held on unload, Quit stops it
+CaptureWriter& captureWriter = *new CaptureWriter();
+
+//runs before anything else sees an advert, rejected ones go no further
+AdvertFilter advertFilter;
+
+
+//adverts and notifications are droppable, the next one supersedes them. completions are not
+template <typename Callback>
+void Deliver(uint64_t deviceAddress, bool droppable, Callback callback)
 {
+	if (!callbackDispatcher.Running())
 	{
-		std::lock_guard lock(quitLock);
-		quitFlag = false;
+		callback();
+		return;
 	}
 
-	receivedCallback = addedCb;
-	stoppedCallback = stoppedCb;
+	callbackDispatcher.Post(deviceAddress, droppable, move(callback));
+}
 
-	// Create BluetoothLEAdvertisementWatcher and set scanning mode
-	advertisementWatcher = BluetoothLEAdvertisementWatcher();
-	advertisementWatcher.ScanningMode(BluetoothLEScanningMode::Active);
+//the bytes are borrowed for the duration of the call, only a callback that is posted gets its own copy
+template <typename Callback>
+void DeliverBytes(uint64_t deviceAddress, bool droppable, const uint8_t* data, size_t size, Callback callback)
+{
+	if (!callbackDispatcher.Running())
+	{
+		callback(data, size);
+		return;
+	}
 
-	BluetoothLEAdvertisementFilter filter;
+	callbackDispatcher.Post(deviceAddress, droppable, [bytes = vector<uint8_t>(data, data + size), callback]()
+	{
+		callback(bytes.data(), bytes.size());
+	});
+}
 
-	if (nameFilter != nullptr && wcslen(nameFilter) > 0)
-		filter.Advertisement().LocalName(nameFilter);
+//wraps a backend completion handler, the operation is timed from here to its completion
+template <typename Handler>
+auto Timed(StatsOperation operation, uint64_t deviceAddress, Handler handler)
+{
+	int64_t start = NowMicroseconds();
 
-	if (serviceFilter != guid{})
-		filter.Advertisement().ServiceUuids().Append(serviceFilter);
+	return [operation, deviceAddress, start, handler](bool success, const auto&... results)
+	{
+		operationStats.Record(operation, deviceAddress, NowMicroseconds() - start, success);
+		handler(success, results...);
+	};
+}
 
-	advertisementWatcher.AdvertisementFilter(filter);
 
-	// Handle received advertisements
-	advertisementWatcher.Received([](BluetoothLEAdvertisementWatcher const&, BluetoothLEAdvertisementReceivedEventArgs const& args)
+BleBackend& Backend()
+{
+	if (backend == nullptr)
+		SelectBackend(BACKEND_WINRT);
+
+	return *backend;
+}
+
+//switches the backend between active, passive and idle windows while scanning. never destroyed, its thread must not
+//be joined while the loader lock is held on unload, Quit stops it
+ScanScheduler& scanScheduler = *new ScanScheduler([](ScanMode mode)
+{
+	Backend().SetScanMode(mode);
+});
+
+//shares one backend subscription per characteristic between every consumer of its notifications
+SubscriptionRegistry subscriptionRegistry([](const GattKey& key, NotificationHandler handler, CompletionHandler done)
+{
+	Backend().Subscribe(key.device, key.service, key.characteristic, [key, handler](const uint8_t* data, size_t size)
 	{
-		BleAdvert di;
+		captureWriter.Notification(key, data, size);
+		handler(data, size);
+	}, Timed(STATS_SUBSCRIBE, key.device, done));
+}, [](const GattKey& key, CompletionHandler done)
+{
+	Backend().Unsubscribe(key.device, key.service, key.characteristic, done);
+});
 
-		//convoluted way of getting the timestamp of the packet
-		//TODO
-		di.timestamp = args.Timestamp().time_since_epoch().count();
-		
-		di.mac = args.BluetoothAddress();
-		di.signalStrength = args.RawSignalStrengthInDBm();
+void DeliverLinkState(uint64_t deviceAddress, LinkState state)
+{
+	if (LinkStateCallback* callback = linkStateCallback.load(memory_order_relaxed))
+	{
+		Deliver(deviceAddress, false, [callback, deviceAddress, state]()
+		{
+			callback(deviceAddress, state);
+		});
+	}
+}
 
-		// Check if TransmitPowerLevelInDBm has a value and assign it if available
-		if (args.TransmitPowerLevelInDBm())
-			di.powerLevel = args.TransmitPowerLevelInDBm().Value();
-		else
-			di.powerLevel = 0; // or set to a default if no power level is provided
+//reconnects managed devices, resolves their warm characteristics and re-arms their subscriptions. never destroyed,
+//its thread must not be joined while the loader lock is held on unload, Quit stops it
+ConnectionManager& connectionManager = *new ConnectionManager([](uint64_t deviceAddress, CompletionHandler done)
+{
+	Backend().Connect(deviceAddress, Timed(STATS_CONNECT, deviceAddress, done));
+}, [](const GattKey& key, CompletionHandler done)
+{
+	Backend().Resolve(key.device, key.service, key.characteristic, Timed(STATS_RESOLVE, key.device, done));
+}, [](uint64_t deviceAddress, CompletionHandler done)
+{
+	return subscriptionRegistry.Rearm(deviceAddress, done);
+}, [](uint64_t deviceAddress, LinkState state, int64_t reconnectMicroseconds)
+{
+	if (reconnectMicroseconds > 0)
+		operationStats.Record(STATS_RECONNECT, deviceAddress, reconnectMicroseconds, state == LINK_CONNECTED);
 
-		// Retrieve the device name from the advertisement
-		auto advertisement = args.Advertisement();
+	DeliverLinkState(deviceAddress, state);
+});
 
-		//TODO
-//		advertisement.Flags()
-//		advertisement.ManufacturerData()
+//a device nobody manages just reports the drop
+void OnLinkLost(uint64_t deviceAddress)
+{
+	if (!connectionManager.LinkLost(deviceAddress))
+		DeliverLinkState(deviceAddress, LINK_DISCONNECTED);
+}
 
-		//check if there are service uuids to copy over from the adavert
-		di.numServiceUuids = advertisement.ServiceUuids().Size();
+//orders and pipelines the writes of every characteristic
+WriteScheduler writeScheduler([](const GattKey& key, const uint8_t* data, size_t size, bool withResponse, CompletionHandler done)
+{
+	Backend().Write(key.device, key.service, key.characteristic, data, size, withResponse, Timed(STATS_WRITE, key.device, done));
+});
 
-		if (di.numServiceUuids > 0) 
-		{
-			//build list
-			di.serviceUuids = new guid[di.numServiceUuids];
+//streams files and buffers through writeScheduler
+TransferEngine transferEngine([](uint64_t deviceAddress, MtuHandler done)
+{
+	Backend().QueryMtu(deviceAddress, done);
+}, writeScheduler);
+
+//framed messages on characteristic pairs, on top of writeScheduler
+FramedChannels framedChannels(writeScheduler);
+
+void QueueAdvert(RingBuffer<BleAdvertRecord>& queue, const AdvertEvent& advert)
+{
+	BleAdvertRecord record;
+
+	record.mac = advert.mac;
+	record.timestamp = advert.timestamp;
+	record.signalStrength = advert.signalStrength;
+	record.powerLevel = advert.powerLevel;
+
+	record.numServiceUuids = advert.numServiceUuids;
+	memcpy(record.serviceUuids, advert.serviceUuids, min(advert.numServiceUuids, RECORD_SERVICE_UUIDS) * sizeof(guid));
+
+	wcsncpy_s(record.name, RECORD_NAME_SIZE, advert.name, _TRUNCATE);
+
+	record.sectionBytes = (int32_t)WriteAdvertSections(advert, record.sections, RECORD_SECTION_BYTES);
 
-			//copy guids into list
-			int i = 0;
-			for (auto&& service : advertisement.ServiceUuids())
-				di.serviceUuids[i++] = service;
+	if (queue.TryPush(record))
+		advertsQueued++;
+	else
+		advertsDropped++;
+}
+
+//false if the filter rejected the advert
+bool OnAdvert(const AdvertEvent& advert)
+{
+	if (!advertFilter.Accept(advert))
+		return false;
+
+	if (BeaconCallback* callback = beaconCallback.load(memory_order_relaxed))
+	{
+		BleBeacon beacon;
+		if (DecodeBeacon(advert, beacon))
+		{
+			Deliver(advert.mac, true, [callback, beacon]() mutable
+			{
+				callback(&beacon);
+			});
 		}
+	}
+
+	if (deviceTableEnabled)
+	{
+		deviceTable.Merge(advert);
+		return true;
+	}
+
+	if (RingBuffer<BleAdvertRecord>* queue = advertQueue.load())
+	{
+		QueueAdvert(*queue, advert);
+		return true;
+	}
+
+	BleAdvert di;
+
+	di.timestamp = advert.timestamp;
+	di.mac = advert.mac;
+	di.signalStrength = advert.signalStrength;
+	di.powerLevel = advert.powerLevel;
+
+	//the uuids are borrowed from the backend for the duration of the callback
+	di.serviceUuids = advert.serviceUuids;
+	di.numServiceUuids = advert.numServiceUuids;
+
+	wcsncpy_s(di.name, NAME_SIZE, advert.name, _TRUNCATE);
+
+	sectionBuffer.resize(AdvertSectionBytes(advert));
+	di.sectionBytes = (int32_t)WriteAdvertSections(advert, sectionBuffer.data(), sectionBuffer.size());
+	di.sections = sectionBuffer.data();
+
+	if (!callbackDispatcher.Running())
+	{
+		if (receivedCallback)
+			(*receivedCallback)(&di);
+
+		return true;
+	}
 
-		if (!advertisement.LocalName().empty())
-			wcscpy_s(di.name, NAME_SIZE, advertisement.LocalName().c_str());
-		else
-			wcscpy_s(di.name, NAME_SIZE, L"");
+	vector<guid> uuids(advert.serviceUuids, advert.serviceUuids + advert.numServiceUuids);
+	vector<uint8_t> sections(sectionBuffer.begin(), sectionBuffer.begin() + di.sectionBytes);
+
+	callbackDispatcher.Post(advert.mac, true, [di, uuids = move(uuids), sections = move(sections)]() mutable
+	{
+		di.serviceUuids = uuids.data();
+		di.sections = sections.data();
 
 		if (receivedCallback)
 			(*receivedCallback)(&di);
 	});
 
-	// Handle watcher stopped
-	advertisementWatcher.Stopped([](BluetoothLEAdvertisementWatcher const&, BluetoothLEAdvertisementWatcherStoppedEventArgs const& args)
+	return true;
+}
+
+//what the backend reports is captured, replayed adverts go to OnAdvert directly
+void OnBackendAdvert(const AdvertEvent& advert)
+{
+	captureWriter.Advert(advert);
+
+	//adverts heard passively get their name from the scheduler's cache
+	AdvertEvent observed = advert;
+	ScanMode mode = scanScheduler.Observe(observed);
+
+	if (OnAdvert(observed))
+		scanScheduler.Delivered(mode);
+}
+
+//feeds a capture back into the same handlers the backend calls. never destroyed like captureWriter, Quit stops it
+CaptureReplay& captureReplay = *new CaptureReplay(OnAdvert, [](const GattKey& key, const uint8_t* data, size_t size)
+{
+	return subscriptionRegistry.Inject(key, data, size);
+});
+
+void OnScanStopped()
+{
+	Deliver(0, false, []()
 	{
 		if (stoppedCallback)
 			(*stoppedCallback)();
 	});
 }
 
+
+void SelectBackend(BackendType type)
+{
+	BleBackend* next = type == BACKEND_SIMULATED ? &GetSimulatedBackend() : &GetWinrtBackend();
+
+	if (backend != nullptr && backend != next)
+	{
+		scanScheduler.Stop();
+		connectionManager.Clear();
+		backend->Quit();
+	}
+
+	backend = next;
+	backend->SetDiscoveryOptions(discoveryOptions);
+	backend->SetLinkLostHandler(OnLinkLost);
+}
+
+void InitializeScan(const wchar_t* nameFilter, guid serviceFilter, ReceivedCallback addedCb, StoppedCallback stoppedCb)
+{
+	receivedCallback = addedCb;
+	stoppedCallback = stoppedCb;
+
+	Backend().InitializeScan(nameFilter, serviceFilter, OnBackendAdvert, OnScanStopped);
+}
+
+void RegisterBeaconCallback(BeaconCallback beaconCb)
+{
+	beaconCallback = beaconCb;
+}
+
 void StartScan()
 {
-	advertisementWatcher.Start();
+	scanScheduler.Start();
+	Backend().StartScan();
 }
 
 void StopScan()
 {
-	advertisementWatcher.Stop();
+	scanScheduler.Stop();
+	Backend().StopScan();
+}
+
+void SetScanSchedule(const BleScanSchedule* schedule)
+{
+	scanScheduler.Configure(schedule != nullptr ? *schedule : BleScanSchedule());
+}
+
+void GetScanStats(BleScanStats* stats)
+{
+	if (stats == nullptr)
+		return;
+
+	*stats = {};
+	scanScheduler.Stats(*stats);
+}
+
+void EnableAdvertQueue(int32_t capacity)
+{
+	lock_guard guard(advertQueueLock);
+
+	size_t size = capacity > 0 ? RingBuffer<BleAdvertRecord>::RoundCapacity(capacity) : 0;
+	RingBuffer<BleAdvertRecord>* current = advertQueue.load();
+	RingBuffer<BleAdvertRecord>* next = nullptr;
+
+	if (current != nullptr && current->Capacity() == size)
+		next = current;
+
+	for (auto it = retiredAdvertQueues.begin(); next == nullptr && size > 0 && it != retiredAdvertQueues.end(); ++it)
+	{
+		if ((*it)->Capacity() == size)
+		{
+			next = it->release();
+			retiredAdvertQueues.erase(it);
+			break;
+		}
+	}
+
+	if (next == nullptr && size > 0)
+		next = new RingBuffer<BleAdvertRecord>(size);
+
+	//a reused queue starts out empty, adverts pushed by a handler that loaded it before it was retired may still
+	//trickle in
+	BleAdvertRecord discarded;
+	while (next != nullptr && next->TryPop(discarded))
+	{
+	}
+
+	advertQueue = next;
+	if (current != nullptr && current != next)
+		retiredAdvertQueues.emplace_back(current);
+
+	advertsQueued = 0;
+	advertsDropped = 0;
+}
+
+int32_t PollAdverts(BleAdvertRecord* buffer, int32_t maxCount)
+{
+	RingBuffer<BleAdvertRecord>* queue = advertQueue.load();
+	if (queue == nullptr || buffer == nullptr)
+		return 0;
+
+	int32_t count = 0;
+	while (count < maxCount && queue->TryPop(buffer[count]))
+		count++;
+
+	return count;
+}
+
+void GetAdvertQueueStats(BleQueueStats* stats)
+{
+	if (stats == nullptr)
+		return;
+
+	*stats = {};
+	stats->enqueued = advertsQueued;
+	stats->dropped = advertsDropped;
+
+	if (RingBuffer<BleAdvertRecord>* queue = advertQueue.load())
+	{
+		stats->capacity = (uint32_t)queue->Capacity();
+		stats->pending = (uint32_t)queue->Size();
+	}
+}
+
+void EnableDeviceTable(int32_t maxDevices, float smoothing)
+{
+	deviceTable.Clear();
+
+	if (maxDevices > 0)
+		deviceTable.Configure(maxDevices, smoothing);
+
+	deviceTableEnabled = maxDevices > 0;
+}
+
+int32_t GetDeviceChanges(BleDeviceState* buffer, int32_t maxCount)
+{
+	if (buffer == nullptr)
+		return 0;
+
+	return deviceTable.Changes(buffer, maxCount);
+}
+
+int32_t GetDeviceSnapshot(BleDeviceState* buffer, int32_t maxCount)
+{
+	if (buffer == nullptr)
+		return 0;
+
+	return deviceTable.Snapshot(buffer, maxCount);
+}
+
+void ClearDeviceTable()
+{
+	deviceTable.Clear();
 }
 
 void ConnectDevice(uint64_t deviceAddress, ConnectedCallback connectedCb)
 {
-	ConnectDeviceAsync(deviceAddress, connectedCb);
+	Backend().Connect(deviceAddress, Timed(STATS_CONNECT, deviceAddress, [deviceAddress, connectedCb](bool success)
+	{
+		Deliver(deviceAddress, false, [deviceAddress, connectedCb, success]()
+		{
+			if (connectedCb)
+				(*connectedCb)(success ? deviceAddress : 0);
+		});
+	}));
 }
 
 void DisconnectDevice(uint64_t deviceAddress, DisconnectedCallback connectedCb)
 {
 	try
 	{
-		RemoveFromCache(deviceAddress);
+		//not reconnected after this
+		if (connectionManager.Release(deviceAddress))
+			DeliverLinkState(deviceAddress, LINK_DISCONNECTED);
+
+		Backend().Disconnect(deviceAddress);
 
 		if (connectedCb)
 			(*connectedCb)(deviceAddress);
@@ -142,347 +510,760 @@ void DisconnectDevice(uint64_t deviceAddress, DisconnectedCallback connectedCb)
 	}
 }
 
-void ScanServices(uint64_t deviceAddress, ServicesFoundCallback serviceFoundCb)
+void ManageConnection(uint64_t deviceAddress, const BleCharacteristicKey* warm, int32_t warmCount)
 {
-	ScanServicesAsync(deviceAddress, serviceFoundCb);
+	vector<GattKey> keys;
+
+	for (int32_t i = 0; warm != nullptr && i < warmCount; i++)
+		keys.push_back(GattKey{ deviceAddress, warm[i].service, warm[i].characteristic });
+
+	//selects the backend if nothing did yet, so its drops are reported
+	Backend();
+	connectionManager.Manage(deviceAddress, move(keys));
 }
 
-void ScanCharacteristics(uint64_t deviceAddress, guid serviceUuid, CharacteristicsFoundCallback characteristicFoundCb)
+bool ReleaseConnection(uint64_t deviceAddress)
 {
-	ScanCharacteristicsAsync(deviceAddress, serviceUuid, characteristicFoundCb);
+	return connectionManager.Release(deviceAddress);
 }
 
-void SubscribeCharacteristic(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, SubscribeCallback subscribeCallback)
+void ConfigureReconnect(const BleReconnectPolicy* policy)
 {
-	SubscribeCharacteristicAsync(deviceAddress, serviceUuid, characteristicUuid, subscribeCallback);
+	connectionManager.Configure(policy != nullptr ? *policy : BleReconnectPolicy());
 }
 
-void UnsubscribeCharacteristic(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid)
+void RegisterLinkStateCallback(LinkStateCallback linkStateCb)
 {
-	UnsubscribeCharacteristicAsync(deviceAddress, serviceUuid, characteristicUuid);
+	linkStateCallback = linkStateCb;
 }
 
-void ReadBytes(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, ReadBytesCallback readBufferCb)
+bool GetLinkStats(uint64_t deviceAddress, BleLinkStats* stats)
 {
-	ReadBytesAsync(deviceAddress, serviceUuid, characteristicUuid, readBufferCb);
+	if (stats == nullptr)
+		return false;
+
+	*stats = {};
+	stats->device = deviceAddress;
+	return connectionManager.Stats(deviceAddress, *stats);
 }
 
-void WriteBytes(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, const uint8_t* data, size_t size, WriteBytesCallback writeBytesCb)
+int32_t GetLinkSnapshot(BleLinkStats* buffer, int32_t maxCount)
 {
-	WriteBytesAsync(deviceAddress, serviceUuid, characteristicUuid, data, size, writeBytesCb);
+	return (int32_t)connectionManager.Snapshot(buffer, maxCount > 0 ? (size_t)maxCount : 0);
 }
 
-
-fire_and_forget ScanServicesAsync(uint64_t deviceAddress, ServicesFoundCallback servicesCb)
+//the arrays are only valid during the callback, they go back to the arena as soon as it returns
+void DeliverServices(const vector<ServiceInfo>& services, ServicesFoundCallback serviceFoundCb)
 {
 	BleServiceArray service_list;
+	service_list.count = (int)services.size();
+	service_list.services = (BleService*)resultArena.Allocate(services.size() * sizeof(BleService));
 
-	try
-	{
-		// Connect to device if not already connected
-		BluetoothLEDevice device = co_await RetrieveDevice(deviceAddress);
-		if (device == nullptr)
-		{
-			//wprintf(L"Failed to retrieve device at address: %llu\n", deviceAddress);
-			if (servicesCb)
-				(*servicesCb)(&service_list);
+	for (int i = 0; i < service_list.count; i++)
+		service_list.services[i].serviceUuid = services[i].uuid;
 
-			co_return;
-		}
-
-		// Try using BluetoothCacheMode::Cached to see if it improves results
-		GattDeviceServicesResult result = co_await device.GetGattServicesAsync(BluetoothCacheMode::Uncached);
+	if (serviceFoundCb)
+		(*serviceFoundCb)(&service_list);
 
-		{
-			//check for quit signal after an async operation
-			std::lock_guard lock(quitLock);
-			if (quitFlag)
-				co_return;
-		}
+	resultArena.Release(service_list.services);
+}
 
-		if (result.Status() == GattCommunicationStatus::Unreachable)
-			result = co_await device.GetGattServicesAsync(BluetoothCacheMode::Cached);
+void DeliverCharacteristics(const vector<CharacteristicInfo>& characteristics, CharacteristicsFoundCallback characteristicFoundCb)
+{
+	BleCharacteristicArray char_list;
+	char_list.count = (int)characteristics.size();
+	char_list.characteristics = (BleCharacteristic*)resultArena.Allocate(characteristics.size() * sizeof(BleCharacteristic));
 
-		if (result.Status() == GattCommunicationStatus::Success)
-		{
-			auto services = result.Services();
-			service_list.count = services.Size();
+	for (int i = 0; i < char_list.count; i++)
+	{
+		//create a carrier object to pass through marshaled callback
+		BleCharacteristic& char_carrier = char_list.characteristics[i];
 
-			if (service_list.count == 0)
-			{
-				wprintf(L"No services found for device at address: %llu\n", deviceAddress);
-			}
-			else
-			{
-				service_list.services = new BleService[service_list.count];
-				int i = 0;
+		char_carrier.characteristicUuid = characteristics[i].uuid;
+		wcsncpy_s(char_carrier.userDescription, DESCRIPTION_SIZE, characteristics[i].userDescription.c_str(), _TRUNCATE);
+	}
 
-				for (auto&& service : services)
-				{
-					//TODO: does this really need a carrier just for a list of services?
-					BleService service_carrier {};
+	if (characteristicFoundCb)
+		(*characteristicFoundCb)(&char_list);
 
-					service_carrier.serviceUuid = service.Uuid();
+	resultArena.Release(char_list.characteristics);
+}
 
-					service_list.services[i++] = service_carrier;
-				}
-			}
-		}
-	}
-	catch (hresult_error& ex)
+//the tree belongs to the callback, without one it goes straight back
+void DeliverTree(uint64_t deviceAddress, BleGattTree* tree, GattTreeCallback* treeCb)
+{
+	if (treeCb == nullptr)
 	{
-		wprintf(L"%s:%d ScanServicesAsync catch: %s\n", __WFILE__, __LINE__, ex.message().c_str());
+		resultArena.Release(tree);
+		return;
 	}
 
-	// Call the callback with the service list, even if it's empty
-	if (servicesCb)
-		(*servicesCb)(&service_list);
+	Deliver(deviceAddress, false, [tree, treeCb]()
+	{
+		(*treeCb)(tree);
+	});
 }
 
+//a known layout is answered right away, the discovery that follows then only revalidates the database
+void DiscoverServices(uint64_t deviceAddress, ServicesHandler deliver)
+{
+	vector<ServiceInfo> known;
+	bool warm = gattDatabase.FindServices(deviceAddress, known);
+
+	if (warm)
+		deliver(true, known);
+
+	Backend().ScanServices(deviceAddress, Timed(STATS_SERVICES, deviceAddress, [deviceAddress, warm, deliver](bool success, const vector<ServiceInfo>& services)
+	{
+		bool changed = success && gattDatabase.StoreServices(deviceAddress, services);
+
+		if (!warm)
+			deliver(success, services);
+		else if (success)
+			gattDatabase.CountRevalidation(changed);
+	}));
+}
 
-fire_and_forget ScanCharacteristicsAsync(uint64_t deviceAddress, guid serviceUuid, CharacteristicsFoundCallback characteristicsCb)
+void DiscoverCharacteristics(uint64_t deviceAddress, guid serviceUuid, CharacteristicsHandler deliver)
 {
-	BleCharacteristicArray char_list;
+	vector<CharacteristicInfo> known;
+	bool warm = gattDatabase.FindCharacteristics(deviceAddress, serviceUuid, known);
 
-	try
+	if (warm)
+		deliver(true, known);
+
+	Backend().ScanCharacteristics(deviceAddress, serviceUuid, Timed(STATS_CHARACTERISTICS, deviceAddress, [deviceAddress, serviceUuid, warm, deliver](bool success, const vector<CharacteristicInfo>& characteristics)
 	{
-		auto service = co_await RetrieveService(deviceAddress, serviceUuid);
-		if (service == nullptr)
-		{
-			if (characteristicsCb)
-				(*characteristicsCb)(&char_list);
-			co_return;
-		}
+		bool changed = success && gattDatabase.StoreCharacteristics(deviceAddress, serviceUuid, characteristics);
+
+		if (!warm)
+			deliver(success, characteristics);
+		else if (success)
+			gattDatabase.CountRevalidation(changed);
+	}));
+}
 
-		GattCharacteristicsResult charScan = co_await service.GetCharacteristicsAsync(BluetoothCacheMode::Uncached);
+void ScanServices(uint64_t deviceAddress, ServicesFoundCallback serviceFoundCb)
+{
+	DiscoverServices(deviceAddress, [deviceAddress, serviceFoundCb](bool success, const vector<ServiceInfo>& services)
+	{
+		Deliver(deviceAddress, false, [services, serviceFoundCb]()
+		{
+			DeliverServices(services, serviceFoundCb);
+		});
+	});
+}
 
-		if (charScan.Status() != GattCommunicationStatus::Success)
+void ScanCharacteristics(uint64_t deviceAddress, guid serviceUuid, CharacteristicsFoundCallback characteristicFoundCb)
+{
+	DiscoverCharacteristics(deviceAddress, serviceUuid, [deviceAddress, characteristicFoundCb](bool success, const vector<CharacteristicInfo>& characteristics)
+	{
+		Deliver(deviceAddress, false, [characteristics, characteristicFoundCb]()
 		{
-			LogError(L"%s:%d Error scanning characteristics from service %s width status %d\n", __WFILE__, __LINE__, serviceUuid, (int)charScan.Status());
+			DeliverCharacteristics(characteristics, characteristicFoundCb);
+		});
+	});
+}
 
-			if (characteristicsCb)
-				(*characteristicsCb)(&char_list);
-			co_return;
-		}
+void ScanServicesTree(uint64_t deviceAddress, GattTreeCallback servicesCb)
+{
+	DiscoverServices(deviceAddress, [deviceAddress, servicesCb](bool success, const vector<ServiceInfo>& services)
+	{
+		BleGattTree* tree = BuildGattTree(resultArena, deviceAddress, success, services, {});
 
-		auto characteristics = charScan.Characteristics();
+		DeliverTree(deviceAddress, tree, servicesCb);
+	});
+}
 
-		char_list.count = characteristics.Size();
-		char_list.characteristics = new BleCharacteristic[char_list.count];
+void ScanCharacteristicsTree(uint64_t deviceAddress, guid serviceUuid, GattTreeCallback characteristicsCb)
+{
+	DiscoverCharacteristics(deviceAddress, serviceUuid, [deviceAddress, serviceUuid, characteristicsCb](bool success, const vector<CharacteristicInfo>& characteristics)
+	{
+		//the one service the characteristics belong to, its attribute handle isn't known here
+		BleGattTree* tree = BuildGattTree(resultArena, deviceAddress, success, { ServiceInfo{ serviceUuid } }, { characteristics });
 
-		int i = 0;
+		DeliverTree(deviceAddress, tree, characteristicsCb);
+	});
+}
 
-		for (auto c : characteristics)
-		{
-			//create a carrier object to pass through marshaled callback
-			BleCharacteristic char_carrier {};
+//one DiscoverAll in progress, the characteristic scans of all services run at once and the last one to finish
+//builds the tree
+struct Discovery
+{
+	mutex lock;
+	uint64_t deviceAddress = 0;
+	DiscoverAllCallback* callback = nullptr;
+
+	bool success = true;
+	size_t pending = 0;
+	vector<ServiceInfo> services;
+	vector<vector<CharacteristicInfo>> characteristics;
+};
 
-			char_carrier.characteristicUuid = c.Uuid();
+void FinishDiscovery(Discovery& discovery)
+{
+	if (discovery.success)
+		gattDatabase.StoreDevice(discovery.deviceAddress, discovery.services, discovery.characteristics);
 
-			// retrieve user description
-			GattDescriptorsResult descriptorScan = co_await c.GetDescriptorsForUuidAsync(make_guid(L"00002901-0000-1000-8000-00805F9B34FB"), BluetoothCacheMode::Uncached);
+	BleGattTree* tree = BuildGattTree(resultArena, discovery.deviceAddress, discovery.success, discovery.services, discovery.characteristics);
 
-			if (descriptorScan.Descriptors().Size() == 0)
-			{
-				//default to empty description
-				const wchar_t* defaultDescription = L"";
+	DeliverTree(discovery.deviceAddress, tree, discovery.callback);
+}
+
+void DiscoverAll(uint64_t deviceAddress, DiscoverAllCallback discoveredCb)
+{
+	auto discovery = make_shared<Discovery>();
+	discovery->deviceAddress = deviceAddress;
+	discovery->callback = discoveredCb;
 
-				//safely copy it over
-				wcscpy_s(char_carrier.userDescription, sizeof(char_carrier.userDescription) / sizeof(wchar_t), defaultDescription);
-			}
-			else
+	Backend().ScanServices(deviceAddress, Timed(STATS_SERVICES, deviceAddress, [discovery](bool success, const vector<ServiceInfo>& services)
+	{
+		discovery->success = success;
+		discovery->services = services;
+		discovery->characteristics.resize(services.size());
+		discovery->pending = services.size();
+
+		if (!success || services.empty())
+		{
+			FinishDiscovery(*discovery);
+			return;
+		}
+
+		for (size_t i = 0; i < services.size(); i++)
+		{
+			Backend().ScanCharacteristics(discovery->deviceAddress, services[i].uuid, Timed(STATS_CHARACTERISTICS, discovery->deviceAddress, [discovery, i](bool success, const vector<CharacteristicInfo>& characteristics)
 			{
-				//get first descriptor
-				GattDescriptor descriptor = descriptorScan.Descriptors().GetAt(0);
+				bool last = false;
 
-				//read name descriptor
-				GattReadResult nameResult = co_await descriptor.ReadValueAsync();
-				if (nameResult.Status() != GattCommunicationStatus::Success)
 				{
-					LogError(L"%s:%d couldn't read user description for charasteristic %s, status %d", __WFILE__, __LINE__, to_hstring(c.Uuid()).c_str(), nameResult.Status());
-					continue;
+					lock_guard guard(discovery->lock);
+
+					discovery->characteristics[i] = characteristics;
+					discovery->success &= success;
+					last = --discovery->pending == 0;
 				}
 
-				auto dataReader = DataReader::FromBuffer(nameResult.Value());
-				auto output = dataReader.ReadString(dataReader.UnconsumedBufferLength());
-				wcscpy_s(char_carrier.userDescription, sizeof(char_carrier.userDescription) / sizeof(wchar_t), output.c_str());
-			}
+				if (last)
+					FinishDiscovery(*discovery);
+			}));
+		}
+	}));
+}
 
-			char_list.characteristics[i++] = char_carrier;
+void ReleaseResult(void* result)
+{
+	if (!resultArena.Release(result))
+		LogError(L"%s:%d ReleaseResult called with a pointer that is not a live result", __WFILE__, __LINE__);
+}
 
-			{
-				lock_guard lock(quitLock);
-				if (quitFlag)
-					break;
-			}
-		}
-	}
-	catch (hresult_error& ex)
-	{
-		LogError(L"%s:%d ScanCharacteristicsAsync catch: %s\n", __WFILE__, __LINE__, ex.message().c_str());
-	}
+void SetDiscoveryOptions(int32_t maxConcurrentReads, bool readUserDescriptions)
+{
+	discoveryOptions.maxConcurrentReads = maxConcurrentReads > 0 ? maxConcurrentReads : 1;
+	discoveryOptions.readUserDescriptions = readUserDescriptions;
 
-	if (characteristicsCb)
-		(*characteristicsCb)(&char_list);
+	Backend().SetDiscoveryOptions(discoveryOptions);
 }
 
-fire_and_forget SubscribeCharacteristicAsync(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, SubscribeCallback subscribeCallback)
+void EnableGattDatabase(const wchar_t* path)
 {
-	try
-	{
-		GattCharacteristic characteristic = co_await RetrieveCharacteristic(deviceAddress, serviceUuid, characteristicUuid);
-		if (characteristic != nullptr)
-		{
-			auto status = co_await characteristic.WriteClientCharacteristicConfigurationDescriptorAsync(GattClientCharacteristicConfigurationDescriptorValue::Notify);
-			if (status != GattCommunicationStatus::Success)
-			{
-				LogError(L"%s:%d Error subscribing to characteristic with uuid %s and status %d", __WFILE__, __LINE__, characteristicUuid, status);
-				co_return;
-			}
-			
-			Subscription* subscription = new Subscription();
-			subscription->characteristic = characteristic;
-
-			// Inline handler for ValueChanged event
-			subscription->revoker = characteristic.ValueChanged(auto_revoke,
-				[deviceAddress, serviceUuid, characteristicUuid, subscribeCallback]
-				(GattCharacteristic const& characteristic, GattValueChangedEventArgs args)
-			{
-				uint8_t buf[512];
-				uint16_t size;
+	gattDatabase.Open(path);
+}
 
-				size = args.CharacteristicValue().Length();
+void InvalidateGattDatabase(uint64_t deviceAddress)
+{
+	gattDatabase.Invalidate(deviceAddress);
+}
 
-				// Convert IBuffer to byte array
-				std::vector<uint8_t> buffer(size);
-				DataReader::FromBuffer(args.CharacteristicValue()).ReadBytes(buffer);
-				memcpy(buf, buffer.data(), size);
+void GetGattDatabaseStats(BleGattDatabaseStats* stats)
+{
+	if (stats == nullptr)
+		return;
 
-				// Process the data or trigger a callback as needed
-				if (subscribeCallback)
-					(*subscribeCallback)(deviceAddress, serviceUuid, characteristicUuid, buf, size);
-			});
+	*stats = {};
+	gattDatabase.Stats(*stats);
+}
 
-			subscriptions.push_back(subscription);
-		}
-	}
-	catch (hresult_error& ex)
-	{
-		LogError(L"%s:%d SubscribeCharacteristicAsync catch: %s", __WFILE__, __LINE__, ex.message().c_str());
-	}
+void SubscribeCharacteristic(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, SubscribeCallback subscribeCallback)
+{
+	AddSubscription(deviceAddress, serviceUuid, characteristicUuid, subscribeCallback);
+}
+
+void UnsubscribeCharacteristic(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid)
+{
+	subscriptionRegistry.RemoveAll(GattKey{ deviceAddress, serviceUuid, characteristicUuid });
 }
 
-fire_and_forget UnsubscribeCharacteristicAsync(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid)
+uint32_t AddSubscription(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, SubscribeCallback subscribeCallback)
 {
-	try
+	auto onValue = [deviceAddress, serviceUuid, characteristicUuid, subscribeCallback](uint32_t, const uint8_t* data, size_t size)
 	{
-		// Find the subscription in the subscriptions list
-		auto it = std::find_if(subscriptions.begin(), subscriptions.end(), [&](Subscription* sub)
+		int64_t arrived = NowMicroseconds();
+
+		DeliverBytes(deviceAddress, true, data, size, [deviceAddress, serviceUuid, characteristicUuid, subscribeCallback, arrived](const uint8_t* value, size_t length)
 		{
-			return sub->characteristic.Uuid() == characteristicUuid && sub->characteristic.Service().Uuid() == serviceUuid;
+			if (subscribeCallback)
+				(*subscribeCallback)(deviceAddress, serviceUuid, characteristicUuid, value, length);
+
+			operationStats.Record(STATS_NOTIFICATION, deviceAddress, NowMicroseconds() - arrived, true);
 		});
+	};
+
+	return subscriptionRegistry.Add(GattKey{ deviceAddress, serviceUuid, characteristicUuid }, onValue, [deviceAddress](bool success)
+	{
+		if (!success)
+			LogError(L"%s:%d subscription on device %llx could not subscribe", __WFILE__, __LINE__, deviceAddress);
+	});
+}
+
+bool RemoveSubscription(uint32_t handle)
+{
+	return subscriptionRegistry.Remove(handle);
+}
 
-		if (it == subscriptions.end())
-			co_return;
+void GetSubscriptionStats(BleSubscriptionStats* stats)
+{
+	if (stats == nullptr)
+		return;
 
-		// Retrieve the characteristic
-		GattCharacteristic characteristic = (*it)->characteristic;
+	*stats = {};
+	subscriptionRegistry.Stats(*stats);
+}
 
-		// Disable notifications
-		auto status = co_await characteristic.WriteClientCharacteristicConfigurationDescriptorAsync(GattClientCharacteristicConfigurationDescriptorValue::None);
-		if (status != GattCommunicationStatus::Success)
-		{
-			LogError(L"%s:%d Error unsubscribing from characteristic with uuid %s and status %d", __WFILE__, __LINE__, characteristicUuid, status);
-			co_return;
-		}
+void EnableNotificationQueue(uint32_t capacityBytes)
+{
+	notificationQueue.Configure(capacityBytes);
+}
 
-		// Revoke the event handler and delete the subscription
-		(*it)->revoker.revoke();
-		delete* it;
-		subscriptions.erase(it);
-	}
-	catch (hresult_error& ex)
+uint32_t SubscribeCharacteristicQueued(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid)
+{
+	if (notificationQueue.Capacity() == 0)
 	{
-		LogError(L"%s:%d UnsubscribeCharacteristicAsync catch: %s", __WFILE__, __LINE__, ex.message().c_str());
+		LogError(L"%s:%d EnableNotificationQueue has to be called before SubscribeCharacteristicQueued", __WFILE__, __LINE__);
+		return 0;
 	}
+
+	//the registry handle tags the queued notifications and removes the subscription again
+	auto onValue = [](uint32_t handle, const uint8_t* data, size_t size)
+	{
+		notificationQueue.Push(handle, NowMicroseconds(), data, size);
+	};
+
+	return subscriptionRegistry.Add(GattKey{ deviceAddress, serviceUuid, characteristicUuid }, onValue, [deviceAddress](bool success)
+	{
+		if (!success)
+			LogError(L"%s:%d queued subscription on device %llx could not subscribe", __WFILE__, __LINE__, deviceAddress);
+	});
 }
 
-fire_and_forget ConnectDeviceAsync(uint64_t deviceAddress, ConnectedCallback connectedCb)
+uint32_t DrainNotifications(uint8_t* buffer, uint32_t bufferBytes)
 {
-	auto device = co_await RetrieveDevice(deviceAddress);
-	if (device == nullptr)
+	if (buffer == nullptr)
+		return 0;
+
+	return (uint32_t)notificationQueue.Drain(buffer, bufferBytes);
+}
+
+void GetNotificationQueueStats(BleQueueStats* stats)
+{
+	if (stats == nullptr)
+		return;
+
+	*stats = {};
+	stats->enqueued = notificationQueue.enqueued;
+	stats->dropped = notificationQueue.dropped;
+	stats->capacity = (uint32_t)notificationQueue.Capacity();
+	stats->pending = (uint32_t)notificationQueue.Pending();
+}
+
+void ReadBytes(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, ReadBytesCallback readBufferCb)
+{
+	Backend().Read(deviceAddress, serviceUuid, characteristicUuid, Timed(STATS_READ, deviceAddress, [deviceAddress, readBufferCb](bool success, const uint8_t* data, size_t size)
 	{
-		if (connectedCb)
-			(*connectedCb)(0);
+		//failed reads are not reported, same as before the backend split
+		if (success && readBufferCb)
+			DeliverBytes(deviceAddress, false, data, size, readBufferCb);
+	}));
+}
 
-		co_return;
-	}
+void WriteBytes(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, const uint8_t* data, size_t size, WriteBytesCallback writeBytesCb)
+{
+	//with response and queued, back-to-back writes no longer race each other
+	WriteBytesQueued(deviceAddress, serviceUuid, characteristicUuid, data, size, WRITE_WITH_RESPONSE, writeBytesCb);
+}
 
-	if (connectedCb)
-		(*connectedCb)(deviceAddress);
+bool WriteBytesQueued(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, const uint8_t* data, size_t size, WriteOption option, WriteBytesCallback writeBytesCb)
+{
+	auto done = [deviceAddress, writeBytesCb](bool success)
+	{
+		if (writeBytesCb)
+			Deliver(deviceAddress, false, [writeBytesCb, success]() { writeBytesCb(success); });
+	};
+
+	GattKey key{ deviceAddress, serviceUuid, characteristicUuid };
+	if (writeScheduler.Enqueue(key, data, size, option != WRITE_WITHOUT_RESPONSE, done))
+		return true;
+
+	done(false);
+	return false;
 }
 
-fire_and_forget ReadBytesAsync(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, ReadBytesCallback readBufferCb)
+void ConfigureWriteQueue(uint32_t maxOutstanding, uint32_t maxQueued)
 {
-	GattCharacteristic ch = co_await RetrieveCharacteristic(deviceAddress, serviceUuid, characteristicUuid);
-	GattReadResult dataFromRead = co_await ch.ReadValueAsync();
-	if (dataFromRead.Status() != GattCommunicationStatus::Success)
-		co_return;
+	writeScheduler.Configure(maxOutstanding, maxQueued);
+}
+
+bool GetWriteQueueStats(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, BleWriteQueueStats* stats)
+{
+	if (stats == nullptr)
+		return false;
 
-	// Convert the data from IBuffer to a byte array
-	IBuffer buffer = dataFromRead.Value();
-	std::vector<uint8_t> bytes(buffer.Length());
-	if (buffer.Length() > 0)
+	return writeScheduler.Stats(GattKey{ deviceAddress, serviceUuid, characteristicUuid }, *stats);
+}
+
+TransferHandler TransferProgress(uint64_t deviceAddress, BulkTransferCallback progressCb)
+{
+	return [deviceAddress, progressCb](const BleTransferProgress& progress)
 	{
-		DataReader reader = DataReader::FromBuffer(buffer);
-		reader.ReadBytes(bytes);
-	}
+		if (progressCb)
+			Deliver(deviceAddress, false, [progress, progressCb]() { progressCb(&progress); });
+	};
+}
+
+uint32_t StartBulkTransferFile(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, const wchar_t* path, uint64_t offset, BulkTransferCallback progressCb)
+{
+	uint32_t transfer = transferEngine.StartFile(GattKey{ deviceAddress, serviceUuid, characteristicUuid }, path, offset, TransferProgress(deviceAddress, progressCb));
+	if (transfer == 0)
+		LogError(L"%s:%d StartBulkTransferFile can't map %s from offset %llu", __WFILE__, __LINE__, path != nullptr ? path : L"(null)", offset);
+
+	return transfer;
+}
+
+uint32_t StartBulkTransfer(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, const uint8_t* data, size_t size, uint64_t offset, BulkTransferCallback progressCb)
+{
+	return transferEngine.StartBuffer(GattKey{ deviceAddress, serviceUuid, characteristicUuid }, data, size, offset, TransferProgress(deviceAddress, progressCb));
+}
 
-	if (readBufferCb)
-		readBufferCb(bytes.data(), bytes.size());
+void CancelBulkTransfer(uint32_t transfer)
+{
+	transferEngine.Cancel(transfer);
 }
 
-fire_and_forget WriteBytesAsync(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, const uint8_t* data, size_t size, WriteBytesCallback writeCallback)
+bool GetBulkTransferProgress(uint32_t transfer, BleTransferProgress* progress)
 {
-	// Retrieve the characteristic asynchronously
-	GattCharacteristic ch = co_await RetrieveCharacteristic(deviceAddress, serviceUuid, characteristicUuid);
-	if (!ch)
+	if (progress == nullptr)
+		return false;
+
+	*progress = {};
+	return transferEngine.Progress(transfer, *progress);
+}
+
+void ConfigureBulkTransfer(uint32_t window, uint32_t ackInterval)
+{
+	TransferOptions options;
+	options.window = window;
+	options.ackInterval = ackInterval;
+
+	transferEngine.Configure(options);
+}
+
+uint32_t OpenFramedChannel(uint64_t deviceAddress, guid serviceUuid, guid writeCharacteristicUuid, guid notifyCharacteristicUuid, uint32_t maxMessage, FramedMessageCallback messageCb)
+{
+	GattKey write{ deviceAddress, serviceUuid, writeCharacteristicUuid };
+	GattKey notify{ deviceAddress, serviceUuid, notifyCharacteristicUuid };
+
+	uint32_t channel = framedChannels.Open(write, notify, maxMessage, [deviceAddress, messageCb](uint32_t channel, const uint8_t* data, size_t size)
+	{
+		if (messageCb)
+			DeliverBytes(deviceAddress, true, data, size, [channel, messageCb](const uint8_t* message, size_t length) { messageCb(channel, message, length); });
+	});
+
+	Backend().QueryMtu(deviceAddress, [channel](bool success, uint32_t mtu)
 	{
-		if (writeCallback)
-			writeCallback(false); // Indicate that the characteristic is unavailable
+		if (success)
+			framedChannels.SetMtu(channel, mtu);
+	});
 
-		co_return;
-	}
+	uint32_t subscription = subscriptionRegistry.Add(notify, [channel](uint32_t, const uint8_t* data, size_t size)
+	{
+		framedChannels.Receive(channel, data, size);
+	}, [channel](bool success)
+	{
+		if (!success)
+			LogError(L"%s:%d framed channel %u could not subscribe", __WFILE__, __LINE__, channel);
+	});
 
-	// Create an IBuffer from the byte array
-	DataWriter writer;
-	writer.WriteBytes(array_view<const uint8_t>(data, data + size));
-	IBuffer buffer = writer.DetachBuffer();
+	framedChannels.SetSubscription(channel, subscription);
+	return channel;
+}
 
-	// Write the value asynchronously
-	GattCommunicationStatus status = co_await ch.WriteValueAsync(buffer);
+bool SendFramedMessage(uint32_t channel, const uint8_t* data, size_t size, WriteOption option, WriteBytesCallback sentCb)
+{
+	return framedChannels.Send(channel, data, size, option != WRITE_WITHOUT_RESPONSE, [sentCb](uint64_t deviceAddress, bool success)
+	{
+		if (sentCb)
+			Deliver(deviceAddress, false, [sentCb, success]() { sentCb(success); });
+	});
+}
 
-	// Call the callback with the result status
-	if (writeCallback)
-		writeCallback(true);
+void CloseFramedChannel(uint32_t channel)
+{
+	uint32_t subscription;
+	if (framedChannels.Close(channel, subscription))
+		subscriptionRegistry.Remove(subscription);
 }
 
-void Quit()
+bool GetFramingStats(uint32_t channel, BleFramingStats* stats)
 {
+	if (stats == nullptr)
+		return false;
+
+	*stats = {};
+	return framedChannels.Stats(channel, *stats);
+}
+
+bool ConfigureDispatcher(uint32_t threads, int32_t priority, uint64_t affinityMask, uint32_t queueCapacity)
+{
+	DispatcherOptions options;
+	options.threads = threads;
+	options.priority = priority;
+	options.affinityMask = affinityMask;
+
+	if (queueCapacity > 0)
+		options.queueCapacity = queueCapacity;
+
+	if (callbackDispatcher.Configure(options))
+		return true;
+
+	LogError(L"%s:%d ConfigureDispatcher can't be called from a dispatched callback", __WFILE__, __LINE__);
+	return false;
+}
+
+void EnableDeferredDelivery(bool enabled, uint32_t maxDeferred)
+{
+	callbackDispatcher.Defer(enabled, maxDeferred > 0 ? maxDeferred : DEFAULT_MAX_DEFERRED);
+}
+
+uint32_t Pump(uint32_t maxMicroseconds)
+{
+	return callbackDispatcher.Pump(maxMicroseconds);
+}
+
+void GetDispatcherStats(BleDispatcherStats* stats)
+{
+	if (stats == nullptr)
+		return;
+
+	*stats = {};
+	callbackDispatcher.Stats(*stats);
+}
+
+int32_t GetStats(BleOperationStats* buffer, int32_t maxCount)
+{
+	return (int32_t)operationStats.Snapshot(buffer, buffer != nullptr && maxCount > 0 ? (size_t)maxCount : 0);
+}
+
+void ResetStats()
+{
+	operationStats.Reset();
+}
+
+bool StartCapture(const wchar_t* path)
+{
+	if (path == nullptr || path[0] == 0)
+		return false;
+
+	if (captureWriter.Open(path))
+		return true;
+
+	LogError(L"%s:%d can't create capture %s", __WFILE__, __LINE__, path);
+	return false;
+}
+
+void StopCapture()
+{
+	captureWriter.Close();
+}
+
+void GetCaptureStats(BleCaptureStats* stats)
+{
+	if (stats == nullptr)
+		return;
+
+	*stats = {};
+	captureWriter.Stats(*stats);
+}
+
+//recorded devices the simulator doesn't know are added with their characteristics, so connecting and subscribing to
+//them succeeds. peripherals scripted with SimAddPeripheral are left as they are
+void AddRecordedPeripherals()
+{
+	SimulatedBackend& simulator = GetSimulatedBackend();
+	vector<uint64_t> added;
+
+	for (auto& device : captureReplay.Devices())
 	{
-		lock_guard lock(quitLock);
-		quitFlag = true;
+		if (simulator.HasPeripheral(device.mac))
+			continue;
+
+		simulator.AddPeripheral(device.mac, device.name.c_str(), device.signalStrength, device.powerLevel, 0);
+		added.push_back(device.mac);
 	}
 
-	StopScan();
-	
+	for (auto& key : captureReplay.Characteristics())
 	{
-		for (auto subscription : subscriptions)
-			subscription->revoker.revoke();
+		if (find(added.begin(), added.end(), key.device) == added.end())
+			continue;
 
-		subscriptions = {};
+		simulator.AddService(key.device, key.service, false);
+		simulator.AddCharacteristic(key.device, key.service, key.characteristic, L"");
 	}
-	
+}
+
+bool StartReplay(const wchar_t* path, double speed, bool loop, ReplayFinishedCallback finishedCb)
+{
+	if (path == nullptr || !captureReplay.Load(path))
+	{
+		LogError(L"%s:%d can't replay capture %s", __WFILE__, __LINE__, path != nullptr ? path : L"");
+		return false;
+	}
+
+	if (&Backend() == &GetSimulatedBackend())
+		AddRecordedPeripherals();
+
+	return captureReplay.Start(speed, loop, [finishedCb]()
+	{
+		Deliver(0, false, [finishedCb]()
+		{
+			if (finishedCb)
+				(*finishedCb)();
+		});
+	});
+}
+
+void StopReplay()
+{
+	captureReplay.Stop();
+}
+
+void GetReplayStats(BleReplayStats* stats)
+{
+	if (stats == nullptr)
+		return;
+
+	*stats = {};
+	captureReplay.Stats(*stats);
+}
+
+bool SetAdvertFilter(const BleFilterRule* rules, int32_t count, const uint64_t* macs, int32_t macCount, FilterAction defaultAction)
+{
+	if (count < 0 || macCount < 0)
+		return false;
 
-	ClearCache();
-}
\ No newline at end of file
+	return advertFilter.Configure(rules, (size_t)count, macs, (size_t)macCount, defaultAction);
+}
+
+void GetAdvertFilterStats(BleFilterStats* stats)
+{
+	if (stats != nullptr)
+		advertFilter.Stats(*stats);
+}
+
+int32_t GetAdvertFilterHits(uint64_t* hits, int32_t maxCount)
+{
+	return (int32_t)advertFilter.RuleHits(hits, maxCount > 0 ? (size_t)maxCount : 0);
+}
+
+void Quit()
+{
+	scanScheduler.Stop();
+	connectionManager.Clear();
+	captureReplay.Stop();
+	captureWriter.Close();
+
+	writeScheduler.Clear();
+	subscriptionRegistry.Clear();
+	Backend().Quit();
+
+	//delivers what is still queued or deferred, later callbacks run inline again
+	callbackDispatcher.Configure(DispatcherOptions());
+	callbackDispatcher.Defer(false, 0);
+
+	//delivers the lines still queued, the next one logged starts the thread again
+	StopLogging();
+}
+
+
+void SimReset()
+{
+	GetSimulatedBackend().Reset();
+}
+
+void SimSetLatency(uint32_t latencyUs, uint32_t jitterUs)
+{
+	GetSimulatedBackend().SetLatency(latencyUs, jitterUs);
+}
+
+void SimSetFailureRate(double probability)
+{
+	GetSimulatedBackend().SetFailureRate(probability);
+}
+
+void SimAddPeripheral(uint64_t deviceAddress, const wchar_t* name, int32_t signalStrength, int32_t powerLevel, uint32_t advertIntervalUs)
+{
+	GetSimulatedBackend().AddPeripheral(deviceAddress, name != nullptr ? name : L"", signalStrength, powerLevel, advertIntervalUs);
+}
+
+void SimRemovePeripheral(uint64_t deviceAddress)
+{
+	GetSimulatedBackend().RemovePeripheral(deviceAddress);
+}
+
+void SimAddService(uint64_t deviceAddress, guid serviceUuid, bool advertised)
+{
+	GetSimulatedBackend().AddService(deviceAddress, serviceUuid, advertised);
+}
+
+void SimAddCharacteristic(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, const wchar_t* userDescription)
+{
+	GetSimulatedBackend().AddCharacteristic(deviceAddress, serviceUuid, characteristicUuid, userDescription != nullptr ? userDescription : L"");
+}
+
+void SimSetMtu(uint64_t deviceAddress, uint32_t mtu)
+{
+	GetSimulatedBackend().SetMtu(deviceAddress, mtu);
+}
+
+void SimSetManufacturerData(uint64_t deviceAddress, uint16_t companyId, const uint8_t* data, size_t size)
+{
+	GetSimulatedBackend().SetManufacturerData(deviceAddress, companyId, data, data != nullptr ? size : 0);
+}
+
+void SimSetAdvertData(uint64_t deviceAddress, const uint8_t* data, size_t size)
+{
+	GetSimulatedBackend().SetAdvertData(deviceAddress, data, data != nullptr ? size : 0);
+}
+
+void SimSetValue(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, const uint8_t* data, size_t size)
+{
+	GetSimulatedBackend().SetValue(deviceAddress, serviceUuid, characteristicUuid, data, size);
+}
+
+void SimSetNotificationInterval(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, uint32_t intervalUs, uint32_t payloadSize)
+{
+	GetSimulatedBackend().SetNotificationInterval(deviceAddress, serviceUuid, characteristicUuid, intervalUs, payloadSize);
+}
+
+void SimEmitAdverts(uint64_t deviceAddress, uint32_t count)
+{
+	GetSimulatedBackend().EmitAdverts(deviceAddress, count);
+}
+
+void SimNotify(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, const uint8_t* data, size_t size)
+{
+	GetSimulatedBackend().Notify(deviceAddress, serviceUuid, characteristicUuid, data, size);
+}
+
+void SimDropLink(uint64_t deviceAddress, uint32_t downMilliseconds)
+{
+	GetSimulatedBackend().DropLink(deviceAddress, downMilliseconds * 1000);
+}
@@ -1,5 +1,21 @@
 #pragma once
 
+#include "advert-filter.h"
+#include "beacon.h"
+#include "carriers.h"
+#include "callback-dispatcher.h"
+#include "capture.h"
+#include "connection-manager.h"
+#include "device-table.h"
+#include "framing.h"
+#include "gatt-database.h"
+#include "bulk-transfer.h"
+#include "gatt-tree.h"
+#include "operation-stats.h"
+#include "scan-scheduler.h"
+#include "subscription-registry.h"
+#include "write-queue.h"
+
 using namespace std;
 using namespace winrt;
 using namespace Windows::Foundation;
@@ -17,47 +33,218 @@ struct BleCharacteristicArray
 	int count = 0;
 };
 
+enum BackendType : int32_t
+{
+	BACKEND_WINRT = 0,
+	BACKEND_SIMULATED = 1,
+};
+
+enum WriteOption : int32_t
+{
+	WRITE_WITH_RESPONSE = 0,
+	WRITE_WITHOUT_RESPONSE = 1,
+};
+
 using ReceivedCallback = void(BleAdvert*);
+using BeaconCallback = void(BleBeacon*);
 using StoppedCallback = void();
 using ConnectedCallback = void(uint64_t);
 using DisconnectedCallback = void(uint64_t);
+using LinkStateCallback = void(uint64_t deviceAddress, LinkState state);
 using ServicesFoundCallback = void(BleServiceArray *);
 using CharacteristicsFoundCallback = void(BleCharacteristicArray *);
+using GattTreeCallback = void(BleGattTree* tree);
+using DiscoverAllCallback = GattTreeCallback;
 
 using SubscribeCallback = void(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, const uint8_t* data, size_t size);
 using ReadBytesCallback = void(const uint8_t* data, size_t size);
 using WriteBytesCallback = void(bool success);
-
-
-fire_and_forget ScanServicesAsync(uint64_t deviceAddress, ServicesFoundCallback servicesCb);
-fire_and_forget ScanCharacteristicsAsync(uint64_t deviceAddress, guid serviceUuid, CharacteristicsFoundCallback characteristicsCb);
-fire_and_forget SubscribeCharacteristicAsync(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, SubscribeCallback subscribeCallback);
-fire_and_forget UnsubscribeCharacteristicAsync(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid);
-
-fire_and_forget ConnectDeviceAsync(uint64_t deviceAddress, ConnectedCallback connectedCb);
-
-fire_and_forget ReadBytesAsync(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, ReadBytesCallback readBufferCb);
-fire_and_forget WriteBytesAsync(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, const uint8_t* data, size_t size, WriteBytesCallback writeCallback);
+using BulkTransferCallback = void(const BleTransferProgress* progress);
+using FramedMessageCallback = void(uint32_t channel, const uint8_t* data, size_t size);
+using ReplayFinishedCallback = void();
 
 
 //these functions will be available through the native DLL interface, exposed to Unity
 extern "C"
 {
+	//choose the backend every following call is routed through, switching quits the previous one
+	__declspec(dllexport) void SelectBackend(BackendType type);
+
 	__declspec(dllexport) void InitializeScan(const wchar_t* nameFilter, guid serviceFilter, ReceivedCallback addedCb, StoppedCallback stoppedCb);
 	__declspec(dllexport) void StartScan();
 	__declspec(dllexport) void StopScan();
 
+	//alternate active, passive and idle windows while scanning, and optionally scan passively once the names of the
+	//devices around are cached. null goes back to scanning actively without a break. resets the scan stats
+	__declspec(dllexport) void SetScanSchedule(const BleScanSchedule* schedule);
+	//adverts and callbacks per scan mode, windows and time spent in each
+	__declspec(dllexport) void GetScanStats(BleScanStats* stats);
+
+	//queue adverts instead of invoking the received callback per packet, 0 switches back to callbacks. call while not scanning
+	__declspec(dllexport) void EnableAdvertQueue(int32_t capacity);
+	//drain up to maxCount queued adverts, returns the number copied
+	__declspec(dllexport) int32_t PollAdverts(BleAdvertRecord* buffer, int32_t maxCount);
+	__declspec(dllexport) void GetAdvertQueueStats(BleQueueStats* stats);
+
+	//decode ibeacon, altbeacon and eddystone frames from every advert that passes the filter, on top of delivering it
+	//as usual. null stops decoding
+	__declspec(dllexport) void RegisterBeaconCallback(BeaconCallback beaconCb);
+
+	//merge adverts into a per-device table instead of delivering them, 0 switches back. smoothing weights new rssi samples
+	__declspec(dllexport) void EnableDeviceTable(int32_t maxDevices, float smoothing);
+	//devices updated since the previous call, returns the number copied
+	__declspec(dllexport) int32_t GetDeviceChanges(BleDeviceState* buffer, int32_t maxCount);
+	__declspec(dllexport) int32_t GetDeviceSnapshot(BleDeviceState* buffer, int32_t maxCount);
+	__declspec(dllexport) void ClearDeviceTable();
+
 	__declspec(dllexport) void ConnectDevice(uint64_t deviceAddress, ConnectedCallback connectedCb);
 	__declspec(dllexport) void DisconnectDevice(uint64_t deviceAddress, DisconnectedCallback connectedCb);
 
+	//keep the link up: connect now and whenever it drops connect again, with exponential backoff and jitter between
+	//failed attempts. after every connect the warm characteristics are resolved, so the first operation finds them
+	//cached, and the device's subscriptions are armed again. call at startup for the devices that should be ready.
+	//DisconnectDevice stops managing the device
+	__declspec(dllexport) void ManageConnection(uint64_t deviceAddress, const BleCharacteristicKey* warm, int32_t warmCount);
+	//stop reconnecting the device and leave the link as it is, false if it wasn't managed
+	__declspec(dllexport) bool ReleaseConnection(uint64_t deviceAddress);
+	//null restores the default policy
+	__declspec(dllexport) void ConfigureReconnect(const BleReconnectPolicy* policy);
+	//state changes of managed devices, and LINK_DISCONNECTED when the link of any other connected device drops. null
+	//stops reporting
+	__declspec(dllexport) void RegisterLinkStateCallback(LinkStateCallback linkStateCb);
+	//drops, attempts and reconnect times of a managed device, false if it isn't managed
+	__declspec(dllexport) bool GetLinkStats(uint64_t deviceAddress, BleLinkStats* stats);
+	//returns the number of devices written, or the number managed if buffer is null
+	__declspec(dllexport) int32_t GetLinkSnapshot(BleLinkStats* buffer, int32_t maxCount);
+
+	//the arrays are only valid during the callback
 	__declspec(dllexport) void ScanServices(uint64_t deviceAddress, ServicesFoundCallback serviceFoundCb);
 	__declspec(dllexport) void ScanCharacteristics(uint64_t deviceAddress, guid serviceUuid, CharacteristicsFoundCallback characteristicFoundCb);
+	//same results as a BleGattTree with utf-8 descriptions, owned by the caller until ReleaseResult. the services tree
+	//has no characteristics, the characteristics tree has the one service they belong to
+	__declspec(dllexport) void ScanServicesTree(uint64_t deviceAddress, GattTreeCallback servicesCb);
+	__declspec(dllexport) void ScanCharacteristicsTree(uint64_t deviceAddress, guid serviceUuid, GattTreeCallback characteristicsCb);
+	//services, characteristics and user descriptions in one go, all characteristic scans run in parallel. the tree is a
+	//single block owned by the caller until it is passed to ReleaseResult, it is null only if allocating it failed
+	__declspec(dllexport) void DiscoverAll(uint64_t deviceAddress, DiscoverAllCallback discoveredCb);
+	__declspec(dllexport) void ReleaseResult(void* result);
+
+	//user descriptions are read with up to maxConcurrentReads requests in flight, or skipped entirely
+	__declspec(dllexport) void SetDiscoveryOptions(int32_t maxConcurrentReads, bool readUserDescriptions);
+
+	//persist discovered layouts in the given file and answer ScanServices/ScanCharacteristics from it for known devices,
+	//revalidating in the background. null or empty closes the database
+	__declspec(dllexport) void EnableGattDatabase(const wchar_t* path);
+	//forget the layout of one device, 0 forgets all
+	__declspec(dllexport) void InvalidateGattDatabase(uint64_t deviceAddress);
+	__declspec(dllexport) void GetGattDatabaseStats(BleGattDatabaseStats* stats);
 
 	__declspec(dllexport) void SubscribeCharacteristic(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, SubscribeCallback subscribeCallback);
+	//removes every subscription of the characteristic, including handles from AddSubscription
 	__declspec(dllexport) void UnsubscribeCharacteristic(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid);
+	//subscribe alongside other consumers of the same characteristic, only the first enables notifications on the device
+	__declspec(dllexport) uint32_t AddSubscription(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, SubscribeCallback subscribeCallback);
+	//the last handle of a characteristic to go disables its notifications, also takes handles of queued subscriptions
+	__declspec(dllexport) bool RemoveSubscription(uint32_t handle);
+	__declspec(dllexport) void GetSubscriptionStats(BleSubscriptionStats* stats);
+
+	//size the queue used by queued subscriptions, drops anything still queued
+	__declspec(dllexport) void EnableNotificationQueue(uint32_t capacityBytes);
+	//subscribe without a callback, notifications are appended to the queue tagged with the returned handle (0 on error)
+	__declspec(dllexport) uint32_t SubscribeCharacteristicQueued(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid);
+	//copy out as many packed BleNotificationRecords as fit, returns the number of bytes written
+	__declspec(dllexport) uint32_t DrainNotifications(uint8_t* buffer, uint32_t bufferBytes);
+	__declspec(dllexport) void GetNotificationQueueStats(BleQueueStats* stats);
 
 	__declspec(dllexport) void ReadBytes(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, ReadBytesCallback readBufferCb);
 	__declspec(dllexport) void WriteBytes(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, const uint8_t* data, size_t size, WriteBytesCallback writeBytesCb);
+	//queue a write behind the characteristic's earlier ones, false (and the callback with false) if the queue is full.
+	//writes without response are pipelined, the callback then only means the write left the host
+	__declspec(dllexport) bool WriteBytesQueued(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, const uint8_t* data, size_t size, WriteOption option, WriteBytesCallback writeBytesCb);
+	//writes without response in flight per characteristic, and writes allowed to wait behind them
+	__declspec(dllexport) void ConfigureWriteQueue(uint32_t maxOutstanding, uint32_t maxQueued);
+	//false and zeroed stats if nothing was written to the characteristic yet
+	__declspec(dllexport) bool GetWriteQueueStats(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, BleWriteQueueStats* stats);
+
+	//stream a file (mapped) or a buffer (copied) from offset in mtu sized writes, returns the transfer id or 0. progress is
+	//reported on every acknowledgement and once more with the end state; restart a failed transfer from acknowledgedBytes
+	__declspec(dllexport) uint32_t StartBulkTransferFile(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, const wchar_t* path, uint64_t offset, BulkTransferCallback progressCb);
+	__declspec(dllexport) uint32_t StartBulkTransfer(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, const uint8_t* data, size_t size, uint64_t offset, BulkTransferCallback progressCb);
+	__declspec(dllexport) void CancelBulkTransfer(uint32_t transfer);
+	//false once the transfer has ended
+	__declspec(dllexport) bool GetBulkTransferProgress(uint32_t transfer, BleTransferProgress* progress);
+	//chunks in flight per transfer, and how many chunks go out per write with response
+	__declspec(dllexport) void ConfigureBulkTransfer(uint32_t window, uint32_t ackInterval);
+
+	//exchange messages of up to maxMessage bytes (0 for 64 KB) over a characteristic written to and one notifying back.
+	//messages are split into mtu sized fragments and put back together on arrival, returns the channel id
+	__declspec(dllexport) uint32_t OpenFramedChannel(uint64_t deviceAddress, guid serviceUuid, guid writeCharacteristicUuid, guid notifyCharacteristicUuid, uint32_t maxMessage, FramedMessageCallback messageCb);
+	//false if the channel is unknown or the write queue is full, the callback reports once every fragment completed
+	__declspec(dllexport) bool SendFramedMessage(uint32_t channel, const uint8_t* data, size_t size, WriteOption option, WriteBytesCallback sentCb);
+	__declspec(dllexport) void CloseFramedChannel(uint32_t channel);
+	__declspec(dllexport) bool GetFramingStats(uint32_t channel, BleFramingStats* stats);
+
+	//run callbacks on dedicated threads, each device's in order. priority is a THREAD_PRIORITY_* value, worker i is pinned
+	//to the i-th cpu of affinityMask. 0 threads delivers on the event threads again, Quit does the same
+	__declspec(dllexport) bool ConfigureDispatcher(uint32_t threads, int32_t priority, uint64_t affinityMask, uint32_t queueCapacity);
+	//hold adverts, notifications and completions until Pump, for hosts with a main loop. maxDeferred (0 for 4096) bounds
+	//the adverts and notifications, completions are never dropped. turning it off runs what is left on the calling thread
+	__declspec(dllexport) void EnableDeferredDelivery(bool enabled, uint32_t maxDeferred);
+	//run deferred callbacks on the calling thread for up to maxMicroseconds (0 for everything deferred so far), at least
+	//one per call. returns how many are still waiting
+	__declspec(dllexport) uint32_t Pump(uint32_t maxMicroseconds);
+	__declspec(dllexport) void GetDispatcherStats(BleDispatcherStats* stats);
+
+	//latency of every operation, the totals of all StatsOperations first and then one line per device and operation
+	//that saw any. returns the number of lines written, or the number available if buffer is null
+	__declspec(dllexport) int32_t GetStats(BleOperationStats* buffer, int32_t maxCount);
+	__declspec(dllexport) void ResetStats();
+
+	//append every advert and notification the backend reports to a binary file, written from a background thread.
+	//replaces the previous capture
+	__declspec(dllexport) bool StartCapture(const wchar_t* path);
+	__declspec(dllexport) void StopCapture();
+	__declspec(dllexport) void GetCaptureStats(BleCaptureStats* stats);
+
+	//play a capture back through the delivery path the backend uses: adverts as if scanning, notifications to whoever
+	//is subscribed to their characteristic. speed 1 keeps the recorded timing, 0 plays as fast as possible. with the
+	//simulated backend selected, recorded devices it doesn't know are added first. finishedCb runs at the end of the
+	//file, never while looping
+	__declspec(dllexport) bool StartReplay(const wchar_t* path, double speed, bool loop, ReplayFinishedCallback finishedCb);
+	__declspec(dllexport) void StopReplay();
+	__declspec(dllexport) void GetReplayStats(BleReplayStats* stats);
+
+	//checks every advert against the rules before it reaches the device table, the advert queue or the callback, the
+	//first rule that matches decides and defaultAction applies when none does. macs holds the addresses the rules
+	//refer to by range. replaces the previous rules and their counters, count 0 removes them. false if a rule is
+	//malformed
+	__declspec(dllexport) bool SetAdvertFilter(const BleFilterRule* rules, int32_t count, const uint64_t* macs, int32_t macCount, FilterAction defaultAction);
+	__declspec(dllexport) void GetAdvertFilterStats(BleFilterStats* stats);
+	//hits per rule in order, returns the number of rules
+	__declspec(dllexport) int32_t GetAdvertFilterHits(uint64_t* hits, int32_t maxCount);
 
 	__declspec(dllexport) void Quit();
+
+	//scripting of the simulated backend, see backend-sim.h
+	__declspec(dllexport) void SimReset();
+	__declspec(dllexport) void SimSetLatency(uint32_t latencyUs, uint32_t jitterUs);
+	__declspec(dllexport) void SimSetFailureRate(double probability);
+
+	__declspec(dllexport) void SimAddPeripheral(uint64_t deviceAddress, const wchar_t* name, int32_t signalStrength, int32_t powerLevel, uint32_t advertIntervalUs);
+	__declspec(dllexport) void SimRemovePeripheral(uint64_t deviceAddress);
+	__declspec(dllexport) void SimAddService(uint64_t deviceAddress, guid serviceUuid, bool advertised);
+	__declspec(dllexport) void SimAddCharacteristic(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, const wchar_t* userDescription);
+
+	__declspec(dllexport) void SimSetMtu(uint64_t deviceAddress, uint32_t mtu);
+	__declspec(dllexport) void SimSetManufacturerData(uint64_t deviceAddress, uint16_t companyId, const uint8_t* data, size_t size);
+	//raw advertising data sent along with every advert, as on air
+	__declspec(dllexport) void SimSetAdvertData(uint64_t deviceAddress, const uint8_t* data, size_t size);
+	__declspec(dllexport) void SimSetValue(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, const uint8_t* data, size_t size);
+	__declspec(dllexport) void SimSetNotificationInterval(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, uint32_t intervalUs, uint32_t payloadSize);
+
+	//deliver on the calling thread, bypassing the simulated timeline
+	__declspec(dllexport) void SimEmitAdverts(uint64_t deviceAddress, uint32_t count);
+	__declspec(dllexport) void SimNotify(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid, const uint8_t* data, size_t size);
+	//the link drops as if the peripheral went out of range, connecting fails for downMilliseconds
+	__declspec(dllexport) void SimDropLink(uint64_t deviceAddress, uint32_t downMilliseconds);
 }
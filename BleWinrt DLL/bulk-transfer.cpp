@@ -0,0 +1,285 @@
+#include "bulk-transfer.h"
+
+#include <algorithm>
+
+using namespace std;
+
+
+TransferEngine::TransferEngine(QueryMtu queryMtu, WriteScheduler& writes) : queryMtu(move(queryMtu)), writes(writes)
+{
+}
+
+void TransferEngine::Configure(const TransferOptions& options)
+{
+	lock_guard guard(lock);
+
+	this->options.window = max(options.window, 1u);
+	this->options.ackInterval = max(options.ackInterval, 1u);
+}
+
+uint32_t TransferEngine::StartFile(const GattKey& key, const wchar_t* path, uint64_t offset, TransferHandler handler)
+{
+	auto transfer = make_shared<Transfer>();
+	transfer->key = key;
+	transfer->handler = move(handler);
+
+	if (path == nullptr || !transfer->file.Open(path))
+		return 0;
+
+	transfer->data = transfer->file.Data();
+	transfer->progress.totalBytes = transfer->file.Size();
+	return Start(transfer, offset);
+}
+
+uint32_t TransferEngine::StartBuffer(const GattKey& key, const uint8_t* data, size_t size, uint64_t offset, TransferHandler handler)
+{
+	auto transfer = make_shared<Transfer>();
+	transfer->key = key;
+	transfer->handler = move(handler);
+
+	//the caller's buffer is only borrowed, one copy up front and the chunks are sliced from it
+	transfer->copy.assign(data, data + size);
+	transfer->data = transfer->copy.data();
+	transfer->progress.totalBytes = size;
+	return Start(transfer, offset);
+}
+
+uint32_t TransferEngine::Start(const shared_ptr<Transfer>& transfer, uint64_t offset)
+{
+	if (offset > transfer->progress.totalBytes)
+		return 0;
+
+	transfer->startOffset = offset;
+	transfer->progress.sentBytes = offset;
+	transfer->progress.acknowledgedBytes = offset;
+
+	uint32_t id;
+
+	{
+		lock_guard guard(lock);
+
+		id = nextId++;
+		if (nextId == 0)
+			nextId = 1;
+
+		transfer->options = options;
+		transfer->progress.transfer = id;
+		transfers[id] = transfer;
+	}
+
+	queryMtu(transfer->key.device, [this, transfer](bool success, uint32_t mtu)
+	{
+		Begin(transfer, success, mtu);
+	});
+
+	return id;
+}
+
+void TransferEngine::Begin(const shared_ptr<Transfer>& transfer, bool success, uint32_t mtu)
+{
+	BleTransferProgress progress;
+	bool retired = false;
+
+	{
+		lock_guard guard(lock);
+
+		//cancelled meanwhile, the final report went out already
+		if (transfer->progress.state != TRANSFER_STARTING)
+			return;
+
+		if (success && mtu > ATT_WRITE_OVERHEAD)
+		{
+			transfer->progress.chunkSize = min(mtu - ATT_WRITE_OVERHEAD, ATT_MAX_VALUE_SIZE);
+			transfer->progress.state = transfer->startOffset < transfer->progress.totalBytes ? TRANSFER_RUNNING : TRANSFER_COMPLETED;
+			transfer->started = NowMicroseconds();
+		}
+		else
+		{
+			transfer->progress.state = TRANSFER_FAILED;
+		}
+
+		retired = Retire(*transfer);
+		progress = transfer->progress;
+	}
+
+	if (retired)
+		Finish(transfer, progress);
+	else
+		Pump(transfer);
+}
+
+void TransferEngine::Pump(const shared_ptr<Transfer>& transfer)
+{
+	{
+		lock_guard guard(lock);
+
+		if (transfer->pumping)
+			return;
+
+		transfer->pumping = true;
+	}
+
+	vector<Chunk> chunks;
+
+	while (true)
+	{
+		chunks.clear();
+
+		{
+			lock_guard guard(lock);
+
+			BleTransferProgress& progress = transfer->progress;
+
+			while (progress.state == TRANSFER_RUNNING && transfer->inFlight < transfer->options.window && progress.sentBytes < progress.totalBytes)
+			{
+				uint32_t size = (uint32_t)min<uint64_t>(progress.chunkSize, progress.totalBytes - progress.sentBytes);
+				bool last = progress.sentBytes + size == progress.totalBytes;
+				bool withResponse = last || ++transfer->sinceAck >= transfer->options.ackInterval;
+
+				if (withResponse)
+					transfer->sinceAck = 0;
+
+				chunks.push_back({ progress.sentBytes, size, withResponse });
+				progress.sentBytes += size;
+				transfer->inFlight++;
+			}
+
+			//a completion arriving after this sees pumping cleared and pumps itself
+			if (chunks.empty())
+			{
+				transfer->pumping = false;
+				return;
+			}
+		}
+
+		//outside the lock, a chunk may complete before Enqueue returns. once one is rejected the rest of the batch
+		//isn't sent either, it would land past the gap
+		bool rejected = false;
+		for (auto& chunk : chunks)
+		{
+			auto done = [this, transfer, chunk](bool success)
+			{
+				Completed(transfer, chunk, success);
+			};
+
+			if (rejected || !writes.Enqueue(transfer->key, transfer->data + chunk.offset, chunk.size, chunk.withResponse, done))
+			{
+				rejected = true;
+				Completed(transfer, chunk, false);
+			}
+		}
+	}
+}
+
+void TransferEngine::Completed(const shared_ptr<Transfer>& transfer, const Chunk& chunk, bool success)
+{
+	BleTransferProgress progress;
+	bool acknowledged = false;
+	bool retired = false;
+
+	{
+		lock_guard guard(lock);
+
+		BleTransferProgress& current = transfer->progress;
+		transfer->inFlight--;
+
+		if (!success)
+		{
+			if (current.state == TRANSFER_RUNNING)
+				current.state = TRANSFER_FAILED;
+
+			transfer->failedAt = min(transfer->failedAt, chunk.offset);
+			current.acknowledgedBytes = min(current.acknowledgedBytes, transfer->failedAt);
+		}
+		else
+		{
+			transfer->completedBytes += chunk.size;
+
+			//a chunk behind a failed one doesn't confirm what came before it, the resume offset stays at the gap
+			if (chunk.withResponse && chunk.offset < transfer->failedAt)
+			{
+				acknowledged = true;
+				current.acknowledgedBytes = max(current.acknowledgedBytes, chunk.offset + chunk.size);
+
+				if (current.state == TRANSFER_RUNNING && current.acknowledgedBytes == current.totalBytes)
+					current.state = TRANSFER_COMPLETED;
+			}
+		}
+
+		int64_t elapsed = NowMicroseconds() - transfer->started;
+		current.bytesPerSecond = elapsed > 0 ? (double)transfer->completedBytes * 1000000.0 / (double)elapsed : 0;
+
+		retired = Retire(*transfer);
+		progress = current;
+	}
+
+	if (retired)
+	{
+		Finish(transfer, progress);
+		return;
+	}
+
+	//only the final report carries an end state, acknowledgements trailing a failure are not reported
+	if (acknowledged && progress.state == TRANSFER_RUNNING && transfer->handler)
+		transfer->handler(progress);
+
+	Pump(transfer);
+}
+
+void TransferEngine::Cancel(uint32_t id)
+{
+	shared_ptr<Transfer> transfer;
+	BleTransferProgress progress;
+
+	{
+		lock_guard guard(lock);
+
+		auto found = transfers.find(id);
+		if (found == transfers.end())
+			return;
+
+		BleTransferProgress& current = found->second->progress;
+		if (current.state == TRANSFER_STARTING || current.state == TRANSFER_RUNNING)
+			current.state = TRANSFER_CANCELLED;
+
+		transfer = found->second;
+		if (!Retire(*transfer))
+			return;
+
+		progress = current;
+	}
+
+	Finish(transfer, progress);
+}
+
+bool TransferEngine::Progress(uint32_t id, BleTransferProgress& progress)
+{
+	lock_guard guard(lock);
+
+	auto found = transfers.find(id);
+	if (found == transfers.end())
+		return false;
+
+	progress = found->second->progress;
+	return true;
+}
+
+bool TransferEngine::Retire(Transfer& transfer)
+{
+	int32_t state = transfer.progress.state;
+	if (state == TRANSFER_STARTING || state == TRANSFER_RUNNING || transfer.inFlight > 0)
+		return false;
+
+	transfers.erase(transfer.progress.transfer);
+	return true;
+}
+
+void TransferEngine::Finish(const shared_ptr<Transfer>& transfer, const BleTransferProgress& progress)
+{
+	//nothing is in flight, the write queue copied every chunk it was given
+	transfer->file.Close();
+	transfer->copy = {};
+
+	if (transfer->handler)
+		transfer->handler(progress);
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "backend.h"
+#include "mapped-file.h"
+#include "write-queue.h"
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+enum TransferState : int32_t
+{
+	//waiting for the mtu
+	TRANSFER_STARTING = 0,
+	TRANSFER_RUNNING = 1,
+	TRANSFER_COMPLETED = 2,
+	TRANSFER_FAILED = 3,
+	TRANSFER_CANCELLED = 4,
+};
+
+struct BleTransferProgress
+{
+	uint32_t transfer = 0;
+	int32_t state = TRANSFER_STARTING;
+
+	uint64_t totalBytes = 0;
+	//handed to the write queue, including the resume offset
+	uint64_t sentBytes = 0;
+	//confirmed by the last acknowledged chunk. after a failure, restart from here
+	uint64_t acknowledgedBytes = 0;
+
+	//achieved since the start, the resume offset not counted
+	double bytesPerSecond = 0;
+
+	uint32_t chunkSize = 0;
+	uint32_t reserved = 0;
+};
+
+struct TransferOptions
+{
+	//chunks handed to the write queue and not completed yet
+	uint32_t window = 8;
+
+	//every ackInterval-th chunk, and the last one, is written with response. the peripheral confirming it confirms
+	//everything before it, since writes on a characteristic are delivered in order
+	uint32_t ackInterval = 16;
+};
+
+using TransferHandler = std::function<void(const BleTransferProgress& progress)>;
+
+//streams a mapped file or a copied buffer to a characteristic in mtu sized chunks through the write queue. progress
+//is reported on every acknowledgement and once more when the transfer ends
+class TransferEngine
+{
+public:
+	using QueryMtu = std::function<void(uint64_t deviceAddress, MtuHandler done)>;
+
+	TransferEngine(QueryMtu queryMtu, WriteScheduler& writes);
+
+	//applies to transfers started afterwards
+	void Configure(const TransferOptions& options);
+
+	//0 if the file can't be opened or offset is past its end
+	uint32_t StartFile(const GattKey& key, const wchar_t* path, uint64_t offset, TransferHandler handler);
+	uint32_t StartBuffer(const GattKey& key, const uint8_t* data, size_t size, uint64_t offset, TransferHandler handler);
+
+	//chunks already queued still complete, the final report follows once they have
+	void Cancel(uint32_t transfer);
+
+	//false once the transfer has ended and its final progress was reported
+	bool Progress(uint32_t transfer, BleTransferProgress& progress);
+
+private:
+	struct Transfer
+	{
+		GattKey key;
+		TransferOptions options;
+		TransferHandler handler;
+
+		//source, either the view or the copy
+		MappedFile file;
+		std::vector<uint8_t> copy;
+		const uint8_t* data = nullptr;
+
+		BleTransferProgress progress;
+		uint64_t startOffset = 0;
+		int64_t started = 0;
+
+		uint64_t completedBytes = 0;
+		uint32_t inFlight = 0;
+		uint32_t sinceAck = 0;
+		//offset of the earliest chunk that failed. chunks queued behind it may still be acknowledged, but the
+		//peripheral never got it, so nothing past it counts as acknowledged
+		uint64_t failedAt = UINT64_MAX;
+
+		//set while one thread hands chunks to the write queue, keeps them in order
+		bool pumping = false;
+	};
+
+	struct Chunk
+	{
+		uint64_t offset;
+		uint32_t size;
+		bool withResponse;
+	};
+
+	uint32_t Start(const std::shared_ptr<Transfer>& transfer, uint64_t offset);
+	void Begin(const std::shared_ptr<Transfer>& transfer, bool success, uint32_t mtu);
+	void Pump(const std::shared_ptr<Transfer>& transfer);
+	void Completed(const std::shared_ptr<Transfer>& transfer, const Chunk& chunk, bool success);
+
+	//callers hold lock. once no chunk is in flight an ended transfer is forgotten, true if that happened
+	bool Retire(Transfer& transfer);
+	//reports the final state and releases the source, without the lock
+	void Finish(const std::shared_ptr<Transfer>& transfer, const BleTransferProgress& progress);
+
+	QueryMtu queryMtu;
+	WriteScheduler& writes;
+
+	std::mutex lock;
+	std::unordered_map<uint32_t, std::shared_ptr<Transfer>> transfers;
+	TransferOptions options;
+	uint32_t nextId = 1;
+};
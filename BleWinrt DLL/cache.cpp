@@ -1,6 +1,8 @@
 #include "stdafx.h"
 #include "carriers.h"
 #include "cache.h"
+#include "gatt-cache.h"
+#include "single-flight.h"
 #include "serialization.h"
 #include "logging.h"
 #include "ble-winrt.h"
@@ -14,46 +16,64 @@
 // implement own caching instead of using the system-provicded cache as there is an AccessDenied error when trying to
 // call GetCharacteristicsAsync on a service for which a reference is hold in global scope
 // cf. https://stackoverflow.com/a/36106137
-map<uint64_t, DeviceCacheEntry> cache;
+//
+// the coroutines below run concurrently on the thread pool, each level lives in its own sharded cache so a hit is a
+// single locked lookup of the level asked for
+GattCache<BluetoothLEDevice> deviceCache;
+GattCache<GattDeviceService> serviceCache;
+GattCache<GattCharacteristic> characteristicCache;
 
+template <typename Value>
+using GattFlights = SingleFlight<GattKey, Value, GattKeyHash>;
 
-IAsyncOperation<BluetoothLEDevice> RetrieveDevice(uint64_t deviceAddress)
-{
-	auto item = cache.find(deviceAddress);
-	if (item != cache.end())
-		co_return item->second.device;
+//misses being resolved, concurrent retrievals of the same key await the first one instead of repeating the round-trip
+GattFlights<BluetoothLEDevice> deviceFlights;
+GattFlights<GattDeviceService> serviceFlights;
+GattFlights<GattCharacteristic> characteristicFlights;
 
-	try
-	{
-		BluetoothLEDevice device = co_await BluetoothLEDevice::FromBluetoothAddressAsync(deviceAddress);
-		if (device == nullptr)
-			co_return nullptr;
 
-		//store in cache
-		cache[deviceAddress] = { device };
+//returns the cached object, otherwise joins the resolution in flight for key or leads a new one
+template <typename Value, typename Resolve>
+IAsyncOperation<Value> Retrieve(GattCache<Value>& cache, GattFlights<Value>& flights, GattKey key, Resolve resolve)
+{
+	Value value = nullptr;
+	if (cache.Find(key, value))
+		co_return value;
 
-		// Wait for the connection to stabilize
-		//co_await winrt::resume_after(std::chrono::milliseconds(100));
+	bool leader = false;
+	auto flight = flights.Join(key, leader);
+	if (!leader)
+		co_return co_await GattFlights<Value>::Wait(flight);
 
-		co_return device;
-	}
-	catch (hresult_error const&)
+	//the previous leader may have finished between the lookup and joining
+	if (!cache.Find(key, value))
 	{
-		co_return nullptr;
+		//the flight has to complete whatever happens, otherwise everyone who joined waits forever
+		try
+		{
+			value = co_await resolve();
+		}
+		catch (hresult_error const& ex)
+		{
+			LogError(L"%s:%d Retrieve catch: %s", __WFILE__, __LINE__, ex.message().c_str());
+			value = nullptr;
+		}
+
+		if (value != nullptr)
+			value = cache.Insert(key, value);
 	}
+
+	flights.Complete(key, flight, value);
+	co_return value;
 }
 
-IAsyncOperation<GattDeviceService> RetrieveService(uint64_t deviceAddress, guid serviceUuid)
+IAsyncOperation<GattDeviceService> ResolveService(uint64_t deviceAddress, guid serviceUuid)
 {
 	//connect to device if not already connected
 	auto device = co_await RetrieveDevice(deviceAddress);
 	if (device == nullptr)
 		co_return nullptr;
 
-	//pull service if present
-	if (cache[deviceAddress].services.count(serviceUuid))
-		co_return cache[deviceAddress].services[serviceUuid].service;
-
 	//get specific service from device
 	GattDeviceServicesResult result = co_await device.GetGattServicesForUuidAsync(serviceUuid, BluetoothCacheMode::Cached);
 
@@ -69,21 +89,15 @@ IAsyncOperation<GattDeviceService> RetrieveService(uint64_t deviceAddress, guid
 		co_return nullptr;
 	}
 
-	//add to cache
-	cache[deviceAddress].services[serviceUuid] = { result.Services().GetAt(0) };
-	co_return cache[deviceAddress].services[serviceUuid].service;
+	co_return result.Services().GetAt(0);
 }
 
-IAsyncOperation<GattCharacteristic> RetrieveCharacteristic(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid)
+IAsyncOperation<GattCharacteristic> ResolveCharacteristic(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid)
 {
 	auto service = co_await RetrieveService(deviceAddress, serviceUuid);
 	if (service == nullptr)
 		co_return nullptr;
 
-	//pull characteristic if present
-	if (cache[deviceAddress].services[serviceUuid].characteristics.count(characteristicUuid))
-		co_return cache[deviceAddress].services[serviceUuid].characteristics[characteristicUuid].characteristic;
-
 	//get specific characteristic from device
 	GattCharacteristicsResult result = co_await service.GetCharacteristicsForUuidAsync(characteristicUuid, BluetoothCacheMode::Cached);
 
@@ -99,37 +113,68 @@ IAsyncOperation<GattCharacteristic> RetrieveCharacteristic(uint64_t deviceAddres
 		co_return nullptr;
 	}
 
-	//add to cache
-	cache[deviceAddress].services[serviceUuid].characteristics[characteristicUuid] = { result.Characteristics().GetAt(0) };
-	co_return cache[deviceAddress].services[serviceUuid].characteristics[characteristicUuid].characteristic;
+	co_return result.Characteristics().GetAt(0);
 }
 
-void RemoveFromCache(uint64_t deviceAddress)
+IAsyncOperation<BluetoothLEDevice> RetrieveDevice(uint64_t deviceAddress)
 {
-	const auto devP = cache.find(deviceAddress);
-	if (devP == cache.end())
-		return;
-
-	// Copying device and services as in Quit function. 
-	auto dev = devP->second;
-	if (dev.device != nullptr)
-		dev.device.Close();
+	return Retrieve(deviceCache, deviceFlights, { deviceAddress }, [deviceAddress]()
+	{
+		// Wait for the connection to stabilize
+		//co_await winrt::resume_after(std::chrono::milliseconds(100));
 
-	for (auto service : dev.services)
-		service.second.service.Close();
+		return BluetoothLEDevice::FromBluetoothAddressAsync(deviceAddress);
+	});
+}
 
-	cache.erase(deviceAddress);
+IAsyncOperation<GattDeviceService> RetrieveService(uint64_t deviceAddress, guid serviceUuid)
+{
+	return Retrieve(serviceCache, serviceFlights, { deviceAddress, serviceUuid }, [deviceAddress, serviceUuid]()
+	{
+		return ResolveService(deviceAddress, serviceUuid);
+	});
 }
 
-void ClearCache()
+//the hot path of every read, write and subscribe
+IAsyncOperation<GattCharacteristic> RetrieveCharacteristic(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid)
 {
-	for (auto device : cache)
+	return Retrieve(characteristicCache, characteristicFlights, { deviceAddress, serviceUuid, characteristicUuid }, [deviceAddress, serviceUuid, characteristicUuid]()
 	{
-		device.second.device.Close();
+		return ResolveCharacteristic(deviceAddress, serviceUuid, characteristicUuid);
+	});
+}
 
-		for (auto service : device.second.services)
-			service.second.service.Close();
-	}
+static void CloseDevice(BluetoothLEDevice& device)
+{
+	if (device != nullptr)
+		device.Close();
+}
 
-	cache.clear();
-}
\ No newline at end of file
+static void CloseService(GattDeviceService& service)
+{
+	if (service != nullptr)
+		service.Close();
+}
+
+vector<GattKey> CachedKeys(uint64_t deviceAddress)
+{
+	vector<GattKey> keys = serviceCache.Keys(deviceAddress);
+	vector<GattKey> characteristics = characteristicCache.Keys(deviceAddress);
+
+	keys.insert(keys.end(), characteristics.begin(), characteristics.end());
+	return keys;
+}
+
+void RemoveFromCache(uint64_t deviceAddress)
+{
+	characteristicCache.EraseDevice(deviceAddress, nullptr);
+	serviceCache.EraseDevice(deviceAddress, CloseService);
+	deviceCache.EraseDevice(deviceAddress, CloseDevice);
+}
+
+void ClearCache()
+{
+	characteristicCache.Clear(nullptr);
+	serviceCache.Clear(CloseService);
+	deviceCache.Clear(CloseDevice);
+}
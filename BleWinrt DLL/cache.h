@@ -1,5 +1,7 @@
 #pragma once
 
+#include "gatt-cache.h"
+
 using namespace std;
 using namespace winrt;
 
@@ -12,27 +14,11 @@ using namespace Windows::Devices::Enumeration;
 using namespace Windows::Storage::Streams;
 
 
-struct CharacteristicCacheEntry
-{
-	GattCharacteristic characteristic = nullptr;
-};
-
-struct ServiceCacheEntry
-{
-	GattDeviceService service = nullptr;
-	map<guid, CharacteristicCacheEntry> characteristics = { };
-};
-
-struct DeviceCacheEntry
-{
-	BluetoothLEDevice device = nullptr;
-	map<guid, ServiceCacheEntry> services = { };
-};
-
-
 IAsyncOperation<BluetoothLEDevice> RetrieveDevice(uint64_t id);
 IAsyncOperation<GattDeviceService> RetrieveService(uint64_t id, guid serviceUuid);
 IAsyncOperation<GattCharacteristic> RetrieveCharacteristic(uint64_t deviceAddress, guid serviceUuid, guid characteristicUuid);
 
+//services first, then characteristics
+vector<GattKey> CachedKeys(uint64_t id);
 void RemoveFromCache(uint64_t id);
 void ClearCache();
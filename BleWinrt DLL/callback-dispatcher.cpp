@@ -0,0 +1,328 @@
+#include "callback-dispatcher.h"
+#include "gatt-cache.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+using namespace std;
+
+
+//set on worker threads, which must not wait for themselves to finish
+thread_local bool onWorker = false;
+
+//set while Pump runs callbacks, a callback pumping again would reorder them
+thread_local bool pumping = false;
+
+CallbackDispatcher::~CallbackDispatcher()
+{
+	Stop();
+
+	//too late to run them
+	for (Queued* queued : deferred)
+		delete queued;
+}
+
+bool CallbackDispatcher::Configure(const DispatcherOptions& options)
+{
+	if (onWorker)
+		return false;
+
+	lock_guard configuring(configureLock);
+
+	vector<unique_ptr<Worker>> next;
+	for (uint32_t i = 0; i < options.threads; i++)
+		next.push_back(make_unique<Worker>(options.queueCapacity > 0 ? options.queueCapacity : 1));
+
+	//the new workers start once the old ones are drained, what is posted meanwhile waits in their queues
+	vector<Worker*> started;
+	for (auto& worker : next)
+		started.push_back(worker.get());
+
+	vector<unique_ptr<Worker>> previous;
+
+	{
+		unique_lock guard(lock);
+		previous.swap(workers);
+		workers.swap(next);
+		running = !workers.empty();
+	}
+
+	//outside the lock, a callback still running on an old worker may post again
+	for (auto& worker : previous)
+	{
+		{
+			lock_guard guard(worker->lock);
+			worker->stop = true;
+		}
+
+		worker->wake.notify_one();
+		worker->thread.join();
+	}
+
+	//configureLock keeps them from being replaced before they run
+	for (uint32_t i = 0; i < started.size(); i++)
+		started[i]->thread = thread(&CallbackDispatcher::Run, this, ref(*started[i]), i, options);
+
+	return true;
+}
+
+void CallbackDispatcher::Stop()
+{
+	Configure(DispatcherOptions());
+}
+
+void CallbackDispatcher::Post(uint64_t deviceAddress, bool droppable, Task task)
+{
+	if (deferring && TryDefer(droppable, task))
+		return;
+
+	Queued* queued = nullptr;
+	bool waited = false;
+
+	while (true)
+	{
+		shared_lock guard(lock);
+
+		if (workers.empty())
+			break;
+
+		Worker& worker = *workers[MixBits(deviceAddress) % workers.size()];
+
+		if (queued == nullptr)
+			queued = new Queued{ move(task), NowMicroseconds(), droppable };
+
+		if (worker.queue.TryPush(queued))
+		{
+			posted++;
+			Wake(worker);
+			return;
+		}
+
+		if (droppable)
+		{
+			dropped++;
+			delete queued;
+			return;
+		}
+
+		//workers waiting on each other's queues could wait forever
+		if (onWorker)
+		{
+			inlined++;
+			break;
+		}
+
+		if (!waited)
+			stalled++;
+
+		waited = true;
+
+		//without the lock, so the workers can be replaced meanwhile
+		guard.unlock();
+		this_thread::yield();
+	}
+
+	if (queued != nullptr)
+	{
+		task = move(queued->task);
+		delete queued;
+	}
+
+	task();
+}
+
+bool CallbackDispatcher::TryDefer(bool droppable, Task& task)
+{
+	lock_guard guard(deferredLock);
+
+	//turned off meanwhile
+	if (!deferring)
+		return false;
+
+	if (droppable)
+	{
+		if (deferredDroppable >= deferredCapacity)
+		{
+			dropped++;
+			return true;
+		}
+
+		deferredDroppable++;
+	}
+
+	deferred.push_back(new Queued{ move(task), NowMicroseconds(), droppable });
+	posted++;
+	return true;
+}
+
+void CallbackDispatcher::Defer(bool enabled, uint32_t capacity)
+{
+	deque<Queued*> remaining;
+
+	{
+		lock_guard guard(deferredLock);
+
+		deferredCapacity = capacity;
+		deferring = enabled;
+
+		if (!enabled)
+		{
+			remaining.swap(deferred);
+			deferredDroppable = 0;
+		}
+	}
+
+	for (Queued* queued : remaining)
+		Execute(queued);
+}
+
+uint32_t CallbackDispatcher::Pump(uint32_t maxMicroseconds)
+{
+	int64_t start = NowMicroseconds();
+	size_t count;
+
+	{
+		lock_guard guard(deferredLock);
+		count = deferred.size();
+	}
+
+	if (pumping)
+		return (uint32_t)count;
+
+	pumping = true;
+
+	//at least one callback per call, so a budget smaller than any callback still makes progress
+	for (size_t i = 0; i < count; i++)
+	{
+		if (i > 0 && maxMicroseconds > 0 && NowMicroseconds() - start >= maxMicroseconds)
+			break;
+
+		Queued* queued;
+
+		{
+			lock_guard guard(deferredLock);
+
+			//Defer(false) ran them meanwhile
+			if (deferred.empty())
+				break;
+
+			queued = deferred.front();
+			deferred.pop_front();
+
+			if (queued->droppable)
+				deferredDroppable--;
+		}
+
+		Execute(queued);
+	}
+
+	pumping = false;
+
+	lock_guard guard(deferredLock);
+	return (uint32_t)deferred.size();
+}
+
+void CallbackDispatcher::Wake(Worker& worker)
+{
+	//pairs with the fence in Run, either the worker sees the task or we see it idle
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (worker.idle.load(memory_order_relaxed))
+	{
+		{
+			lock_guard guard(worker.lock);
+			worker.signaled = true;
+		}
+
+		worker.wake.notify_one();
+	}
+}
+
+void CallbackDispatcher::Run(Worker& worker, [[maybe_unused]] uint32_t index, [[maybe_unused]] DispatcherOptions options)
+{
+	onWorker = true;
+
+#ifdef _WIN32
+	if (options.priority != 0)
+		SetThreadPriority(GetCurrentThread(), options.priority);
+
+	if (options.affinityMask != 0)
+	{
+		//a 32 bit process can't be pinned to cpus past the width of DWORD_PTR
+		vector<uint32_t> cpus;
+		for (uint32_t cpu = 0; cpu < sizeof(DWORD_PTR) * 8; cpu++)
+			if (options.affinityMask & (1ULL << cpu))
+				cpus.push_back(cpu);
+
+		if (!cpus.empty())
+			SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpus[index % cpus.size()]);
+	}
+#endif
+
+	while (true)
+	{
+		Queued* queued;
+		if (worker.queue.TryPop(queued))
+		{
+			Execute(queued);
+			continue;
+		}
+
+		worker.idle.store(true, memory_order_relaxed);
+		atomic_thread_fence(memory_order_seq_cst);
+
+		if (worker.queue.TryPop(queued))
+		{
+			worker.idle.store(false, memory_order_relaxed);
+			Execute(queued);
+			continue;
+		}
+
+		unique_lock guard(worker.lock);
+
+		//nothing is posted to a stopping worker, the queue is drained
+		if (worker.stop)
+			break;
+
+		worker.wake.wait(guard, [&worker]() { return worker.signaled || worker.stop; });
+		worker.signaled = false;
+		worker.idle.store(false, memory_order_relaxed);
+	}
+}
+
+void CallbackDispatcher::Execute(Queued* queued)
+{
+	uint64_t delay = (uint64_t)max<int64_t>(NowMicroseconds() - queued->posted, 0);
+
+	queued->task();
+	delete queued;
+
+	delivered++;
+	totalDelay += delay;
+
+	uint64_t highest = maxDelay.load(memory_order_relaxed);
+	while (delay > highest && !maxDelay.compare_exchange_weak(highest, delay, memory_order_relaxed))
+	{
+	}
+}
+
+void CallbackDispatcher::Stats(BleDispatcherStats& stats)
+{
+	stats.posted = posted;
+	stats.delivered = delivered;
+	stats.dropped = dropped;
+	stats.stalled = stalled;
+	stats.inlined = inlined;
+	stats.totalDelayMicroseconds = totalDelay;
+	stats.maxDelayMicroseconds = maxDelay;
+
+	shared_lock guard(lock);
+
+	stats.threads = (uint32_t)workers.size();
+	for (auto& worker : workers)
+		stats.pending += (uint32_t)worker->queue.Size();
+
+	lock_guard deferredGuard(deferredLock);
+	stats.pending += (uint32_t)deferred.size();
+}
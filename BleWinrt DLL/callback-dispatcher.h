@@ -0,0 +1,139 @@
+#pragma once
+
+#include "platform.h"
+#include "ring-buffer.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+struct BleDispatcherStats
+{
+	uint64_t posted = 0;
+	uint64_t delivered = 0;
+
+	//adverts and notifications dropped because their worker's queue was full
+	uint64_t dropped = 0;
+	//completions that had to wait for room in a full queue
+	uint64_t stalled = 0;
+	//completions posted from a worker to a full queue, run right away instead of waiting
+	uint64_t inlined = 0;
+
+	//time between posting and running, over everything delivered
+	uint64_t totalDelayMicroseconds = 0;
+	uint64_t maxDelayMicroseconds = 0;
+
+	uint32_t threads = 0;
+	//queued on the workers and waiting for Pump
+	uint32_t pending = 0;
+};
+
+struct DispatcherOptions
+{
+	//0 runs every callback on the thread that produced it
+	uint32_t threads = 0;
+	//per worker, rounded up to a power of two
+	uint32_t queueCapacity = 1024;
+
+	//THREAD_PRIORITY_* value, 0 leaves the default
+	int32_t priority = 0;
+	//worker i is pinned to the i-th cpu set in the mask, round robin. 0 leaves the threads unpinned. priority and
+	//affinity are only applied on windows
+	uint64_t affinityMask = 0;
+};
+
+//moves user callbacks off the threads events arrive on. every device maps to one worker, so its callbacks run in
+//the order they were posted, and a slow callback only holds up the devices sharing its worker. each worker drains a
+//bounded lock-free queue and sleeps while it is empty. in deferred mode callbacks wait in a single queue instead,
+//until the host runs them from its own thread with Pump
+class CallbackDispatcher
+{
+public:
+	using Task = std::function<void()>;
+
+	~CallbackDispatcher();
+
+	//finishes everything queued on the old workers before starting the new ones, so each device's callbacks stay in
+	//order. switching to 0 threads runs callbacks posted meanwhile right away, ahead of the old workers' backlog.
+	//false when called from a worker
+	bool Configure(const DispatcherOptions& options);
+
+	//takes precedence over the workers. capacity bounds the droppable callbacks only, completions are always kept.
+	//turning it off runs whatever is still deferred on the calling thread
+	void Defer(bool enabled, uint32_t capacity);
+
+	//runs deferred callbacks on the calling thread until maxMicroseconds are spent, 0 for no limit. callbacks deferred
+	//while pumping wait for the next call. returns how many are still deferred
+	uint32_t Pump(uint32_t maxMicroseconds);
+
+	//false while callbacks run where they are produced
+	bool Running() const
+	{
+		return running || deferring;
+	}
+
+	//runs the task on the device's worker, right away without workers. with a full queue a droppable task is counted
+	//and dropped, any other waits for room so the device's order holds
+	void Post(uint64_t deviceAddress, bool droppable, Task task);
+
+	void Stats(BleDispatcherStats& stats);
+
+private:
+	struct Queued
+	{
+		Task task;
+		int64_t posted;
+		bool droppable;
+	};
+
+	struct Worker
+	{
+		explicit Worker(size_t capacity) : queue(capacity) {}
+
+		RingBuffer<Queued*> queue;
+		std::thread thread;
+
+		//the worker sleeps on wake once it found the queue empty with idle set
+		std::atomic<bool> idle { false };
+		std::mutex lock;
+		std::condition_variable wake;
+		bool signaled = false;
+		bool stop = false;
+	};
+
+	static void Wake(Worker& worker);
+	void Run(Worker& worker, uint32_t index, DispatcherOptions options);
+	void Execute(Queued* queued);
+	void Stop();
+
+	//true if the task was deferred or dropped
+	bool TryDefer(bool droppable, Task& task);
+
+	//held for a whole Configure, one set of workers is replaced at a time
+	std::mutex configureLock;
+
+	//shared by posting threads, exclusive while the workers are replaced
+	std::shared_mutex lock;
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::atomic<bool> running { false };
+
+	std::mutex deferredLock;
+	std::deque<Queued*> deferred;
+	size_t deferredDroppable = 0;
+	size_t deferredCapacity = 0;
+	std::atomic<bool> deferring { false };
+
+	std::atomic<uint64_t> posted { 0 };
+	std::atomic<uint64_t> delivered { 0 };
+	std::atomic<uint64_t> dropped { 0 };
+	std::atomic<uint64_t> stalled { 0 };
+	std::atomic<uint64_t> inlined { 0 };
+	std::atomic<uint64_t> totalDelay { 0 };
+	std::atomic<uint64_t> maxDelay { 0 };
+};
@@ -0,0 +1,608 @@
+#include "capture.h"
+
+#include <filesystem>
+#include <unordered_map>
+#include <unordered_set>
+
+using namespace std;
+
+
+//set on the replay thread, which can't wait for itself to stop
+thread_local bool onReplay = false;
+
+//manufacturer and service data of the advert being captured, laid out as in the file
+thread_local vector<uint8_t> sectionScratch;
+
+CaptureWriter::~CaptureWriter()
+{
+	Close();
+}
+
+bool CaptureWriter::Open(const wchar_t* path)
+{
+	Close();
+
+	file.open(filesystem::path(path), ios::binary | ios::trunc);
+	if (!file)
+		return false;
+
+	CaptureHeader header;
+	header.started = chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+
+	if (!file.write((const char*)&header, sizeof(header)))
+	{
+		file.close();
+		return false;
+	}
+
+	adverts = 0;
+	notifications = 0;
+	dropped = 0;
+	bytesWritten = sizeof(header);
+
+	{
+		lock_guard guard(lock);
+
+		//records appended after the previous capture was closed belong to neither file
+		pending.clear();
+		start = NowMicroseconds();
+		stop = false;
+	}
+
+	writer = thread(&CaptureWriter::Run, this);
+	recording = true;
+	return true;
+}
+
+void CaptureWriter::Close()
+{
+	if (!writer.joinable())
+		return;
+
+	recording = false;
+
+	{
+		lock_guard guard(lock);
+		stop = true;
+	}
+
+	wake.notify_one();
+	writer.join();
+	file.close();
+}
+
+void CaptureWriter::Advert(const AdvertEvent& advert)
+{
+	if (!Recording())
+		return;
+
+	//names are stored as utf-16 code units whatever the size of wchar_t
+	uint16_t name[UINT8_MAX];
+	size_t nameLength = 0;
+	while (nameLength < UINT8_MAX && advert.name[nameLength] != 0)
+	{
+		name[nameLength] = (uint16_t)advert.name[nameLength];
+		nameLength++;
+	}
+
+	CaptureAdvert body;
+	body.timestamp = advert.timestamp;
+	body.signalStrength = advert.signalStrength;
+	body.powerLevel = advert.powerLevel;
+	body.nameLength = (uint16_t)nameLength;
+	body.numServiceUuids = (uint16_t)min(max(advert.numServiceUuids, 0), (int32_t)UINT8_MAX);
+	body.numManufacturerData = (uint16_t)min(max(advert.numManufacturerData, 0), (int32_t)UINT8_MAX);
+	body.numServiceData = (uint8_t)min(max(advert.numServiceData, 0), (int32_t)UINT8_MAX);
+	body.flags = advert.flags;
+
+	sectionScratch.clear();
+
+	auto section = [](const auto& header, const uint8_t* data)
+	{
+		size_t offset = sectionScratch.size();
+		sectionScratch.resize(offset + sizeof(header) + header.size);
+		memcpy(sectionScratch.data() + offset, &header, sizeof(header));
+
+		if (header.size > 0)
+			memcpy(sectionScratch.data() + offset + sizeof(header), data, header.size);
+	};
+
+	for (uint16_t i = 0; i < body.numManufacturerData; i++)
+	{
+		CaptureManufacturerData header;
+		header.companyId = advert.manufacturerData[i].companyId;
+		header.size = (uint16_t)min(advert.manufacturerData[i].size, (uint32_t)UINT16_MAX);
+		section(header, advert.manufacturerData[i].data);
+	}
+
+	for (uint8_t i = 0; i < body.numServiceData; i++)
+	{
+		CaptureServiceData header;
+		header.uuid = advert.serviceData[i].uuid;
+		header.size = (uint16_t)min(advert.serviceData[i].size, (uint32_t)UINT16_MAX);
+		section(header, advert.serviceData[i].data);
+	}
+
+	CaptureRecord record;
+	record.type = CAPTURE_ADVERT;
+	record.device = advert.mac;
+
+	if (Append(record, { { &body, sizeof(body) }, { advert.serviceUuids, body.numServiceUuids * sizeof(guid) }, { name, nameLength * sizeof(uint16_t) }, { sectionScratch.data(), sectionScratch.size() } }))
+		adverts++;
+}
+
+void CaptureWriter::Notification(const GattKey& key, const uint8_t* data, size_t size)
+{
+	if (!Recording())
+		return;
+
+	CaptureNotification body;
+	body.service = key.service;
+	body.characteristic = key.characteristic;
+
+	CaptureRecord record;
+	record.type = CAPTURE_NOTIFICATION;
+	record.device = key.device;
+
+	if (Append(record, { { &body, sizeof(body) }, { data, size } }))
+		notifications++;
+}
+
+bool CaptureWriter::Append(CaptureRecord record, initializer_list<pair<const void*, size_t>> parts)
+{
+	record.size = 0;
+	for (auto& [part, partSize] : parts)
+		record.size += (uint32_t)partSize;
+
+	size_t total = sizeof(record) + record.size;
+
+	bool flush;
+
+	{
+		lock_guard guard(lock);
+
+		if (pending.size() + total > CAPTURE_MAX_PENDING)
+		{
+			dropped++;
+			return false;
+		}
+
+		//taken under the lock, so the records of the file stay in time order
+		record.time = NowMicroseconds() - start;
+
+		size_t offset = pending.size();
+		pending.resize(offset + total);
+
+		uint8_t* out = pending.data() + offset;
+		memcpy(out, &record, sizeof(record));
+		out += sizeof(record);
+
+		for (auto& [part, partSize] : parts)
+		{
+			if (partSize > 0)
+				memcpy(out, part, partSize);
+
+			out += partSize;
+		}
+
+		//only the append that crosses the threshold wakes the writer
+		flush = offset < CAPTURE_FLUSH_BYTES && pending.size() >= CAPTURE_FLUSH_BYTES;
+	}
+
+	if (flush)
+		wake.notify_one();
+
+	return true;
+}
+
+void CaptureWriter::Run()
+{
+	vector<uint8_t> writing;
+	bool stopped = false;
+
+	while (!stopped)
+	{
+		{
+			unique_lock guard(lock);
+
+			wake.wait_for(guard, chrono::milliseconds(CAPTURE_FLUSH_MILLISECONDS), [this]()
+			{
+				return stop || pending.size() >= CAPTURE_FLUSH_BYTES;
+			});
+
+			//both buffers keep their capacity, after a while appending doesn't allocate anymore
+			writing.clear();
+			writing.swap(pending);
+			stopped = stop;
+		}
+
+		if (writing.empty())
+			continue;
+
+		if (file.write((const char*)writing.data(), writing.size()))
+			bytesWritten += writing.size();
+		else
+			dropped++;
+	}
+
+	file.flush();
+}
+
+void CaptureWriter::Stats(BleCaptureStats& stats)
+{
+	stats.adverts = adverts;
+	stats.notifications = notifications;
+	stats.dropped = dropped;
+	stats.bytesWritten = bytesWritten;
+	stats.recording = Recording() ? 1 : 0;
+
+	lock_guard guard(lock);
+	stats.pendingBytes = (uint32_t)pending.size();
+}
+
+
+CaptureReplay::CaptureReplay(AdvertSink advertSink, NotificationSink notificationSink) :
+	advertSink(move(advertSink)), notificationSink(move(notificationSink))
+{
+}
+
+CaptureReplay::~CaptureReplay()
+{
+	Stop();
+}
+
+bool CaptureReplay::Load(const wchar_t* path)
+{
+	if (onReplay)
+		return false;
+
+	Stop();
+
+	devices.clear();
+	characteristics.clear();
+	playable = 0;
+
+	if (!file.Open(path))
+		return false;
+
+	const uint8_t* data = file.Data();
+	size_t size = file.Size();
+
+	CaptureHeader header;
+	if (size < sizeof(header))
+	{
+		file.Close();
+		return false;
+	}
+
+	memcpy(&header, data, sizeof(header));
+	if (header.magic != CAPTURE_MAGIC || header.version != CAPTURE_VERSION)
+	{
+		file.Close();
+		return false;
+	}
+
+	unordered_map<uint64_t, size_t> deviceIndex;
+	unordered_set<GattKey, GattKeyHash> notified;
+
+	auto device = [&](uint64_t mac) -> RecordedDevice&
+	{
+		auto [found, added] = deviceIndex.emplace(mac, devices.size());
+		if (added)
+		{
+			devices.emplace_back();
+			devices.back().mac = mac;
+		}
+
+		return devices[found->second];
+	};
+
+	//every record is checked here, so Play can trust the sizes. a capture cut short by a crash is only missing the end
+	//of its last record, which is left out
+	size_t offset = sizeof(header);
+	bool damaged = false;
+
+	while (offset < size)
+	{
+		CaptureRecord record;
+		if (size - offset < sizeof(record))
+			break;
+
+		memcpy(&record, data + offset, sizeof(record));
+		if (size - offset - sizeof(record) < record.size)
+			break;
+
+		const uint8_t* body = data + offset + sizeof(record);
+
+		if (record.type == CAPTURE_ADVERT)
+		{
+			CaptureAdvert advert;
+			if (record.size < sizeof(advert))
+			{
+				damaged = true;
+				break;
+			}
+
+			memcpy(&advert, body, sizeof(advert));
+
+			size_t used = sizeof(advert) + advert.numServiceUuids * sizeof(guid) + advert.nameLength * sizeof(uint16_t);
+
+			//walks sections of either kind, used ends up past the record if one doesn't fit
+			auto skip = [&](auto section, size_t count)
+			{
+				for (size_t i = 0; i < count && used <= record.size; i++)
+				{
+					if (record.size - used < sizeof(section))
+					{
+						used = SIZE_MAX;
+						return;
+					}
+
+					memcpy(&section, body + used, sizeof(section));
+					used += sizeof(section) + section.size;
+				}
+			};
+
+			skip(CaptureManufacturerData(), advert.numManufacturerData);
+			skip(CaptureServiceData(), advert.numServiceData);
+
+			if (used != record.size)
+			{
+				damaged = true;
+				break;
+			}
+
+			RecordedDevice& recorded = device(record.device);
+			if (recorded.name.empty() && advert.nameLength > 0)
+			{
+				const uint8_t* units = body + sizeof(advert) + advert.numServiceUuids * sizeof(guid);
+				for (uint16_t i = 0; i < advert.nameLength; i++)
+				{
+					uint16_t unit;
+					memcpy(&unit, units + i * sizeof(unit), sizeof(unit));
+					recorded.name.push_back((wchar_t)unit);
+				}
+
+				recorded.signalStrength = advert.signalStrength;
+				recorded.powerLevel = advert.powerLevel;
+			}
+		}
+		else if (record.type == CAPTURE_NOTIFICATION)
+		{
+			CaptureNotification notification;
+			if (record.size < sizeof(notification))
+			{
+				damaged = true;
+				break;
+			}
+
+			memcpy(&notification, body, sizeof(notification));
+			device(record.device);
+
+			GattKey key{ record.device, notification.service, notification.characteristic };
+			if (notified.insert(key).second)
+				characteristics.push_back(key);
+		}
+
+		//records of other types are skipped
+		offset += sizeof(record) + record.size;
+	}
+
+	if (damaged)
+	{
+		devices.clear();
+		characteristics.clear();
+		file.Close();
+		return false;
+	}
+
+	playable = offset;
+	return true;
+}
+
+bool CaptureReplay::Start(double speed, bool loop, FinishedHandler finished)
+{
+	if (onReplay || playable == 0)
+		return false;
+
+	Stop();
+
+	adverts = 0;
+	notifications = 0;
+	unmatched = 0;
+	maxLag = 0;
+	passes = 0;
+
+	stopping = false;
+	running = true;
+	player = thread(&CaptureReplay::Run, this, speed, loop, move(finished));
+	return true;
+}
+
+void CaptureReplay::Stop()
+{
+	{
+		lock_guard guard(lock);
+		stopping = true;
+	}
+
+	wake.notify_one();
+
+	//from the replay thread it only stops, the next Start or the destructor joins it
+	if (player.joinable() && !onReplay)
+		player.join();
+}
+
+void CaptureReplay::Run(double speed, bool loop, FinishedHandler finished)
+{
+	onReplay = true;
+
+	bool completed;
+	do
+	{
+		completed = Play(speed);
+		if (completed)
+			passes++;
+	}
+	while (completed && loop);
+
+	running = false;
+
+	if (completed && finished)
+		finished();
+}
+
+bool CaptureReplay::Play(double speed)
+{
+	const uint8_t* data = file.Data();
+	int64_t start = NowMicroseconds();
+
+	vector<guid> uuids;
+	wstring name;
+	vector<ManufacturerData> manufacturerData;
+	vector<ServiceData> serviceData;
+
+	size_t offset = sizeof(CaptureHeader);
+	while (offset < playable)
+	{
+		CaptureRecord record;
+		memcpy(&record, data + offset, sizeof(record));
+
+		const uint8_t* body = data + offset + sizeof(record);
+		offset += sizeof(record) + record.size;
+
+		if (speed > 0)
+		{
+			int64_t due = start + (int64_t)((double)record.time / speed);
+			if (!WaitUntil(due))
+				return false;
+
+			uint64_t lag = (uint64_t)max<int64_t>(NowMicroseconds() - due, 0);
+			uint64_t highest = maxLag.load(memory_order_relaxed);
+			while (lag > highest && !maxLag.compare_exchange_weak(highest, lag, memory_order_relaxed))
+			{
+			}
+		}
+		else
+		{
+			lock_guard guard(lock);
+			if (stopping)
+				return false;
+		}
+
+		if (record.type == CAPTURE_ADVERT)
+		{
+			CaptureAdvert header;
+			memcpy(&header, body, sizeof(header));
+
+			uuids.resize(header.numServiceUuids);
+			if (header.numServiceUuids > 0)
+				memcpy(uuids.data(), body + sizeof(header), header.numServiceUuids * sizeof(guid));
+
+			const uint8_t* units = body + sizeof(header) + header.numServiceUuids * sizeof(guid);
+
+			name.clear();
+			for (uint16_t i = 0; i < header.nameLength; i++)
+			{
+				uint16_t unit;
+				memcpy(&unit, units + i * sizeof(unit), sizeof(unit));
+				name.push_back((wchar_t)unit);
+			}
+
+			//the section bytes are handed out straight from the mapping
+			const uint8_t* sections = units + header.nameLength * sizeof(uint16_t);
+
+			manufacturerData.resize(header.numManufacturerData);
+			for (auto& section : manufacturerData)
+			{
+				CaptureManufacturerData stored;
+				memcpy(&stored, sections, sizeof(stored));
+
+				section.companyId = stored.companyId;
+				section.data = sections + sizeof(stored);
+				section.size = stored.size;
+				sections += sizeof(stored) + stored.size;
+			}
+
+			serviceData.resize(header.numServiceData);
+			for (auto& section : serviceData)
+			{
+				CaptureServiceData stored;
+				memcpy(&stored, sections, sizeof(stored));
+
+				section.uuid = stored.uuid;
+				section.data = sections + sizeof(stored);
+				section.size = stored.size;
+				sections += sizeof(stored) + stored.size;
+			}
+
+			AdvertEvent advert;
+			advert.mac = record.device;
+			advert.timestamp = header.timestamp;
+			advert.signalStrength = header.signalStrength;
+			advert.powerLevel = header.powerLevel;
+			advert.name = name.c_str();
+			advert.serviceUuids = uuids.data();
+			advert.numServiceUuids = header.numServiceUuids;
+			advert.manufacturerData = manufacturerData.data();
+			advert.numManufacturerData = header.numManufacturerData;
+			advert.serviceData = serviceData.data();
+			advert.numServiceData = header.numServiceData;
+			advert.flags = header.flags;
+
+			advertSink(advert);
+			adverts++;
+		}
+		else if (record.type == CAPTURE_NOTIFICATION)
+		{
+			CaptureNotification header;
+			memcpy(&header, body, sizeof(header));
+
+			GattKey key{ record.device, header.service, header.characteristic };
+
+			//the payload is handed out straight from the mapping
+			if (notificationSink(key, body + sizeof(header), record.size - sizeof(header)))
+				notifications++;
+			else
+				unmatched++;
+		}
+	}
+
+	return true;
+}
+
+bool CaptureReplay::WaitUntil(int64_t due)
+{
+	unique_lock guard(lock);
+
+	while (!stopping)
+	{
+		int64_t remaining = due - NowMicroseconds();
+		if (remaining <= 0)
+			return true;
+
+		//sleeps are only good to a millisecond or so, the last stretch is spent yielding
+		if (remaining > 2000)
+		{
+			wake.wait_for(guard, chrono::microseconds(remaining - 1000));
+		}
+		else
+		{
+			guard.unlock();
+			this_thread::yield();
+			guard.lock();
+		}
+	}
+
+	return false;
+}
+
+void CaptureReplay::Stats(BleReplayStats& stats)
+{
+	stats.adverts = adverts;
+	stats.notifications = notifications;
+	stats.unmatched = unmatched;
+	stats.maxLagMicroseconds = maxLag;
+	stats.running = running ? 1 : 0;
+	stats.passes = passes;
+}
@@ -0,0 +1,228 @@
+#pragma once
+
+#include "backend.h"
+#include "gatt-cache.h"
+#include "mapped-file.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <initializer_list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+//append-only log of adverts and notifications as the backend reported them. the file is a header followed by records
+//back to back, each a CaptureRecord and its body. records carry no alignment guarantee and nothing in them is a
+//pointer, they are copied out field by field when read
+
+const uint32_t CAPTURE_MAGIC = 0x50434242; //"BBCP"
+const uint32_t CAPTURE_VERSION = 2;
+
+struct CaptureHeader
+{
+	uint32_t magic = CAPTURE_MAGIC;
+	uint32_t version = CAPTURE_VERSION;
+
+	//unix time in microseconds the capture started at, for reference only
+	int64_t started = 0;
+};
+
+enum CaptureRecordType : uint16_t
+{
+	//body is a CaptureAdvert, then numServiceUuids guids, nameLength utf-16 units, numManufacturerData sections each a
+	//CaptureManufacturerData and its bytes, and numServiceData sections each a CaptureServiceData and its bytes
+	CAPTURE_ADVERT = 1,
+	//body is a CaptureNotification, then the payload
+	CAPTURE_NOTIFICATION = 2,
+};
+
+struct CaptureRecord
+{
+	uint16_t type = 0;
+	uint16_t reserved = 0;
+	//bytes of the body following the record
+	uint32_t size = 0;
+
+	//microseconds since the capture started
+	int64_t time = 0;
+	uint64_t device = 0;
+};
+
+struct CaptureAdvert
+{
+	int64_t timestamp = 0;
+	int32_t signalStrength = 0;
+	int32_t powerLevel = 0;
+
+	uint16_t nameLength = 0;
+	uint16_t numServiceUuids = 0;
+	uint16_t numManufacturerData = 0;
+	uint8_t numServiceData = 0;
+	uint8_t flags = 0;
+};
+
+struct CaptureManufacturerData
+{
+	uint16_t companyId = 0;
+	uint16_t size = 0;
+};
+
+struct CaptureServiceData
+{
+	guid uuid {};
+	uint16_t size = 0;
+	uint16_t reserved = 0;
+};
+
+struct CaptureNotification
+{
+	guid service {};
+	guid characteristic {};
+};
+
+struct BleCaptureStats
+{
+	uint64_t adverts = 0;
+	uint64_t notifications = 0;
+
+	//records lost because the writer fell more than CAPTURE_MAX_PENDING bytes behind, and buffers the file refused
+	uint64_t dropped = 0;
+	uint64_t bytesWritten = 0;
+
+	uint32_t recording = 0;
+	uint32_t pendingBytes = 0;
+};
+
+struct BleReplayStats
+{
+	uint64_t adverts = 0;
+	//notifications of characteristics nobody is subscribed to are counted as unmatched instead
+	uint64_t notifications = 0;
+	uint64_t unmatched = 0;
+
+	//how far delivery fell behind the recorded timing, when the consumers can't keep up with the speed
+	uint64_t maxLagMicroseconds = 0;
+
+	uint32_t running = 0;
+	//passes over the whole file completed so far
+	uint32_t passes = 0;
+};
+
+//the event threads only append to a buffer, a writer thread hands it to the file once it reaches CAPTURE_FLUSH_BYTES
+//or every CAPTURE_FLUSH_MILLISECONDS
+const size_t CAPTURE_FLUSH_BYTES = 64 * 1024;
+const int CAPTURE_FLUSH_MILLISECONDS = 100;
+const size_t CAPTURE_MAX_PENDING = 8 * 1024 * 1024;
+
+class CaptureWriter
+{
+public:
+	~CaptureWriter();
+
+	//truncates the file, closes the previous capture first
+	bool Open(const wchar_t* path);
+	//writes whatever is still buffered
+	void Close();
+
+	bool Recording() const
+	{
+		return recording.load(std::memory_order_relaxed);
+	}
+
+	void Advert(const AdvertEvent& advert);
+	void Notification(const GattKey& key, const uint8_t* data, size_t size);
+
+	void Stats(BleCaptureStats& stats);
+
+private:
+	//false if the writer is too far behind, the record is dropped
+	bool Append(CaptureRecord record, std::initializer_list<std::pair<const void*, size_t>> parts);
+	void Run();
+
+	std::atomic<bool> recording { false };
+
+	std::mutex lock;
+	std::condition_variable wake;
+	//guarded by lock
+	int64_t start = 0;
+	std::vector<uint8_t> pending;
+	bool stop = false;
+
+	//owned by the writer thread while recording
+	std::ofstream file;
+	std::thread writer;
+
+	std::atomic<uint64_t> adverts { 0 };
+	std::atomic<uint64_t> notifications { 0 };
+	std::atomic<uint64_t> dropped { 0 };
+	std::atomic<uint64_t> bytesWritten { 0 };
+};
+
+//plays a capture back through the handlers the backend would have called, from its own thread. the file is mapped and
+//checked as a whole by Load, playing it back allocates nothing but the strings of adverts
+class CaptureReplay
+{
+public:
+	using AdvertSink = std::function<void(const AdvertEvent& advert)>;
+	//false if nobody is subscribed to the characteristic
+	using NotificationSink = std::function<bool(const GattKey& key, const uint8_t* data, size_t size)>;
+	using FinishedHandler = std::function<void()>;
+
+	struct RecordedDevice
+	{
+		uint64_t mac = 0;
+		//of its first advert
+		std::wstring name;
+		int32_t signalStrength = 0;
+		int32_t powerLevel = 0;
+	};
+
+	CaptureReplay(AdvertSink advertSink, NotificationSink notificationSink);
+	~CaptureReplay();
+
+	//stops the current replay. false if the file is missing or isn't a complete capture
+	bool Load(const wchar_t* path);
+
+	//what Load found, every device that advertised or notified and every characteristic that notified
+	const std::vector<RecordedDevice>& Devices() const { return devices; }
+	const std::vector<GattKey>& Characteristics() const { return characteristics; }
+
+	//speed 1 keeps the recorded timing, 2 plays twice as fast, 0 as fast as the sinks take it. finished is called on
+	//the replay thread once the file was played to its end, never with loop set. false if nothing is loaded, or
+	//when called from a sink or finished
+	bool Start(double speed, bool loop, FinishedHandler finished);
+	void Stop();
+
+	void Stats(BleReplayStats& stats);
+
+private:
+	void Run(double speed, bool loop, FinishedHandler finished);
+	bool Play(double speed);
+
+	//waits until NowMicroseconds() reaches due, false if stopped meanwhile
+	bool WaitUntil(int64_t due);
+
+	AdvertSink advertSink;
+	NotificationSink notificationSink;
+
+	MappedFile file;
+	//bytes up to the end of the last complete record
+	size_t playable = 0;
+	std::vector<RecordedDevice> devices;
+	std::vector<GattKey> characteristics;
+
+	std::thread player;
+	std::mutex lock;
+	std::condition_variable wake;
+	bool stopping = false;
+
+	std::atomic<bool> running { false };
+	std::atomic<uint64_t> adverts { 0 };
+	std::atomic<uint64_t> notifications { 0 };
+	std::atomic<uint64_t> unmatched { 0 };
+	std::atomic<uint64_t> maxLag { 0 };
+	std::atomic<uint32_t> passes { 0 };
+};
@@ -6,6 +6,10 @@ using namespace winrt::Windows::Devices::Bluetooth::GenericAttributeProfile;
 const int NAME_SIZE = 128;
 const int DESCRIPTION_SIZE = 128;
 
+const int RECORD_NAME_SIZE = 32;
+const int RECORD_SERVICE_UUIDS = 4;
+const int RECORD_SECTION_BYTES = 64;
+
 struct BleAdvert
 {
 	uint64_t mac = 0;
@@ -17,8 +21,41 @@ struct BleAdvert
 	int32_t signalStrength = 0;
 	int32_t powerLevel = 0; //16-bit is enough, but 32 for C# serialization
 
-	guid *serviceUuids;
+	const guid* serviceUuids = nullptr;
 	int32_t numServiceUuids = 0; //8-bit is enough, but 32 for C# serialization
+
+	//flags, manufacturer and service data as laid out by WriteAdvertSections, borrowed like the uuids
+	const uint8_t* sections = nullptr;
+	int32_t sectionBytes = 0;
+};
+
+//compact advert stored in the advert queue and drained in bulk through PollAdverts
+struct BleAdvertRecord
+{
+	uint64_t mac = 0;
+	int64_t timestamp = 0;
+
+	int32_t signalStrength = 0;
+	int32_t powerLevel = 0;
+
+	//total count in the advert, only the first RECORD_SERVICE_UUIDS are stored inline
+	int32_t numServiceUuids = 0;
+	guid serviceUuids[RECORD_SERVICE_UUIDS];
+
+	//truncated local name, legacy adverts can't carry more anyway
+	wchar_t name[RECORD_NAME_SIZE];
+
+	//as in BleAdvert, sections that don't fit are left out whole
+	int32_t sectionBytes = 0;
+	uint8_t sections[RECORD_SECTION_BYTES];
+};
+
+struct BleQueueStats
+{
+	uint64_t enqueued = 0;
+	uint64_t dropped = 0;
+	uint32_t capacity = 0;
+	uint32_t pending = 0;
 };
 
 struct BleService
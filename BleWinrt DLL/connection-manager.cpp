@@ -0,0 +1,352 @@
+#include "connection-manager.h"
+
+#include <algorithm>
+
+using namespace std;
+
+
+ConnectionManager::ConnectionManager(ConnectFunction connect, ResolveFunction resolve, RearmFunction rearm, StateHandler changed) :
+	connect(move(connect)), resolve(move(resolve)), rearm(move(rearm)), changed(move(changed))
+{
+}
+
+ConnectionManager::~ConnectionManager()
+{
+	Clear();
+}
+
+void ConnectionManager::Configure(const BleReconnectPolicy& policy)
+{
+	lock_guard guard(lock);
+
+	this->policy = policy;
+	this->policy.multiplier = max(policy.multiplier, 1.0f);
+	this->policy.jitter = min(max(policy.jitter, 0.0f), 1.0f);
+	this->policy.maxDelayMilliseconds = max(policy.maxDelayMilliseconds, policy.initialDelayMilliseconds);
+}
+
+void ConnectionManager::Manage(uint64_t device, vector<GattKey> warm)
+{
+	{
+		lock_guard guard(lock);
+
+		auto [found, added] = links.try_emplace(device);
+		Link& link = found->second;
+		link.warm = move(warm);
+
+		if (!added && link.state != LINK_FAILED)
+			return;
+
+		link.state = LINK_CONNECTING;
+		link.generation = ++nextGeneration;
+		link.attempts = 0;
+		link.lostAt = 0;
+
+		Schedule(device, link, 0);
+	}
+
+	changed(device, LINK_CONNECTING, 0);
+}
+
+bool ConnectionManager::Release(uint64_t device)
+{
+	lock_guard guard(lock);
+
+	//attempts in flight find no link when they complete
+	return links.erase(device) > 0;
+}
+
+bool ConnectionManager::LinkLost(uint64_t device)
+{
+	{
+		lock_guard guard(lock);
+
+		auto found = links.find(device);
+		if (found == links.end())
+			return false;
+
+		Link& link = found->second;
+
+		if (link.state == LINK_CONNECTING || link.state == LINK_RECONNECTING)
+		{
+			//the attempt in flight may have connected just before, its result can't be trusted
+			link.generation = ++nextGeneration;
+			Schedule(device, link, RetryDelay(link.attempts));
+			return true;
+		}
+
+		if (link.state != LINK_CONNECTED)
+			return true;
+
+		link.state = LINK_RECONNECTING;
+		link.generation = ++nextGeneration;
+		link.attempts = 0;
+		link.lostAt = NowMicroseconds();
+		link.stats.drops++;
+
+		Schedule(device, link, 0);
+	}
+
+	changed(device, LINK_RECONNECTING, 0);
+	return true;
+}
+
+bool ConnectionManager::Stats(uint64_t device, BleLinkStats& stats)
+{
+	lock_guard guard(lock);
+
+	auto found = links.find(device);
+	if (found == links.end())
+		return false;
+
+	Snapshot(device, found->second, stats);
+	return true;
+}
+
+size_t ConnectionManager::Snapshot(BleLinkStats* buffer, size_t maxCount)
+{
+	lock_guard guard(lock);
+
+	if (buffer == nullptr)
+		return links.size();
+
+	size_t written = 0;
+
+	for (auto& [device, link] : links)
+	{
+		if (written == maxCount)
+			break;
+
+		Snapshot(device, link, buffer[written++]);
+	}
+
+	return written;
+}
+
+void ConnectionManager::Snapshot(uint64_t device, const Link& link, BleLinkStats& stats)
+{
+	stats = link.stats;
+	stats.device = device;
+	stats.state = link.state;
+	stats.attempts = link.attempts;
+	stats.meanReconnect = link.stats.reconnects > 0 ? link.totalReconnect / link.stats.reconnects : 0;
+}
+
+void ConnectionManager::Clear()
+{
+	thread stopped;
+
+	{
+		lock_guard guard(lock);
+
+		workerGeneration++;
+		stopped = move(worker);
+
+		links.clear();
+		attempts = {};
+	}
+
+	wake.notify_all();
+
+	if (!stopped.joinable())
+		return;
+
+	//a state handler may end up here on the worker itself, it exits once the handler returns
+	if (stopped.get_id() == this_thread::get_id())
+		stopped.detach();
+	else
+		stopped.join();
+}
+
+void ConnectionManager::Schedule(uint64_t device, const Link& link, int64_t delayMicroseconds)
+{
+	attempts.push({ NowMicroseconds() + delayMicroseconds, device, link.generation });
+
+	if (!worker.joinable())
+		worker = thread(&ConnectionManager::Run, this, workerGeneration);
+
+	//a worker Clear stopped may still be waiting too
+	wake.notify_all();
+}
+
+int64_t ConnectionManager::RetryDelay(uint32_t failures)
+{
+	if (failures == 0)
+		return 0;
+
+	double delay = policy.initialDelayMilliseconds;
+	for (uint32_t i = 1; i < failures && delay < policy.maxDelayMilliseconds; i++)
+		delay *= policy.multiplier;
+
+	delay = min(delay, (double)policy.maxDelayMilliseconds);
+	delay *= 1.0 - policy.jitter * uniform_real_distribution<double>(0.0, 1.0)(random);
+
+	return (int64_t)(delay * 1000.0);
+}
+
+ConnectionManager::Link* ConnectionManager::Find(uint64_t device, uint64_t generation)
+{
+	auto found = links.find(device);
+	if (found == links.end() || found->second.generation != generation)
+		return nullptr;
+
+	return &found->second;
+}
+
+void ConnectionManager::Run(uint64_t generation)
+{
+	unique_lock guard(lock);
+
+	while (workerGeneration == generation)
+	{
+		if (attempts.empty())
+		{
+			wake.wait(guard);
+			continue;
+		}
+
+		int64_t wait = attempts.top().due - NowMicroseconds();
+		if (wait > 0)
+		{
+			wake.wait_for(guard, chrono::microseconds(wait));
+			continue;
+		}
+
+		Attempt attempt = attempts.top();
+		attempts.pop();
+
+		Link* link = Find(attempt.device, attempt.generation);
+		if (link == nullptr)
+			continue;
+
+		link->attempts++;
+
+		//the backend may complete right away, on this thread
+		guard.unlock();
+
+		connect(attempt.device, [this, attempt](bool success)
+		{
+			Connected(attempt.device, attempt.generation, success);
+		});
+
+		guard.lock();
+	}
+}
+
+void ConnectionManager::Connected(uint64_t device, uint64_t generation, bool success)
+{
+	if (!success)
+	{
+		Failed(device, generation);
+		return;
+	}
+
+	vector<GattKey> warm;
+
+	{
+		lock_guard guard(lock);
+
+		Link* link = Find(device, generation);
+		if (link == nullptr)
+			return;
+
+		warm = link->warm;
+	}
+
+	if (warm.empty())
+	{
+		Resolved(device, generation, true);
+		return;
+	}
+
+	CompletionHandler resolved = JoinCompletions(warm.size(), [this, device, generation](bool success)
+	{
+		Resolved(device, generation, success);
+	});
+
+	for (auto& key : warm)
+		resolve(key, resolved);
+}
+
+void ConnectionManager::Resolved(uint64_t device, uint64_t generation, bool success)
+{
+	if (!success)
+	{
+		Failed(device, generation);
+		return;
+	}
+
+	size_t rearmed = rearm(device, [this, device, generation](bool success)
+	{
+		Rearmed(device, generation, success);
+	});
+
+	lock_guard guard(lock);
+
+	if (Link* link = Find(device, generation))
+		link->stats.rearmed += rearmed;
+}
+
+void ConnectionManager::Rearmed(uint64_t device, uint64_t generation, bool success)
+{
+	if (!success)
+	{
+		Failed(device, generation);
+		return;
+	}
+
+	int64_t elapsed = 0;
+
+	{
+		lock_guard guard(lock);
+
+		Link* link = Find(device, generation);
+		if (link == nullptr)
+			return;
+
+		link->state = LINK_CONNECTED;
+		link->attempts = 0;
+
+		if (link->lostAt != 0)
+		{
+			elapsed = NowMicroseconds() - link->lostAt;
+			link->lostAt = 0;
+
+			link->stats.reconnects++;
+			link->stats.lastReconnect = (uint64_t)elapsed;
+			link->stats.maxReconnect = max(link->stats.maxReconnect, (uint64_t)elapsed);
+			link->totalReconnect += (uint64_t)elapsed;
+		}
+	}
+
+	changed(device, LINK_CONNECTED, elapsed);
+}
+
+void ConnectionManager::Failed(uint64_t device, uint64_t generation)
+{
+	int64_t elapsed = 0;
+
+	{
+		lock_guard guard(lock);
+
+		Link* link = Find(device, generation);
+		if (link == nullptr)
+			return;
+
+		link->stats.failedAttempts++;
+
+		if (policy.maxAttempts == 0 || link->attempts < policy.maxAttempts)
+		{
+			Schedule(device, *link, RetryDelay(link->attempts));
+			return;
+		}
+
+		link->state = LINK_FAILED;
+		link->generation = ++nextGeneration;
+
+		if (link->lostAt != 0)
+			elapsed = NowMicroseconds() - link->lostAt;
+	}
+
+	changed(device, LINK_FAILED, elapsed);
+}
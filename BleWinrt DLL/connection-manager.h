@@ -0,0 +1,163 @@
+#pragma once
+
+#include "backend.h"
+#include "gatt-cache.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+enum LinkState : int32_t
+{
+	LINK_DISCONNECTED = 0,
+	//first connect of a managed device
+	LINK_CONNECTING = 1,
+	//connected, warm characteristics resolved and subscriptions armed
+	LINK_CONNECTED = 2,
+	//lost, waiting out the backoff or trying again
+	LINK_RECONNECTING = 3,
+	//gave up after maxAttempts, managing the device again starts over
+	LINK_FAILED = 4,
+};
+
+//a characteristic to resolve after every connect
+struct BleCharacteristicKey
+{
+	guid service {};
+	guid characteristic {};
+};
+
+struct BleReconnectPolicy
+{
+	//wait after the first failed attempt, the first one after a drop starts right away
+	uint32_t initialDelayMilliseconds = 200;
+	uint32_t maxDelayMilliseconds = 30000;
+	//every further failed attempt multiplies the wait
+	float multiplier = 2.0f;
+	//fraction of the wait drawn at random, so devices dropped together don't retry in lockstep. 1 waits anywhere
+	//from 0 to the full wait
+	float jitter = 0.5f;
+	//attempts per drop before giving up, 0 retries forever
+	uint32_t maxAttempts = 0;
+};
+
+struct BleLinkStats
+{
+	uint64_t device = 0;
+	int32_t state = LINK_DISCONNECTED;
+	//attempts of the connect under way
+	uint32_t attempts = 0;
+
+	uint64_t drops = 0;
+	uint64_t reconnects = 0;
+	uint64_t failedAttempts = 0;
+	//subscriptions armed again over all reconnects
+	uint64_t rearmed = 0;
+
+	//from the drop to connected again with everything resolved and armed, in microseconds
+	uint64_t lastReconnect = 0;
+	uint64_t meanReconnect = 0;
+	uint64_t maxReconnect = 0;
+};
+
+//keeps the links of managed devices up. a device is connected right away and, whenever the backend reports its link
+//lost, connected again with exponential backoff and jitter between failed attempts. after every connect the warm
+//characteristics are resolved and the subscriptions of the device are armed again before it counts as connected.
+//attempts are started from a thread of its own, started with the first device managed and stopped by Clear
+class ConnectionManager
+{
+public:
+	using ConnectFunction = std::function<void(uint64_t device, CompletionHandler done)>;
+	using ResolveFunction = std::function<void(const GattKey& key, CompletionHandler done)>;
+	//subscribes the device's characteristics again, returns how many
+	using RearmFunction = std::function<size_t(uint64_t device, CompletionHandler done)>;
+	//reconnectMicroseconds is the time since the drop when reaching LINK_CONNECTED or LINK_FAILED after one, else 0
+	using StateHandler = std::function<void(uint64_t device, LinkState state, int64_t reconnectMicroseconds)>;
+
+	ConnectionManager(ConnectFunction connect, ResolveFunction resolve, RearmFunction rearm, StateHandler changed);
+	~ConnectionManager();
+
+	//applies to the next wait
+	void Configure(const BleReconnectPolicy& policy);
+
+	//starts connecting unless the device is managed already, a failed one starts over. the warm list replaces the
+	//previous one and is resolved from the next connect on
+	void Manage(uint64_t device, std::vector<GattKey> warm);
+	//stops reconnecting the device, leaves the link as it is. false if it wasn't managed
+	bool Release(uint64_t device);
+
+	//the backend lost the link, false if the device isn't managed
+	bool LinkLost(uint64_t device);
+
+	bool Stats(uint64_t device, BleLinkStats& stats);
+	//returns the number of devices written, or the number managed if buffer is null
+	size_t Snapshot(BleLinkStats* buffer, size_t maxCount);
+
+	//releases every device and stops the thread, attempts still in flight are ignored when they complete
+	void Clear();
+
+private:
+	struct Link
+	{
+		LinkState state = LINK_CONNECTING;
+		std::vector<GattKey> warm;
+
+		//taken from nextGeneration when a drop or Manage makes the attempt in flight obsolete, so attempts of a
+		//released device never match the link it is managed with again
+		uint64_t generation = 0;
+		uint32_t attempts = 0;
+		//NowMicroseconds() of the drop being recovered from, 0 while connected
+		int64_t lostAt = 0;
+
+		BleLinkStats stats;
+		uint64_t totalReconnect = 0;
+	};
+
+	struct Attempt
+	{
+		int64_t due;
+		uint64_t device;
+		uint64_t generation;
+
+		bool operator>(const Attempt& other) const
+		{
+			return due > other.due;
+		}
+	};
+
+	//exits once Clear moved past its generation
+	void Run(uint64_t generation);
+
+	//the stages of an attempt, each one's completion starts the next
+	void Connected(uint64_t device, uint64_t generation, bool success);
+	void Resolved(uint64_t device, uint64_t generation, bool success);
+	void Rearmed(uint64_t device, uint64_t generation, bool success);
+	void Failed(uint64_t device, uint64_t generation);
+
+	//callers hold lock for everything below
+	Link* Find(uint64_t device, uint64_t generation);
+	void Schedule(uint64_t device, const Link& link, int64_t delayMicroseconds);
+	int64_t RetryDelay(uint32_t failures);
+	static void Snapshot(uint64_t device, const Link& link, BleLinkStats& stats);
+
+	ConnectFunction connect;
+	ResolveFunction resolve;
+	RearmFunction rearm;
+	StateHandler changed;
+
+	std::mutex lock;
+	std::condition_variable wake;
+	std::thread worker;
+	uint64_t workerGeneration = 0;
+
+	BleReconnectPolicy policy;
+	std::mt19937_64 random { std::random_device()() };
+
+	std::unordered_map<uint64_t, Link> links;
+	uint64_t nextGeneration = 0;
+	std::priority_queue<Attempt, std::vector<Attempt>, std::greater<Attempt>> attempts;
+};
@@ -0,0 +1,133 @@
+#include "device-table.h"
+
+#include <algorithm>
+
+using namespace std;
+
+
+static void CopyName(wchar_t* destination, size_t size, const wchar_t* source)
+{
+	size_t i = 0;
+	for (; i + 1 < size && source[i] != 0; i++)
+		destination[i] = source[i];
+
+	destination[i] = 0;
+}
+
+
+void DeviceTable::Configure(uint32_t maxDevices, float smoothing)
+{
+	lock_guard guard(lock);
+
+	this->maxDevices = max(maxDevices, 1u);
+	this->smoothing = smoothing > 0 && smoothing <= 1 ? smoothing : 0.25f;
+
+	while (devices.size() > this->maxDevices)
+		EvictOldest();
+}
+
+void DeviceTable::Clear()
+{
+	lock_guard guard(lock);
+
+	devices.clear();
+	changed.clear();
+}
+
+void DeviceTable::EvictOldest()
+{
+	auto oldest = devices.begin();
+	for (auto it = devices.begin(); it != devices.end(); it++)
+		if (it->second.state.lastSeen < oldest->second.state.lastSeen)
+			oldest = it;
+
+	//a pending change of the evicted device is skipped when draining
+	devices.erase(oldest);
+}
+
+void DeviceTable::Merge(const AdvertEvent& advert)
+{
+	lock_guard guard(lock);
+
+	auto it = devices.find(advert.mac);
+	if (it == devices.end())
+	{
+		if (devices.size() >= maxDevices)
+			EvictOldest();
+
+		it = devices.emplace(advert.mac, Entry()).first;
+
+		BleDeviceState& state = it->second.state;
+		state.mac = advert.mac;
+		state.firstSeen = advert.timestamp;
+		state.smoothedSignalStrength = (float)advert.signalStrength;
+		state.name[0] = 0;
+	}
+
+	Entry& entry = it->second;
+	BleDeviceState& state = entry.state;
+
+	state.lastSeen = advert.timestamp;
+	state.advertCount++;
+
+	state.signalStrength = advert.signalStrength;
+	state.smoothedSignalStrength += smoothing * (advert.signalStrength - state.smoothedSignalStrength);
+
+	//not every advert carries everything, keep what was seen last
+	if (advert.powerLevel != 0)
+		state.powerLevel = advert.powerLevel;
+
+	if (advert.name != nullptr && advert.name[0] != 0)
+		CopyName(state.name, DEVICE_NAME_SIZE, advert.name);
+
+	for (int32_t i = 0; i < advert.numServiceUuids && state.numServiceUuids < DEVICE_SERVICE_UUIDS; i++)
+	{
+		guid* end = state.serviceUuids + state.numServiceUuids;
+		if (find(state.serviceUuids, end, advert.serviceUuids[i]) == end)
+			state.serviceUuids[state.numServiceUuids++] = advert.serviceUuids[i];
+	}
+
+	if (!entry.dirty)
+	{
+		entry.dirty = true;
+		changed.push_back(advert.mac);
+	}
+}
+
+int32_t DeviceTable::Changes(BleDeviceState* buffer, int32_t maxCount)
+{
+	lock_guard guard(lock);
+
+	int32_t count = 0;
+	size_t consumed = 0;
+
+	for (; consumed < changed.size() && count < maxCount; consumed++)
+	{
+		auto it = devices.find(changed[consumed]);
+		if (it == devices.end() || !it->second.dirty)
+			continue;
+
+		it->second.dirty = false;
+		buffer[count++] = it->second.state;
+	}
+
+	changed.erase(changed.begin(), changed.begin() + consumed);
+	return count;
+}
+
+int32_t DeviceTable::Snapshot(BleDeviceState* buffer, int32_t maxCount)
+{
+	lock_guard guard(lock);
+
+	int32_t count = 0;
+	for (auto it = devices.begin(); it != devices.end() && count < maxCount; it++)
+		buffer[count++] = it->second.state;
+
+	return count;
+}
+
+int32_t DeviceTable::Count()
+{
+	lock_guard guard(lock);
+	return (int32_t)devices.size();
+}
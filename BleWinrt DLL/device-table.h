@@ -0,0 +1,65 @@
+#pragma once
+
+#include "backend.h"
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+const int DEVICE_NAME_SIZE = 32;
+const int DEVICE_SERVICE_UUIDS = 8;
+
+//latest known state of one advertiser, handed out by GetDeviceChanges/GetDeviceSnapshot
+struct BleDeviceState
+{
+	uint64_t mac = 0;
+
+	//advert timestamps, same unit as BleAdvert::timestamp
+	int64_t firstSeen = 0;
+	int64_t lastSeen = 0;
+	uint32_t advertCount = 0;
+
+	int32_t signalStrength = 0;
+	float smoothedSignalStrength = 0;
+	int32_t powerLevel = 0;
+
+	//union of all service uuids seen so far
+	int32_t numServiceUuids = 0;
+	guid serviceUuids[DEVICE_SERVICE_UUIDS];
+
+	//last non-empty local name, usually from a scan response
+	wchar_t name[DEVICE_NAME_SIZE];
+};
+
+//merges adverts per mac in place so consumers only see what changed instead of every packet
+class DeviceTable
+{
+public:
+	//maxDevices bounds memory, the least recently seen device is evicted when full.
+	//smoothing is the weight of a new rssi sample in the exponential moving average
+	void Configure(uint32_t maxDevices, float smoothing);
+	void Clear();
+
+	void Merge(const AdvertEvent& advert);
+
+	//copies devices updated since the previous call, devices that don't fit stay pending for the next call
+	int32_t Changes(BleDeviceState* buffer, int32_t maxCount);
+	int32_t Snapshot(BleDeviceState* buffer, int32_t maxCount);
+	int32_t Count();
+
+private:
+	struct Entry
+	{
+		BleDeviceState state;
+		bool dirty = false;
+	};
+
+	void EvictOldest();
+
+	std::mutex lock;
+	std::unordered_map<uint64_t, Entry> devices;
+	std::vector<uint64_t> changed;
+
+	uint32_t maxDevices = 1024;
+	float smoothing = 0.25f;
+};
@@ -0,0 +1,285 @@
+#include "framing.h"
+
+#include <algorithm>
+
+using namespace std;
+
+
+void FragmentMessage(const uint8_t* data, size_t size, size_t maxFragment, uint8_t messageId, vector<vector<uint8_t>>& fragments)
+{
+	//the first fragment carries at least one byte after its header
+	maxFragment = max(maxFragment, FRAME_FIRST_HEADER_SIZE + 1);
+	messageId &= FRAME_MESSAGE_MASK;
+
+	size_t offset = 0;
+	uint8_t index = 0;
+
+	do
+	{
+		bool first = offset == 0;
+		size_t header = first ? FRAME_FIRST_HEADER_SIZE : FRAME_HEADER_SIZE;
+		size_t payload = min(maxFragment - header, size - offset);
+		bool last = offset + payload == size;
+
+		//each fragment is built in the buffer the write queue keeps, the only copy of the caller's data
+		vector<uint8_t> fragment(header + payload);
+		fragment[0] = (uint8_t)(messageId | (first ? FRAME_FIRST : 0) | (last ? FRAME_LAST : 0));
+		fragment[1] = index++;
+
+		if (first)
+		{
+			fragment[2] = (uint8_t)size;
+			fragment[3] = (uint8_t)(size >> 8);
+			fragment[4] = (uint8_t)(size >> 16);
+			fragment[5] = (uint8_t)(size >> 24);
+		}
+
+		if (payload > 0)
+			memcpy(fragment.data() + header, data + offset, payload);
+
+		fragments.push_back(move(fragment));
+		offset += payload;
+	} while (offset < size);
+}
+
+
+Reassembler::Reassembler(ResultArena& pool, uint32_t maxMessage) : pool(pool), maxMessage(maxMessage)
+{
+}
+
+Reassembler::~Reassembler()
+{
+	Reset();
+}
+
+void Reassembler::Reset()
+{
+	if (buffer != nullptr)
+		pool.Release(buffer);
+
+	buffer = nullptr;
+	length = 0;
+	filled = 0;
+}
+
+bool Reassembler::Receive(const uint8_t* fragment, size_t size, const MessageHandler& deliver, bool& delivered)
+{
+	delivered = false;
+
+	if (size < FRAME_HEADER_SIZE)
+	{
+		Reset();
+		return false;
+	}
+
+	uint8_t control = fragment[0];
+	uint8_t index = fragment[1];
+
+	if (control & FRAME_FIRST)
+	{
+		//a new message while one is in progress means the end of the previous one was lost
+		bool broken = buffer != nullptr;
+		Reset();
+
+		if (size < FRAME_FIRST_HEADER_SIZE || index != 0)
+			return false;
+
+		uint32_t messageLength = fragment[2] | (fragment[3] << 8) | (fragment[4] << 16) | ((uint32_t)fragment[5] << 24);
+		const uint8_t* payload = fragment + FRAME_FIRST_HEADER_SIZE;
+		size_t payloadSize = size - FRAME_FIRST_HEADER_SIZE;
+
+		if (messageLength > maxMessage || payloadSize > messageLength)
+			return false;
+
+		//fits one fragment, hand it out without copying
+		if (control & FRAME_LAST)
+		{
+			if (payloadSize != messageLength)
+				return false;
+
+			deliver(payload, payloadSize);
+			delivered = true;
+			return !broken;
+		}
+
+		buffer = (uint8_t*)pool.Allocate(messageLength, false);
+		if (buffer == nullptr)
+			return false;
+
+		memcpy(buffer, payload, payloadSize);
+		length = messageLength;
+		filled = (uint32_t)payloadSize;
+		messageId = control & FRAME_MESSAGE_MASK;
+		nextIndex = 1;
+		return !broken;
+	}
+
+	size_t payloadSize = size - FRAME_HEADER_SIZE;
+
+	if (buffer == nullptr || (control & FRAME_MESSAGE_MASK) != messageId || index != nextIndex || filled + payloadSize > length)
+	{
+		Reset();
+		return false;
+	}
+
+	memcpy(buffer + filled, fragment + FRAME_HEADER_SIZE, payloadSize);
+	filled += (uint32_t)payloadSize;
+	nextIndex++;
+
+	if (control & FRAME_LAST)
+	{
+		bool complete = filled == length;
+		if (complete)
+		{
+			deliver(buffer, length);
+			delivered = true;
+		}
+
+		Reset();
+		return complete;
+	}
+
+	return true;
+}
+
+
+FramedChannels::FramedChannels(WriteScheduler& writes) : writes(writes)
+{
+}
+
+uint32_t FramedChannels::Open(const GattKey& write, const GattKey& notify, uint32_t maxMessage, MessageHandler handler)
+{
+	auto channel = make_shared<Channel>(pool, maxMessage > 0 ? maxMessage : FRAME_DEFAULT_MAX_MESSAGE);
+	channel->write = write;
+	channel->notify = notify;
+	channel->handler = move(handler);
+
+	lock_guard guard(lock);
+
+	uint32_t id = nextId++;
+	if (nextId == 0)
+		nextId = 1;
+
+	channels[id] = channel;
+	return id;
+}
+
+void FramedChannels::SetSubscription(uint32_t id, uint32_t subscription)
+{
+	shared_ptr<Channel> channel = Find(id);
+	if (channel != nullptr)
+		channel->subscription = subscription;
+}
+
+bool FramedChannels::Close(uint32_t id, uint32_t& subscription)
+{
+	shared_ptr<Channel> channel;
+
+	{
+		lock_guard guard(lock);
+
+		auto found = channels.find(id);
+		if (found == channels.end())
+			return false;
+
+		channel = found->second;
+		channels.erase(found);
+	}
+
+	subscription = channel->subscription;
+
+	//a notification being delivered right now finishes first
+	lock_guard guard(channel->receiveLock);
+	channel->reassembler.Reset();
+	return true;
+}
+
+shared_ptr<FramedChannels::Channel> FramedChannels::Find(uint32_t id)
+{
+	lock_guard guard(lock);
+
+	auto found = channels.find(id);
+	return found != channels.end() ? found->second : nullptr;
+}
+
+void FramedChannels::SetMtu(uint32_t id, uint32_t mtu)
+{
+	shared_ptr<Channel> channel = Find(id);
+	if (channel == nullptr || mtu <= ATT_WRITE_OVERHEAD)
+		return;
+
+	lock_guard guard(channel->sendLock);
+	channel->maxFragment = min(mtu - ATT_WRITE_OVERHEAD, ATT_MAX_VALUE_SIZE);
+}
+
+bool FramedChannels::Send(uint32_t id, const uint8_t* data, size_t size, bool withResponse, SentHandler done)
+{
+	shared_ptr<Channel> channel = Find(id);
+	if (channel == nullptr || size > UINT32_MAX)
+		return false;
+
+	uint32_t maxFragment;
+	uint8_t messageId;
+
+	{
+		lock_guard guard(channel->sendLock);
+		maxFragment = channel->maxFragment;
+		messageId = channel->nextMessage++;
+	}
+
+	vector<vector<uint8_t>> fragments;
+	FragmentMessage(data, size, maxFragment, messageId, fragments);
+
+	size_t count = fragments.size();
+	uint64_t device = channel->write.device;
+	if (!writes.EnqueueMessage(channel->write, move(fragments), withResponse, [device, done = move(done)](bool success)
+	{
+		if (done)
+			done(device, success);
+	}))
+		return false;
+
+	channel->messagesSent++;
+	channel->fragmentsSent += count;
+	return true;
+}
+
+void FramedChannels::Receive(uint32_t id, const uint8_t* data, size_t size)
+{
+	shared_ptr<Channel> channel = Find(id);
+	if (channel == nullptr)
+		return;
+
+	auto deliver = [&](const uint8_t* message, size_t messageSize)
+	{
+		if (channel->handler)
+			channel->handler(id, message, messageSize);
+	};
+
+	lock_guard guard(channel->receiveLock);
+
+	bool delivered = false;
+	if (!channel->reassembler.Receive(data, size, deliver, delivered))
+		channel->errors++;
+
+	channel->fragmentsReceived++;
+	if (delivered)
+		channel->messagesReceived++;
+}
+
+bool FramedChannels::Stats(uint32_t id, BleFramingStats& stats)
+{
+	shared_ptr<Channel> channel = Find(id);
+	if (channel == nullptr)
+		return false;
+
+	stats.messagesSent = channel->messagesSent;
+	stats.fragmentsSent = channel->fragmentsSent;
+	stats.messagesReceived = channel->messagesReceived;
+	stats.fragmentsReceived = channel->fragmentsReceived;
+	stats.errors = channel->errors;
+
+	lock_guard guard(channel->sendLock);
+	stats.maxFragment = channel->maxFragment;
+	return true;
+}
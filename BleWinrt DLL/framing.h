@@ -0,0 +1,135 @@
+#pragma once
+
+#include "backend.h"
+#include "result-arena.h"
+#include "write-queue.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+//messages larger than one write or notification travel as fragments. every fragment starts with a control byte
+//(FRAME_FIRST, FRAME_LAST and a 6 bit message id) and the fragment index, the first one also carries the message
+//length as 32 bit little endian so the receiver can take a buffer of the right size up front
+const uint8_t FRAME_FIRST = 0x80;
+const uint8_t FRAME_LAST = 0x40;
+const uint8_t FRAME_MESSAGE_MASK = 0x3F;
+
+const size_t FRAME_HEADER_SIZE = 2;
+const size_t FRAME_FIRST_HEADER_SIZE = FRAME_HEADER_SIZE + 4;
+
+//longest message a reassembler accepts unless configured otherwise
+const uint32_t FRAME_DEFAULT_MAX_MESSAGE = 64 * 1024;
+
+struct BleFramingStats
+{
+	uint64_t messagesSent = 0;
+	uint64_t fragmentsSent = 0;
+	uint64_t messagesReceived = 0;
+	uint64_t fragmentsReceived = 0;
+
+	//fragments out of sequence, oversized or truncated messages. the partial message is dropped
+	uint64_t errors = 0;
+
+	//payload bytes per write, mtu - ATT_WRITE_OVERHEAD once the mtu is known
+	uint32_t maxFragment = 0;
+	uint32_t reserved = 0;
+};
+
+//appends the fragments of one message to fragments, each at most maxFragment bytes including its header
+void FragmentMessage(const uint8_t* data, size_t size, size_t maxFragment, uint8_t messageId, std::vector<std::vector<uint8_t>>& fragments);
+
+//puts one characteristic's fragments back together. a message that fits one fragment is handed out straight from the
+//notification, larger ones are collected in a block from the pool which is returned as soon as the handler is done
+class Reassembler
+{
+public:
+	using MessageHandler = std::function<void(const uint8_t* data, size_t size)>;
+
+	Reassembler(ResultArena& pool, uint32_t maxMessage);
+	~Reassembler();
+
+	Reassembler(const Reassembler&) = delete;
+	Reassembler& operator=(const Reassembler&) = delete;
+
+	//false if the fragment was malformed or broke the message in progress
+	bool Receive(const uint8_t* fragment, size_t size, const MessageHandler& deliver, bool& delivered);
+
+	//drops the message in progress
+	void Reset();
+
+private:
+	ResultArena& pool;
+	uint32_t maxMessage;
+
+	uint8_t* buffer = nullptr;
+	uint32_t length = 0;
+	uint32_t filled = 0;
+	uint8_t messageId = 0;
+	uint8_t nextIndex = 0;
+};
+
+//pairs of a characteristic written to and one notifying back, exchanging framed messages of any size up to maxMessage.
+//the caller subscribes the notifying characteristic, feeds its values to Receive and keeps the subscription handle here
+class FramedChannels
+{
+public:
+	using MessageHandler = std::function<void(uint32_t channel, const uint8_t* data, size_t size)>;
+	//device is the one the channel writes to
+	using SentHandler = std::function<void(uint64_t device, bool success)>;
+
+	explicit FramedChannels(WriteScheduler& writes);
+
+	//returns the channel id. fragments are sized for the default mtu until SetMtu
+	uint32_t Open(const GattKey& write, const GattKey& notify, uint32_t maxMessage, MessageHandler handler);
+	void SetSubscription(uint32_t channel, uint32_t subscription);
+	//false if the channel doesn't exist, otherwise subscription is the handle to remove
+	bool Close(uint32_t channel, uint32_t& subscription);
+	void SetMtu(uint32_t channel, uint32_t mtu);
+
+	//fragments and queues the message as one block on the write characteristic, done reports once all fragments completed
+	bool Send(uint32_t channel, const uint8_t* data, size_t size, bool withResponse, SentHandler done);
+	void Receive(uint32_t channel, const uint8_t* data, size_t size);
+
+	bool Stats(uint32_t channel, BleFramingStats& stats);
+
+private:
+	struct Channel
+	{
+		Channel(ResultArena& pool, uint32_t maxMessage) : reassembler(pool, maxMessage) {}
+
+		GattKey write;
+		GattKey notify;
+		MessageHandler handler;
+		std::atomic<uint32_t> subscription { 0 };
+
+		//guards maxFragment and nextMessage
+		std::mutex sendLock;
+		uint32_t maxFragment = ATT_DEFAULT_MTU - ATT_WRITE_OVERHEAD;
+		uint8_t nextMessage = 0;
+
+		//guards the reassembler, held while the handler runs
+		std::mutex receiveLock;
+		Reassembler reassembler;
+
+		//readable from the handler without taking either lock
+		std::atomic<uint64_t> messagesSent { 0 };
+		std::atomic<uint64_t> fragmentsSent { 0 };
+		std::atomic<uint64_t> messagesReceived { 0 };
+		std::atomic<uint64_t> fragmentsReceived { 0 };
+		std::atomic<uint64_t> errors { 0 };
+	};
+
+	std::shared_ptr<Channel> Find(uint32_t channel);
+
+	WriteScheduler& writes;
+
+	//reassembly buffers of every channel
+	ResultArena pool;
+
+	std::mutex lock;
+	std::unordered_map<uint32_t, std::shared_ptr<Channel>> channels;
+	uint32_t nextId = 1;
+};
@@ -0,0 +1,169 @@
+#pragma once
+
+#include "platform.h"
+
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+//identifies a cached gatt object. service entries leave the characteristic zeroed, device entries both uuids
+struct GattKey
+{
+	uint64_t device = 0;
+	guid service {};
+	guid characteristic {};
+};
+
+inline bool operator==(const GattKey& left, const GattKey& right)
+{
+	return left.device == right.device && left.service == right.service && left.characteristic == right.characteristic;
+}
+
+//splitmix64 finalizer, spreads sequential mac addresses over all shards and buckets
+inline uint64_t MixBits(uint64_t value)
+{
+	value ^= value >> 30;
+	value *= 0xbf58476d1ce4e5b9ULL;
+	value ^= value >> 27;
+	value *= 0x94d049bb133111ebULL;
+	value ^= value >> 31;
+	return value;
+}
+
+inline uint64_t HashGuid(const guid& value)
+{
+	uint64_t halves[2];
+	memcpy(halves, &value, sizeof(halves));
+	return MixBits(halves[0] ^ MixBits(halves[1]));
+}
+
+struct GattKeyHash
+{
+	size_t operator()(const GattKey& key) const
+	{
+		return (size_t)(MixBits(key.device) ^ (HashGuid(key.service) * 31) ^ HashGuid(key.characteristic));
+	}
+};
+
+//concurrent map from GattKey to a cached object. entries are sharded by device address, so operations on different
+//devices rarely contend and everything of one device lives in a single shard. readers share the shard lock and a hit
+//is exactly one hash lookup; nothing is ever inserted as a side effect of looking up
+template <typename Value>
+class GattCache
+{
+public:
+	//copies the cached object into value, false if there is none
+	bool Find(const GattKey& key, Value& value) const
+	{
+		const Shard& shard = ShardOf(key.device);
+		std::shared_lock guard(shard.lock);
+
+		auto it = shard.entries.find(key);
+		if (it == shard.entries.end())
+			return false;
+
+		value = it->second;
+		return true;
+	}
+
+	//first writer wins, returns whatever ends up cached so racing callers agree on one object
+	Value Insert(const GattKey& key, const Value& value)
+	{
+		Shard& shard = ShardOf(key.device);
+		std::unique_lock guard(shard.lock);
+
+		return shard.entries.emplace(key, value).first->second;
+	}
+
+	//keys of every entry of the device
+	std::vector<GattKey> Keys(uint64_t device) const
+	{
+		std::vector<GattKey> keys;
+
+		const Shard& shard = ShardOf(device);
+		std::shared_lock guard(shard.lock);
+
+		for (auto& entry : shard.entries)
+			if (entry.first.device == device)
+				keys.push_back(entry.first);
+
+		return keys;
+	}
+
+	//drops every entry of the device, release runs after the shard lock is given up
+	void EraseDevice(uint64_t device, const std::function<void(Value&)>& release)
+	{
+		std::vector<Value> removed;
+
+		{
+			Shard& shard = ShardOf(device);
+			std::unique_lock guard(shard.lock);
+
+			for (auto it = shard.entries.begin(); it != shard.entries.end();)
+			{
+				if (it->first.device != device)
+				{
+					it++;
+					continue;
+				}
+
+				removed.push_back(std::move(it->second));
+				it = shard.entries.erase(it);
+			}
+		}
+
+		if (release)
+			for (auto& value : removed)
+				release(value);
+	}
+
+	void Clear(const std::function<void(Value&)>& release)
+	{
+		std::vector<Value> removed;
+
+		for (auto& shard : shards)
+		{
+			std::unique_lock guard(shard.lock);
+
+			for (auto& entry : shard.entries)
+				removed.push_back(std::move(entry.second));
+
+			shard.entries.clear();
+		}
+
+		if (release)
+			for (auto& value : removed)
+				release(value);
+	}
+
+private:
+	static const int SHARD_BITS = 4;
+	static const size_t SHARD_COUNT = (size_t)1 << SHARD_BITS;
+
+	//one cache line per shard header so neighbouring locks don't false share
+	struct alignas(64) Shard
+	{
+		mutable std::shared_mutex lock;
+		std::unordered_map<GattKey, Value, GattKeyHash> entries;
+	};
+
+	//the top bits pick the shard, the low bits stay free to pick buckets inside it
+	static size_t ShardIndex(uint64_t device)
+	{
+		return (size_t)(MixBits(device) >> (64 - SHARD_BITS));
+	}
+
+	Shard& ShardOf(uint64_t device)
+	{
+		return shards[ShardIndex(device)];
+	}
+
+	const Shard& ShardOf(uint64_t device) const
+	{
+		return shards[ShardIndex(device)];
+	}
+
+	Shard shards[SHARD_COUNT];
+};
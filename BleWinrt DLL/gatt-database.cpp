@@ -0,0 +1,411 @@
+#include "gatt-database.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+using namespace std;
+
+
+void GattDatabase::Open(const wchar_t* path)
+{
+	//a write under way finishes on the previous file first
+	lock_guard saving(saveLock);
+	lock_guard guard(lock);
+
+	this->path = path != nullptr ? path : L"";
+	devices.clear();
+	dirty = false;
+	fileBytes = 0;
+
+	hits = 0;
+	misses = 0;
+	revalidations = 0;
+	changes = 0;
+
+	if (!this->path.empty())
+		Load();
+}
+
+bool GattDatabase::IsOpen()
+{
+	lock_guard guard(lock);
+	return !path.empty();
+}
+
+GattDatabase::ServiceLayout* GattDatabase::FindService(DeviceLayout& device, guid serviceUuid)
+{
+	for (auto& service : device.services)
+		if (service.info.uuid == serviceUuid)
+			return &service;
+
+	return nullptr;
+}
+
+bool GattDatabase::FindServices(uint64_t deviceAddress, vector<ServiceInfo>& services)
+{
+	lock_guard guard(lock);
+
+	auto it = devices.find(deviceAddress);
+	if (path.empty() || it == devices.end() || !it->second.servicesKnown)
+	{
+		misses++;
+		return false;
+	}
+
+	services.clear();
+	for (auto& service : it->second.services)
+		services.push_back(service.info);
+
+	hits++;
+	return true;
+}
+
+bool GattDatabase::FindCharacteristics(uint64_t deviceAddress, guid serviceUuid, vector<CharacteristicInfo>& characteristics)
+{
+	lock_guard guard(lock);
+
+	auto it = devices.find(deviceAddress);
+	ServiceLayout* service = it != devices.end() ? FindService(it->second, serviceUuid) : nullptr;
+
+	if (path.empty() || service == nullptr || !service->characteristicsKnown)
+	{
+		misses++;
+		return false;
+	}
+
+	characteristics = service->characteristics;
+
+	hits++;
+	return true;
+}
+
+bool GattDatabase::MergeServices(DeviceLayout& device, const vector<ServiceInfo>& services)
+{
+	bool changed = !device.servicesKnown || device.services.size() != services.size();
+	for (size_t i = 0; !changed && i < services.size(); i++)
+		changed = !(device.services[i].info == services[i]);
+
+	if (!changed)
+		return false;
+
+	//keep what is known about services that are still there
+	vector<ServiceLayout> layout(services.size());
+	for (size_t i = 0; i < services.size(); i++)
+	{
+		ServiceLayout* previous = FindService(device, services[i].uuid);
+		if (previous != nullptr && previous->info == services[i])
+			layout[i] = move(*previous);
+
+		layout[i].info = services[i];
+	}
+
+	device.services = move(layout);
+	device.servicesKnown = true;
+	return true;
+}
+
+bool GattDatabase::MergeCharacteristics(DeviceLayout& device, guid serviceUuid, const vector<CharacteristicInfo>& characteristics)
+{
+	ServiceLayout* service = FindService(device, serviceUuid);
+	if (service == nullptr)
+	{
+		//looked up without a service discovery first, the handle stays unknown
+		device.services.push_back({});
+		service = &device.services.back();
+		service->info.uuid = serviceUuid;
+	}
+
+	if (service->characteristicsKnown && service->characteristics == characteristics)
+		return false;
+
+	service->characteristics = characteristics;
+	service->characteristicsKnown = true;
+	return true;
+}
+
+bool GattDatabase::StoreServices(uint64_t deviceAddress, const vector<ServiceInfo>& services)
+{
+	{
+		lock_guard guard(lock);
+
+		if (path.empty() || !MergeServices(devices[deviceAddress], services))
+			return false;
+
+		dirty = true;
+	}
+
+	Save();
+	return true;
+}
+
+bool GattDatabase::StoreCharacteristics(uint64_t deviceAddress, guid serviceUuid, const vector<CharacteristicInfo>& characteristics)
+{
+	{
+		lock_guard guard(lock);
+
+		if (path.empty() || !MergeCharacteristics(devices[deviceAddress], serviceUuid, characteristics))
+			return false;
+
+		dirty = true;
+	}
+
+	Save();
+	return true;
+}
+
+bool GattDatabase::StoreDevice(uint64_t deviceAddress, const vector<ServiceInfo>& services, const vector<vector<CharacteristicInfo>>& characteristics)
+{
+	{
+		lock_guard guard(lock);
+
+		if (path.empty())
+			return false;
+
+		DeviceLayout& device = devices[deviceAddress];
+
+		bool changed = MergeServices(device, services);
+		for (size_t i = 0; i < services.size() && i < characteristics.size(); i++)
+			changed |= MergeCharacteristics(device, services[i].uuid, characteristics[i]);
+
+		if (!changed)
+			return false;
+
+		dirty = true;
+	}
+
+	Save();
+	return true;
+}
+
+void GattDatabase::Invalidate(uint64_t deviceAddress)
+{
+	{
+		lock_guard guard(lock);
+
+		if (deviceAddress == 0)
+			devices.clear();
+		else if (devices.erase(deviceAddress) == 0)
+			return;
+
+		if (path.empty())
+			return;
+
+		dirty = true;
+	}
+
+	Save();
+}
+
+void GattDatabase::CountRevalidation(bool changed)
+{
+	revalidations++;
+
+	if (changed)
+		changes++;
+}
+
+void GattDatabase::Stats(BleGattDatabaseStats& stats)
+{
+	lock_guard guard(lock);
+
+	stats.hits = hits;
+	stats.misses = misses;
+	stats.revalidations = revalidations;
+	stats.changes = changes;
+	stats.devices = (uint32_t)devices.size();
+	stats.fileBytes = (uint32_t)fileBytes;
+}
+
+
+//descriptions are stored as utf-16 code units whatever the size of wchar_t
+static void AppendDescription(vector<uint16_t>& pool, const wstring& description, GattDatabaseCharacteristic& record)
+{
+	record.descriptionOffset = (uint32_t)pool.size();
+	record.descriptionLength = (uint16_t)min(description.size(), (size_t)UINT16_MAX);
+
+	for (size_t i = 0; i < record.descriptionLength; i++)
+		pool.push_back((uint16_t)description[i]);
+}
+
+template <typename Record>
+static void AppendBytes(vector<uint8_t>& image, const Record* records, size_t count)
+{
+	const uint8_t* bytes = (const uint8_t*)records;
+	image.insert(image.end(), bytes, bytes + count * sizeof(Record));
+}
+
+vector<uint8_t> GattDatabase::Serialize()
+{
+	vector<GattDatabaseDevice> deviceRecords;
+	vector<GattDatabaseService> serviceRecords;
+	vector<GattDatabaseCharacteristic> characteristicRecords;
+	vector<uint16_t> descriptions;
+
+	for (auto& entry : devices)
+	{
+		GattDatabaseDevice device;
+		device.mac = entry.first;
+		device.firstService = (uint32_t)serviceRecords.size();
+		device.serviceCount = (uint32_t)entry.second.services.size();
+		device.servicesKnown = entry.second.servicesKnown ? 1 : 0;
+		deviceRecords.push_back(device);
+
+		for (auto& layout : entry.second.services)
+		{
+			GattDatabaseService service;
+			service.uuid = layout.info.uuid;
+			service.attributeHandle = layout.info.attributeHandle;
+			service.firstCharacteristic = (uint32_t)characteristicRecords.size();
+			service.characteristicCount = layout.characteristicsKnown ? (uint32_t)layout.characteristics.size() : GATT_DATABASE_UNKNOWN;
+			serviceRecords.push_back(service);
+
+			for (auto& info : layout.characteristics)
+			{
+				GattDatabaseCharacteristic characteristic;
+				characteristic.uuid = info.uuid;
+				characteristic.properties = info.properties;
+				characteristic.attributeHandle = info.attributeHandle;
+				AppendDescription(descriptions, info.userDescription, characteristic);
+				characteristicRecords.push_back(characteristic);
+			}
+		}
+	}
+
+	GattDatabaseHeader header;
+	header.deviceCount = (uint32_t)deviceRecords.size();
+	header.serviceCount = (uint32_t)serviceRecords.size();
+	header.characteristicCount = (uint32_t)characteristicRecords.size();
+	header.descriptionUnits = (uint32_t)descriptions.size();
+
+	vector<uint8_t> image;
+	AppendBytes(image, &header, 1);
+	AppendBytes(image, deviceRecords.data(), deviceRecords.size());
+	AppendBytes(image, serviceRecords.data(), serviceRecords.size());
+	AppendBytes(image, characteristicRecords.data(), characteristicRecords.size());
+	AppendBytes(image, descriptions.data(), descriptions.size());
+	return image;
+}
+
+void GattDatabase::Save()
+{
+	//a store waiting here while another one writes finds its change already written, or writes everything changed
+	//since in one go
+	lock_guard saving(saveLock);
+
+	vector<uint8_t> image;
+	wstring target;
+
+	{
+		lock_guard guard(lock);
+
+		if (!dirty || path.empty())
+			return;
+
+		image = Serialize();
+		target = path;
+		dirty = false;
+	}
+
+	//write next to the file and swap it in, a crash mid-write leaves the previous version intact
+	filesystem::path temporary(target + L".tmp");
+
+	{
+		ofstream file(temporary, ios::binary | ios::trunc);
+		if (!file.write((const char*)image.data(), image.size()))
+			return;
+	}
+
+	error_code error;
+	filesystem::rename(temporary, filesystem::path(target), error);
+
+	if (error)
+		return;
+
+	//path can't have changed, Open waits for saveLock
+	lock_guard guard(lock);
+	fileBytes = image.size();
+}
+
+void GattDatabase::Load()
+{
+	ifstream file(filesystem::path(path), ios::binary);
+	if (!file)
+		return;
+
+	vector<uint8_t> image((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+	GattDatabaseHeader header;
+	if (image.size() < sizeof(header))
+		return;
+
+	memcpy(&header, image.data(), sizeof(header));
+	if (header.magic != GATT_DATABASE_MAGIC || header.version != GATT_DATABASE_VERSION)
+		return;
+
+	size_t devicesOffset = sizeof(header);
+	size_t servicesOffset = devicesOffset + (size_t)header.deviceCount * sizeof(GattDatabaseDevice);
+	size_t characteristicsOffset = servicesOffset + (size_t)header.serviceCount * sizeof(GattDatabaseService);
+	size_t descriptionsOffset = characteristicsOffset + (size_t)header.characteristicCount * sizeof(GattDatabaseCharacteristic);
+
+	if (descriptionsOffset + (size_t)header.descriptionUnits * sizeof(uint16_t) != image.size())
+		return;
+
+	//copied out record by record, the image carries no alignment guarantee
+	auto device = [&](uint32_t i) { GattDatabaseDevice record; memcpy(&record, &image[devicesOffset + i * sizeof(record)], sizeof(record)); return record; };
+	auto service = [&](uint32_t i) { GattDatabaseService record; memcpy(&record, &image[servicesOffset + i * sizeof(record)], sizeof(record)); return record; };
+	auto characteristic = [&](uint32_t i) { GattDatabaseCharacteristic record; memcpy(&record, &image[characteristicsOffset + i * sizeof(record)], sizeof(record)); return record; };
+
+	unordered_map<uint64_t, DeviceLayout> loaded;
+
+	for (uint32_t d = 0; d < header.deviceCount; d++)
+	{
+		GattDatabaseDevice deviceRecord = device(d);
+		if ((uint64_t)deviceRecord.firstService + deviceRecord.serviceCount > header.serviceCount)
+			return;
+
+		DeviceLayout& layout = loaded[deviceRecord.mac];
+		layout.servicesKnown = deviceRecord.servicesKnown != 0;
+
+		for (uint32_t s = deviceRecord.firstService; s < deviceRecord.firstService + deviceRecord.serviceCount; s++)
+		{
+			GattDatabaseService serviceRecord = service(s);
+
+			ServiceLayout serviceLayout;
+			serviceLayout.info.uuid = serviceRecord.uuid;
+			serviceLayout.info.attributeHandle = serviceRecord.attributeHandle;
+			serviceLayout.characteristicsKnown = serviceRecord.characteristicCount != GATT_DATABASE_UNKNOWN;
+
+			uint32_t count = serviceLayout.characteristicsKnown ? serviceRecord.characteristicCount : 0;
+			if ((uint64_t)serviceRecord.firstCharacteristic + count > header.characteristicCount)
+				return;
+
+			for (uint32_t c = serviceRecord.firstCharacteristic; c < serviceRecord.firstCharacteristic + count; c++)
+			{
+				GattDatabaseCharacteristic record = characteristic(c);
+				if ((uint64_t)record.descriptionOffset + record.descriptionLength > header.descriptionUnits)
+					return;
+
+				CharacteristicInfo info;
+				info.uuid = record.uuid;
+				info.properties = record.properties;
+				info.attributeHandle = record.attributeHandle;
+
+				size_t units = descriptionsOffset + (size_t)record.descriptionOffset * sizeof(uint16_t);
+				for (uint16_t i = 0; i < record.descriptionLength; i++)
+				{
+					uint16_t unit;
+					memcpy(&unit, &image[units + i * sizeof(unit)], sizeof(unit));
+					info.userDescription.push_back((wchar_t)unit);
+				}
+
+				serviceLayout.characteristics.push_back(move(info));
+			}
+
+			layout.services.push_back(move(serviceLayout));
+		}
+	}
+
+	devices = move(loaded);
+	fileBytes = image.size();
+}
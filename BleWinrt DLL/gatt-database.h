@@ -0,0 +1,135 @@
+#pragma once
+
+#include "backend.h"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//persistent per-device gatt layout, so a known device's discovery can be answered without any radio round-trip.
+//the file is one flat image: a header, then device, service and characteristic tables referencing each other by
+//index, then a pool of utf-16 descriptions. nothing in it is a pointer, so it can be read or mapped as is
+
+const uint32_t GATT_DATABASE_MAGIC = 0x42444742; //"BGDB"
+const uint32_t GATT_DATABASE_VERSION = 1;
+
+//marks a service whose characteristics were never discovered
+const uint32_t GATT_DATABASE_UNKNOWN = 0xFFFFFFFF;
+
+struct GattDatabaseHeader
+{
+	uint32_t magic = GATT_DATABASE_MAGIC;
+	uint32_t version = GATT_DATABASE_VERSION;
+
+	uint32_t deviceCount = 0;
+	uint32_t serviceCount = 0;
+	uint32_t characteristicCount = 0;
+	uint32_t descriptionUnits = 0;
+};
+
+struct GattDatabaseDevice
+{
+	uint64_t mac = 0;
+	uint32_t firstService = 0;
+	uint32_t serviceCount = 0;
+
+	//0 if only single services were looked up, the service list isn't complete then
+	uint32_t servicesKnown = 0;
+	uint32_t reserved = 0;
+};
+
+struct GattDatabaseService
+{
+	guid uuid {};
+	uint32_t firstCharacteristic = 0;
+	uint32_t characteristicCount = GATT_DATABASE_UNKNOWN;
+	uint16_t attributeHandle = 0;
+	uint16_t reserved = 0;
+};
+
+struct GattDatabaseCharacteristic
+{
+	guid uuid {};
+	uint32_t properties = 0;
+	uint32_t descriptionOffset = 0;
+	uint16_t descriptionLength = 0;
+	uint16_t attributeHandle = 0;
+};
+
+struct BleGattDatabaseStats
+{
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+
+	//background discoveries of devices answered from the database, and how many of them found a different layout
+	uint64_t revalidations = 0;
+	uint64_t changes = 0;
+
+	uint32_t devices = 0;
+	uint32_t fileBytes = 0;
+};
+
+class GattDatabase
+{
+public:
+	//loads the file if it exists, a missing or unreadable file starts out empty. an empty path closes the database
+	void Open(const wchar_t* path);
+	bool IsOpen();
+
+	bool FindServices(uint64_t deviceAddress, std::vector<ServiceInfo>& services);
+	bool FindCharacteristics(uint64_t deviceAddress, guid serviceUuid, std::vector<CharacteristicInfo>& characteristics);
+
+	//record a completed discovery and write the file if anything changed, returns whether it did. the file is written
+	//outside the lock, stores made while a write is under way are coalesced into the next one
+	bool StoreServices(uint64_t deviceAddress, const std::vector<ServiceInfo>& services);
+	bool StoreCharacteristics(uint64_t deviceAddress, guid serviceUuid, const std::vector<CharacteristicInfo>& characteristics);
+	//a whole device at once, characteristics holds those of every service in order. one write for all of it
+	bool StoreDevice(uint64_t deviceAddress, const std::vector<ServiceInfo>& services, const std::vector<std::vector<CharacteristicInfo>>& characteristics);
+
+	//forget one device, 0 forgets all of them
+	void Invalidate(uint64_t deviceAddress);
+
+	void CountRevalidation(bool changed);
+	void Stats(BleGattDatabaseStats& stats);
+
+private:
+	struct ServiceLayout
+	{
+		ServiceInfo info;
+		bool characteristicsKnown = false;
+		std::vector<CharacteristicInfo> characteristics;
+	};
+
+	struct DeviceLayout
+	{
+		bool servicesKnown = false;
+		std::vector<ServiceLayout> services;
+	};
+
+	//callers hold lock
+	ServiceLayout* FindService(DeviceLayout& device, guid serviceUuid);
+	bool MergeServices(DeviceLayout& device, const std::vector<ServiceInfo>& services);
+	bool MergeCharacteristics(DeviceLayout& device, guid serviceUuid, const std::vector<CharacteristicInfo>& characteristics);
+	std::vector<uint8_t> Serialize();
+	void Load();
+
+	//writes the file if anything changed since the last write, callers don't hold lock
+	void Save();
+
+	//held for a whole write, taken before lock
+	std::mutex saveLock;
+
+	std::mutex lock;
+	std::wstring path;
+	std::unordered_map<uint64_t, DeviceLayout> devices;
+	//changed since the last write
+	bool dirty = false;
+	size_t fileBytes = 0;
+
+	std::atomic<uint64_t> hits { 0 };
+	std::atomic<uint64_t> misses { 0 };
+	std::atomic<uint64_t> revalidations { 0 };
+	std::atomic<uint64_t> changes { 0 };
+};
@@ -0,0 +1,81 @@
+#include "gatt-tree.h"
+#include "utf8.h"
+
+#include <cstring>
+#include <new>
+
+using namespace std;
+
+
+BleGattTree* BuildGattTree(ResultArena& arena, uint64_t deviceAddress, bool success, const vector<ServiceInfo>& services,
+	const vector<vector<CharacteristicInfo>>& characteristics)
+{
+	//descriptions are encoded up front, that fixes the size of the one allocation
+	string strings;
+	vector<uint32_t> stringEnds;
+
+	for (size_t s = 0; s < services.size() && s < characteristics.size(); s++)
+	{
+		for (auto& characteristic : characteristics[s])
+		{
+			AppendUtf8(strings, characteristic.userDescription);
+			stringEnds.push_back((uint32_t)strings.size());
+		}
+	}
+
+	size_t characteristicCount = stringEnds.size();
+
+	size_t servicesOffset = sizeof(BleGattTree);
+	size_t characteristicsOffset = servicesOffset + services.size() * sizeof(BleGattTreeService);
+	size_t stringsOffset = characteristicsOffset + characteristicCount * sizeof(BleGattTreeCharacteristic);
+	size_t totalBytes = stringsOffset + strings.size();
+
+	uint8_t* block = (uint8_t*)arena.Allocate(totalBytes);
+	if (block == nullptr)
+		return nullptr;
+
+	BleGattTree* tree = new (block) BleGattTree();
+	tree->deviceAddress = deviceAddress;
+	tree->success = success ? 1 : 0;
+	tree->serviceCount = (int32_t)services.size();
+	tree->characteristicCount = (int32_t)characteristicCount;
+	tree->stringBytes = (uint32_t)strings.size();
+	tree->servicesOffset = (uint32_t)servicesOffset;
+	tree->characteristicsOffset = (uint32_t)characteristicsOffset;
+	tree->stringsOffset = (uint32_t)stringsOffset;
+	tree->totalBytes = (uint32_t)totalBytes;
+
+	BleGattTreeService* serviceRecords = (BleGattTreeService*)(block + servicesOffset);
+	BleGattTreeCharacteristic* characteristicRecords = (BleGattTreeCharacteristic*)(block + characteristicsOffset);
+	memcpy(block + stringsOffset, strings.data(), strings.size());
+
+	uint32_t next = 0;
+
+	for (size_t s = 0; s < services.size(); s++)
+	{
+		BleGattTreeService& service = *new (&serviceRecords[s]) BleGattTreeService();
+		service.serviceUuid = services[s].uuid;
+		service.attributeHandle = services[s].attributeHandle;
+		service.firstCharacteristic = next;
+
+		if (s >= characteristics.size())
+			continue;
+
+		for (auto& info : characteristics[s])
+		{
+			BleGattTreeCharacteristic& characteristic = *new (&characteristicRecords[next]) BleGattTreeCharacteristic();
+			characteristic.characteristicUuid = info.uuid;
+			characteristic.serviceIndex = (uint32_t)s;
+			characteristic.properties = info.properties;
+			characteristic.attributeHandle = info.attributeHandle;
+
+			characteristic.descriptionOffset = next > 0 ? stringEnds[next - 1] : 0;
+			characteristic.descriptionBytes = stringEnds[next] - characteristic.descriptionOffset;
+			next++;
+		}
+
+		service.characteristicCount = next - service.firstCharacteristic;
+	}
+
+	return tree;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "backend.h"
+#include "result-arena.h"
+
+#include <vector>
+
+//complete gatt layout of one device in a single contiguous block: this header, the services, the characteristics and
+//a pool of utf-8 descriptions, in that order. everything refers to everything else by index or byte offset, so the
+//block can be copied or marshaled as is. handed out by DiscoverAll and freed with ReleaseResult
+struct BleGattTree
+{
+	uint64_t deviceAddress = 0;
+	int32_t success = 0;
+
+	int32_t serviceCount = 0;
+	int32_t characteristicCount = 0;
+	uint32_t stringBytes = 0;
+
+	//byte offsets from the start of the tree
+	uint32_t servicesOffset = 0;
+	uint32_t characteristicsOffset = 0;
+	uint32_t stringsOffset = 0;
+	uint32_t totalBytes = 0;
+};
+
+struct BleGattTreeService
+{
+	guid serviceUuid;
+	uint32_t firstCharacteristic = 0;
+	uint32_t characteristicCount = 0;
+	uint16_t attributeHandle = 0;
+	uint16_t reserved = 0;
+};
+
+struct BleGattTreeCharacteristic
+{
+	guid characteristicUuid;
+	uint32_t serviceIndex = 0;
+
+	//GattCharacteristicProperties bits
+	uint32_t properties = 0;
+	uint16_t attributeHandle = 0;
+	uint16_t reserved = 0;
+
+	//utf-8 user description in the string pool, not null terminated
+	uint32_t descriptionOffset = 0;
+	uint32_t descriptionBytes = 0;
+};
+
+//characteristics[i] belongs to services[i]
+BleGattTree* BuildGattTree(ResultArena& arena, uint64_t deviceAddress, bool success, const std::vector<ServiceInfo>& services,
+	const std::vector<std::vector<CharacteristicInfo>>& characteristics);
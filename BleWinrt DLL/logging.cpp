@@ -1,10 +1,653 @@
-#include "stdafx.h"
 #include "logging.h"
-#include "serialization.h"
+#include "gatt-cache.h"
+#include "ring-buffer.h"
+#include "utf8.h"
 
+#include <condition_variable>
+#include <cwchar>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
-LogCallback* loggerCallback = nullptr;
-ErrorCallback* errorCallback = nullptr;
+
+atomic<int32_t> logThreshold{ LOG_INFO };
+
+atomic<LogCallback*> loggerCallback{ nullptr };
+atomic<ErrorCallback*> errorCallback{ nullptr };
+
+//set on the logging thread, a callback flushing would wait for itself
+thread_local bool onLogThread = false;
+
+namespace
+{
+	class Logger
+	{
+	public:
+		bool Push(const LogRecord& record)
+		{
+			Start();
+
+			if (!queue.TryPush(record))
+			{
+				dropped++;
+				return false;
+			}
+
+			logged++;
+
+			//pairs with the fence in Run, either the thread sees the record or we see it idle
+			atomic_thread_fence(memory_order_seq_cst);
+
+			if (idle.load(memory_order_relaxed))
+			{
+				{
+					lock_guard guard(lock);
+					signaled = true;
+				}
+
+				wake.notify_one();
+			}
+
+			return true;
+		}
+
+		void Flush()
+		{
+			if (onLogThread)
+				return;
+
+			uint64_t target = logged;
+
+			unique_lock guard(lock);
+			if (!running)
+				return;
+
+			signaled = true;
+			wake.notify_one();
+
+			flushed.wait(guard, [this, target]() { return handled >= target || !running; });
+		}
+
+		void Stop()
+		{
+			if (onLogThread)
+				return;
+
+			lock_guard startGuard(startLock);
+
+			{
+				lock_guard guard(lock);
+				if (!thread.joinable())
+					return;
+
+				stop = true;
+			}
+
+			wake.notify_one();
+			thread.join();
+
+			lock_guard guard(lock);
+			stop = false;
+			flushed.notify_all();
+		}
+
+		void SetRateLimit(uint32_t linesPerSecond)
+		{
+			rateLimit = linesPerSecond;
+		}
+
+		bool OpenFile(const wchar_t* path)
+		{
+			lock_guard guard(fileLock);
+
+			file.close();
+			file.clear();
+
+			if (path == nullptr || path[0] == 0)
+				return true;
+
+			file.open(filesystem::path(path), ios::binary | ios::trunc);
+
+			LogFileHeader header;
+			if (!file || !file.write((const char*)&header, sizeof(header)))
+			{
+				file.close();
+				return false;
+			}
+
+			return true;
+		}
+
+		void Stats(BleLogStats& stats)
+		{
+			stats.logged = logged;
+			stats.dropped = dropped;
+			stats.suppressed = suppressed;
+			stats.delivered = delivered;
+			stats.pending = (uint32_t)queue.Size();
+			stats.capacity = (uint32_t)queue.Capacity();
+		}
+
+	private:
+		//lines of one format string within the current second
+		struct Burst
+		{
+			int64_t windowStart = 0;
+			uint32_t lines = 0;
+			uint64_t suppressed = 0;
+			LogRecord last;
+		};
+
+		void Start()
+		{
+			if (running.load(memory_order_acquire))
+				return;
+
+			lock_guard startGuard(startLock);
+			if (running.load(memory_order_relaxed))
+				return;
+
+			thread = std::thread(&Logger::Run, this);
+			running.store(true, memory_order_release);
+		}
+
+		void Run()
+		{
+			onLogThread = true;
+
+			LogRecord record;
+			uint64_t done;
+
+			{
+				lock_guard guard(lock);
+				done = handled;
+			}
+
+			while (true)
+			{
+				while (queue.TryPop(record))
+				{
+					Handle(record);
+					done++;
+				}
+
+				FinishBursts(false);
+				ReportDropped();
+
+				{
+					lock_guard guard(fileLock);
+					if (file.is_open())
+						file.flush();
+				}
+
+				{
+					lock_guard guard(lock);
+					handled = done;
+				}
+
+				flushed.notify_all();
+
+				idle.store(true, memory_order_relaxed);
+				atomic_thread_fence(memory_order_seq_cst);
+
+				if (queue.TryPop(record))
+				{
+					idle.store(false, memory_order_relaxed);
+					Handle(record);
+					done++;
+					continue;
+				}
+
+				unique_lock guard(lock);
+
+				//nothing is pushed anymore once stop is set, the queue is drained
+				if (stop)
+					break;
+
+				//suppressed lines are summed up once their second is over
+				if (bursts.empty())
+					wake.wait(guard, [this]() { return signaled || stop; });
+				else
+					wake.wait_for(guard, chrono::seconds(1), [this]() { return signaled || stop; });
+
+				signaled = false;
+				idle.store(false, memory_order_relaxed);
+			}
+
+			FinishBursts(true);
+
+			lock_guard guard(lock);
+			handled = done;
+			running.store(false, memory_order_release);
+		}
+
+		void Handle(const LogRecord& record)
+		{
+			uint32_t limit = rateLimit;
+			if (limit == 0)
+			{
+				Deliver(record, 0);
+				return;
+			}
+
+			Burst& burst = bursts[Key(record)];
+			int64_t now = NowMicroseconds();
+
+			if (now - burst.windowStart >= 1000000)
+			{
+				if (burst.suppressed > 0)
+					Deliver(burst.last, burst.suppressed);
+
+				burst.windowStart = now;
+				burst.lines = 0;
+				burst.suppressed = 0;
+			}
+
+			if (burst.lines < limit)
+			{
+				burst.lines++;
+				Deliver(record, 0);
+				return;
+			}
+
+			burst.suppressed++;
+			burst.last = record;
+			suppressed++;
+		}
+
+		//sums up the bursts whose second is over and forgets the quiet ones, all of them when stopping
+		void FinishBursts(bool all)
+		{
+			int64_t now = NowMicroseconds();
+
+			for (auto it = bursts.begin(); it != bursts.end();)
+			{
+				Burst& burst = it->second;
+				if (!all && now - burst.windowStart < 1000000)
+				{
+					++it;
+					continue;
+				}
+
+				if (burst.suppressed > 0)
+					Deliver(burst.last, burst.suppressed);
+
+				it = bursts.erase(it);
+			}
+		}
+
+		//lines lost to a full queue are reported once the queue has room again
+		void ReportDropped()
+		{
+			uint64_t total = dropped;
+			if (total == reportedDropped)
+				return;
+
+			LogRecord record;
+			record.count = 0;
+			record.textBytes = 0;
+			record.time = chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+			record.format = L"%llu log lines dropped, the log queue was full";
+			record.level = LOG_WARNING;
+			LogCaptureUnsigned(record, total - reportedDropped);
+
+			reportedDropped = total;
+			Deliver(record, 0);
+		}
+
+		//the format string identifies the call site, a plain message its text
+		static uint64_t Key(const LogRecord& record)
+		{
+			uint64_t key = record.format != nullptr ? (uint64_t)(uintptr_t)record.format : 14695981039346656037ULL;
+
+			if (record.format == nullptr)
+				for (uint16_t i = 0; i < record.textBytes; i++)
+					key = (key ^ record.text[i]) * 1099511628211ULL;
+
+			return MixBits(key ^ (uint64_t)record.level);
+		}
+
+		void Deliver(const LogRecord& record, uint64_t suppressedLines)
+		{
+			message.clear();
+			Format(record, message);
+
+			if (suppressedLines > 0)
+			{
+				wchar_t summary[64];
+				swprintf(summary, 64, L" [%llu more suppressed]", (unsigned long long)suppressedLines);
+				message += summary;
+			}
+
+			utf8.clear();
+
+			if (record.level >= LOG_ERROR)
+			{
+				if (ErrorCallback* callback = errorCallback.load())
+					callback(message.c_str());
+			}
+			else if (LogCallback* callback = loggerCallback.load())
+			{
+				AppendUtf8(utf8, message);
+				callback(utf8.c_str());
+			}
+
+			{
+				lock_guard guard(fileLock);
+
+				if (file.is_open())
+				{
+					if (utf8.empty())
+						AppendUtf8(utf8, message);
+
+					LogFileRecord line;
+					line.time = record.time;
+					line.level = record.level;
+					line.size = (uint32_t)utf8.size();
+
+					file.write((const char*)&line, sizeof(line));
+					file.write(utf8.data(), utf8.size());
+				}
+			}
+
+			delivered++;
+		}
+
+		static void AppendArgument(const LogRecord& record, const LogArgument& argument, wstring& out)
+		{
+			const uint8_t* text = record.text + argument.offset;
+
+			switch (argument.kind)
+			{
+			case LOG_ARGUMENT_WIDE:
+			{
+				size_t start = out.size();
+				out.resize(start + argument.length);
+				memcpy(&out[start], text, argument.length * sizeof(wchar_t));
+				break;
+			}
+			case LOG_ARGUMENT_NARROW:
+				AppendWide(out, (const char*)text, argument.length);
+				break;
+			case LOG_ARGUMENT_GUID:
+			{
+				guid value;
+				memcpy(&value, text, sizeof(value));
+
+				wchar_t buffer[40];
+				swprintf(buffer, 40, L"{%08x-%04x-%04x-%02x%02x-%02x%02x%02x%02x%02x%02x}", value.Data1, value.Data2, value.Data3,
+					value.Data4[0], value.Data4[1], value.Data4[2], value.Data4[3], value.Data4[4], value.Data4[5], value.Data4[6], value.Data4[7]);
+				out += buffer;
+				break;
+			}
+			default:
+				break;
+			}
+		}
+
+		//walks the format itself, every conversion is handed to swprintf on its own with the captured argument
+		static void Format(const LogRecord& record, wstring& out)
+		{
+			if (record.format == nullptr)
+			{
+				if (record.count > 0)
+					AppendArgument(record, record.arguments[0], out);
+
+				return;
+			}
+
+			const wchar_t* format = record.format;
+			uint16_t next = 0;
+
+			while (*format != 0)
+			{
+				if (*format != L'%')
+				{
+					out.push_back(*format++);
+					continue;
+				}
+
+				if (format[1] == L'%')
+				{
+					out.push_back(L'%');
+					format += 2;
+					continue;
+				}
+
+				//flags, width and precision are kept, the length modifier is replaced to match the captured type
+				wchar_t spec[32] = L"%";
+				size_t specLength = 1;
+				const wchar_t* cursor = format + 1;
+
+				while (*cursor != 0 && wcschr(L"-+ #0123456789.", *cursor) != nullptr && specLength < 24)
+					spec[specLength++] = *cursor++;
+
+				while (*cursor != 0 && wcschr(L"hlLqjzt", *cursor) != nullptr)
+					cursor++;
+
+				wchar_t conversion = *cursor;
+				if (conversion == 0)
+				{
+					out.append(format);
+					break;
+				}
+
+				format = cursor + 1;
+
+				if (next >= record.count)
+				{
+					out.append(L"(missing)");
+					continue;
+				}
+
+				const LogArgument& argument = record.arguments[next++];
+				wchar_t buffer[128];
+				buffer[0] = 0;
+
+				switch (argument.kind)
+				{
+				case LOG_ARGUMENT_SIGNED:
+				case LOG_ARGUMENT_UNSIGNED:
+				{
+					bool isUnsigned = wcschr(L"uxXo", conversion) != nullptr;
+					wchar_t type = wcschr(L"diuxXo", conversion) != nullptr ? conversion : (argument.kind == LOG_ARGUMENT_SIGNED ? L'd' : L'u');
+					isUnsigned = isUnsigned || type == L'u';
+
+					spec[specLength] = L'l';
+					spec[specLength + 1] = L'l';
+					spec[specLength + 2] = type;
+					spec[specLength + 3] = 0;
+
+					if (conversion == L'c')
+						swprintf(buffer, 128, L"%lc", (wint_t)argument.unsignedInteger);
+					else if (isUnsigned)
+						swprintf(buffer, 128, spec, (unsigned long long)argument.unsignedInteger);
+					else
+						swprintf(buffer, 128, spec, (long long)argument.integer);
+					break;
+				}
+				case LOG_ARGUMENT_REAL:
+					spec[specLength] = wcschr(L"feEgGaA", conversion) != nullptr ? conversion : L'g';
+					spec[specLength + 1] = 0;
+					swprintf(buffer, 128, spec, argument.real);
+					break;
+				case LOG_ARGUMENT_POINTER:
+					swprintf(buffer, 128, L"%p", argument.pointer);
+					break;
+				default:
+					AppendArgument(record, argument, out);
+					break;
+				}
+
+				out += buffer;
+			}
+		}
+
+		RingBuffer<LogRecord> queue{ LOG_QUEUE_CAPACITY };
+
+		mutex startLock;
+		std::thread thread;
+		atomic<bool> running{ false };
+
+		//the thread sleeps on wake once it found the queue empty with idle set
+		atomic<bool> idle{ false };
+		mutex lock;
+		condition_variable wake;
+		condition_variable flushed;
+		bool signaled = false;
+		bool stop = false;
+		//records taken off the queue over all runs of the thread, compared against logged
+		uint64_t handled = 0;
+
+		atomic<uint32_t> rateLimit{ LOG_DEFAULT_RATE_LIMIT };
+
+		//owned by the logging thread
+		unordered_map<uint64_t, Burst> bursts;
+		uint64_t reportedDropped = 0;
+		wstring message;
+		string utf8;
+
+		mutex fileLock;
+		ofstream file;
+
+		atomic<uint64_t> logged{ 0 };
+		atomic<uint64_t> dropped{ 0 };
+		atomic<uint64_t> suppressed{ 0 };
+		atomic<uint64_t> delivered{ 0 };
+	};
+
+	//never destroyed, the logging thread must not be joined while the loader lock is held on unload, StopLogging
+	//stops it
+	Logger& logger = *new Logger();
+
+	LogArgument* NextArgument(LogRecord& record, LogArgumentKind kind)
+	{
+		if (record.count >= LOG_MAX_ARGUMENTS)
+			return nullptr;
+
+		LogArgument& argument = record.arguments[record.count++];
+		argument.kind = kind;
+		argument.offset = 0;
+		argument.length = 0;
+		argument.unsignedInteger = 0;
+		return &argument;
+	}
+
+	//copies as many whole units as fit, returns how many
+	size_t CopyText(LogRecord& record, LogArgument& argument, const void* data, size_t units, size_t unitSize)
+	{
+		size_t fit = min(units, (LOG_TEXT_BYTES - record.textBytes) / unitSize);
+
+		argument.offset = record.textBytes;
+		argument.length = (uint16_t)fit;
+
+		if (fit > 0)
+			memcpy(record.text + record.textBytes, data, fit * unitSize);
+
+		record.textBytes = (uint16_t)(record.textBytes + fit * unitSize);
+		return fit;
+	}
+}
+
+
+void LogCaptureSigned(LogRecord& record, int64_t value)
+{
+	if (LogArgument* argument = NextArgument(record, LOG_ARGUMENT_SIGNED))
+		argument->integer = value;
+}
+
+void LogCaptureUnsigned(LogRecord& record, uint64_t value)
+{
+	if (LogArgument* argument = NextArgument(record, LOG_ARGUMENT_UNSIGNED))
+		argument->unsignedInteger = value;
+}
+
+void LogCaptureReal(LogRecord& record, double value)
+{
+	if (LogArgument* argument = NextArgument(record, LOG_ARGUMENT_REAL))
+		argument->real = value;
+}
+
+void LogCapturePointer(LogRecord& record, const void* value)
+{
+	if (LogArgument* argument = NextArgument(record, LOG_ARGUMENT_POINTER))
+		argument->pointer = value;
+}
+
+void LogCaptureWide(LogRecord& record, const wchar_t* value, size_t length)
+{
+	if (LogArgument* argument = NextArgument(record, LOG_ARGUMENT_WIDE))
+		CopyText(record, *argument, value, length, sizeof(wchar_t));
+}
+
+void LogCaptureNarrow(LogRecord& record, const char* value, size_t length)
+{
+	if (LogArgument* argument = NextArgument(record, LOG_ARGUMENT_NARROW))
+		CopyText(record, *argument, value, length, 1);
+}
+
+void LogCaptureWide(LogRecord& record, const wchar_t* value)
+{
+	LogCaptureWide(record, value, value != nullptr ? wcslen(value) : 0);
+}
+
+void LogCaptureNarrow(LogRecord& record, const char* value)
+{
+	LogCaptureNarrow(record, value, value != nullptr ? strlen(value) : 0);
+}
+
+void LogCaptureGuid(LogRecord& record, const guid& value)
+{
+	if (LogArgument* argument = NextArgument(record, LOG_ARGUMENT_GUID))
+		CopyText(record, *argument, &value, 1, sizeof(guid));
+}
+
+bool LogPush(LogRecord& record, LogLevel level, const wchar_t* format)
+{
+	record.time = chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+	record.format = format;
+	record.level = level;
+
+	return logger.Push(record);
+}
+
+void Log(const wstring& s)
+{
+	if (!LogEnabled(LOG_INFO))
+		return;
+
+	LogRecord record;
+	record.count = 0;
+	record.textBytes = 0;
+
+	LogCaptureWide(record, s.c_str(), s.size());
+	LogPush(record, LOG_INFO, nullptr);
+}
+
+void Log(const char* s)
+{
+	if (!LogEnabled(LOG_INFO) || s == nullptr)
+		return;
+
+	LogRecord record;
+	record.count = 0;
+	record.textBytes = 0;
+
+	LogCaptureNarrow(record, s, strlen(s));
+	LogPush(record, LOG_INFO, nullptr);
+}
+
+void FlushLog()
+{
+	logger.Flush();
+}
+
+void StopLogging()
+{
+	logger.Stop();
+}
 
 
 void RegisterLogCallback(LogCallback cb)
@@ -17,26 +660,26 @@ void RegisterErrorCallback(ErrorCallback cb)
 	errorCallback = cb;
 }
 
-void Log(const wstring& s)
+void SetLogLevel(LogLevel level)
 {
-	if (loggerCallback)
-		(*loggerCallback)(convert_to_string(s).c_str());
+	logThreshold = level;
 }
 
-void Log(const char* s)
+void SetLogRateLimit(uint32_t linesPerSecond)
 {
-	if (loggerCallback)
-		(*loggerCallback)(s);
+	logger.SetRateLimit(linesPerSecond);
 }
 
-void LogError(const wchar_t* message, ...)
+bool EnableBinaryLog(const wchar_t* path)
 {
-	wchar_t last_error[2048];
-	va_list args;
-	va_start(args, message);
-	vswprintf_s(last_error, message, args);
-	va_end(args);
+	return logger.OpenFile(path);
+}
 
-	if (errorCallback)
-		(*errorCallback)(last_error);
-}
\ No newline at end of file
+void GetLogStats(BleLogStats* stats)
+{
+	if (stats == nullptr)
+		return;
+
+	*stats = {};
+	logger.Stats(*stats);
+}
@@ -1,12 +1,183 @@
 #pragma once
 
-#include "stdafx.h"
+#include "platform.h"
+
+#include <atomic>
+#include <string>
+#include <type_traits>
 
 using namespace std;
 
+//logging never formats or calls back on the thread that logs. the arguments are captured into a fixed size record
+//pushed to a lock-free queue, a background thread formats the records, rate limits them and hands them to the
+//registered callbacks and the binary log
+
+enum LogLevel : int32_t
+{
+	LOG_TRACE = 0,
+	LOG_DEBUG = 1,
+	LOG_INFO = 2,
+	LOG_WARNING = 3,
+	//errors and above go to the error callback, everything else to the log callback
+	LOG_ERROR = 4,
+	LOG_NONE = 5,
+};
+
+struct BleLogStats
+{
+	uint64_t logged = 0;
+	//lost because the queue was full
+	uint64_t dropped = 0;
+	//held back by the rate limit, each burst is summed up in one line once its second is over
+	uint64_t suppressed = 0;
+	uint64_t delivered = 0;
+
+	uint32_t pending = 0;
+	uint32_t capacity = 0;
+};
+
+const int LOG_MAX_ARGUMENTS = 8;
+//strings and guids of a record are copied here, longer ones are cut short
+const size_t LOG_TEXT_BYTES = 512;
+const size_t LOG_QUEUE_CAPACITY = 1024;
+//lines per second from one format string before the rest are counted instead, 0 for no limit
+const uint32_t LOG_DEFAULT_RATE_LIMIT = 20;
+
+const uint32_t LOG_FILE_MAGIC = 0x474F4C42; //"BLOG"
+const uint32_t LOG_FILE_VERSION = 1;
+
+//binary log: a LogFileHeader, then per line a LogFileRecord and its utf-8 text
+struct LogFileHeader
+{
+	uint32_t magic = LOG_FILE_MAGIC;
+	uint32_t version = LOG_FILE_VERSION;
+};
+
+struct LogFileRecord
+{
+	//unix time in microseconds the line was logged at
+	int64_t time = 0;
+	int32_t level = 0;
+	uint32_t size = 0;
+};
+
+enum LogArgumentKind : uint8_t
+{
+	LOG_ARGUMENT_SIGNED,
+	LOG_ARGUMENT_UNSIGNED,
+	LOG_ARGUMENT_REAL,
+	LOG_ARGUMENT_POINTER,
+	//offset and length in the record's text
+	LOG_ARGUMENT_WIDE,
+	LOG_ARGUMENT_NARROW,
+	LOG_ARGUMENT_GUID,
+};
+
+struct LogArgument
+{
+	LogArgumentKind kind;
+	uint16_t offset;
+	uint16_t length;
+
+	union
+	{
+		int64_t integer;
+		uint64_t unsignedInteger;
+		double real;
+		const void* pointer;
+	};
+};
+
+//format must be a string literal, it is only read once the record is formatted. without a format the record's one
+//argument is the message
+struct LogRecord
+{
+	int64_t time;
+	const wchar_t* format;
+	int32_t level;
+	uint16_t count;
+	uint16_t textBytes;
+
+	LogArgument arguments[LOG_MAX_ARGUMENTS];
+	uint8_t text[LOG_TEXT_BYTES];
+};
+
+extern atomic<int32_t> logThreshold;
+
+inline bool LogEnabled(LogLevel level)
+{
+	return level >= logThreshold.load(memory_order_relaxed);
+}
+
+void LogCaptureSigned(LogRecord& record, int64_t value);
+void LogCaptureUnsigned(LogRecord& record, uint64_t value);
+void LogCaptureReal(LogRecord& record, double value);
+void LogCapturePointer(LogRecord& record, const void* value);
+void LogCaptureWide(LogRecord& record, const wchar_t* value, size_t length);
+void LogCaptureNarrow(LogRecord& record, const char* value, size_t length);
+//null strings are captured as empty ones
+void LogCaptureWide(LogRecord& record, const wchar_t* value);
+void LogCaptureNarrow(LogRecord& record, const char* value);
+void LogCaptureGuid(LogRecord& record, const guid& value);
+
+template <typename T>
+void LogCapture(LogRecord& record, const T& value)
+{
+	using Plain = decay_t<T>;
+
+	if constexpr (is_enum_v<Plain>)
+		LogCaptureSigned(record, (int64_t)value);
+	else if constexpr (is_integral_v<Plain> && is_signed_v<Plain>)
+		LogCaptureSigned(record, value);
+	else if constexpr (is_integral_v<Plain>)
+		LogCaptureUnsigned(record, value);
+	else if constexpr (is_floating_point_v<Plain>)
+		LogCaptureReal(record, value);
+	else if constexpr (is_convertible_v<const T&, const wchar_t*>)
+		LogCaptureWide(record, (const wchar_t*)value);
+	else if constexpr (is_convertible_v<const T&, const char*>)
+		LogCaptureNarrow(record, (const char*)value);
+	else if constexpr (is_same_v<Plain, wstring>)
+		LogCaptureWide(record, value.c_str(), value.size());
+	else if constexpr (is_same_v<Plain, string>)
+		LogCaptureNarrow(record, value.c_str(), value.size());
+	else if constexpr (is_same_v<Plain, guid>)
+		LogCaptureGuid(record, value);
+	else
+		LogCapturePointer(record, (const void*)value);
+}
+
+//false and counted as dropped if the queue is full
+bool LogPush(LogRecord& record, LogLevel level, const wchar_t* format);
+
+//printf style, %s takes wide and narrow strings as well as guids. the format has to outlive the process' logging
+template <typename... Args>
+void LogFormat(LogLevel level, const wchar_t* format, const Args&... args)
+{
+	static_assert(sizeof...(Args) <= LOG_MAX_ARGUMENTS, "too many log arguments");
+
+	if (!LogEnabled(level))
+		return;
+
+	LogRecord record;
+	record.count = 0;
+	record.textBytes = 0;
+
+	(LogCapture(record, args), ...);
+	LogPush(record, level, format);
+}
+
+template <typename... Args>
+void LogError(const wchar_t* format, const Args&... args)
+{
+	LogFormat(LOG_ERROR, format, args...);
+}
+
 void Log(const wstring& s);
 void Log(const char* s);
-void LogError(const wchar_t* message, ...);
+
+//delivers what is still queued and stops the logging thread, the next line starts it again
+void StopLogging();
 
 
 //these functions will be available through the native DLL interface, exposed to Unity
@@ -16,6 +187,16 @@ extern "C"
 	using ErrorCallback = void(const wchar_t*);
 
 	//register logging functions
-	__declspec(dllexport) void RegisterLogCallback(LogCallback cb);
-	__declspec(dllexport) void RegisterErrorCallback(ErrorCallback cb);
-}
\ No newline at end of file
+	BLE_EXPORT void RegisterLogCallback(LogCallback cb);
+	BLE_EXPORT void RegisterErrorCallback(ErrorCallback cb);
+
+	//lines below the level are discarded before anything is captured, LOG_INFO by default
+	BLE_EXPORT void SetLogLevel(LogLevel level);
+	//lines per second from one format string, the rest are summed up once the second is over. 0 disables the limit
+	BLE_EXPORT void SetLogRateLimit(uint32_t linesPerSecond);
+	//also write every delivered line to a binary log, null or empty closes it
+	BLE_EXPORT bool EnableBinaryLog(const wchar_t* path);
+	//blocks until everything logged so far was delivered, returns right away from a log callback
+	BLE_EXPORT void FlushLog();
+	BLE_EXPORT void GetLogStats(BleLogStats* stats);
+}
@@ -0,0 +1,129 @@
+#include "mapped-file.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include "utf8.h"
+
+#include <cwchar>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const wchar_t* path)
+{
+	Close();
+
+	HANDLE handle = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	file = handle;
+
+	LARGE_INTEGER length;
+	if (!GetFileSizeEx(handle, &length))
+	{
+		Close();
+		return false;
+	}
+
+	//a zero length file can't be mapped
+	if (length.QuadPart == 0)
+		return true;
+
+	mapping = CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr)
+	{
+		Close();
+		return false;
+	}
+
+	data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (data == nullptr)
+	{
+		Close();
+		return false;
+	}
+
+	size = (size_t)length.QuadPart;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (data != nullptr)
+		UnmapViewOfFile(data);
+
+	if (mapping != nullptr)
+		CloseHandle(mapping);
+
+	if (file != nullptr)
+		CloseHandle(file);
+
+	file = nullptr;
+	mapping = nullptr;
+	data = nullptr;
+	size = 0;
+}
+
+#else
+
+bool MappedFile::Open(const wchar_t* path)
+{
+	Close();
+
+	string narrow;
+	AppendUtf8(narrow, path, wcslen(path));
+
+	int descriptor = open(narrow.c_str(), O_RDONLY);
+	if (descriptor < 0)
+		return false;
+
+	struct stat status;
+	if (fstat(descriptor, &status) != 0)
+	{
+		close(descriptor);
+		return false;
+	}
+
+	//the mapping keeps the file referenced, the descriptor is not needed past this point
+	if (status.st_size > 0)
+	{
+		void* view = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+		if (view == MAP_FAILED)
+		{
+			close(descriptor);
+			return false;
+		}
+
+		madvise(view, (size_t)status.st_size, MADV_SEQUENTIAL);
+		data = (const uint8_t*)view;
+		size = (size_t)status.st_size;
+	}
+
+	close(descriptor);
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (data != nullptr)
+		munmap((void*)data, size);
+
+	data = nullptr;
+	size = 0;
+}
+
+#endif
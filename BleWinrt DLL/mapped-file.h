@@ -0,0 +1,30 @@
+#pragma once
+
+#include "platform.h"
+
+//read-only view of a whole file, CreateFileMapping on Windows and mmap elsewhere
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	//closes the previous view. an empty file opens fine with a null Data()
+	bool Open(const wchar_t* path);
+	void Close();
+
+	const uint8_t* Data() const { return data; }
+	size_t Size() const { return size; }
+
+private:
+#ifdef _WIN32
+	void* file = nullptr;
+	void* mapping = nullptr;
+#endif
+
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+};
@@ -0,0 +1,92 @@
+#include "notification-queue.h"
+
+using namespace std;
+
+
+void NotificationQueue::Configure(size_t capacityBytes)
+{
+	lock_guard guard(lock);
+
+	bytes.assign(capacityBytes, 0);
+	readOffset = 0;
+	writeOffset = 0;
+
+	enqueued = 0;
+	dropped = 0;
+}
+
+bool NotificationQueue::Push(uint32_t subscription, int64_t timestamp, const uint8_t* data, size_t size)
+{
+	size_t recordSize = NotificationRecordSize(size);
+
+	lock_guard guard(lock);
+
+	if (writeOffset + recordSize > bytes.size())
+	{
+		//move the unread records to the front, only happens when the consumer lags behind
+		size_t unread = writeOffset - readOffset;
+		if (unread + recordSize > bytes.size())
+		{
+			dropped++;
+			return false;
+		}
+
+		memmove(bytes.data(), bytes.data() + readOffset, unread);
+		readOffset = 0;
+		writeOffset = unread;
+	}
+
+	BleNotificationRecord header;
+	header.subscription = subscription;
+	header.size = (uint32_t)size;
+	header.timestamp = timestamp;
+
+	memcpy(bytes.data() + writeOffset, &header, sizeof(header));
+	if (size > 0)
+		memcpy(bytes.data() + writeOffset + sizeof(header), data, size);
+
+	writeOffset += recordSize;
+	enqueued++;
+
+	return true;
+}
+
+size_t NotificationQueue::Drain(uint8_t* buffer, size_t bufferBytes)
+{
+	lock_guard guard(lock);
+
+	//find the last whole record that still fits, then copy everything up to it at once
+	size_t end = readOffset;
+	while (end < writeOffset)
+	{
+		BleNotificationRecord header;
+		memcpy(&header, bytes.data() + end, sizeof(header));
+
+		size_t recordSize = NotificationRecordSize(header.size);
+		if (end + recordSize - readOffset > bufferBytes)
+			break;
+
+		end += recordSize;
+	}
+
+	size_t count = end - readOffset;
+	memcpy(buffer, bytes.data() + readOffset, count);
+
+	readOffset = end;
+	if (readOffset == writeOffset)
+		readOffset = writeOffset = 0;
+
+	return count;
+}
+
+size_t NotificationQueue::Capacity()
+{
+	lock_guard guard(lock);
+	return bytes.size();
+}
+
+size_t NotificationQueue::Pending()
+{
+	lock_guard guard(lock);
+	return writeOffset - readOffset;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "platform.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+//header of a packed notification record. the payload follows the header directly and the next record starts at the
+//following multiple of 8 bytes, see NotificationRecordSize
+struct BleNotificationRecord
+{
+	uint32_t subscription = 0;
+	uint32_t size = 0;
+
+	//NowMicroseconds() when the notification arrived
+	int64_t timestamp = 0;
+};
+
+inline size_t NotificationRecordSize(size_t payloadSize)
+{
+	return sizeof(BleNotificationRecord) + ((payloadSize + 7) & ~(size_t)7);
+}
+
+//bounded byte queue of packed notification records, filled by the notification handlers and drained in bulk
+class NotificationQueue
+{
+public:
+	//drops everything queued
+	void Configure(size_t capacityBytes);
+
+	//false if the record doesn't fit, the notification is dropped and counted
+	bool Push(uint32_t subscription, int64_t timestamp, const uint8_t* data, size_t size);
+
+	//copies as many whole records as fit into buffer, returns the number of bytes written
+	size_t Drain(uint8_t* buffer, size_t bufferBytes);
+
+	size_t Capacity();
+	size_t Pending();
+
+	std::atomic<uint64_t> enqueued { 0 };
+	std::atomic<uint64_t> dropped { 0 };
+
+private:
+	std::mutex lock;
+	std::vector<uint8_t> bytes;
+
+	//unread records live in [readOffset, writeOffset)
+	size_t readOffset = 0;
+	size_t writeOffset = 0;
+};
@@ -0,0 +1,186 @@
+#include "operation-stats.h"
+
+#include <cmath>
+#include <mutex>
+
+using namespace std;
+
+
+int LatencyHistogram::BucketOf(uint64_t value)
+{
+	if (value < SUB_BUCKETS)
+		return (int)value;
+
+	if (value >= (1ULL << MAX_EXPONENT))
+		return BUCKETS - 1;
+
+	int exponent = 0;
+	while ((value >> exponent) >= 2 * SUB_BUCKETS)
+		exponent++;
+
+	//value >> exponent is in [SUB_BUCKETS, 2 * SUB_BUCKETS), the low bits pick the linear bucket
+	return (exponent + 1) * SUB_BUCKETS + (int)((value >> exponent) - SUB_BUCKETS);
+}
+
+uint64_t LatencyHistogram::UpperBound(int bucket)
+{
+	if (bucket < SUB_BUCKETS)
+		return (uint64_t)bucket;
+
+	int exponent = bucket / SUB_BUCKETS - 1;
+	uint64_t mantissa = SUB_BUCKETS + bucket % SUB_BUCKETS;
+	return ((mantissa + 1) << exponent) - 1;
+}
+
+void LatencyHistogram::Record(uint64_t microseconds, bool success)
+{
+	buckets[BucketOf(microseconds)].fetch_add(1, memory_order_relaxed);
+	count.fetch_add(1, memory_order_relaxed);
+	total.fetch_add(microseconds, memory_order_relaxed);
+
+	if (!success)
+	{
+		errors.fetch_add(1, memory_order_relaxed);
+
+		if ((int64_t)microseconds >= STATS_TIMEOUT_MICROSECONDS)
+			timeouts.fetch_add(1, memory_order_relaxed);
+	}
+
+	uint64_t highest = max.load(memory_order_relaxed);
+	while (microseconds > highest && !max.compare_exchange_weak(highest, microseconds, memory_order_relaxed))
+	{
+	}
+}
+
+void LatencyHistogram::Snapshot(BleOperationStats& stats) const
+{
+	uint64_t counts[BUCKETS];
+	uint64_t recorded = 0;
+
+	//recording goes on meanwhile, the percentiles are taken over the buckets as read here
+	for (int i = 0; i < BUCKETS; i++)
+	{
+		counts[i] = buckets[i].load(memory_order_relaxed);
+		recorded += counts[i];
+	}
+
+	stats.count = count.load(memory_order_relaxed);
+	stats.errors = errors.load(memory_order_relaxed);
+	stats.timeouts = timeouts.load(memory_order_relaxed);
+	stats.max = max.load(memory_order_relaxed);
+	stats.mean = stats.count > 0 ? total.load(memory_order_relaxed) / stats.count : 0;
+
+	if (recorded == 0)
+		return;
+
+	//rank of each percentile, rounded up so p999 of a handful of samples is the largest one
+	const double fractions[3] = { 0.5, 0.99, 0.999 };
+	uint64_t* results[3] = { &stats.p50, &stats.p99, &stats.p999 };
+
+	int bucket = 0;
+	uint64_t seen = counts[0];
+
+	for (int i = 0; i < 3; i++)
+	{
+		uint64_t rank = (uint64_t)ceil(fractions[i] * (double)recorded);
+		if (rank < 1)
+			rank = 1;
+
+		while (seen < rank && bucket < BUCKETS - 1)
+			seen += counts[++bucket];
+
+		*results[i] = min(UpperBound(bucket), stats.max);
+	}
+}
+
+void LatencyHistogram::Reset()
+{
+	for (auto& bucket : buckets)
+		bucket.store(0, memory_order_relaxed);
+
+	count = 0;
+	errors = 0;
+	timeouts = 0;
+	total = 0;
+	max = 0;
+}
+
+
+void OperationStats::Record(StatsOperation operation, uint64_t deviceAddress, int64_t microseconds, bool success)
+{
+	if (operation < 0 || operation >= STATS_OPERATIONS)
+		return;
+
+	uint64_t elapsed = microseconds > 0 ? (uint64_t)microseconds : 0;
+	totals.operations[operation].Record(elapsed, success);
+
+	{
+		shared_lock guard(lock);
+
+		auto found = devices.find(deviceAddress);
+		if (found != devices.end())
+		{
+			found->second->operations[operation].Record(elapsed, success);
+			return;
+		}
+	}
+
+	unique_lock guard(lock);
+
+	auto& histograms = devices[deviceAddress];
+	if (!histograms)
+	{
+		if (devices.size() > STATS_MAX_DEVICES)
+		{
+			devices.erase(deviceAddress);
+			return;
+		}
+
+		histograms = make_unique<Histograms>();
+	}
+
+	histograms->operations[operation].Record(elapsed, success);
+}
+
+size_t OperationStats::Snapshot(BleOperationStats* buffer, size_t maxCount)
+{
+	size_t written = 0;
+
+	auto add = [&](uint64_t device, int operation, const LatencyHistogram& histogram)
+	{
+		if (buffer != nullptr)
+		{
+			if (written >= maxCount)
+				return;
+
+			BleOperationStats& line = buffer[written];
+			line = BleOperationStats();
+			line.device = device;
+			line.operation = (uint32_t)operation;
+			histogram.Snapshot(line);
+		}
+
+		written++;
+	};
+
+	for (int i = 0; i < STATS_OPERATIONS; i++)
+		add(0, i, totals.operations[i]);
+
+	shared_lock guard(lock);
+
+	for (auto& [device, histograms] : devices)
+		for (int i = 0; i < STATS_OPERATIONS; i++)
+			if (histograms->operations[i].Count() > 0)
+				add(device, i, histograms->operations[i]);
+
+	return written;
+}
+
+void OperationStats::Reset()
+{
+	for (auto& histogram : totals.operations)
+		histogram.Reset();
+
+	unique_lock guard(lock);
+	devices.clear();
+}
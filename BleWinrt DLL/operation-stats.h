@@ -0,0 +1,104 @@
+#pragma once
+
+#include "platform.h"
+
+#include <atomic>
+#include <memory>
+#include <shared_mutex>
+#include <unordered_map>
+
+enum StatsOperation
+{
+	STATS_CONNECT = 0,
+	STATS_SERVICES = 1,
+	STATS_CHARACTERISTICS = 2,
+	STATS_READ = 3,
+	STATS_WRITE = 4,
+	STATS_SUBSCRIBE = 5,
+	//from a notification arriving to its callback returning, queueing on the dispatcher included
+	STATS_NOTIFICATION = 6,
+	//from a managed device's link dropping to it being connected again, or given up on as an error
+	STATS_RECONNECT = 7,
+	//a managed device's warm characteristic resolved after a connect
+	STATS_RESOLVE = 8,
+	STATS_OPERATIONS = 9,
+};
+
+//one line of the snapshot, device 0 for the totals over all devices. latencies in microseconds, percentiles are the
+//upper bound of their bucket and at most 12.5% too high
+struct BleOperationStats
+{
+	uint64_t device = 0;
+	uint32_t operation = 0;
+	uint32_t reserved = 0;
+
+	uint64_t count = 0;
+	uint64_t errors = 0;
+	//failures that took longer than STATS_TIMEOUT_MICROSECONDS, which is how the radio reports a peripheral gone quiet
+	uint64_t timeouts = 0;
+
+	uint64_t mean = 0;
+	uint64_t p50 = 0;
+	uint64_t p99 = 0;
+	uint64_t p999 = 0;
+	uint64_t max = 0;
+};
+
+const int64_t STATS_TIMEOUT_MICROSECONDS = 5000000;
+
+//devices beyond this only count towards the totals
+const size_t STATS_MAX_DEVICES = 256;
+
+//log-linear latency histogram: 8 linear buckets per power of two, values up to 2^32 microseconds. recording is a few
+//relaxed atomic increments, no lock
+class LatencyHistogram
+{
+public:
+	static const int SUB_BITS = 3;
+	static const int SUB_BUCKETS = 1 << SUB_BITS;
+	static const int MAX_EXPONENT = 32;
+	static const int BUCKETS = (MAX_EXPONENT - SUB_BITS + 1) * SUB_BUCKETS;
+
+	void Record(uint64_t microseconds, bool success);
+	void Snapshot(BleOperationStats& stats) const;
+	void Reset();
+
+	uint64_t Count() const
+	{
+		return count.load(std::memory_order_relaxed);
+	}
+
+	static int BucketOf(uint64_t value);
+	static uint64_t UpperBound(int bucket);
+
+private:
+	std::atomic<uint64_t> buckets[BUCKETS] {};
+	std::atomic<uint64_t> count { 0 };
+	std::atomic<uint64_t> errors { 0 };
+	std::atomic<uint64_t> timeouts { 0 };
+	std::atomic<uint64_t> total { 0 };
+	std::atomic<uint64_t> max { 0 };
+};
+
+//a histogram per operation, over all devices and per device
+class OperationStats
+{
+public:
+	void Record(StatsOperation operation, uint64_t deviceAddress, int64_t microseconds, bool success);
+
+	//totals for every operation first, then every device and operation that saw any. returns the number of lines
+	//written, or the number needed if buffer is null
+	size_t Snapshot(BleOperationStats* buffer, size_t maxCount);
+	void Reset();
+
+private:
+	struct Histograms
+	{
+		LatencyHistogram operations[STATS_OPERATIONS];
+	};
+
+	Histograms totals;
+
+	std::shared_mutex lock;
+	std::unordered_map<uint64_t, std::unique_ptr<Histograms>> devices;
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+//types shared by the exported api, the backends and the portable helpers. everything reachable from this header
+//has to compile without the Windows SDK, so the simulated backend can be built and exercised on other platforms
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <chrono>
+
+#ifdef _WIN32
+
+#include <winrt/base.h>
+
+using winrt::guid;
+
+//exported from the DLL, headers shared with the portable helpers declare their exports with it
+#define BLE_EXPORT __declspec(dllexport)
+
+#else
+
+#define BLE_EXPORT
+
+//layout compatible stand-in for winrt::guid / GUID
+struct guid
+{
+	uint32_t Data1;
+	uint16_t Data2;
+	uint16_t Data3;
+	uint8_t Data4[8];
+};
+
+inline bool operator==(const guid& left, const guid& right)
+{
+	return memcmp(&left, &right, sizeof(guid)) == 0;
+}
+
+inline bool operator!=(const guid& left, const guid& right)
+{
+	return !(left == right);
+}
+
+inline bool operator<(const guid& left, const guid& right)
+{
+	return memcmp(&left, &right, sizeof(guid)) < 0;
+}
+
+#endif
+
+//monotonic clock used for latencies and scheduling, independent of the advert timestamps reported by the radio
+inline int64_t NowMicroseconds()
+{
+	using namespace std::chrono;
+	return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,105 @@
+#include "result-arena.h"
+
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+const uint32_t BLOCK_LIVE = 0x4C425241; //"ARBL"
+const uint32_t BLOCK_FREE = 0x45524641; //"AFRE"
+
+
+ResultArena::~ResultArena()
+{
+	for (auto& blocks : freeBlocks)
+		for (BlockHeader* block : blocks)
+			free(block);
+}
+
+int ResultArena::SizeClass(size_t bytes)
+{
+	int sizeClass = 0;
+	while ((MIN_BLOCK << sizeClass) < bytes + sizeof(BlockHeader))
+		sizeClass++;
+
+	return sizeClass;
+}
+
+void* ResultArena::Allocate(size_t bytes, bool zeroFill)
+{
+	int sizeClass = SizeClass(bytes);
+	size_t blockBytes = MIN_BLOCK << sizeClass;
+	BlockHeader* block = nullptr;
+
+	if (sizeClass < SIZE_CLASSES)
+	{
+		lock_guard guard(lock);
+
+		if (!freeBlocks[sizeClass].empty())
+		{
+			block = freeBlocks[sizeClass].back();
+			freeBlocks[sizeClass].pop_back();
+		}
+	}
+
+	if (block == nullptr)
+	{
+		//malloc aligns to 16 on the 64-bit targets, the header keeps the payload at that alignment
+		block = (BlockHeader*)malloc(blockBytes);
+		if (block == nullptr)
+			return nullptr;
+	}
+
+	block->magic = BLOCK_LIVE;
+	block->sizeClass = (uint32_t)sizeClass;
+	block->bytes = bytes;
+
+	outstanding++;
+	outstandingBytes += bytes;
+
+	void* result = block + 1;
+	if (zeroFill)
+		memset(result, 0, bytes);
+
+	return result;
+}
+
+bool ResultArena::Release(void* result)
+{
+	if (result == nullptr)
+		return false;
+
+	BlockHeader* block = (BlockHeader*)result - 1;
+	if (block->magic != BLOCK_LIVE)
+		return false;
+
+	block->magic = BLOCK_FREE;
+
+	outstanding--;
+	outstandingBytes -= block->bytes;
+
+	if (block->sizeClass < SIZE_CLASSES)
+	{
+		lock_guard guard(lock);
+
+		auto& blocks = freeBlocks[block->sizeClass];
+		if (blocks.size() < MAX_FREE_PER_CLASS)
+		{
+			blocks.push_back(block);
+			return true;
+		}
+	}
+
+	free(block);
+	return true;
+}
+
+uint32_t ResultArena::Outstanding() const
+{
+	return outstanding;
+}
+
+uint64_t ResultArena::OutstandingBytes() const
+{
+	return outstandingBytes;
+}
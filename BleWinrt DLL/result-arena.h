@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+//blocks handed to the managed side as callback results and given back through ReleaseResult. freed blocks are kept
+//per power of two size class and reused, so a session that rediscovers over and over settles on a fixed footprint
+class ResultArena
+{
+public:
+	~ResultArena();
+
+	//aligned to 16 bytes, zero filled unless the caller overwrites all of it anyway
+	void* Allocate(size_t bytes, bool zeroFill = true);
+
+	//false if result didn't come from Allocate or was already released
+	bool Release(void* result);
+
+	//blocks and bytes currently held by callers
+	uint32_t Outstanding() const;
+	uint64_t OutstandingBytes() const;
+
+private:
+	static const int SIZE_CLASSES = 24;
+	static const size_t MIN_BLOCK = 64;
+
+	//free blocks kept per size class, anything beyond that goes back to the heap
+	static const size_t MAX_FREE_PER_CLASS = 8;
+
+	struct alignas(16) BlockHeader
+	{
+		uint32_t magic;
+		uint32_t sizeClass;
+		uint64_t bytes;
+	};
+
+	static int SizeClass(size_t bytes);
+
+	std::mutex lock;
+	std::vector<BlockHeader*> freeBlocks[SIZE_CLASSES];
+
+	std::atomic<uint32_t> outstanding { 0 };
+	std::atomic<uint64_t> outstandingBytes { 0 };
+};
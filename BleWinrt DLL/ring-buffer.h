@@ -0,0 +1,126 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+//bounded lock-free queue for trivially copyable records (Vyukov's array based design). any number of producers and
+//consumers may use it concurrently; a full queue rejects the push instead of growing
+template <typename T>
+class RingBuffer
+{
+public:
+	explicit RingBuffer(size_t capacity)
+	{
+		size_t size = RoundCapacity(capacity);
+
+		mask = size - 1;
+		cells.reset(new Cell[size]);
+
+		for (size_t i = 0; i < size; i++)
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	RingBuffer(const RingBuffer&) = delete;
+	RingBuffer& operator=(const RingBuffer&) = delete;
+
+	bool TryPush(const T& value)
+	{
+		size_t position = enqueuePosition.load(std::memory_order_relaxed);
+
+		while (true)
+		{
+			Cell& cell = cells[position & mask];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+
+			if (difference == 0)
+			{
+				if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				{
+					cell.value = value;
+					cell.sequence.store(position + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (difference < 0)
+			{
+				//full
+				return false;
+			}
+			else
+			{
+				position = enqueuePosition.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	bool TryPop(T& value)
+	{
+		size_t position = dequeuePosition.load(std::memory_order_relaxed);
+
+		while (true)
+		{
+			Cell& cell = cells[position & mask];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+
+			if (difference == 0)
+			{
+				if (dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				{
+					value = cell.value;
+					cell.sequence.store(position + mask + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (difference < 0)
+			{
+				//empty
+				return false;
+			}
+			else
+			{
+				position = dequeuePosition.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	size_t Capacity() const
+	{
+		return mask + 1;
+	}
+
+	//the capacity a queue asked for capacity ends up with
+	static size_t RoundCapacity(size_t capacity)
+	{
+		size_t size = 2;
+		while (size < capacity)
+			size <<= 1;
+
+		return size;
+	}
+
+	//only exact while no producer or consumer is active
+	size_t Size() const
+	{
+		size_t enqueued = enqueuePosition.load(std::memory_order_relaxed);
+		size_t dequeued = dequeuePosition.load(std::memory_order_relaxed);
+		return enqueued >= dequeued ? enqueued - dequeued : 0;
+	}
+
+private:
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	std::unique_ptr<Cell[]> cells;
+	size_t mask = 0;
+
+	//producers and consumers spin on different cache lines
+	alignas(64) std::atomic<size_t> enqueuePosition { 0 };
+	alignas(64) std::atomic<size_t> dequeuePosition { 0 };
+};
@@ -0,0 +1,257 @@
+#include "scan-scheduler.h"
+
+using namespace std;
+
+
+//windows of a cycle in order, a mode doubles as the index of its counters
+const ScanMode CYCLE[3] = { SCAN_ACTIVE, SCAN_PASSIVE, SCAN_IDLE };
+
+ScanScheduler::ScanScheduler(ModeHandler apply) :
+	apply(move(apply))
+{
+}
+
+ScanScheduler::~ScanScheduler()
+{
+	Stop();
+}
+
+void ScanScheduler::Configure(const BleScanSchedule& schedule)
+{
+	bool running;
+
+	{
+		lock_guard guard(lock);
+		running = scheduler.joinable();
+	}
+
+	Stop();
+
+	{
+		lock_guard guard(lock);
+		this->schedule = schedule;
+	}
+
+	autoPassive = schedule.autoPassive != 0;
+
+	for (int i = 0; i < 3; i++)
+	{
+		adverts[i] = 0;
+		callbacks[i] = 0;
+		windows[i] = 0;
+		milliseconds[i] = 0;
+	}
+
+	namesFilled = 0;
+
+	if (running)
+		Start();
+}
+
+void ScanScheduler::Start()
+{
+	Stop();
+
+	BleScanSchedule current;
+
+	{
+		lock_guard guard(lock);
+		current = schedule;
+		stopping = false;
+	}
+
+	//the backend starts scanning in the first window's mode, the thread only counts it
+	ScanMode first = SCAN_ACTIVE;
+	if (current.activeMilliseconds == 0 && current.passiveMilliseconds > 0)
+		first = SCAN_PASSIVE;
+	else if (current.activeMilliseconds == 0 && current.passiveMilliseconds == 0 && current.idleMilliseconds > 0)
+		first = SCAN_IDLE;
+
+	mode = first;
+	apply(first);
+
+	scheduler = thread(&ScanScheduler::Run, this, current);
+}
+
+void ScanScheduler::Stop()
+{
+	{
+		lock_guard guard(lock);
+		stopping = true;
+	}
+
+	wake.notify_one();
+
+	if (scheduler.joinable())
+		scheduler.join();
+}
+
+void ScanScheduler::Enter(ScanMode next)
+{
+	windows[next]++;
+
+	if (mode.exchange(next) != next)
+		apply(next);
+}
+
+void ScanScheduler::Run(BleScanSchedule schedule)
+{
+	uint32_t lengths[3] = { schedule.activeMilliseconds, schedule.passiveMilliseconds, schedule.idleMilliseconds };
+	if (lengths[0] == 0 && lengths[1] == 0 && lengths[2] == 0)
+		lengths[0] = SCAN_CONTINUOUS_MILLISECONDS;
+
+	int window = 0;
+	while (lengths[window] == 0)
+		window++;
+
+	//nothing is known about the devices around before the first active window
+	bool named = false;
+
+	while (true)
+	{
+		ScanMode next = CYCLE[window];
+		if (next == SCAN_ACTIVE && autoPassive && named)
+			next = SCAN_PASSIVE;
+
+		unknownHeard = false;
+		Enter(next);
+
+		int64_t start = NowMicroseconds();
+		bool interrupted;
+		bool stopped;
+
+		{
+			unique_lock guard(lock);
+
+			interrupted = wake.wait_for(guard, chrono::milliseconds(lengths[window]), [this, next]()
+			{
+				return stopping || (next == SCAN_PASSIVE && autoPassive && unknownHeard);
+			});
+
+			stopped = stopping;
+		}
+
+		milliseconds[next] += (uint64_t)(NowMicroseconds() - start) / 1000;
+
+		if (stopped)
+			return;
+
+		if (next == SCAN_ACTIVE)
+			named = NamesComplete();
+
+		//a device without a cached name cuts the passive window short, if there is an active one to switch to
+		if (interrupted && lengths[0] > 0)
+		{
+			named = false;
+			window = 0;
+			continue;
+		}
+
+		do
+		{
+			window = (window + 1) % 3;
+		}
+		while (lengths[window] == 0);
+	}
+}
+
+bool ScanScheduler::NamesComplete()
+{
+	unique_lock guard(namesLock);
+
+	bool complete = true;
+
+	for (uint64_t mac : unnamed)
+	{
+		CachedName& entry = names[mac];
+		if (entry.name.empty() && ++entry.attempts < SCAN_NAME_ATTEMPTS)
+			complete = false;
+	}
+
+	unnamed.clear();
+	return complete;
+}
+
+ScanMode ScanScheduler::Observe(AdvertEvent& advert)
+{
+	//the name handed out while the cached one may change
+	thread_local wstring filled;
+
+	ScanMode current = Mode();
+	adverts[current].fetch_add(1, memory_order_relaxed);
+
+	if (advert.name != nullptr && advert.name[0] != 0)
+	{
+		{
+			shared_lock guard(namesLock);
+
+			auto found = names.find(advert.mac);
+			if (found != names.end() && found->second.name == advert.name)
+				return current;
+		}
+
+		unique_lock guard(namesLock);
+
+		if (names.size() >= SCAN_MAX_NAMES)
+			names.clear();
+
+		names[advert.mac].name = advert.name;
+		return current;
+	}
+
+	{
+		shared_lock guard(namesLock);
+
+		auto found = names.find(advert.mac);
+		if (found != names.end() && !found->second.name.empty())
+		{
+			filled = found->second.name;
+			advert.name = filled.c_str();
+			namesFilled.fetch_add(1, memory_order_relaxed);
+			return current;
+		}
+
+		if (found != names.end() && found->second.attempts >= SCAN_NAME_ATTEMPTS)
+			return current;
+	}
+
+	if (current == SCAN_ACTIVE)
+	{
+		unique_lock guard(namesLock);
+		unnamed.insert(advert.mac);
+	}
+	else if (current == SCAN_PASSIVE && autoPassive && !unknownHeard.exchange(true))
+	{
+		lock_guard guard(lock);
+		wake.notify_one();
+	}
+
+	return current;
+}
+
+void ScanScheduler::Delivered(ScanMode mode)
+{
+	callbacks[mode].fetch_add(1, memory_order_relaxed);
+}
+
+void ScanScheduler::Stats(BleScanStats& stats)
+{
+	stats.activeAdverts = adverts[SCAN_ACTIVE];
+	stats.passiveAdverts = adverts[SCAN_PASSIVE];
+	stats.activeCallbacks = callbacks[SCAN_ACTIVE];
+	stats.passiveCallbacks = callbacks[SCAN_PASSIVE];
+
+	stats.activeWindows = windows[SCAN_ACTIVE];
+	stats.passiveWindows = windows[SCAN_PASSIVE];
+	stats.idleWindows = windows[SCAN_IDLE];
+
+	stats.activeMilliseconds = milliseconds[SCAN_ACTIVE];
+	stats.passiveMilliseconds = milliseconds[SCAN_PASSIVE];
+	stats.idleMilliseconds = milliseconds[SCAN_IDLE];
+
+	stats.namesFilled = namesFilled;
+	stats.mode = Mode();
+
+	shared_lock guard(namesLock);
+	stats.cachedNames = (uint32_t)names.size();
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "backend.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+//one cycle is an active window, a passive window and an idle gap, windows of length 0 are skipped. all 0 scans
+//actively without a break, as without a schedule
+struct BleScanSchedule
+{
+	uint32_t activeMilliseconds = 0;
+	uint32_t passiveMilliseconds = 0;
+	uint32_t idleMilliseconds = 0;
+
+	//active windows are scanned passively while every device heard has its name cached, a device that isn't brings
+	//the next active window forward
+	uint32_t autoPassive = 0;
+};
+
+struct BleScanStats
+{
+	//adverts the radio reported in each mode, and the ones that passed the filter and were delivered
+	uint64_t activeAdverts = 0;
+	uint64_t passiveAdverts = 0;
+	uint64_t activeCallbacks = 0;
+	uint64_t passiveCallbacks = 0;
+
+	uint64_t activeWindows = 0;
+	uint64_t passiveWindows = 0;
+	uint64_t idleWindows = 0;
+
+	uint64_t activeMilliseconds = 0;
+	uint64_t passiveMilliseconds = 0;
+	uint64_t idleMilliseconds = 0;
+
+	//passive adverts that got their name from the cache
+	uint64_t namesFilled = 0;
+
+	int32_t mode = SCAN_ACTIVE;
+	uint32_t cachedNames = 0;
+};
+
+//bounds the name cache, it starts over once full
+const size_t SCAN_MAX_NAMES = 4096;
+//active windows a device may go without sending a name before it is taken as having none
+const uint32_t SCAN_NAME_ATTEMPTS = 3;
+//window length while scanning without a break, only matters to autoPassive and the stats
+const uint32_t SCAN_CONTINUOUS_MILLISECONDS = 1000;
+
+//drives the scan mode of the backend from its own thread while scanning. names learned from scan responses are
+//cached, so passive windows can fill them in and active windows are only needed for devices not seen before
+class ScanScheduler
+{
+public:
+	using ModeHandler = std::function<void(ScanMode mode)>;
+
+	explicit ScanScheduler(ModeHandler apply);
+	~ScanScheduler();
+
+	//restarts the cycle if scanning, and resets the stats
+	void Configure(const BleScanSchedule& schedule);
+
+	//sets the first window's mode before the backend starts scanning, then follows the schedule
+	void Start();
+	void Stop();
+
+	ScanMode Mode() const
+	{
+		return mode.load(std::memory_order_relaxed);
+	}
+
+	//counts the advert against the current mode and caches its name, or fills in a missing one. the name is pointed
+	//at a copy only valid on this thread until the next call. returns the mode to pass to Delivered
+	ScanMode Observe(AdvertEvent& advert);
+	void Delivered(ScanMode mode);
+
+	void Stats(BleScanStats& stats);
+
+private:
+	struct CachedName
+	{
+		std::wstring name;
+		//active windows the device was heard in without a name, it counts as named at SCAN_NAME_ATTEMPTS
+		uint32_t attempts = 0;
+	};
+
+	void Run(BleScanSchedule schedule);
+	//counts the window and switches the backend if the mode changes
+	void Enter(ScanMode next);
+	//at the end of an active window, true if every device heard had its name cached by then
+	bool NamesComplete();
+
+	ModeHandler apply;
+
+	std::mutex lock;
+	std::condition_variable wake;
+	std::thread scheduler;
+	bool stopping = false;
+	BleScanSchedule schedule;
+
+	//a passive window heard a device with no cached name
+	std::atomic<bool> unknownHeard { false };
+
+	std::atomic<ScanMode> mode { SCAN_ACTIVE };
+	std::atomic<bool> autoPassive { false };
+
+	std::shared_mutex namesLock;
+	std::unordered_map<uint64_t, CachedName> names;
+	//heard without a name during the current active window
+	std::unordered_set<uint64_t> unnamed;
+
+	std::atomic<uint64_t> adverts[3] {};
+	std::atomic<uint64_t> callbacks[3] {};
+	std::atomic<uint64_t> windows[3] {};
+	std::atomic<uint64_t> milliseconds[3] {};
+	std::atomic<uint64_t> namesFilled { 0 };
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+//de-duplicates concurrent resolutions of the same key: the first caller becomes the leader and does the work, every
+//caller arriving while it is in flight awaits the leader's result instead of starting its own round-trip
+template <typename Key, typename Value, typename Hash>
+class SingleFlight
+{
+public:
+	//result of one resolution, shared by the leader and everyone who joined it
+	class Flight
+	{
+	private:
+		friend class SingleFlight;
+
+		std::mutex lock;
+		std::optional<Value> result;
+		std::vector<std::function<void()>> waiters;
+	};
+
+	//co_await Wait(flight) suspends until the leader completes, waiters are resumed on the leader's thread
+	struct Awaiter
+	{
+		std::shared_ptr<Flight> flight;
+
+		bool await_ready()
+		{
+			std::lock_guard guard(flight->lock);
+			return flight->result.has_value();
+		}
+
+		//templated so it binds to whichever coroutine_handle the compiler's coroutine support provides
+		template <typename Handle>
+		bool await_suspend(Handle handle)
+		{
+			std::lock_guard guard(flight->lock);
+			if (flight->result.has_value())
+				return false;
+
+			flight->waiters.push_back([handle]() mutable { handle.resume(); });
+			return true;
+		}
+
+		Value await_resume()
+		{
+			std::lock_guard guard(flight->lock);
+			return *flight->result;
+		}
+	};
+
+	static Awaiter Wait(const std::shared_ptr<Flight>& flight)
+	{
+		return { flight };
+	}
+
+	//returns the flight in progress for key, or starts one and sets leader. a leader has to call Complete exactly once
+	std::shared_ptr<Flight> Join(const Key& key, bool& leader)
+	{
+		std::lock_guard guard(lock);
+
+		auto& flight = flights[key];
+		leader = flight == nullptr;
+
+		if (leader)
+			flight = std::make_shared<Flight>();
+
+		return flight;
+	}
+
+	//publishes the leader's result and resumes everyone who joined, callers arriving afterwards start a new flight
+	void Complete(const Key& key, const std::shared_ptr<Flight>& flight, const Value& value)
+	{
+		{
+			std::lock_guard guard(lock);
+
+			auto it = flights.find(key);
+			if (it != flights.end() && it->second == flight)
+				flights.erase(it);
+		}
+
+		std::vector<std::function<void()>> waiters;
+
+		{
+			std::lock_guard guard(flight->lock);
+			flight->result = value;
+			waiters.swap(flight->waiters);
+		}
+
+		for (auto& resume : waiters)
+			resume();
+	}
+
+	size_t InFlight()
+	{
+		std::lock_guard guard(lock);
+		return flights.size();
+	}
+
+private:
+	std::mutex lock;
+	std::unordered_map<Key, std::shared_ptr<Flight>, Hash> flights;
+};
@@ -0,0 +1,337 @@
+#include "subscription-registry.h"
+
+using namespace std;
+
+
+SubscriptionRegistry::SubscriptionRegistry(BackendSubscribe subscribe, BackendUnsubscribe unsubscribe) :
+	subscribe(move(subscribe)), unsubscribe(move(unsubscribe))
+{
+}
+
+SubscriptionRegistry::ConsumerList SubscriptionRegistry::Consumers(Entry& entry)
+{
+	lock_guard guard(entry.consumersLock);
+	return entry.consumers;
+}
+
+void SubscriptionRegistry::SetConsumers(Entry& entry, vector<Consumer> consumers)
+{
+	auto list = make_shared<const vector<Consumer>>(move(consumers));
+
+	lock_guard guard(entry.consumersLock);
+	entry.consumers = move(list);
+}
+
+uint32_t SubscriptionRegistry::Add(const GattKey& key, ConsumerHandler handler, CompletionHandler done)
+{
+	shared_ptr<Entry> start;
+	bool active = false;
+	uint32_t handle;
+
+	{
+		lock_guard guard(lock);
+
+		handle = nextHandle++;
+		if (nextHandle == 0)
+			nextHandle = 1;
+
+		auto& entry = entries[key];
+		if (!entry)
+		{
+			entry = make_shared<Entry>();
+			entry->key = key;
+			entry->consumers = make_shared<const vector<Consumer>>();
+			start = entry;
+		}
+
+		vector<Consumer> consumers = *Consumers(*entry);
+		consumers.push_back({ handle, make_shared<ConsumerHandler>(move(handler)) });
+		SetConsumers(*entry, move(consumers));
+		handles[handle] = key;
+
+		//while unsubscribing the entry is subscribed again once that completes
+		if (entry->state == State::Active)
+			active = true;
+		else
+			entry->waiting.push_back(move(done));
+	}
+
+	if (start)
+		StartSubscribe(start);
+
+	if (active && done)
+		done(true);
+
+	return handle;
+}
+
+bool SubscriptionRegistry::Remove(uint32_t handle)
+{
+	shared_ptr<Entry> stop;
+
+	{
+		lock_guard guard(lock);
+
+		auto found = handles.find(handle);
+		if (found == handles.end())
+			return false;
+
+		shared_ptr<Entry> entry = entries[found->second];
+		handles.erase(found);
+
+		vector<Consumer> consumers = *Consumers(*entry);
+		for (size_t i = 0; i < consumers.size(); i++)
+		{
+			if (consumers[i].handle == handle)
+			{
+				consumers.erase(consumers.begin() + i);
+				break;
+			}
+		}
+
+		bool empty = consumers.empty();
+		SetConsumers(*entry, move(consumers));
+
+		//still subscribing, Subscribed unsubscribes right away
+		if (empty && entry->state == State::Active)
+		{
+			entry->state = State::Unsubscribing;
+			stop = entry;
+		}
+	}
+
+	if (stop)
+		StartUnsubscribe(stop);
+
+	return true;
+}
+
+size_t SubscriptionRegistry::RemoveAll(const GattKey& key)
+{
+	shared_ptr<Entry> stop;
+	size_t removed = 0;
+
+	{
+		lock_guard guard(lock);
+
+		auto found = entries.find(key);
+		if (found == entries.end())
+			return 0;
+
+		shared_ptr<Entry> entry = found->second;
+
+		for (auto& consumer : *Consumers(*entry))
+			handles.erase(consumer.handle);
+
+		removed = Consumers(*entry)->size();
+		SetConsumers(*entry, {});
+
+		if (entry->state == State::Active)
+		{
+			entry->state = State::Unsubscribing;
+			stop = entry;
+		}
+	}
+
+	if (stop)
+		StartUnsubscribe(stop);
+
+	return removed;
+}
+
+bool SubscriptionRegistry::Inject(const GattKey& key, const uint8_t* data, size_t size)
+{
+	shared_ptr<Entry> entry;
+
+	{
+		lock_guard guard(lock);
+
+		auto found = entries.find(key);
+		if (found == entries.end())
+			return false;
+
+		entry = found->second;
+	}
+
+	if (Consumers(*entry)->empty())
+		return false;
+
+	Notify(*entry, data, size);
+	return true;
+}
+
+size_t SubscriptionRegistry::Rearm(uint64_t device, CompletionHandler done)
+{
+	vector<shared_ptr<Entry>> active;
+
+	{
+		lock_guard guard(lock);
+
+		//the others are in the middle of a transition that goes to the backend anyway
+		for (auto& [key, entry] : entries)
+			if (key.device == device && entry->state == State::Active)
+				active.push_back(entry);
+	}
+
+	if (active.empty())
+	{
+		if (done)
+			done(true);
+
+		return 0;
+	}
+
+	CompletionHandler rearmed = JoinCompletions(active.size(), move(done));
+
+	for (auto& entry : active)
+	{
+		cccdWrites++;
+		subscribe(entry->key, Delivery(entry), rearmed);
+	}
+
+	return active.size();
+}
+
+void SubscriptionRegistry::Clear()
+{
+	vector<CompletionHandler> waiting;
+
+	{
+		lock_guard guard(lock);
+
+		for (auto& [key, entry] : entries)
+		{
+			SetConsumers(*entry, {});
+
+			for (auto& done : entry->waiting)
+				waiting.push_back(move(done));
+
+			entry->waiting.clear();
+		}
+
+		entries.clear();
+		handles.clear();
+	}
+
+	for (auto& done : waiting)
+		if (done)
+			done(false);
+}
+
+void SubscriptionRegistry::Stats(BleSubscriptionStats& stats)
+{
+	lock_guard guard(lock);
+
+	stats.characteristics = (uint32_t)entries.size();
+	stats.consumers = (uint32_t)handles.size();
+	stats.cccdWrites = cccdWrites;
+	stats.notifications = notifications;
+}
+
+void SubscriptionRegistry::StartSubscribe(const shared_ptr<Entry>& entry)
+{
+	cccdWrites++;
+
+	subscribe(entry->key, Delivery(entry), [this, entry](bool success)
+	{
+		Subscribed(entry, success);
+	});
+}
+
+NotificationHandler SubscriptionRegistry::Delivery(const shared_ptr<Entry>& entry)
+{
+	//the backend keeps this handler, and with it the entry, until it is unsubscribed
+	return [this, entry](const uint8_t* data, size_t size)
+	{
+		Notify(*entry, data, size);
+	};
+}
+
+void SubscriptionRegistry::Notify(Entry& entry, const uint8_t* data, size_t size)
+{
+	notifications++;
+
+	ConsumerList consumers = Consumers(entry);
+	for (auto& consumer : *consumers)
+		(*consumer.handler)(consumer.handle, data, size);
+}
+
+void SubscriptionRegistry::StartUnsubscribe(const shared_ptr<Entry>& entry)
+{
+	cccdWrites++;
+
+	unsubscribe(entry->key, [this, entry](bool)
+	{
+		//even a failed cccd write leaves no handler behind, the consumers are gone either way
+		Unsubscribed(entry);
+	});
+}
+
+void SubscriptionRegistry::Subscribed(const shared_ptr<Entry>& entry, bool success)
+{
+	vector<CompletionHandler> waiting;
+	bool stop = false;
+
+	{
+		lock_guard guard(lock);
+
+		//cleared meanwhile, its waiting handlers were already told
+		auto found = entries.find(entry->key);
+		if (found == entries.end() || found->second != entry)
+			return;
+
+		waiting.swap(entry->waiting);
+
+		if (!success)
+		{
+			for (auto& consumer : *Consumers(*entry))
+				handles.erase(consumer.handle);
+
+			SetConsumers(*entry, {});
+			entries.erase(found);
+		}
+		else if (Consumers(*entry)->empty())
+		{
+			entry->state = State::Unsubscribing;
+			stop = true;
+		}
+		else
+		{
+			entry->state = State::Active;
+		}
+	}
+
+	if (stop)
+		StartUnsubscribe(entry);
+
+	for (auto& done : waiting)
+		if (done)
+			done(success);
+}
+
+void SubscriptionRegistry::Unsubscribed(const shared_ptr<Entry>& entry)
+{
+	bool resubscribe = false;
+
+	{
+		lock_guard guard(lock);
+
+		auto found = entries.find(entry->key);
+		if (found == entries.end() || found->second != entry)
+			return;
+
+		//consumers arrived while unsubscribing
+		if (!Consumers(*entry)->empty())
+		{
+			entry->state = State::Subscribing;
+			resubscribe = true;
+		}
+		else
+		{
+			entries.erase(found);
+		}
+	}
+
+	if (resubscribe)
+		StartSubscribe(entry);
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "backend.h"
+#include "gatt-cache.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+struct BleSubscriptionStats
+{
+	//characteristics with notifications enabled or being enabled, and the consumers sharing them
+	uint32_t characteristics = 0;
+	uint32_t consumers = 0;
+
+	//cccd writes issued to the backend, subscribing and unsubscribing
+	uint64_t cccdWrites = 0;
+	uint64_t notifications = 0;
+};
+
+//every consumer of a characteristic's notifications gets its own handle, the characteristic is subscribed once with the
+//backend when the first one arrives and unsubscribed when the last one leaves. notifications fan out from a consumer
+//list that is replaced rather than modified, delivering only copies the pointer to it
+class SubscriptionRegistry
+{
+public:
+	using BackendSubscribe = std::function<void(const GattKey& key, NotificationHandler handler, CompletionHandler done)>;
+	using BackendUnsubscribe = std::function<void(const GattKey& key, CompletionHandler done)>;
+
+	//gets the handle Add returned, which may not have returned yet when the first notification arrives
+	using ConsumerHandler = std::function<void(uint32_t handle, const uint8_t* data, size_t size)>;
+
+	SubscriptionRegistry(BackendSubscribe subscribe, BackendUnsubscribe unsubscribe);
+
+	//returns the handle right away, done reports whether notifications are enabled. a failed subscription drops the
+	//handle again
+	uint32_t Add(const GattKey& key, ConsumerHandler handler, CompletionHandler done);
+
+	//false if the handle is unknown
+	bool Remove(uint32_t handle);
+	//drops every consumer of the characteristic, returns how many there were
+	size_t RemoveAll(const GattKey& key);
+
+	//hands a notification to the consumers of the characteristic as if the backend had delivered it, false if it
+	//has none. for notifications that don't come from the backend, such as a replayed capture
+	bool Inject(const GattKey& key, const uint8_t* data, size_t size);
+
+	//subscribes the device's characteristics with the backend again, for after its link was lost and restored. the
+	//consumers stay whatever happens, done reports whether all of them are back. returns how many there are
+	size_t Rearm(uint64_t device, CompletionHandler done);
+
+	//forgets everything without unsubscribing, for when the backend drops its subscriptions itself
+	void Clear();
+
+	void Stats(BleSubscriptionStats& stats);
+
+private:
+	enum class State
+	{
+		Subscribing,
+		Active,
+		Unsubscribing,
+	};
+
+	struct Consumer
+	{
+		uint32_t handle;
+		std::shared_ptr<ConsumerHandler> handler;
+	};
+
+	using ConsumerList = std::shared_ptr<const std::vector<Consumer>>;
+
+	struct Entry
+	{
+		GattKey key;
+		State state = State::Subscribing;
+
+		//only guards the pointer, replaced under the registry lock too. atomic_load on shared_ptr is deprecated in c++20
+		std::mutex consumersLock;
+		ConsumerList consumers;
+
+		std::vector<CompletionHandler> waiting;
+	};
+
+	static ConsumerList Consumers(Entry& entry);
+	//the handler the backend is subscribed with, keeps the entry alive
+	NotificationHandler Delivery(const std::shared_ptr<Entry>& entry);
+	void Notify(Entry& entry, const uint8_t* data, size_t size);
+	//callers hold lock
+	static void SetConsumers(Entry& entry, std::vector<Consumer> consumers);
+
+	//start the backend transition the entry's state calls for, without the lock
+	void StartSubscribe(const std::shared_ptr<Entry>& entry);
+	void StartUnsubscribe(const std::shared_ptr<Entry>& entry);
+
+	void Subscribed(const std::shared_ptr<Entry>& entry, bool success);
+	void Unsubscribed(const std::shared_ptr<Entry>& entry);
+
+	BackendSubscribe subscribe;
+	BackendUnsubscribe unsubscribe;
+
+	std::mutex lock;
+	std::unordered_map<GattKey, std::shared_ptr<Entry>, GattKeyHash> entries;
+	std::unordered_map<uint32_t, GattKey> handles;
+	uint32_t nextHandle = 1;
+
+	std::atomic<uint64_t> cccdWrites { 0 };
+	std::atomic<uint64_t> notifications { 0 };
+};
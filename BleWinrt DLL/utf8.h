@@ -0,0 +1,109 @@
+#pragma once
+
+#include <string>
+
+//portable wchar_t to utf-8, wchar_t is utf-16 on Windows and utf-32 elsewhere. unpaired surrogates become U+FFFD
+inline void AppendUtf8(std::string& out, const wchar_t* text, size_t length)
+{
+	for (size_t i = 0; i < length; i++)
+	{
+		uint32_t code = (uint32_t)text[i];
+
+		if (code >= 0xD800 && code <= 0xDBFF && i + 1 < length && (uint32_t)text[i + 1] >= 0xDC00 && (uint32_t)text[i + 1] <= 0xDFFF)
+			code = 0x10000 + ((code - 0xD800) << 10) + ((uint32_t)text[++i] - 0xDC00);
+		else if ((code >= 0xD800 && code <= 0xDFFF) || code > 0x10FFFF)
+			code = 0xFFFD;
+
+		if (code < 0x80)
+		{
+			out.push_back((char)code);
+		}
+		else if (code < 0x800)
+		{
+			out.push_back((char)(0xC0 | (code >> 6)));
+			out.push_back((char)(0x80 | (code & 0x3F)));
+		}
+		else if (code < 0x10000)
+		{
+			out.push_back((char)(0xE0 | (code >> 12)));
+			out.push_back((char)(0x80 | ((code >> 6) & 0x3F)));
+			out.push_back((char)(0x80 | (code & 0x3F)));
+		}
+		else
+		{
+			out.push_back((char)(0xF0 | (code >> 18)));
+			out.push_back((char)(0x80 | ((code >> 12) & 0x3F)));
+			out.push_back((char)(0x80 | ((code >> 6) & 0x3F)));
+			out.push_back((char)(0x80 | (code & 0x3F)));
+		}
+	}
+}
+
+inline void AppendUtf8(std::string& out, const std::wstring& text)
+{
+	AppendUtf8(out, text.c_str(), text.size());
+}
+
+//utf-8 back to wchar_t, surrogate pairs where wchar_t is 16 bits. malformed sequences become U+FFFD
+inline void AppendWide(std::wstring& out, const char* text, size_t length)
+{
+	size_t i = 0;
+	while (i < length)
+	{
+		uint8_t lead = (uint8_t)text[i++];
+		uint32_t code;
+		size_t continuation;
+
+		if (lead < 0x80)
+		{
+			out.push_back((wchar_t)lead);
+			continue;
+		}
+		else if (lead >= 0xC2 && lead < 0xE0)
+		{
+			code = lead & 0x1F;
+			continuation = 1;
+		}
+		else if (lead >= 0xE0 && lead < 0xF0)
+		{
+			code = lead & 0x0F;
+			continuation = 2;
+		}
+		else if (lead >= 0xF0 && lead < 0xF5)
+		{
+			code = lead & 0x07;
+			continuation = 3;
+		}
+		else
+		{
+			out.push_back((wchar_t)0xFFFD);
+			continue;
+		}
+
+		size_t taken = 0;
+		while (taken < continuation && i < length && ((uint8_t)text[i] & 0xC0) == 0x80)
+		{
+			code = (code << 6) | ((uint8_t)text[i++] & 0x3F);
+			taken++;
+		}
+
+		//overlong forms, surrogates and anything past U+10FFFF are rejected as well
+		bool overlong = (continuation == 2 && code < 0x800) || (continuation == 3 && code < 0x10000);
+		if (taken < continuation || overlong || (code >= 0xD800 && code <= 0xDFFF) || code > 0x10FFFF)
+		{
+			out.push_back((wchar_t)0xFFFD);
+			continue;
+		}
+
+		if (sizeof(wchar_t) == 2 && code >= 0x10000)
+		{
+			code -= 0x10000;
+			out.push_back((wchar_t)(0xD800 + (code >> 10)));
+			out.push_back((wchar_t)(0xDC00 + (code & 0x3FF)));
+		}
+		else
+		{
+			out.push_back((wchar_t)code);
+		}
+	}
+}
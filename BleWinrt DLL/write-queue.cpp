@@ -0,0 +1,214 @@
+#include "write-queue.h"
+
+#include <atomic>
+
+using namespace std;
+
+
+WriteScheduler::WriteScheduler(Issue issue) : issue(move(issue))
+{
+}
+
+void WriteScheduler::Configure(uint32_t maxOutstanding, uint32_t maxQueued)
+{
+	lock_guard guard(lock);
+	this->maxOutstanding = maxOutstanding > 0 ? maxOutstanding : 1;
+	this->maxQueued = maxQueued;
+}
+
+bool WriteScheduler::Enqueue(const GattKey& key, const uint8_t* data, size_t size, bool withResponse, CompletionHandler done)
+{
+	Write write{ vector<uint8_t>(data, data + size), withResponse, move(done) };
+	return Push(key, &write, 1);
+}
+
+bool WriteScheduler::EnqueueMessage(const GattKey& key, vector<vector<uint8_t>>&& writes, bool withResponse, CompletionHandler done)
+{
+	struct Pending
+	{
+		atomic<size_t> remaining;
+		atomic<bool> success { true };
+		CompletionHandler done;
+	};
+
+	auto pending = make_shared<Pending>();
+	pending->remaining = writes.size();
+	pending->done = move(done);
+
+	//completions without response may arrive out of order, the last one to arrive reports
+	auto part = [pending](bool success)
+	{
+		if (!success)
+			pending->success = false;
+
+		if (--pending->remaining == 0 && pending->done)
+			pending->done(pending->success);
+	};
+
+	vector<Write> batch;
+	batch.reserve(writes.size());
+
+	for (auto& data : writes)
+		batch.push_back(Write{ move(data), withResponse, part });
+
+	if (batch.empty())
+	{
+		if (pending->done)
+			pending->done(true);
+
+		return true;
+	}
+
+	return Push(key, batch.data(), batch.size());
+}
+
+bool WriteScheduler::Push(const GattKey& key, Write* writes, size_t count)
+{
+	vector<Write> ready;
+
+	{
+		lock_guard guard(lock);
+
+		auto& queue = queues[key];
+		if (!queue)
+			queue = make_unique<Queue>();
+
+		if (!queue->waiting.empty() && queue->waiting.size() + count > maxQueued)
+		{
+			queue->stats.rejected += count;
+			return false;
+		}
+
+		for (size_t i = 0; i < count; i++)
+			queue->waiting.push_back(move(writes[i]));
+
+		queue->stats.enqueued += count;
+
+		uint32_t depth = (uint32_t)queue->waiting.size() + queue->inFlight;
+		if (depth > queue->stats.maxDepth)
+			queue->stats.maxDepth = depth;
+
+		TakeReady(*queue, ready);
+	}
+
+	Send(key, ready);
+	return true;
+}
+
+void WriteScheduler::TakeReady(Queue& queue, vector<Write>& ready)
+{
+	while (!queue.waiting.empty() && !queue.responsePending && queue.inFlight < maxOutstanding)
+	{
+		//a write with response goes out alone, after everything before it has completed
+		if (queue.waiting.front().withResponse)
+		{
+			if (queue.inFlight > 0)
+				break;
+
+			queue.responsePending = true;
+		}
+
+		if (queue.firstIssued == 0)
+			queue.firstIssued = NowMicroseconds();
+
+		queue.inFlight++;
+		ready.push_back(move(queue.waiting.front()));
+		queue.waiting.pop_front();
+	}
+}
+
+void WriteScheduler::Send(const GattKey& key, vector<Write>& ready)
+{
+	//the backend copies the data, a write completing synchronously re-enters Completed without the lock held
+	for (auto& write : ready)
+	{
+		size_t size = write.data.size();
+		bool withResponse = write.withResponse;
+		CompletionHandler done = move(write.done);
+
+		issue(key, write.data.data(), size, withResponse, [this, key, size, withResponse, done](bool success)
+		{
+			Completed(key, size, withResponse, success, done);
+		});
+	}
+}
+
+void WriteScheduler::Completed(const GattKey& key, size_t size, bool withResponse, bool success, const CompletionHandler& done)
+{
+	vector<Write> ready;
+
+	{
+		lock_guard guard(lock);
+
+		auto found = queues.find(key);
+		if (found != queues.end())
+		{
+			Queue& queue = *found->second;
+
+			queue.inFlight--;
+			if (withResponse)
+				queue.responsePending = false;
+
+			if (success)
+			{
+				queue.stats.completed++;
+				queue.stats.bytesCompleted += size;
+			}
+			else
+			{
+				queue.stats.failed++;
+			}
+
+			queue.lastCompleted = NowMicroseconds();
+			TakeReady(queue, ready);
+		}
+	}
+
+	if (done)
+		done(success);
+
+	Send(key, ready);
+}
+
+bool WriteScheduler::Stats(const GattKey& key, BleWriteQueueStats& stats)
+{
+	lock_guard guard(lock);
+
+	auto found = queues.find(key);
+	if (found == queues.end())
+	{
+		stats = BleWriteQueueStats();
+		return false;
+	}
+
+	Queue& queue = *found->second;
+	stats = queue.stats;
+	stats.inFlight = queue.inFlight;
+	stats.depth = (uint32_t)queue.waiting.size() + queue.inFlight;
+
+	int64_t elapsed = queue.lastCompleted - queue.firstIssued;
+	stats.bytesPerSecond = elapsed > 0 ? (double)queue.stats.bytesCompleted * 1000000.0 / (double)elapsed : 0;
+	return true;
+}
+
+void WriteScheduler::Clear()
+{
+	vector<Write> dropped;
+
+	{
+		lock_guard guard(lock);
+
+		for (auto& [key, queue] : queues)
+		{
+			for (auto& write : queue->waiting)
+				dropped.push_back(move(write));
+
+			queue->stats.failed += queue->waiting.size();
+			queue->waiting.clear();
+		}
+	}
+
+	for (auto& write : dropped)
+		if (write.done)
+			write.done(false);
+}
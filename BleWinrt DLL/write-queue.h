@@ -0,0 +1,93 @@
+#pragma once
+
+#include "backend.h"
+#include "gatt-cache.h"
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+struct BleWriteQueueStats
+{
+	uint64_t enqueued = 0;
+	uint64_t completed = 0;
+	uint64_t failed = 0;
+
+	//rejected because the queue was full
+	uint64_t rejected = 0;
+
+	uint64_t bytesCompleted = 0;
+
+	//bytes completed per second between the first write issued and the last completion
+	double bytesPerSecond = 0;
+
+	//waiting plus in flight, and the highest that ever was
+	uint32_t depth = 0;
+	uint32_t maxDepth = 0;
+	uint32_t inFlight = 0;
+	uint32_t reserved = 0;
+};
+
+//sends the writes of one characteristic in the order they were queued. writes without response are pipelined, up to
+//maxOutstanding of them are handed to the backend at once; a write with response waits for everything before it and
+//holds back everything after it until its status is known
+class WriteScheduler
+{
+public:
+	using Issue = std::function<void(const GattKey& key, const uint8_t* data, size_t size, bool withResponse, CompletionHandler done)>;
+
+	explicit WriteScheduler(Issue issue);
+
+	//applies to writes issued from now on. maxQueued bounds the waiting writes per characteristic
+	void Configure(uint32_t maxOutstanding, uint32_t maxQueued);
+
+	//copies data, false if the characteristic's queue is full. done is called once the backend reports the status
+	bool Enqueue(const GattKey& key, const uint8_t* data, size_t size, bool withResponse, CompletionHandler done);
+
+	//takes the writes as they are and queues them back to back, nothing else on the characteristic goes in between.
+	//done is called once with whether all of them succeeded. all or nothing: false if they don't fit behind the
+	//writes already waiting, an empty queue accepts any number
+	bool EnqueueMessage(const GattKey& key, std::vector<std::vector<uint8_t>>&& writes, bool withResponse, CompletionHandler done);
+
+	//false if nothing was ever written to the characteristic
+	bool Stats(const GattKey& key, BleWriteQueueStats& stats);
+
+	//drops the waiting writes of every characteristic and reports them as failed, writes in flight still complete
+	void Clear();
+
+private:
+	struct Write
+	{
+		std::vector<uint8_t> data;
+		bool withResponse = false;
+		CompletionHandler done;
+	};
+
+	struct Queue
+	{
+		std::deque<Write> waiting;
+		uint32_t inFlight = 0;
+		bool responsePending = false;
+
+		BleWriteQueueStats stats;
+		int64_t firstIssued = 0;
+		int64_t lastCompleted = 0;
+	};
+
+	//all or nothing, moves from writes only when accepted
+	bool Push(const GattKey& key, Write* writes, size_t count);
+
+	//callers hold lock, moves the writes that may go out now to ready
+	void TakeReady(Queue& queue, std::vector<Write>& ready);
+	void Send(const GattKey& key, std::vector<Write>& ready);
+	void Completed(const GattKey& key, size_t size, bool withResponse, bool success, const CompletionHandler& done);
+
+	Issue issue;
+
+	std::mutex lock;
+	std::unordered_map<GattKey, std::unique_ptr<Queue>, GattKeyHash> queues;
+	uint32_t maxOutstanding = 4;
+	uint32_t maxQueued = 256;
+};